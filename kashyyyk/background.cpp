@@ -2,6 +2,7 @@
 #include "networkwatch.hpp"
 #include "autolocker.hpp"
 #include "monitor.hpp"
+#include "metrics.hpp"
 #include <TSPR/concurrent_queue.h>
 
 #include <thread>
@@ -35,22 +36,37 @@ class Thread::TaskGroup{
     concurrent_queue<Task *> queue;
     Monitor monitor;
     NetworkWatch *watch;
+    //! Number of Tasks in queue. Tasks that are running are not counted.
+    Metrics::Gauge *depth;
 
-    TaskGroup()
-      : watch(nullptr){}
+    TaskGroup(const char *name)
+      : watch(nullptr)
+      , depth(Metrics::RegisterGauge(name)){}
+
+    void Push(Task *task){
+        depth->Add();
+        queue.push(task);
+    }
+
+    bool TryPop(Task *&task){
+        if(!queue.try_pop(task))
+            return false;
+        depth->Sub();
+        return true;
+    }
 
 };
 
 struct Thread::Thread_Impl{
-    concurrent_queue<Task *> &queue;
+    TaskGroup &group;
     Monitor monitor;
     std::atomic<bool> live;
     std::atomic<bool> started;
     std::thread thread;
 
-    Thread_Impl(concurrent_queue<Task *> &q, Monitor &mon)
-      : queue(q)
-      , monitor(mon.GetMutex())
+    Thread_Impl(TaskGroup &g)
+      : group(g)
+      , monitor(g.monitor.GetMutex())
       , live(true)
       , started(false)
       , thread(ThreadFunction, ThreadFunctionArg(*this, started)) {
@@ -74,12 +90,15 @@ static void ThreadFunction(ThreadFunctionArg input){
 
     while(thimble.live){
 
-        if(thimble.queue.try_pop(task)){
-            
+        // Give every Task that is queued a turn, so that a Server with data
+        // waiting does not also wait for a wakeup per Server ahead of it.
+        long long round = thimble.group.depth->Get();
+        while((round-- > 0) && thimble.group.TryPop(task)){
+
             task->Run();
 
             if(task->repeating)
-                thimble.queue.push(task);
+                thimble.group.Push(task);
             else
               delete task;
 
@@ -91,31 +110,31 @@ static void ThreadFunction(ThreadFunctionArg input){
 
 
 Thread::TaskGroup *Thread::GetShortThreadPool(){
-    static TaskGroup group;
+    static TaskGroup group("tasks.short.depth");
     return &group;
 }
 
 
 Thread::TaskGroup *Thread::GetLongThreadPool(){
-    static TaskGroup group;
+    static TaskGroup group("tasks.long.depth");
     return &group;
 }
 
 
 void Thread::AddLongRunningTask(Task *task){
-    Thread::GetLongThreadPool()->queue.push(task);
+    Thread::GetLongThreadPool()->Push(task);
     Thread::GetLongThreadPool()->monitor.Notify();
 }
 
 
 void Thread::AddShortRunningTask(Task *task){
-    Thread::GetShortThreadPool()->queue.push(task);
+    Thread::GetShortThreadPool()->Push(task);
     Thread::GetShortThreadPool()->monitor.Notify();
 }
 
 
 Thread::Thread(TaskGroup *group)
-  : guts(new Thread::Thread_Impl(group->queue, group->monitor)){
+  : guts(new Thread::Thread_Impl(*group)){
 
 }
 
@@ -128,7 +147,7 @@ Thread::~Thread(){
 
 
 void Thread::AddTask(TaskGroup *pool, Task *task){
-    pool->queue.push(task);
+    pool->Push(task);
     pool->monitor.Notify();
 }
 
@@ -136,21 +155,21 @@ void Thread::AddTask(TaskGroup *pool, Task *task){
 void Thread::PerformTask(TaskGroup *pool){
     while(true){
         Task * task;
-        if(!pool->queue.try_pop(task))
+        if(!pool->TryPop(task))
           break;
 
         task->Run();
 
         if(task->repeating)
-          pool->queue.push(task);
+          pool->Push(task);
         else
           delete task;
     }
 }
 
 
-Thread::TaskGroup *Thread::CreateTaskGroup(){
-    Thread::TaskGroup *group = new Thread::TaskGroup();
+Thread::TaskGroup *Thread::CreateTaskGroup(const char *metric_name){
+    Thread::TaskGroup *group = new Thread::TaskGroup(metric_name);
     assert(group);
     return group;
 }
@@ -164,11 +183,25 @@ void Thread::DestroyTaskGroup(Thread::TaskGroup *a){
 void NetworkWatch::ThreadFunction(NetworkWatch *that){
     while(that->live){
 #if NEEDS_FJNET_POLL_TIMEOUT
-        if(PollSet(eRead, that->socket_set, 100))
+        const bool retrying = that->retry.exchange(false);
+        if(PollSet(eRead, that->socket_set, 100) || retrying)
+            that->monitor.Notify();
 #else
-        if(PollSet(eRead, that->socket_set, 0))
-#endif
+        // RetrySoon only pokes the set while we might wait forever, so that
+        // a task that keeps retrying doesn't keep cutting the wait short.
+        that->sleeping = true;
+        if(that->retry.exchange(false)){
+            that->sleeping = false;
+            PollSet(eRead, that->socket_set, 100);
             that->monitor.Notify();
+        }
+        else{
+            const bool ready = PollSet(eRead, that->socket_set, 0)!=0;
+            that->sleeping = false;
+            if(ready)
+                that->monitor.Notify();
+        }
+#endif
 
     }
 }
@@ -176,6 +209,8 @@ void NetworkWatch::ThreadFunction(NetworkWatch *that){
 
 NetworkWatch::NetworkWatch(Thread::TaskGroup *group)
   : live(true)
+  , retry(false)
+  , sleeping(false)
   , monitor(group->monitor.GetMutex())
   , socket_set(GenerateSocketSet(nullptr, 0))
   , thread(NetworkWatch::ThreadFunction, this){
@@ -185,6 +220,8 @@ NetworkWatch::NetworkWatch(Thread::TaskGroup *group)
 
 NetworkWatch::NetworkWatch(std::shared_ptr<struct Monitor::MutexHolder> &mutex)
   : live(true)
+  , retry(false)
+  , sleeping(false)
   , monitor(mutex)
   , socket_set(GenerateSocketSet(nullptr, 0))
   , thread(NetworkWatch::ThreadFunction, this){
@@ -229,5 +266,10 @@ void Thread::RemoveSocketFromTaskGroup(WSocket *socket, TaskGroup *group){
     group->watch->DelSocket(socket);
 }
 
+void Thread::RetryTaskGroup(TaskGroup *group){
+    if(group->watch!=nullptr)
+        group->watch->RetrySoon();
+}
+
 
 }
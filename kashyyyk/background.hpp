@@ -132,8 +132,10 @@ public:
     //!
     //! This is a very lightweight call, since all thread creation and
     //! initialization is performed when Thread objects are created.s
+    //! @param metric_name Name of the Metrics gauge of the TaskGroup's queue
+    //! depth. It must outlive the TaskGroup.
     //! @return New TaskGroup, ready to be used
-    static TaskGroup *CreateTaskGroup();
+    static TaskGroup *CreateTaskGroup(const char *metric_name = "tasks.group.depth");
     //! @brief Destroy a TaskGroup
     //!
     //! @warning All remaining queued tasks are dropped when this is called,
@@ -143,6 +145,10 @@ public:
     static void AddWatchToTaskGroup(NetworkWatch *watch, TaskGroup *group);
     static void AddSocketToTaskGroup(WSocket *socket, TaskGroup *group);
     static void RemoveSocketFromTaskGroup(WSocket *socket, TaskGroup *group);
+    //! @brief Run the tasks in @p group again soon, even if none of its
+    //! sockets have anything to read. Used when a socket would not take all
+    //! that was written to it.
+    static void RetryTaskGroup(TaskGroup *group);
 
 
     //! @cond
@@ -1,15 +1,16 @@
 #include "channel.hpp"
 #include "server.hpp"
-#include "prefs.hpp"
+#include "settings.hpp"
 #include "message.hpp"
 #include "channelmessage.hpp"
+#include "chatlog.hpp"
+#include "log.hpp"
 #include "monitor.hpp"
 #include "message.h"
 #include "input.h"
 #include "csv.h"
 #include "platform/pling.h"
 #include "platform/notification.h"
-#include "platform/strcasestr.h"
 
 #include <FL/Fl_Group.H>
 #include <FL/Fl_Box.H>
@@ -24,6 +25,9 @@
 #include <FL/Fl_Preferences.H>
 #include <FL/fl_ask.H>
 
+#include <unordered_set>
+#include <cstring>
+
 #ifdef _WIN32
 // This include is necessary for std::min and std::max with MSVC.
 #include <algorithm>
@@ -41,20 +45,23 @@ using namespace Kashyyyk::ChannelMessage;
 
 namespace Kashyyyk{
 
-Channel::find_user::find_user(const std::string &s)
-  : n(s){
+//! Most nicks named in a summary line of a netsplit or netjoin.
+static const unsigned max_summary_nicks = 20;
+
+Channel::find_user::find_user(const Interned &s)
+  : n(s.Handle()){
 
 }
 
 
 Channel::find_user::find_user(const User *a)
-  : n(a->name) {
+  : n(a->nick.Handle()) {
 
 }
 
 
 bool Channel::find_user::operator () (const User &a){
-    return a.name==n;
+    return a.nick.Handle()==n;
 }
 
 //! @cond
@@ -82,49 +89,21 @@ Channel::StyleTable Channel::table = {{
 
 //! @endcond
 
-//! Based the FLTK.org text editor example.
-//! Very much overkill, this can handle text insertions as well as deletions.
-//! Which is good just in case.
-void Channel::TextModify_CB(int pos, int nInserted, int nDeleted, int nRestyled, const char* deletedText, void *p){
-
-    Channel *that = static_cast<Channel *>(p);
-    assert(that);
-
-    if ((!nInserted) && (!nDeleted)){
-        that->stylebuffer->unselect();
-        return;
-    }
-
-    if (nInserted>0) {
-      char style = 'A';
-
-      switch((IRC_messageType)(that->last_msg_type)){
-          case IRC_join:
-          style = 'B';
-          break;
-          case IRC_quit:
-          style = 'C';
-          break;
-          case IRC_nick:
-          style = 'D';
-          break;
-          case IRC_notice:
-          style = 'E';
-          break;
-          case IRC_privmsg:
-          default:
-          break;
-      }
-
-      std::string style_str(nInserted, style);
-      that->stylebuffer->replace(pos, pos+nDeleted, style_str.c_str());
-    }
-    else {
-      that->stylebuffer->remove(pos, pos+nDeleted);
+//! Style of a line written after a message of type @p type.
+static char LineStyle(int type){
+    switch(type){
+        case IRC_join:
+        return 'B';
+        case IRC_quit:
+        return 'C';
+        case IRC_nick:
+        return 'D';
+        case IRC_notice:
+        return 'E';
+        case IRC_privmsg:
+        default:
+        return 'A';
     }
-
-    // Avoids callbacks?
-    that->stylebuffer->select(pos, pos+nInserted-nDeleted);
 }
 
 void Input_CB(Fl_Widget *w, void *p){
@@ -139,6 +118,7 @@ void Input_CB(Fl_Widget *w, void *p){
     while(iter!=str.end()){
         if(!isspace(*iter))
           break;
+        iter++;
     }
 
     if(iter==str.end())
@@ -150,8 +130,15 @@ void Input_CB(Fl_Widget *w, void *p){
 
     channel->SendMessage(msg);
 
-    msg->from = IRC_Strdup(channel->GetNick());
-    channel->GiveMessage(msg);
+    // With echo-message the server sends our messages back to us, and they are
+    // shown when they arrive just like anyone else's.
+    const bool echoed = ((msg->type==IRC_privmsg) || (msg->type==IRC_notice)) &&
+      channel->HasCap(IRC_cap_echo_message);
+
+    if(!echoed){
+        msg = IRC_SetMessageFrom(msg, channel->GetNick());
+        channel->GiveMessage(msg);
+    }
 
     IRC_FreeMessage(msg);
 
@@ -160,13 +147,57 @@ void Input_CB(Fl_Widget *w, void *p){
 
 Channel::Channel(Server *s, const std::string &channel_name)
   : LockingReciever<Server, Monitor>(s)
+  , enabled(true)
   , widget()
+  , topiclabel(nullptr)
+  , userlist(nullptr)
+  , chatlist(nullptr)
+  , focus(false)
   , alignment(8)
-  , name(channel_name) {
+  , highlight_generation(0)
+  , settings_generation(0)
+  , highlight_dirty(true)
+  , name(channel_name)
+  , key(s->Names().Intern(channel_name))
+  , last_msg_type(IRC_privmsg) {
+
+    history = ChatLog::Open(Parent->GetName(), name);
+
+    const int scrollback = GetSettings().chatlog_scrollback;
+    if(scrollback>0){
+        std::vector<ChatLog::Line> lines;
+        ChatLog::Tail(history, scrollback, lines);
+        for(std::vector<ChatLog::Line>::const_iterator i = lines.cbegin(); i!=lines.cend(); i++)
+            PrintLine(i->from.c_str(), i->text.c_str());
+    }
 
-    Fl_Preferences &prefs = GetPreferences();
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new PrivateMessage_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Part_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new JoinPrint_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Join_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Namelist_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Topic_Handler(this)));
+
+}
+
+Channel::~Channel(){
+    Fl::remove_timeout(Build_CB, this);
+    Fl::remove_timeout(Unload_CB, this);
+ // Server->Window->...
+    Parent->Parent->RemoveChannel(this);
+    ChatLog::Release(history);
+}
+
+
+void Channel::BuildWidgets(){
+
+    AutoLocker<Channel *> locker(this);
+
+    if(widget)
+        return;
+
+    const int font = GetSettings().font;
 
-    prefs.get("sys.appearance.font", font, FL_SCREEN);
     table.ChangeFont(font);
 
     fl_font(font, fl_size());
@@ -176,16 +207,26 @@ Channel::Channel(Server *s, const std::string &channel_name)
     widget.reset(tiler);
 
     topiclabel = new Fl_Output(0, 0, 64, 24);
+    topiclabel->value(topic.c_str());
 
     chatlist =  new Fl_Text_Display(0,  24,  64, 64);
 
-    buffer = new Fl_Text_Buffer();
-    buffer->add_modify_callback(Channel::TextModify_CB, this);
-    stylebuffer = new Fl_Text_Buffer();
+    std::string text, styles;
+    for(std::deque<ChatLine>::const_iterator i = lines.cbegin(); i!=lines.cend(); i++){
+        text+=i->text;
+        styles.append(i->text.size(), i->style);
+    }
+
+    buffer.reset(new Fl_Text_Buffer());
+    buffer->text(text.c_str());
+    stylebuffer.reset(new Fl_Text_Buffer());
+    stylebuffer->text(styles.c_str());
 
-    chatlist->buffer(buffer);
-    chatlist->highlight_data(stylebuffer, table.styletable, table.NumEntries, 'A', nullptr, 0);
+    chatlist->buffer(buffer.get());
+    chatlist->highlight_data(stylebuffer.get(), table.styletable, table.NumEntries, 'A', nullptr, 0);
     chatlist->color(FL_BACKGROUND_COLOR);
+    chatlist->insert_position(buffer->length());
+    chatlist->show_insert_position();
 
     tiler->begin();
 
@@ -197,6 +238,7 @@ Channel::Channel(Server *s, const std::string &channel_name)
     userlist = new Fl_Browser(64, 0, 128, 112);
     userlist->textfont(font);
     userlist->format_char(0);
+    RebuildUserList_l();
 
      // Set the chat box to be the auto-resizable portion.
     Fl_Box *resize_box = new Fl_Box(FL_NO_BOX, 24, 24, 40, 64, "");
@@ -204,43 +246,90 @@ Channel::Channel(Server *s, const std::string &channel_name)
     tiler->resizable(resize_box);
     tiler->end();
 
+    if(!enabled)
+        tiler->deactivate();
+
     Parent->AddChild(tiler);
 
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new PrivateMessage_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new Part_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new JoinPrint_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new Join_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new Quit_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new Namelist_Handler(this)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new Topic_Handler(this)));
+    KLOG_DEBUG(Channel, "Built widgets for %s", name.c_str());
 
 }
 
-Channel::~Channel(){
- // Server->Window->...
-    Parent->Parent->RemoveChannel(this);
+
+void Channel::DestroyWidgets(){
+
+    AutoLocker<Channel *> locker(this);
+
+    if(!widget)
+        return;
+
+    // The group takes itself out of the Server's group, and takes every
+    // other widget with it. The buffers are not owned by the display.
+    widget.reset();
+    topiclabel = nullptr;
+    userlist = nullptr;
+    chatlist = nullptr;
+    buffer.reset();
+    stylebuffer.reset();
+
+    KLOG_DEBUG(Channel, "Destroyed widgets for %s", name.c_str());
+
 }
 
+
+void Channel::Build_CB(void *p){
+
+    Channel *that = static_cast<Channel *>(p);
+
+    if((!that->focus) || that->widget)
+        return;
+
+    that->BuildWidgets();
+    that->widget->show();
+    that->Parent->widget->redraw();
+
+}
+
+
+void Channel::Unload_CB(void *p){
+
+    Channel *that = static_cast<Channel *>(p);
+
+    if(!that->focus)
+        that->DestroyWidgets();
+
+}
+
+
 void Channel::GiveMessage(IRC_Message *msg){
     
     LockingReciever<Server, Monitor>::GiveMessage(msg);
     
     Fl::lock();
-    chatlist->redraw();
+    if(chatlist)
+        chatlist->redraw();
     Parent->widget->redraw();
     Fl::unlock();
     
     
 }
 
-void Channel::SetTopic(const char *topic){
+void Channel::SetTopic(const char *t){
 
-    topiclabel->value(topic);
+    topic = t;
+    if(topiclabel)
+        topiclabel->value(t);
 
 }
 
 
 void Channel::WriteLine(const char *from, const char *msg){
+    PrintLine(from, msg);
+    ChatLog::Append(history, from, msg);
+}
+
+
+void Channel::PrintLine(const char *from, const char *msg){
     const unsigned from_len = strlen(from);
     alignment = std::max<unsigned>(from_len, alignment);
 
@@ -252,7 +341,23 @@ void Channel::WriteLine(const char *from, const char *msg){
 
     line.push_back('\n');
 
-    buffer->append(line.c_str());
+    const char style = LineStyle(last_msg_type);
+
+    if(lines.size()>=GetSettings().channel_max_lines){
+        if(buffer){
+            const int length = lines.front().text.size();
+            buffer->remove(0, length);
+            stylebuffer->remove(0, length);
+        }
+        lines.pop_front();
+    }
+
+    if(buffer){
+        buffer->append(line.c_str());
+        stylebuffer->append(std::string(line.size(), style).c_str());
+    }
+
+    lines.push_back({std::move(line), style});
 
 }
 
@@ -273,10 +378,48 @@ void Channel::Highlight(HighlightLevel level){
 
     Parent->Highlight();
 
-    Fl_Preferences &prefs = GetPreferences();
+    if((level==HighlightLevel::High) && GetSettings().pling)
+      Pling();
+
+}
+
+
+void Channel::Highlight(HighlightLevel level, const char *text){
+
+    UpdateHighlighter_l();
 
-    int do_pling = 1;
-    prefs.get("sys.pling.enabled", do_pling, 1);
+    Highlight(highlighter.Matches(text)?HighlightLevel::High:level);
+
+}
+
+
+void Channel::SetHighlightWords(const std::vector<std::string> &words){
+
+    lock();
+    highlight_words = words;
+    highlight_dirty = true;
+    unlock();
+
+}
+
+
+void Channel::UpdateHighlighter_l(){
+
+    const Settings &settings = GetSettings();
+    const unsigned generation = Parent->HighlightGeneration();
+    if((!highlight_dirty) && (generation==highlight_generation) && (settings.generation==settings_generation))
+        return;
+
+    std::vector<std::string> words(1, Parent->GetNick());
+
+    words.insert(words.end(), settings.highlight_words.cbegin(), settings.highlight_words.cend());
+    words.insert(words.end(), highlight_words.cbegin(), highlight_words.cend());
+
+    highlighter.Compile(words, Parent->isupport.fold);
+
+    highlight_generation = generation;
+    settings_generation = settings.generation;
+    highlight_dirty = false;
 
 }
 
@@ -288,21 +431,39 @@ void Channel::FocusChanged(){
 void Channel::SendMessage(IRC_Message *msg){
     if(msg->type==IRC_join && msg->num_parameters>0){
         Parent->JoinChannel(msg->parameters[0]);
-        printf("Pushing a join message for %s.\n", msg->parameters[0]);
+        KLOG_DEBUG(Channel, "Pushing a join message for %s.", msg->parameters[0]);
     }
 
     Parent->SendMessage(msg);
 }
 
 void Channel::GiveFocus(){
-    widget->show();
     focus = true;
+    Fl::remove_timeout(Unload_CB, this);
+
+    if(widget)
+        widget->show();
+    else if(!Fl::has_timeout(Build_CB, this)){
+        // A burst of joins shows each new Channel in turn. Waiting for the
+        // event loop means only the one left in front is ever built.
+        Fl::add_timeout(0.0, Build_CB, this);
+        Fl::awake();
+    }
 }
 
 
 void Channel::LoseFocus(){
-    widget->hide();
     focus = false;
+    Fl::remove_timeout(Build_CB, this);
+
+    if(!widget)
+        return;
+
+    widget->hide();
+
+    const int unload_timeout = GetSettings().channel_unload_timeout;
+    if(unload_timeout>0)
+        Fl::add_timeout(unload_timeout, Unload_CB, this);
 }
 
 
@@ -320,15 +481,33 @@ void Channel::Hide(){
 }
 
 void Channel::AddUser_l(const char *user, const char *mode){
-    AddUser_l({user, mode});
+    AddUser_l(user, strlen(user), mode);
+}
+
+void Channel::AddUser_l(const char *user, unsigned long len, const char *mode){
+    const unsigned long prefix = std::min<unsigned long>(strspn(user, Parent->UserPrefixes_l()), len);
+    User added = {Parent->Names().Intern(user+prefix, len-prefix), std::string(user, prefix)+mode};
+
+    // Folding never changes the length, only the case.
+    if(memcmp(added.nick.c_str(), user+prefix, len-prefix)!=0)
+        added.spelling.assign(user+prefix, len-prefix);
+
+    AddUser_l(added);
 }
 
 void Channel::AddUser_l(const struct User &user){
 
+    // The Server knows if they are here already, without a search.
+    if(!Parent->AddMember_l(user.nick, this))
+        return;
+
+    const std::string shown = user.Name();
+
     Users.push_back(user);
-    userlist->add(user.name.c_str());
+    if(userlist)
+        userlist->add(shown.c_str());
 
-    alignment = std::max<unsigned>(user.name.size(), alignment);
+    alignment = std::max<unsigned>(shown.size(), alignment);
 }
 
 
@@ -350,13 +529,20 @@ void Channel::SortUsers(){
 
 
 void Channel::SortUsers_l(){
+    if(!userlist)
+        return;
+
     userlist->sort(FL_SORT_ASCENDING);
     userlist->redraw();
 }
 
 
 void Channel::AddUser(const char *user, const char *mode){
-    AddUser({user, mode});
+    lock();
+
+    AddUser_l(user, mode);
+
+    unlock();
 }
 
 
@@ -365,41 +551,49 @@ const char *Channel::GetNick(){
 }
 
 
+bool Channel::HasCap(enum IRC_capability cap) const{
+    return Parent->HasCap(cap);
+}
+
+
 void Channel::RemoveUser_l(const char *user_c){
 
-    std::string user(user_c);
+    // A nick that isn't interned can't be in any Channel.
+    const Interned nick = Parent->Names().Find(user_c);
+    if(nick)
+        RemoveUser_l(nick);
 
-    std::list<User>::iterator iter = Users.begin();
-    while(iter!=Users.end()){
+}
 
-        bool skip_first_char = false;
-        char first_char = iter->name[0];
-        if((first_char=='&') ||
-           (first_char=='@') ||
-           (first_char=='~'))
-           skip_first_char = true;
-
-        if((iter->name==user) ||
-           (skip_first_char && (iter->name.substr(1)==user))){
-            Users.erase(iter);
-
-            for(int i = 1; i<=userlist->size(); i++){
-                if(std::string(userlist->text(i))==user){
-                    userlist->remove(i);
-                    break;
-                }
-            }
 
-            Fl::lock();
-            userlist->redraw();
-            Fl::unlock();
+void Channel::RemoveUser_l(const Interned &nick){
 
-            return;
-        }
+    std::list<User>::iterator iter =
+      std::find_if(Users.begin(), Users.end(), find_user(nick));
 
-        iter++;
+    if(iter==Users.end())
+        return;
+
+    // The userlist shows names with their mode characters.
+    const std::string shown = iter->Name();
+
+    Parent->RemoveMember_l(nick, this);
+    Users.erase(iter);
+
+    if(!userlist)
+        return;
+
+    for(int i = 1; i<=userlist->size(); i++){
+        if(shown==userlist->text(i)){
+            userlist->remove(i);
+            break;
+        }
     }
 
+    Fl::lock();
+    userlist->redraw();
+    Fl::unlock();
+
 }
 
 
@@ -411,14 +605,196 @@ void Channel::RemoveUser(const char *user_c){
 
 }
 
+
+void Channel::RebuildUserList_l(){
+
+    if(!userlist)
+        return;
+
+    userlist->clear();
+
+    for(std::list<User>::const_iterator iter = Users.cbegin(); iter!=Users.cend(); iter++)
+        userlist->add(iter->Name().c_str());
+
+    SortUsers_l();
+
+}
+
+
+void Channel::WriteSummary_l(const std::vector<Interned> &nicks, const char *what, const std::string &servers){
+
+    std::string line = std::to_string(nicks.size());
+    line+=(nicks.size()==1)?" user ":" users ";
+    line+=what;
+
+    if(!servers.empty())
+        line+=" (" + servers + ")";
+
+    line+=": ";
+
+    for(unsigned i = 0; (i<nicks.size()) && (i<max_summary_nicks); i++){
+        if(i!=0)
+            line+=", ";
+        line+=nicks[i].c_str();
+    }
+
+    if(nicks.size()>max_summary_nicks)
+        line+=" and " + std::to_string(nicks.size()-max_summary_nicks) + " more";
+
+    WriteLine("", line.c_str());
+
+    Fl::lock();
+    if(chatlist)
+        chatlist->redraw();
+    Parent->widget->redraw();
+    Fl::unlock();
+
+}
+
+
+void Channel::QuitUser(const Interned &nick, const char *reason){
+
+    AutoLocker<Channel *> locker(this);
+
+    last_msg_type = IRC_quit;
+
+    const std::string line = nick.str() + " " + reason;
+    WriteLine("", line.c_str());
+
+    RemoveUser_l(nick);
+
+    Fl::lock();
+    if(chatlist)
+        chatlist->redraw();
+    Parent->widget->redraw();
+    Fl::unlock();
+
+}
+
+
+void Channel::RenameUser(const Interned &from, const Interned &to, const char *spelling){
+
+    AutoLocker<Channel *> locker(this);
+
+    std::list<User>::iterator iter =
+      std::find_if(Users.begin(), Users.end(), find_user(from));
+
+    if(iter==Users.end())
+        return;
+
+    const std::string old_nick = iter->Nick();
+    const std::string old_shown = iter->Name();
+
+    // A change of case only keeps the same handle, so the spelling is all
+    // that changes.
+    iter->nick = to;
+    if(strcmp(to.c_str(), spelling)==0)
+        iter->spelling.clear();
+    else
+        iter->spelling = spelling;
+
+    const std::string shown = iter->Name();
+
+    alignment = std::max<unsigned>(shown.size(), alignment);
+
+    // Changed where it is, rather than removed, added and sorted again.
+    if(userlist){
+        for(int i = 1; i<=userlist->size(); i++){
+            if(old_shown==userlist->text(i)){
+                userlist->text(i, shown.c_str());
+                break;
+            }
+        }
+    }
+
+    last_msg_type = IRC_nick;
+
+    const std::string line = old_nick + " is now known as " + spelling;
+    WriteLine("", line.c_str());
+
+    Fl::lock();
+    if(userlist)
+        userlist->redraw();
+    if(chatlist)
+        chatlist->redraw();
+    Parent->widget->redraw();
+    Fl::unlock();
+
+}
+
+
+void Channel::BulkQuit(const std::vector<Interned> &nicks, const std::string &servers){
+
+    AutoLocker<Channel *> locker(this);
+
+    std::unordered_set<const IRC_Interned *> quitting;
+    for(std::vector<Interned>::const_iterator iter = nicks.cbegin(); iter!=nicks.cend(); iter++)
+        quitting.insert(iter->Handle());
+
+    std::vector<Interned> gone;
+
+    std::list<User>::iterator iter = Users.begin();
+    while(iter!=Users.end()){
+        if(quitting.count(iter->nick.Handle())){
+            Parent->RemoveMember_l(iter->nick, this);
+            gone.push_back(std::move(iter->nick));
+            iter = Users.erase(iter);
+        }
+        else
+            iter++;
+    }
+
+    if(gone.empty())
+        return;
+
+    RebuildUserList_l();
+
+    last_msg_type = IRC_quit;
+    WriteSummary_l(gone, "quit", servers);
+
+}
+
+
+void Channel::BulkJoin(const std::vector<Interned> &nicks, const std::string &servers){
+
+    AutoLocker<Channel *> locker(this);
+
+    std::vector<Interned> joined;
+
+    for(std::vector<Interned>::const_iterator iter = nicks.cbegin(); iter!=nicks.cend(); iter++){
+        if(!Parent->AddMember_l(*iter, this))
+            continue;
+
+        Users.push_back({*iter, ""});
+        alignment = std::max<unsigned>(iter->size(), alignment);
+        joined.push_back(*iter);
+    }
+
+    if(joined.empty())
+        return;
+
+    RebuildUserList_l();
+
+    last_msg_type = IRC_join;
+    WriteSummary_l(joined, "joined", servers);
+
+}
+
+
 void Channel::Enable(){
-    printf("Enabling channel %s\n", name.c_str());
+    KLOG_DEBUG(Channel, "Enabling channel %s", name.c_str());
+    enabled = true;
+    if(!widget)
+        return;
     widget->activate();
     widget->redraw();
 }
 
 void Channel::Disable(){
-    printf("Disabling channel %s\n", name.c_str());
+    KLOG_DEBUG(Channel, "Disabling channel %s", name.c_str());
+    enabled = false;
+    if(!widget)
+        return;
     widget->deactivate();
     widget->redraw();
 }
@@ -9,8 +9,12 @@
 #include "reciever.hpp"
 #include "autolocker.hpp"
 #include "monitor.hpp"
+#include "intern.hpp"
+#include "highlight.hpp"
+#include "cap.h"
 
 #include <list>
+#include <deque>
 #include <vector>
 #include <memory>
 #include <string>
@@ -49,18 +53,29 @@ namespace Kashyyyk{
 
 //! @brief User Structure
 //!
-//! Stores a user name and mode.
-//! Currently, Mode is meaningless.
+//! Stores a user's nick and mode characters.
 struct User {
-    //! User's name. This includes the Mode character, if applicable.
-    std::string name;
-    //! Currently, Mode is meaningless, and will just be an empty string.
-    //! Mode signifiers are prepended to the Name.
+    //! User's nick, without any mode characters. Interned in the owning
+    //! Server's table, so Users are compared by pointer.
+    Interned nick;
+    //! Mode characters shown before the nick, such as "@", or "@+" with
+    //! multi-prefix. Usually empty.
     std::string mode;
+    //! The nick as the server spells it, if that isn't how nick is spelled.
+    //! The table keeps whichever spelling it saw first, so this is set after
+    //! a change of case, such as "Foo" to "foo". Usually empty.
+    std::string spelling;
+
+    //! The nick as it is shown.
+    const char *Nick() const {return spelling.empty()?nick.c_str():spelling.c_str();}
+    //! The name as it is shown in the user list.
+    std::string Name() const {return mode + Nick();}
 };
 
 class Server;
 
+namespace ChatLog {class Stream;}
+
 //!
 //! @brief IRC Channel
 //!
@@ -83,8 +98,36 @@ class Channel : public LockingReciever<Server, Monitor>{
     //! Used internally to format text for the chat box
     static struct StyleTable table;
 
+    //! @brief A line of the chat box, as it is shown.
+    struct ChatLine {
+        //! The aligned line, with its newline.
+        std::string text;
+        //! Style table entry, from 'A'.
+        char style;
+    };
+
+    //! @name Model
+    //! Everything the widgets show. Kept whether or not the widgets exist,
+    //! and guarded by the Channel's lock. See also Users.
+    //! @{
+
+    std::string topic;
+    //! The newest lines of the chat box, up to `sys.channel.maxlines`.
+    std::deque<ChatLine> lines;
+    bool enabled;
+
+    //! @}
+
+    //! @name Widgets
+    //! Only built once the Channel is shown, and destroyed again after it
+    //! has been hidden for `sys.channel.unload.timeout` seconds, so that
+    //! Channels that are never looked at cost no widgets. All are null while
+    //! there are none. Like any widget, only touched with Fl::lock held.
+    //! @{
+
     //! Containing group for all related widgets to the channel.
-    //! The lifetime of this widget controls the lifetime of
+    //! The lifetime of this widget controls the lifetime of the others,
+    //! except for the text buffers.
     std::unique_ptr<Fl_Group> widget;
 
     //! Topic for the channel
@@ -94,12 +137,13 @@ class Channel : public LockingReciever<Server, Monitor>{
     //! The main chat box
     Fl_Text_Display *chatlist;
     //! Text buffer for the chat box
-    Fl_Text_Buffer *buffer;
+    std::unique_ptr<Fl_Text_Buffer> buffer;
     //! Style buffer for the chat box
-    Fl_Text_Buffer *stylebuffer;
+    std::unique_ptr<Fl_Text_Buffer> stylebuffer;
+
+    //! @}
 
     bool focus;
-    int font;
 /*
     //! @brief Gets the item that represents the channel
     //!
@@ -109,6 +153,50 @@ class Channel : public LockingReciever<Server, Monitor>{
     //! @brief Used for aligning usernames with messages in the chat box
     unsigned alignment;
 
+    //! @brief Builds the widgets from the model. Locks the Channel.
+    void BuildWidgets();
+    //! @brief Destroys the widgets. The model is untouched. Locks the
+    //! Channel.
+    void DestroyWidgets();
+
+    static void Build_CB(void *p);
+    static void Unload_CB(void *p);
+
+    //! @brief This Channel's chat log, or empty if logging is off.
+    std::shared_ptr<ChatLog::Stream> history;
+
+    //! @brief Prints a line in the chat box without logging it.
+    void PrintLine(const char *from, const char *msg);
+
+    //! @name Highlighting
+    //! Guarded by the Channel's lock.
+    //! @{
+
+    //! Our nick, the global highlight words, and highlight_words.
+    Highlighter highlighter;
+    //! Words that only highlight this Channel.
+    std::vector<std::string> highlight_words;
+    //! The Server's HighlightGeneration when highlighter was compiled.
+    unsigned highlight_generation;
+    //! The Settings generation when highlighter was compiled.
+    unsigned settings_generation;
+    //! True if highlight_words changed since highlighter was compiled.
+    bool highlight_dirty;
+
+    //! @brief Compiles highlighter again if anything it is made from changed.
+    //! The Channel and the owning Server must be locked.
+    void UpdateHighlighter_l();
+
+    //! @}
+
+    //! @brief Refills the user list widget from Users, and sorts it.
+    //! The Channel must be locked.
+    void RebuildUserList_l();
+
+    //! @brief Writes a line such as "3 users quit (a.net b.net): x, y, z" and
+    //! redraws the chat. The Channel must be locked.
+    void WriteSummary_l(const std::vector<Interned> &nicks, const char *what, const std::string &servers);
+
 public:
     friend class Server;
     friend class AutoLocker<Channel *>;
@@ -120,6 +208,9 @@ public:
     //! Server's name. Includes any type (#, &, etc.) prefix.
     std::string name;
 
+    //! The name interned in the owning Server's table, for routing messages.
+    Interned key;
+
     //! @brief All active users.
     //! @warning You must lock this Channel before modifying or iterating this member.
     std::list<User> Users;
@@ -140,13 +231,14 @@ public:
     virtual void SendMessage(IRC_Message *msg) override;
 
     //! The method that is called when Show occurs. Can be called independantly
-    //! to simulate a Show event.
+    //! to simulate a Show event. If the widgets don't exist, they are built
+    //! shortly after, unless the Channel loses focus again first.
     //! @warning You must use Fl::lock if you are before calling this if you
     //! not on the main thread! See
     //! http://fltk.org/doc-1.3/group__fl__multithread.html
     void GiveFocus();
     //! The method that is called when Hide occurs. Can be called independantly
-    //! to simulate a Show event.
+    //! to simulate a Show event. Starts the timeout to destroy the widgets.
     //! @warning You must use Fl::lock if you are before calling this if you
     //! not on the main thread! See
     //! http://fltk.org/doc-1.3/group__fl__multithread.html
@@ -189,7 +281,7 @@ public:
     //! color indicating the level.
     //! @li A level of @link High @endlink is the same as @link Medium @endlink
     //! except that it also causes the owning Server's owning Window to flash
-    //! for the user's attention.
+    //! for the user's attention, if `sys.pling.enabled` is set.
     //!
     //! @warning You must use Fl::lock if you are before calling this if you
     //! not on the main thread! See
@@ -199,6 +291,20 @@ public:
     //!
     //! @sa Kashyyyk::Server::Highlight
     void Highlight(HighlightLevel level = Low);
+    //! @brief Highlights the Channel at @p level, or at @link High @endlink
+    //! if @p text mentions us.
+    //!
+    //! A mention is our nick or any of the words in `sys.highlight.words` or
+    //! given to SetHighlightWords. They are all found in a single pass over
+    //! @p text. See Highlighter for how words are matched.
+    //!
+    //! @warning The Channel and the owning Server must be locked, as they
+    //! are when a MessageHandler is called.
+    void Highlight(HighlightLevel level, const char *text);
+
+    //! @brief Sets words that highlight only this Channel, on top of the
+    //! global ones. Locks the Channel.
+    void SetHighlightWords(const std::vector<std::string> &words);
     //! Called to indicate that the focus has changed. Results in the chat GUI
     //! redrawing if it is active.
     void FocusChanged();
@@ -212,7 +318,7 @@ public:
     //! @param [out] path Resulting path is placed here
     void GetPath(std::string &path) const;
 
-    //! Sets the Topic in the topic widget.
+    //! Sets the Topic, and shows it in the topic widget if there is one.
     //! @warning You must use Fl::lock if you are before calling this if you
     //! not on the main thread! See
     //! http://fltk.org/doc-1.3/group__fl__multithread.html
@@ -220,6 +326,7 @@ public:
     //! @overload
     inline void SetTopic(const std::string &topic){SetTopic(topic.c_str());}
 
+    //! @brief Prints a line in the chat box, and adds it to the chat log.
     void WriteLine(const char *from, const char *msg);
 
     //! @brief Adds a User to the Channel
@@ -228,7 +335,11 @@ public:
     //! chatbox about the user joining, although it does add the user to the
     //! user list widget.
     //!
-    //! It is recommended to call SortUsers after adding Users.
+    //! It is recommended to call SortUsers after adding Users. A user that is
+    //! already in the Channel is left as it is.
+    //!
+    //! The owning Server must be locked, since it keeps track of which
+    //! Channels each nick is in.
     //!
     //! @warning This function locks the Channel! If you already have locked
     //! the channel, used the the nonlocking variant @link AddUsers_l @endlink
@@ -241,7 +352,9 @@ public:
     //! @sa AddUser_l
     void AddUser(const struct User &user);
     //! @overload
-    //! @brief Equivalent to @link AddUser @endlink @p ({ @p user, @p mode})
+    //! @brief Adds the User @p user. Any mode characters at the start of
+    //! @p user are moved in front of @p mode. The owning Server must be
+    //! locked.
     void AddUser(const char *user, const char *mode);
 
     //! @brief Nonlocking version of AddUser
@@ -255,8 +368,14 @@ public:
     //! @sa AddUser
     void AddUser_l(const struct User &user);
     //! @overload
-    //! @brief Equivalent to @link AddUser_l @endlink @p ({ @p user, @p mode})
+    //! @brief Nonlocking version of AddUser(const char *, const char *)
+    //!
+    //! The owning Server must be locked, since it knows which mode
+    //! characters there are.
     void AddUser_l(const char *user, const char *mode);
+    //! @overload
+    //! @brief As above, with only the first @p len bytes of @p user.
+    void AddUser_l(const char *user, unsigned long len, const char *mode);
 
     //! @brief Sorts the usernames in the userlist alphabetically
     //!
@@ -293,14 +412,74 @@ public:
     void SortUsers_l();
 
     //! @brief Removes a user from the Channel
+    //!
+    //! As with adding Users, the owning Server must be locked.
     void RemoveUser_l(const char *user);
+    //! @overload
+    void RemoveUser_l(const Interned &nick);
 
     //! @brief Removes a user from the Channel
     void RemoveUser(const char *user);
 
+    //! @brief Removes a user that quit, and says so in the chat box
+    //!
+    //! @warning This function locks the Channel! The owning Server must
+    //! already be locked.
+    //!
+    //! @param nick Nick that quit
+    //! @param reason Reason given in the QUIT
+    void QuitUser(const Interned &nick, const char *reason);
+
+    //! @brief Renames a user after a NICK, and says so in the chat box
+    //!
+    //! The User keeps its place in Users and in the user list widget, so
+    //! nothing is added or sorted again. This does not change which Channels
+    //! the owning Server has the nick in; see Server::RenameMember_l.
+    //!
+    //! @warning This function locks the Channel! The owning Server must
+    //! already be locked.
+    //!
+    //! @param from Nick before the NICK
+    //! @param to Nick after the NICK, which is @p from again if only the
+    //! case changed
+    //! @param spelling The new nick as the server spelled it
+    void RenameUser(const Interned &from, const Interned &to, const char *spelling);
+
+    //! @brief Applies a netsplit to the Channel
+    //!
+    //! Removes every User named in @p nicks, rebuilds the user list once, and
+    //! writes a single line naming who left. Nicks that are not in the Channel
+    //! are ignored.
+    //!
+    //! @warning This function locks the Channel!
+    //!
+    //! @warning You must use Fl::lock if you are before calling this if you
+    //! not on the main thread! See
+    //! http://fltk.org/doc-1.3/group__fl__multithread.html
+    //!
+    //! @param nicks Nicks that quit
+    //! @param servers Servers that split, as given in the BATCH
+    void BulkQuit(const std::vector<Interned> &nicks, const std::string &servers);
+
+    //! @brief Applies a netjoin to the Channel
+    //!
+    //! The counterpart to @link BulkQuit @endlink . Adds every User named in
+    //! @p nicks that is not already in the Channel.
+    //!
+    //! @warning This function locks the Channel!
+    //!
+    //! @warning You must use Fl::lock if you are before calling this if you
+    //! not on the main thread! See
+    //! http://fltk.org/doc-1.3/group__fl__multithread.html
+    void BulkJoin(const std::vector<Interned> &nicks, const std::string &servers);
+
     //! @brief Get the nickname for this Channel
     const char *GetNick();
 
+    //! @brief Returns true if the owning Server negotiated @p cap
+    //! @sa Server::HasCap
+    bool HasCap(enum IRC_capability cap) const;
+
     //! @brief Disables the channel's widgets
     //! 
     //! This is primarily used when a server has disconnected.
@@ -313,19 +492,17 @@ public:
     //! @sa Disable
     void Enable();
     
-    static void TextModify_CB(int, int, int, int, const char*, void*);
-
     //! @brief Functional-style object for finding certain Users in a Channel
     //!
     //! This class is intended to be used with std::find_if and Users.
-    //! Used to search for a User in UserList by name. Does not consider Mode.
-    //! Should not be used after the string or User used to construct the
+    //! Used to search for a User in UserList by nick. Does not consider Mode.
+    //! Should not be used after the Interned or User used to construct the
     //! find_user is freed.
     //! @sa Kashyyyk::User
     class find_user {
-        const std::string &n;
+        const IRC_Interned *n;
     public:
-        find_user(const std::string &s);
+        find_user(const Interned &s);
         find_user(const User *);
         bool operator () (const User &);
     };
@@ -12,29 +12,6 @@ Message_Handler::Message_Handler(Channel *c)
 }
 
 
-Quit_Handler::Quit_Handler(Channel *c)
-  : Message_Handler(c){
-
-}
-
-
-bool Quit_Handler::HandleMessage(IRC_Message *msg){
-    if((msg->type!=IRC_quit) || (msg->from==nullptr))
-       return false;
-
-    from_reader r;
-
-    std::list<User>::const_iterator iter = std::find_if(channel->Users.cbegin(), channel->Users.cend(), Channel::find_user(r(msg)));
-    if(iter!=channel->Users.cend()){
-        std::string message = std::string(r(msg)) + " " + ((msg->num_parameters>0)?msg->parameters[0]:"");
-        channel->WriteLine("", message.c_str());
-    }
-
-    channel->RemoveUser_l(r(msg));
-
-    return false;
-}
-
 Topic_Handler::Topic_Handler(Channel *c)
   : Message_Handler(c){
 
@@ -74,18 +51,16 @@ Namelist_Handler::Namelist_Handler(Channel *c)
 bool Namelist_Handler::HandleMessage(IRC_Message *msg){
 
     if(msg->type==IRC_namelist_num){
-        const char **names = FJ::CSV::ParseString(r(msg), ' ');
-        int i = 0;
-        for(const char *iter = names[i++];iter!=nullptr; iter = names[i++]){
-            if(iter[0]=='\0')
-              continue;
+        const FJ::CSV::Elements names = FJ::CSV::Split(r(msg), ' ');
+        for(FJ::CSV::Elements::iterator iter = names.begin(); iter!=names.end(); iter++){
+            const FJ::CSV::Element name = *iter;
 
-            channel->AddUser_l({iter, ""});
+            // With userhost-in-names, names come as nick!user@host.
+            const char *bang = static_cast<const char *>(memchr(name.data(), '!', name.size()));
+            channel->AddUser_l(name.data(), (bang==nullptr)?name.size():(bang-name.data()), "");
         }
 
         channel->SortUsers_l();
-
-        FJ::CSV::FreeParse(names);
     }
     return false;
 
@@ -15,7 +15,6 @@
 #include "message.hpp"
 #include "message.h"
 #include <string>
-#include "platform/strcasestr.h"
 
 #ifdef SendMessage
 #undef SendMessage
@@ -40,10 +39,9 @@ protected:
     //!
     //! The message being handled can be assumed to be directed to this channel
     //! if the message includes destination channel (such as JOIN or PART).
-    //! Other types that are sent to clients without specifying the applicable
-    //! channel, such as QUIT, are given indiscrimitely to all Channels the
-    //! Server owns. It is the job of the Message_Handler to determine whether
-    //! or not to act on such messages.
+    //! QUIT and NICK, which don't name a channel, are not given to Channels
+    //! at all; the Server calls Channel::QuitUser and Channel::RenameUser on
+    //! the Channels the nick is in.
     //!
     //! @param msg Message being handled.
     bool HandleMessage(IRC_Message *msg) = 0;
@@ -55,19 +53,6 @@ public:
 
 };
 
-//!
-//! @brief Repeating handler for QUIT messages
-//!
-//! This Handler must determine if the channel contains the user quitting.
-class Quit_Handler : public Message_Handler {
-public:
-    Quit_Handler(Channel *c);
-    ~Quit_Handler() override {}
-
-    bool HandleMessage(IRC_Message *msg) override;
-
-};
-
 //!
 //! @brief Repeating handler for TOPIC and 332 (IRC_topic_num) messages
 //!
@@ -164,15 +149,10 @@ public:
 
         channel->last_msg_type = type;
         const char *from = r(msg);
+        const char *text = t(msg);
 
-        channel->WriteLine(from, t(msg));
-
-        if(strcasestr(t(msg), channel->server()->GetNick().c_str())!=nullptr){
-            channel->Highlight(Channel::HighlightLevel::High);
-        }
-        else{
-            channel->Highlight(level);
-        }
+        channel->WriteLine(from, text);
+        channel->Highlight(level, text);
 
 		t.Reset();
 		r.Reset();
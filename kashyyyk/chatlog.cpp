@@ -0,0 +1,623 @@
+#include "chatlog.hpp"
+#include "search.hpp"
+#include "log.hpp"
+#include "intern.h"
+#include "platform/mapfile.h"
+#include "platform/paths.h"
+
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace Kashyyyk {
+namespace ChatLog {
+
+//! Segments are started again once their log is this big.
+static const unsigned long long SegmentSize = 4ull<<20;
+
+//! Most lines that may wait for the writer before they are dropped.
+static const unsigned long MaxQueued = 1<<14;
+
+class Stream {
+public:
+    Stream(const std::string &s, const std::string &c)
+      : server(s)
+      , channel(c)
+      , log(nullptr)
+      , index(nullptr)
+      , log_size(0)
+      , segment(-1)
+      , dirty(false)
+      , failed(false)
+      , open(false){}
+
+    ~Stream(){
+        if(log)
+            fclose(log);
+        if(index)
+            fclose(index);
+    }
+
+    //! Directory names, already made safe for the file system.
+    const std::string server, channel;
+
+    //! @name Writer state
+    //! Only ever touched by the writer thread.
+    //! @{
+    FILE *log, *index;
+    unsigned long long log_size;
+    //! Number of the newest segment, or -1 before the directory is looked at.
+    long segment;
+    //! True if something was written since the last sync.
+    bool dirty;
+    //! True if a segment could not be opened. Lines are dropped from then on.
+    bool failed;
+    //! True while the writer has the Stream in its list of open streams.
+    bool open;
+    //! Terms of the lines in the current segment.
+    Search::SegmentIndex terms;
+    //! @}
+};
+
+struct Queued {
+    std::shared_ptr<Stream> stream;
+    long long time;
+    std::string from;
+    std::string text;
+    //! If true, this is not a line but the end of the stream's segment.
+    bool release;
+};
+
+static std::string base_directory;
+static unsigned sync_interval = 1000;
+
+static std::mutex queue_mutex;
+static std::vector<Queued> queue;
+
+static std::atomic<unsigned long long> dropped(0);
+static std::atomic<bool> running(false);
+static std::thread *writer = nullptr;
+
+//! Streams already in the `logs/streams` list. Only touched by the writer.
+static std::unordered_set<std::string> listed;
+
+
+static long long NowMilliseconds(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+//! Casefolds @p name and replaces anything that a file system might not like.
+static std::string SafeName(const std::string &name){
+    std::string safe(name);
+    IRC_CaseFold(&safe[0], safe.c_str(), safe.size());
+
+    for(std::string::iterator i = safe.begin(); i!=safe.end(); i++){
+        const unsigned char c = *i;
+        if((c<' ') || (c>'~') || (strchr("/\\:*?\"<>|", c)!=nullptr))
+            *i = '_';
+    }
+
+    if(safe.empty() || (safe[0]=='.'))
+        safe.insert(0, "_");
+
+    return safe;
+}
+
+
+std::string Directory(){
+    return base_directory.empty()?base_directory:(base_directory + "/logs");
+}
+
+
+std::string StreamName(const std::string &server, const std::string &channel){
+    return SafeName(server) + '/' + SafeName(channel);
+}
+
+
+std::string StreamDirectory(const std::string &name){
+    return base_directory + "/logs/" + name;
+}
+
+
+static std::string StreamDirectory(const Stream &stream){
+    return StreamDirectory(stream.server + '/' + stream.channel);
+}
+
+
+void ListStreams(std::vector<std::string> &out){
+
+    if(base_directory.empty())
+        return;
+
+    FILE *file = fopen((base_directory + "/logs/streams").c_str(), "rb");
+    if(!file)
+        return;
+
+    std::unordered_set<std::string> seen;
+    std::string name;
+    int c;
+
+    while((c = fgetc(file))!=EOF){
+        if(c!='\n'){
+            name.push_back(c);
+            continue;
+        }
+
+        if((!name.empty()) && seen.insert(name).second)
+            out.push_back(name);
+        name.clear();
+    }
+
+    fclose(file);
+}
+
+
+//! Adds @p stream to the `logs/streams` list if it isn't there yet.
+static void ListStream(const Stream &stream){
+
+    const std::string name = stream.server + '/' + stream.channel;
+
+    if(listed.count(name))
+        return;
+
+    FILE *file = fopen((base_directory + "/logs/streams").c_str(), "ab");
+    if(!file)
+        return;
+
+    fputs(name.c_str(), file);
+    fputc('\n', file);
+    fclose(file);
+
+    listed.insert(name);
+}
+
+
+std::string SegmentPath(const std::string &directory, long segment, const char *extension){
+    char name[32];
+    snprintf(name, sizeof(name), "/%08lx.%s", segment, extension);
+    return directory + name;
+}
+
+
+static bool SegmentFileExists(const std::string &directory, long segment, const char *extension){
+    FILE *file = fopen(SegmentPath(directory, segment, extension).c_str(), "rb");
+    if(file)
+        fclose(file);
+    return file!=nullptr;
+}
+
+
+static bool SegmentExists(const std::string &directory, long segment){
+    return SegmentFileExists(directory, segment, "idx");
+}
+
+
+//! Segments are numbered from 0 with no gaps, so this only needs to probe a
+//! logarithmic number of them.
+long NewestSegment(const std::string &directory){
+
+    if(!SegmentExists(directory, 0))
+        return -1;
+
+    long low = 0, high = 1;
+    while(SegmentExists(directory, high)){
+        low = high;
+        high<<=1;
+    }
+
+    // low exists and high doesn't.
+    while(high-low>1){
+        const long middle = low+((high-low)>>1);
+        if(SegmentExists(directory, middle))
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+
+//! Closes the stream's current segment, if it has one, and writes out its
+//! term index.
+static void FinishSegment(Stream &stream){
+
+    if(stream.dirty){
+        if(stream.log)
+            Kashyyyk_SyncFile(stream.log);
+        if(stream.index)
+            Kashyyyk_SyncFile(stream.index);
+    }
+
+    if(stream.log)
+        fclose(stream.log);
+    if(stream.index)
+        fclose(stream.index);
+
+    if(stream.log && stream.index && (!stream.terms.Write(SegmentPath(StreamDirectory(stream), stream.segment, "fts"))))
+        KLOG_WARNING(UI, "Could not write the search index of chat log segment %li.", stream.segment);
+
+    stream.log = nullptr;
+    stream.index = nullptr;
+    stream.dirty = false;
+    stream.terms.Clear();
+}
+
+
+//! Opens the segment after the newest one. Returns false if it can't.
+static bool StartSegment(Stream &stream){
+
+    if(stream.failed)
+        return false;
+
+    FinishSegment(stream);
+
+    const std::string directory = StreamDirectory(stream);
+
+    if(stream.segment<0){
+        Kashyyyk_MakeDir((base_directory + "/logs").c_str());
+        Kashyyyk_MakeDir((base_directory + "/logs/" + stream.server).c_str());
+        Kashyyyk_MakeDir(directory.c_str());
+        stream.segment = NewestSegment(directory);
+
+        // Only the newest segment can be missing its term index, if the
+        // last session ended without closing the log.
+        if((stream.segment>=0) && (!SegmentFileExists(directory, stream.segment, "fts")))
+            Search::IndexSegment(directory, stream.segment);
+
+        ListStream(stream);
+    }
+
+    stream.segment++;
+    stream.log_size = 0;
+
+    stream.log = fopen(SegmentPath(directory, stream.segment, "log").c_str(), "wb");
+    stream.index = fopen(SegmentPath(directory, stream.segment, "idx").c_str(), "wb");
+
+    if(stream.log && stream.index)
+        return true;
+
+    KLOG_WARNING(UI, "Could not open chat log segment %li in %s.", stream.segment, directory.c_str());
+
+    stream.failed = true;
+
+    if(stream.log)
+        fclose(stream.log);
+    if(stream.index)
+        fclose(stream.index);
+    stream.log = nullptr;
+    stream.index = nullptr;
+    return false;
+}
+
+
+static void WriteQueued(Queued &line, std::vector<std::shared_ptr<Stream> > &dirty, std::vector<std::shared_ptr<Stream> > &open){
+
+    Stream &stream = *line.stream;
+
+    if(line.release){
+        FinishSegment(stream);
+        return;
+    }
+
+    if(((!stream.log) || (stream.log_size>=SegmentSize)) && (!StartSegment(stream)))
+        return;
+
+    if(!stream.open){
+        stream.open = true;
+        open.push_back(line.stream);
+    }
+
+    const Entry entry = {static_cast<unsigned long long>(line.time), stream.log_size};
+
+    fputs(line.from.c_str(), stream.log);
+    fputc('\t', stream.log);
+    fputs(line.text.c_str(), stream.log);
+    fputc('\n', stream.log);
+    stream.log_size+=line.from.size()+line.text.size()+2;
+
+    fwrite(&entry, sizeof(Entry), 1, stream.index);
+
+    stream.terms.Add(line.from.c_str(), line.text.c_str());
+
+    if(!stream.dirty){
+        stream.dirty = true;
+        dirty.push_back(line.stream);
+    }
+}
+
+
+static void SyncAll(std::vector<std::shared_ptr<Stream> > &dirty){
+    for(std::vector<std::shared_ptr<Stream> >::iterator i = dirty.begin(); i!=dirty.end(); i++){
+        Stream &stream = **i;
+        // The log first, so that the index never points past it on disk.
+        if(stream.log)
+            Kashyyyk_SyncFile(stream.log);
+        if(stream.index)
+            Kashyyyk_SyncFile(stream.index);
+        stream.dirty = false;
+    }
+    dirty.clear();
+}
+
+
+static void WriterThread(){
+
+    std::vector<Queued> batch;
+    std::vector<std::shared_ptr<Stream> > dirty, open;
+    unsigned long long reported_drops = 0;
+    long long last_sync = NowMilliseconds();
+    unsigned idle = 0;
+
+    {
+        std::vector<std::string> names;
+        ListStreams(names);
+        listed.insert(names.begin(), names.end());
+    }
+
+    while(true){
+
+        // Read before taking the queue, so that nothing queued before Close
+        // can be left behind.
+        const bool stopping = !running.load();
+
+        {
+            std::lock_guard<std::mutex> guard(queue_mutex);
+            batch.swap(queue);
+        }
+
+        for(std::vector<Queued>::iterator i = batch.begin(); i!=batch.end(); i++)
+            WriteQueued(*i, dirty, open);
+
+        const long long now = NowMilliseconds();
+
+        if((!dirty.empty()) && (stopping || (now-last_sync>=sync_interval))){
+            SyncAll(dirty);
+            last_sync = now;
+        }
+
+        // Released streams are done with. Their files are already closed.
+        for(std::vector<std::shared_ptr<Stream> >::iterator i = open.begin(); i!=open.end();){
+            if((*i)->log==nullptr){
+                (*i)->open = false;
+                i = open.erase(i);
+            }
+            else
+                i++;
+        }
+
+        const unsigned long long drops = dropped.load(std::memory_order_relaxed);
+        if(drops!=reported_drops){
+            KLOG_WARNING(UI, "Chat log dropped %llu lines.", drops-reported_drops);
+            reported_drops = drops;
+        }
+
+        if(!batch.empty()){
+            batch.clear();
+            idle = 0;
+            continue;
+        }
+
+        if(stopping){
+            for(std::vector<std::shared_ptr<Stream> >::iterator i = open.begin(); i!=open.end(); i++)
+                FinishSegment(**i);
+            break;
+        }
+
+        // Same backoff as the log writer. A burst is picked up within 32ms.
+        if(idle<5)
+            idle++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1<<idle));
+    }
+}
+
+
+void Init(const std::string &directory, unsigned sync_interval_ms){
+
+    base_directory = directory;
+    sync_interval = sync_interval_ms;
+
+    running = true;
+    writer = new std::thread(WriterThread);
+
+}
+
+
+void Close(){
+
+    if(writer==nullptr)
+        return;
+
+    running = false;
+    writer->join();
+    delete writer;
+    writer = nullptr;
+
+}
+
+
+std::shared_ptr<Stream> Open(const std::string &server, const std::string &channel){
+
+    if(!running.load())
+        return std::shared_ptr<Stream>();
+
+    return std::make_shared<Stream>(SafeName(server), SafeName(channel));
+
+}
+
+
+void Append(const std::shared_ptr<Stream> &stream, const char *from, const char *text){
+
+    if(!stream)
+        return;
+
+    Queued line = {stream, NowMilliseconds(), from, text, false};
+
+    std::lock_guard<std::mutex> guard(queue_mutex);
+
+    if(queue.size()>=MaxQueued){
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    queue.push_back(std::move(line));
+
+}
+
+
+void Release(const std::shared_ptr<Stream> &stream){
+
+    if(!stream)
+        return;
+
+    Queued end = {stream, 0, std::string(), std::string(), true};
+
+    // Never dropped, so that the segment is always finished.
+    std::lock_guard<std::mutex> guard(queue_mutex);
+    queue.push_back(std::move(end));
+
+}
+
+
+Segment::Segment(const std::string &directory, long number)
+  : index(Kashyyyk_MapFile(SegmentPath(directory, number, "idx").c_str()))
+  , log(Kashyyyk_MapFile(SegmentPath(directory, number, "log").c_str()))
+  , entries(nullptr)
+  , size(0){
+
+    if(index && log){
+        entries = reinterpret_cast<const Entry *>(Kashyyyk_MappedData(index));
+
+        // A partly written entry, or entries for lines that never reached
+        // the log, are left off.
+        const unsigned long long log_size = Kashyyyk_MappedSize(log);
+        size = Kashyyyk_MappedSize(index)/sizeof(Entry);
+        while((size>0) && (entries[size-1].offset>=log_size))
+            size--;
+    }
+
+}
+
+
+Segment::~Segment(){
+    if(index)
+        Kashyyyk_UnmapFile(index);
+    if(log)
+        Kashyyyk_UnmapFile(log);
+}
+
+
+void Segment::Read(unsigned long line, Line &out) const {
+
+    const char *const data = Kashyyyk_MappedData(log);
+    const unsigned long long log_size = Kashyyyk_MappedSize(log);
+
+    const char *const start = data+entries[line].offset;
+    const char *end = static_cast<const char *>(memchr(start, '\n', log_size-entries[line].offset));
+    if(end==nullptr)
+        end = data+log_size;
+
+    const char *tab = static_cast<const char *>(memchr(start, '\t', end-start));
+    if(tab==nullptr)
+        tab = start;
+
+    out.time = Time(line);
+    out.from.assign(start, tab-start);
+    out.text.assign((tab==start)?start:(tab+1), end);
+}
+
+
+unsigned ReadBefore(Position &first, unsigned n, std::vector<Line> &out){
+
+    // Each segment's lines are read oldest first, newest segment first, so
+    // the segments are put back in order at the end.
+    std::vector<std::vector<Line> > segments;
+    unsigned read = 0;
+
+    while(n>0){
+
+        if(first.line==0){
+            if((first.segment<=0) || (!SegmentExists(first.directory, first.segment-1)))
+                break;
+
+            const Segment previous(first.directory, first.segment-1);
+            first.segment--;
+            first.line = previous.Size();
+            continue;
+        }
+
+        const Segment segment(first.directory, first.segment);
+        const unsigned long last = std::min(first.line, segment.Size());
+        const unsigned long start = (last>n)?(last-n):0;
+
+        segments.push_back(std::vector<Line>(last-start));
+        for(unsigned long i = start; i<last; i++)
+            segment.Read(i, segments.back()[i-start]);
+
+        n-=last-start;
+        read+=last-start;
+        first.line = start;
+    }
+
+    for(std::vector<std::vector<Line> >::reverse_iterator i = segments.rbegin(); i!=segments.rend(); i++)
+        out.insert(out.end(), i->begin(), i->end());
+
+    return read;
+}
+
+
+unsigned ReadAfter(Position &last, unsigned n, std::vector<Line> &out){
+
+    unsigned read = 0;
+
+    while(n>0){
+
+        const Segment segment(last.directory, last.segment);
+
+        if(last.line>=segment.Size()){
+            if(!SegmentExists(last.directory, last.segment+1))
+                break;
+
+            last.segment++;
+            last.line = 0;
+            continue;
+        }
+
+        const unsigned long end = std::min<unsigned long>(segment.Size(), last.line+n);
+
+        for(unsigned long i = last.line; i<end; i++){
+            out.push_back(Line());
+            segment.Read(i, out.back());
+        }
+
+        n-=end-last.line;
+        read+=end-last.line;
+        last.line = end;
+    }
+
+    return read;
+}
+
+
+void Tail(const std::shared_ptr<Stream> &stream, unsigned n, std::vector<Line> &out){
+
+    if(!stream)
+        return;
+
+    const std::string directory = StreamDirectory(*stream);
+
+    // The place after the newest segment's last line.
+    Position end = {directory, NewestSegment(directory)+1, 0};
+    ReadBefore(end, n, out);
+
+}
+
+}
+}
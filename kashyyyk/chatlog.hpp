@@ -0,0 +1,164 @@
+#pragma once
+
+//! @file
+//! @brief Persistent, append-only chat history.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Every Channel's lines go to its own directory, `logs/server/channel` under
+//! the config directory. A directory holds numbered segments, each a pair of
+//! files: `N.log` with one "from\ttext\n" line per message, and `N.idx` with a
+//! fixed size Entry per line giving its time and where it starts in `N.log`.
+//! Segments are only ever appended to. A new one is started for every session
+//! and whenever the current one gets large.
+//!
+//! Append only copies the line into a queue. A single background thread
+//! writes the queue out and syncs the files to disk at most every
+//! `sys.chatlog.sync.interval` milliseconds, so no network or UI thread ever
+//! waits on the disk. If the queue gets too long, lines are dropped and
+//! counted instead of blocking.
+//!
+//! Tail maps the newest segments and uses their indices to pick out the last
+//! lines directly, without reading anything before them.
+//!
+//! The writer also keeps a term index of each segment as it goes, and writes
+//! it out as `N.fts` when the segment is finished. See search.hpp.
+
+#include <string>
+#include <vector>
+#include <memory>
+
+struct Kashyyyk_MappedFile;
+
+namespace Kashyyyk {
+namespace ChatLog {
+
+//! @brief One line of history.
+struct Line {
+    //! Milliseconds since the epoch.
+    long long time;
+    std::string from;
+    std::string text;
+};
+
+//! @brief What an index file is made of. Native byte order.
+struct Entry {
+    //! Milliseconds since the epoch.
+    unsigned long long time;
+    //! Where the line starts in the segment's log file.
+    unsigned long long offset;
+};
+
+//! @brief History of one Channel. Opaque outside of chatlog.cpp.
+class Stream;
+
+//! @brief A point between two lines of a stream's history.
+//!
+//! Refers to the place just before line @p line of segment @p segment. The
+//! place after the last line of a segment is the same as the place before
+//! the first line of the next one, and both may be used.
+struct Position {
+    //! Directory of the stream, from StreamDirectory.
+    std::string directory;
+    long segment;
+    unsigned long line;
+};
+
+//! @brief A read only view of one segment, as it was when it was opened.
+class Segment {
+    Kashyyyk_MappedFile *index, *log;
+    const Entry *entries;
+    unsigned long size;
+
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+public:
+    Segment(const std::string &directory, long number);
+    ~Segment();
+
+    //! False if the segment doesn't exist or is empty.
+    bool Good() const {return size!=0;}
+
+    //! Number of whole lines in the segment.
+    unsigned long Size() const {return size;}
+
+    //! Time of line @p line, in milliseconds since the epoch.
+    long long Time(unsigned long line) const {
+        return static_cast<long long>(entries[line].time);
+    }
+
+    //! Reads line @p line into @p out.
+    void Read(unsigned long line, Line &out) const;
+};
+
+//! @brief Starts the writer thread.
+//!
+//! Must be called once, on the main thread, before any Stream is opened.
+//! Until then, and after Close, Open returns an empty pointer.
+//! @param directory Directory that the `logs` directory goes in.
+//! @param sync_interval_ms Longest time written lines may wait for a sync.
+void Init(const std::string &directory, unsigned sync_interval_ms);
+
+//! @brief Writes out and syncs everything that is queued and stops the
+//! writer thread.
+void Close();
+
+//! @brief Directory that every stream's directory is in. Empty until Init
+//! is called.
+std::string Directory();
+
+//! @brief Returns the name that the history of @p channel on @p server is
+//! kept under, as "server/channel" with both parts made safe for the file
+//! system.
+std::string StreamName(const std::string &server, const std::string &channel);
+
+//! @brief Returns the directory of the stream named @p name.
+std::string StreamDirectory(const std::string &name);
+
+//! @brief Puts the name of every stream that has ever been written onto the
+//! end of @p out.
+void ListStreams(std::vector<std::string> &out);
+
+//! @brief Returns the path of one file of a segment. @p extension is "log",
+//! "idx" or "fts".
+std::string SegmentPath(const std::string &directory, long segment, const char *extension);
+
+//! @brief Returns the newest segment in @p directory, or -1 if there are none.
+long NewestSegment(const std::string &directory);
+
+//! @brief Returns the Stream for @p channel on @p server.
+//!
+//! Nothing touches the disk until the first line is appended. Channel names
+//! are casefolded, so "#Chan" and "#chan" share a history.
+//! Returns an empty pointer if Init has not been called.
+std::shared_ptr<Stream> Open(const std::string &server, const std::string &channel);
+
+//! @brief Queues a line to be written. Never waits on the disk.
+//! Safe to use from any thread.
+void Append(const std::shared_ptr<Stream> &stream, const char *from, const char *text);
+
+//! @brief Queues the end of @p stream's current segment.
+//!
+//! Call when nothing more will be appended, so that the writer closes the
+//! files and writes out the segment's term index right away instead of
+//! waiting for Close.
+void Release(const std::shared_ptr<Stream> &stream);
+
+//! @brief Reads up to @p n lines before @p first, oldest first, onto the end
+//! of @p out, and moves @p first back past them. Returns how many it read.
+unsigned ReadBefore(Position &first, unsigned n, std::vector<Line> &out);
+
+//! @brief Reads up to @p n lines after @p last onto the end of @p out, and
+//! moves @p last forward past them. Returns how many it read.
+unsigned ReadAfter(Position &last, unsigned n, std::vector<Line> &out);
+
+//! @brief Reads up to the last @p n lines of @p stream that are on disk,
+//! oldest first, onto the end of @p out.
+//!
+//! Meant for filling in scrollback when a Channel is created, before it
+//! appends anything itself.
+void Tail(const std::shared_ptr<Stream> &stream, unsigned n, std::vector<Line> &out);
+
+}
+}
@@ -0,0 +1,58 @@
+#include "highlight.hpp"
+#include "highlight.h"
+
+#include <cstring>
+
+namespace Kashyyyk {
+
+Highlighter::Highlighter()
+  : matcher(IRC_CreateHighlighter(nullptr)){
+
+}
+
+
+Highlighter::~Highlighter(){
+    IRC_DestroyHighlighter(matcher);
+}
+
+
+void Highlighter::Compile(const std::vector<std::string> &words, const unsigned char *fold){
+
+    // The fold table is fixed when the matcher is created.
+    IRC_DestroyHighlighter(matcher);
+    matcher = IRC_CreateHighlighter(fold);
+
+    long id = 0;
+    for(std::vector<std::string>::const_iterator i = words.cbegin(); i!=words.cend(); i++, id++){
+        const char *word = i->c_str();
+        unsigned long len = i->size();
+        unsigned flags = IRC_HIGHLIGHT_WORD;
+
+        if((len>0) && (word[0]=='*')){
+            flags&=~IRC_HIGHLIGHT_WORD_START;
+            word++;
+            len--;
+        }
+        if((len>0) && (word[len-1]=='*')){
+            flags&=~IRC_HIGHLIGHT_WORD_END;
+            len--;
+        }
+
+        IRC_HighlighterAdd(matcher, word, len, flags, id);
+    }
+
+    IRC_HighlighterCompile(matcher);
+
+}
+
+
+bool Highlighter::Matches(const char *text, unsigned long len) const{
+    return IRC_HighlighterScan(matcher, text, len, nullptr)!=0;
+}
+
+
+bool Highlighter::Matches(const char *text) const{
+    return Matches(text, strlen(text));
+}
+
+}
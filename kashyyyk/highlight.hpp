@@ -0,0 +1,52 @@
+#pragma once
+
+//! @file
+//! @brief Definition of @link Kashyyyk::Highlighter @endlink
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! A C++ face for the libfjirc highlight matcher in highlight.h.
+
+#include <string>
+#include <vector>
+
+struct IRC_Highlighter;
+
+namespace Kashyyyk {
+
+//!
+//! @brief Finds any of a set of highlight words in a line of text
+//!
+//! All of the words are compiled into one automaton, so a line is scanned
+//! once however many words there are. Words are matched ignoring case.
+//!
+//! A word only matches on its own, not as part of a longer nick or word.
+//! A '*' at the start or end of a word lifts that rule for that end, so
+//! "kash*" matches "Kashyyyk" and "*bot" matches "helperbot".
+//!
+//! A Highlighter is not locked. Its owner must serialize its use.
+class Highlighter {
+    IRC_Highlighter *matcher;
+
+public:
+    Highlighter();
+    ~Highlighter();
+
+    Highlighter(const Highlighter &) = delete;
+    Highlighter &operator=(const Highlighter &) = delete;
+
+    //! @brief Replaces the words with @p words, and compiles them.
+    //!
+    //! @param words Words to match. Empty words are ignored.
+    //! @param fold Lowercase form of every byte, or nullptr for RFC 1459.
+    void Compile(const std::vector<std::string> &words, const unsigned char *fold = nullptr);
+
+    //! Returns true if any word is in the first @p len bytes of @p text.
+    bool Matches(const char *text, unsigned long len) const;
+    //! @overload
+    bool Matches(const char *text) const;
+
+};
+
+}
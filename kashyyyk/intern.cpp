@@ -0,0 +1,82 @@
+#include "intern.hpp"
+#include "intern.h"
+
+#include <cstring>
+
+namespace Kashyyyk {
+
+Interned::Interned(const Interned &other)
+  : table(other.table)
+  , handle(other.handle){
+    if(handle!=nullptr)
+        IRC_InternRetain(table->table, handle);
+}
+
+
+Interned::~Interned(){
+    if(handle!=nullptr)
+        IRC_InternRelease(table->table, handle);
+}
+
+
+const char *Interned::c_str() const{
+    return (handle!=nullptr)?IRC_InternString(handle):"";
+}
+
+
+unsigned long Interned::size() const{
+    return (handle!=nullptr)?IRC_InternLength(handle):0;
+}
+
+
+void InternTable::Lock(void *p){
+    static_cast<Monitor *>(p)->Lock();
+}
+
+
+void InternTable::Unlock(void *p){
+    static_cast<Monitor *>(p)->Unlock();
+}
+
+
+InternTable::InternTable()
+  : table(IRC_CreateInternTable(Lock, Unlock, &monitor)){
+
+}
+
+
+InternTable::~InternTable(){
+    IRC_DestroyInternTable(table);
+}
+
+
+Interned InternTable::Intern(const char *s, unsigned long len){
+    return Interned(this, IRC_Intern(table, s, len));
+}
+
+
+Interned InternTable::Intern(const char *s){
+    return Intern(s, strlen(s));
+}
+
+
+Interned InternTable::Find(const char *s, unsigned long len){
+    return Interned(this, IRC_InternFind(table, s, len));
+}
+
+
+Interned InternTable::Find(const char *s){
+    return Find(s, strlen(s));
+}
+
+
+void InternTable::SetCaseMapping(const unsigned char fold[256]){
+    IRC_InternSetCaseMapping(table, fold);
+}
+
+
+unsigned long InternTable::Count(){
+    return IRC_InternCount(table);
+}
+
+}
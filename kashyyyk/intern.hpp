@@ -0,0 +1,127 @@
+#pragma once
+
+//! @file
+//! @brief Definition of @link Kashyyyk::InternTable @endlink and
+//! @link Kashyyyk::Interned @endlink
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! A C++ face for the libfjirc intern table in intern.h. Each Server has its
+//! own InternTable, and its Channels keep User nicks and their own names as
+//! Interned handles, so that comparing two names is comparing two pointers.
+
+#include "monitor.hpp"
+#include <string>
+#include <utility>
+
+struct IRC_InternTable;
+struct IRC_Interned;
+
+namespace Kashyyyk {
+
+class InternTable;
+
+//!
+//! @brief A reference counted handle to an interned string
+//!
+//! Two Interneds from the same InternTable are equal if and only if their
+//! strings are equal ignoring case, as the table's casemapping folds it. An Interned can be empty, which
+//! is only equal to other empty Interneds.
+//!
+//! Copying and destroying an Interned locks its table, and it must not
+//! outlive the table.
+class Interned {
+    InternTable *table;
+    const IRC_Interned *handle;
+
+    friend class InternTable;
+    Interned(InternTable *t, const IRC_Interned *h)
+      : table(t)
+      , handle(h){}
+
+public:
+
+    Interned()
+      : table(nullptr)
+      , handle(nullptr){}
+
+    Interned(const Interned &other);
+    Interned(Interned &&other)
+      : table(other.table)
+      , handle(other.handle){
+        other.handle = nullptr;
+    }
+
+    ~Interned();
+
+    Interned &operator=(Interned other){
+        std::swap(table, other.table);
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    bool operator==(const Interned &other) const {return handle==other.handle;}
+    bool operator!=(const Interned &other) const {return handle!=other.handle;}
+
+    //! Returns true if this is not empty.
+    explicit operator bool() const {return handle!=nullptr;}
+
+    //! The string, spelled as it was first interned. Empty if this is empty.
+    const char *c_str() const;
+    //! Length of the string.
+    unsigned long size() const;
+    //! Returns the string as a std::string.
+    std::string str() const {return std::string(c_str(), size());}
+
+    //! The raw handle, usable as a key. Only valid while this Interned is.
+    const IRC_Interned *Handle() const {return handle;}
+
+};
+
+
+//!
+//! @brief A thread safe table of interned strings
+//!
+//! @sa Kashyyyk::Interned
+class InternTable {
+    Monitor monitor;
+    IRC_InternTable *const table;
+
+    static void Lock(void *p);
+    static void Unlock(void *p);
+
+    friend class Interned;
+
+public:
+    InternTable();
+    ~InternTable();
+
+    //! Returns a handle for the first @p len characters of @p s, adding
+    //! them to the table if need be.
+    Interned Intern(const char *s, unsigned long len);
+    //! @overload
+    Interned Intern(const char *s);
+    //! @overload
+    Interned Intern(const std::string &s){return Intern(s.c_str(), s.size());}
+
+    //! Returns a handle for @p s if it is already in the table, or an empty
+    //! handle if it is not. This never adds anything, so it is the cheap way
+    //! to ask if a name belongs to anything we know about.
+    Interned Find(const char *s, unsigned long len);
+    //! @overload
+    Interned Find(const char *s);
+    //! @overload
+    Interned Find(const std::string &s){return Find(s.c_str(), s.size());}
+
+    //! Starts comparing names by @p fold, which gives the lowercase form of
+    //! every byte. Existing Interneds stay valid.
+    //! @sa IRC_InternSetCaseMapping
+    void SetCaseMapping(const unsigned char fold[256]);
+
+    //! Number of distinct strings in the table.
+    unsigned long Count();
+
+};
+
+}
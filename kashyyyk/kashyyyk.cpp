@@ -1,10 +1,15 @@
 #include "window.hpp"
 #include "background.hpp"
-#include "networkwatch.hpp"
+#include "shards.hpp"
 #include "prefs.hpp"
+#include "settings.hpp"
 #include "launcher.hpp"
+#include "metricswindow.hpp"
+#include "log.hpp"
+#include "chatlog.hpp"
 #include "platform/notification.h"
 #include "platform/init.h"
+#include "platform/paths.h"
 
 #include <stack>
 #include <string>
@@ -58,13 +63,74 @@ void GetDefaultServers(std::stack<std::string> &default_servers, Fl_Preferences
 
 }
 
-void SetTheme(Fl_Preferences &prefs){
+void ThemeChanged_CB(const Kashyyyk::Settings &old_settings, const Kashyyyk::Settings &new_settings, void *p){
+    if(old_settings.theme!=new_settings.theme)
+      Kashyyyk::LoadScheme(new_settings.theme.c_str());
+}
+
+void SetTheme(){
+    Kashyyyk::LoadScheme(Kashyyyk::GetSettings().theme.c_str());
+    Kashyyyk::AddSettingsCallback(ThemeChanged_CB, nullptr);
+}
+
+void StartLogging(Fl_Preferences &prefs){
+
+    int level = Kashyyyk::Log::Warning;
+    int console = 0;
+    char *subsystems = nullptr;
+
+    prefs.get("sys.log.level", level, level);
+    prefs.get("sys.log.console", console, console);
+    prefs.get("sys.log.subsystems", subsystems, "all");
+
+    if(level<Kashyyyk::Log::None)
+      level = Kashyyyk::Log::None;
+    if(level>Kashyyyk::Log::Debug)
+      level = Kashyyyk::Log::Debug;
+
+    Kashyyyk::Log::Init(static_cast<Kashyyyk::Log::Level>(level),
+      Kashyyyk::Log::ParseSubsystems(subsystems), console!=0);
 
-    char *theme = nullptr;
-    prefs.get("sys.appearance.theme", theme, "gtk+");
+    free(subsystems);
 
-    Kashyyyk::LoadScheme(theme);
-    free(theme);
+#if KASHYYYK_LOG_LEVEL >= 3
+    const char *config_directory = Kashyyyk_ConfigDirectory();
+    KLOG_INFO(Prefs, "Using config directory %s.", config_directory);
+    free((void *)config_directory);
+#endif
+}
+
+
+void StartChatLog(Fl_Preferences &prefs){
+
+    int enabled = 1;
+    int interval = 1000;
+
+    prefs.get("sys.chatlog.enabled", enabled, enabled);
+    prefs.get("sys.chatlog.sync.interval", interval, interval);
+
+    if(!enabled)
+      return;
+
+    if(interval<0)
+      interval = 0;
+
+    const char *config_directory = Kashyyyk_ConfigDirectory();
+    Kashyyyk::ChatLog::Init(config_directory, interval);
+    free((void *)config_directory);
+}
+
+
+void StartShards(Fl_Preferences &prefs){
+
+    int shards = 0;
+
+    prefs.get("sys.network.shards", shards, shards);
+
+    if(shards<0)
+      shards = 0;
+
+    Kashyyyk::Shards::Init(shards);
 }
 
 
@@ -76,6 +142,11 @@ int main(int argc, char *argv[]){
 
     Fl_Preferences &prefs = Kashyyyk::GetPreferences();
 
+    StartLogging(prefs);
+    StartChatLog(prefs);
+    Kashyyyk::ReloadSettings();
+    StartShards(prefs);
+
     std::unique_ptr<Kashyyyk::Thread::TaskGroup, void(*)(Kashyyyk::Thread::TaskGroup*)>
       group(Kashyyyk::Thread::CreateTaskGroup(), Kashyyyk::Thread::DestroyTaskGroup);
 
@@ -129,12 +200,12 @@ int main(int argc, char *argv[]){
 
     }
 
-    SetTheme(prefs);
+    SetTheme();
+
+    Kashyyyk::StartMetricsDump();
 
     Fl::lock();
 
-    Kashyyyk::NetworkWatch watch(Kashyyyk::Thread::GetShortThreadPool());
-    Kashyyyk::Thread::AddWatchToTaskGroup(&watch, Kashyyyk::Thread::GetShortThreadPool());
     {
         Kashyyyk::Thread thread1(Kashyyyk::Thread::GetShortThreadPool());
 
@@ -146,6 +217,12 @@ int main(int argc, char *argv[]){
         
         Kashyyyk::Close();
     }
+
+    Kashyyyk::Shards::Close();
+
+    Kashyyyk::ChatLog::Close();
+    Kashyyyk::Log::Close();
+
     return EXIT_SUCCESS;
 
 }
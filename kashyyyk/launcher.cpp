@@ -4,6 +4,7 @@
 #include "prefs.hpp"
 #include "background.hpp"
 #include "serverlist.hpp"
+#include "log.hpp"
 #include <cstdlib>
 #include <cassert>
 #include <forward_list>
@@ -323,7 +324,7 @@ void Launcher::Release(Window *window_check){
         if(*iter_at == window_check){
             guts->windows.erase_after(iter_last);
 
-            printf("Released window at %i.\n", i);
+            KLOG_DEBUG(UI, "Released window at %i.", i);
             deleted = true;
 
             break;
@@ -332,7 +333,7 @@ void Launcher::Release(Window *window_check){
     }
 
     if(!deleted)
-        printf("No Window released!\n");
+        KLOG_WARNING(UI, "No Window released!");
 
 }
 
@@ -0,0 +1,275 @@
+#include "log.hpp"
+#include "platform/shortlog.h"
+#include "message.h"
+#include "socket.h"
+
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <ctime>
+#include <string>
+
+namespace Kashyyyk {
+namespace Log {
+
+// Zero initialized, so that nothing is enabled before Init.
+std::atomic<unsigned> enabled[Debug+1];
+
+// Bounded multi-producer queue, after Dmitry Vyukov's. Each slot's sequence
+// tells whose turn it is: a producer may claim the slot when the sequence is
+// equal to its ticket, and the writer may take it when it is one more.
+static const unsigned long RingSize = 1024;
+static const unsigned LineLength = 256;
+
+struct Slot {
+    std::atomic<unsigned long> sequence;
+    Subsystem subsystem;
+    Level level;
+    time_t time;
+    char text[LineLength];
+};
+
+static Slot ring[RingSize];
+static std::atomic<unsigned long> enqueue_position(0);
+// Only ever touched by the writer thread.
+static unsigned long dequeue_position = 0;
+
+static std::atomic<unsigned long long> dropped(0);
+static std::atomic<bool> running(false);
+static bool echo = false;
+static std::thread *writer = nullptr;
+
+
+struct SubsystemName {
+    const char *name;
+    Subsystem subsystem;
+};
+
+static const SubsystemName subsystem_names[] = {
+    {"irc", IRC},
+    {"net", Net},
+    {"server", Server},
+    {"channel", Channel},
+    {"prefs", Prefs},
+    {"ui", UI},
+    {"task", Task},
+    {"all", All},
+};
+
+
+static const char *GetSubsystemName(Subsystem subsystem){
+    for(const SubsystemName &s : subsystem_names)
+        if(s.subsystem==subsystem)
+            return s.name;
+    return "?";
+}
+
+
+static const char *GetLevelName(Level level){
+    switch(level){
+        case Error:
+            return "error";
+        case Warning:
+            return "warning";
+        case Info:
+            return "info";
+        case Debug:
+            return "debug";
+        case None:
+        default:
+        ;
+    }
+    return "?";
+}
+
+
+static void WriteLine(const char *line){
+    Kashyyyk_ShortLog_WriteLine(line);
+    if(echo)
+        fputs(line, stderr);
+}
+
+
+// Returns false if the ring was empty.
+static bool TakeLine(){
+
+    Slot &slot = ring[dequeue_position%RingSize];
+
+    if(slot.sequence.load(std::memory_order_acquire)!=dequeue_position+1)
+        return false;
+
+    char stamp[16] = "";
+    struct tm *t = localtime(&slot.time);
+    if(t)
+        strftime(stamp, sizeof(stamp), "%H:%M:%S", t);
+
+    char line[LineLength+64];
+    snprintf(line, sizeof(line), "%s [%s] %s: %s\n", stamp,
+        GetLevelName(slot.level), GetSubsystemName(slot.subsystem), slot.text);
+
+    // Hand the slot back to the producers before the slow part.
+    slot.sequence.store(dequeue_position+RingSize, std::memory_order_release);
+    dequeue_position++;
+
+    WriteLine(line);
+    return true;
+}
+
+
+static void WriterThread(){
+
+    unsigned long long reported_drops = 0;
+    unsigned idle = 0;
+
+    while(true){
+
+        if(TakeLine()){
+            idle = 0;
+            continue;
+        }
+
+        const unsigned long long drops = dropped.load(std::memory_order_relaxed);
+        if(drops!=reported_drops){
+            char line[64];
+            snprintf(line, sizeof(line), "[warning] log: dropped %llu lines\n", drops-reported_drops);
+            WriteLine(line);
+            reported_drops = drops;
+        }
+
+        if(!running.load())
+            break;
+
+        // Monitor has no timed wait, so just back off while nothing is being
+        // logged. A burst is picked up within 32ms at worst.
+        if(idle<5)
+            idle++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1<<idle));
+    }
+}
+
+
+static void IRCLogger(enum IRC_logLevel level, const char *fmt, va_list args){
+    WriteV(IRC, static_cast<Level>(level), fmt, args);
+}
+
+
+static void NetLogger(enum WSockLogLevel level, const char *fmt, va_list args){
+    WriteV(Net, static_cast<Level>(level), fmt, args);
+}
+
+
+void Init(Level level, unsigned subsystems, bool console){
+
+    for(unsigned long i = 0; i<RingSize; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+
+    echo = console;
+
+    for(unsigned i = Error; i<=Debug; i++)
+        enabled[i].store((i<=static_cast<unsigned>(level))?subsystems:0);
+
+    IRC_SetLogger(IRCLogger, (subsystems & IRC)?static_cast<IRC_logLevel>(level):IRC_log_none);
+    SetLogger_Socket(NetLogger, (subsystems & Net)?static_cast<WSockLogLevel>(level):eLogNone);
+
+    running = true;
+    writer = new std::thread(WriterThread);
+
+}
+
+
+void Close(){
+
+    if(writer==nullptr)
+        return;
+
+    IRC_SetLogger(nullptr, IRC_log_none);
+    SetLogger_Socket(nullptr, eLogNone);
+
+    for(unsigned i = Error; i<=Debug; i++)
+        enabled[i].store(0);
+
+    running = false;
+    writer->join();
+    delete writer;
+    writer = nullptr;
+
+}
+
+
+unsigned ParseSubsystems(const char *names){
+
+    unsigned mask = 0;
+    std::string name;
+
+    do{
+        if((*names==',') || (*names=='\0')){
+            for(const SubsystemName &s : subsystem_names)
+                if(name==s.name)
+                    mask|=s.subsystem;
+            name.clear();
+        }
+        else if(!isspace(*names))
+            name.push_back(tolower(*names));
+    }while(*(names++)!='\0');
+
+    return mask;
+}
+
+
+void Write(Subsystem subsystem, Level level, const char *fmt, ...){
+    va_list args;
+    va_start(args, fmt);
+    WriteV(subsystem, level, fmt, args);
+    va_end(args);
+}
+
+
+void WriteV(Subsystem subsystem, Level level, const char *fmt, va_list args){
+
+    if(!Enabled(subsystem, level))
+        return;
+
+    unsigned long position = enqueue_position.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    while(true){
+        slot = ring+(position%RingSize);
+        const long difference = static_cast<long>(slot->sequence.load(std::memory_order_acquire)-position);
+
+        if(difference==0){
+            if(enqueue_position.compare_exchange_weak(position, position+1, std::memory_order_relaxed))
+                break;
+        }
+        else if(difference<0){
+            // The writer is a whole ring behind. Don't wait for it.
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+            position = enqueue_position.load(std::memory_order_relaxed);
+    }
+
+    vsnprintf(slot->text, LineLength, fmt, args);
+
+    // Drop any trailing newlines, since the writer adds its own.
+    size_t len = strlen(slot->text);
+    while((len>0) && ((slot->text[len-1]=='\n') || (slot->text[len-1]=='\r')))
+        slot->text[--len] = '\0';
+
+    slot->subsystem = subsystem;
+    slot->level = level;
+    slot->time = time(nullptr);
+
+    slot->sequence.store(position+1, std::memory_order_release);
+
+}
+
+
+unsigned long long Dropped(){
+    return dropped.load(std::memory_order_relaxed);
+}
+
+}
+}
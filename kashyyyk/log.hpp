@@ -0,0 +1,116 @@
+#pragma once
+
+//! @file
+//! @brief Leveled, asynchronous logging.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! A line is formatted on the calling thread straight into a slot of a fixed
+//! size, lock-free ring. A single background thread takes lines out of the
+//! ring and hands them to Kashyyyk_ShortLog_WriteLine, so that no network or
+//! UI thread ever waits on the disk. If the ring is full the line is dropped
+//! and counted instead of blocking.
+//!
+//! The KLOG_* macros remove every level less severe than KASHYYYK_LOG_LEVEL at
+//! compile time, arguments included. Levels that are compiled in can still be
+//! turned off per Subsystem at runtime, which costs a single relaxed load.
+//!
+//! libfjirc and libfjnet log through the IRC and Net subsystems once Init has
+//! been called.
+
+#include <atomic>
+#include <cstdarg>
+
+//! 0 removes all logging, 1 keeps only errors, up to 4 for debug.
+#ifndef KASHYYYK_LOG_LEVEL
+#define KASHYYYK_LOG_LEVEL 4
+#endif
+
+namespace Kashyyyk {
+namespace Log {
+
+//! @brief Severity of a line. These match IRC_logLevel and WSockLogLevel.
+enum Level {None, Error, Warning, Info, Debug};
+
+//! @brief Part of the client a line comes from. Used as a bitmask.
+enum Subsystem {
+    IRC     = 1<<0,
+    Net     = 1<<1,
+    Server  = 1<<2,
+    Channel = 1<<3,
+    Prefs   = 1<<4,
+    UI      = 1<<5,
+    Task    = 1<<6,
+    All     = (1<<7)-1
+};
+
+//! Mask of enabled Subsystem bits for each Level. Use Enabled instead.
+extern std::atomic<unsigned> enabled[Debug+1];
+
+//! @brief Returns true if lines from @p subsystem at @p level are kept.
+inline bool Enabled(Subsystem subsystem, Level level){
+    return (enabled[level].load(std::memory_order_relaxed) & subsystem)!=0;
+}
+
+//! @brief Starts the writer thread and installs the library loggers.
+//!
+//! Every line at @p level or more severe from a Subsystem in @p subsystems is
+//! kept. If @p console is true, lines are also written to stderr.
+//!
+//! Must be called once, on the main thread, before anything is logged. Lines
+//! logged before Init are discarded.
+void Init(Level level, unsigned subsystems, bool console = false);
+
+//! @brief Writes out any lines still in the ring and stops the writer thread.
+void Close();
+
+//! @brief Parses a comma separated list of Subsystem names, such as
+//! "irc,server", into a mask. "all" selects every Subsystem.
+unsigned ParseSubsystems(const char *names);
+
+//! @brief Logs a printf-style line. Prefer the KLOG_* macros.
+void Write(Subsystem subsystem, Level level, const char *fmt, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+//! @brief va_list version of Write.
+void WriteV(Subsystem subsystem, Level level, const char *fmt, va_list args);
+
+//! @brief Number of lines dropped because the ring was full.
+unsigned long long Dropped();
+
+}
+}
+
+#define KLOG_WRITE(SUBSYSTEM, LEVEL, ...)\
+    do{\
+        if(Kashyyyk::Log::Enabled(Kashyyyk::Log::SUBSYSTEM, Kashyyyk::Log::LEVEL))\
+            Kashyyyk::Log::Write(Kashyyyk::Log::SUBSYSTEM, Kashyyyk::Log::LEVEL, __VA_ARGS__);\
+    }while(0)
+
+#if KASHYYYK_LOG_LEVEL >= 1
+#define KLOG_ERROR(SUBSYSTEM, ...) KLOG_WRITE(SUBSYSTEM, Error, __VA_ARGS__)
+#else
+#define KLOG_ERROR(SUBSYSTEM, ...) do{}while(0)
+#endif
+
+#if KASHYYYK_LOG_LEVEL >= 2
+#define KLOG_WARNING(SUBSYSTEM, ...) KLOG_WRITE(SUBSYSTEM, Warning, __VA_ARGS__)
+#else
+#define KLOG_WARNING(SUBSYSTEM, ...) do{}while(0)
+#endif
+
+#if KASHYYYK_LOG_LEVEL >= 3
+#define KLOG_INFO(SUBSYSTEM, ...) KLOG_WRITE(SUBSYSTEM, Info, __VA_ARGS__)
+#else
+#define KLOG_INFO(SUBSYSTEM, ...) do{}while(0)
+#endif
+
+#if KASHYYYK_LOG_LEVEL >= 4
+#define KLOG_DEBUG(SUBSYSTEM, ...) KLOG_WRITE(SUBSYSTEM, Debug, __VA_ARGS__)
+#else
+#define KLOG_DEBUG(SUBSYSTEM, ...) do{}while(0)
+#endif
@@ -1,5 +1,6 @@
 #include "message.hpp"
-#include <cstdio>
+#include "log.hpp"
+#include <string>
 
 namespace Kashyyyk{
 
@@ -38,23 +39,25 @@ const char * from_reader::operator () (const IRC_Message *m){
 
 
 bool Debug_Handler::HandleMessage(IRC_Message *msg){
-    printf("[Debug] Message type (%s) from (%s) with %li parameter", IRC_GetMessageToken(msg->type), msg->from, msg->num_parameters);
-
-    if(msg->num_parameters!=1)
-        putchar('s');
-
-    if(msg->num_parameters==0)
-        putchar('.');
-    else
-        putchar(':');
+#if KASHYYYK_LOG_LEVEL >= 4
+    // Don't bother building the parameter list if it will be thrown away.
+    if(!Log::Enabled(Log::IRC, Log::Debug))
+        return false;
 
+    std::string params;
     for(int i = 0; i<msg->num_parameters; i++){
-        if(msg->parameters[i])
-          printf("(%s) ", msg->parameters[i]);
+        if(msg->parameters[i]){
+            params+='(';
+            params+=msg->parameters[i];
+            params+=") ";
+        }
     }
 
-    putchar('\n');
-
+    KLOG_DEBUG(IRC, "Message type (%s) from (%s) with %li parameter%s%s%s",
+        IRC_GetMessageToken(msg->type), msg->from?msg->from:"",
+        msg->num_parameters, (msg->num_parameters!=1)?"s":"",
+        (msg->num_parameters==0)?".":": ", params.c_str());
+#endif
     return false;
 }
 
@@ -0,0 +1,163 @@
+#include "metrics.hpp"
+#include <cstdio>
+
+namespace Kashyyyk {
+namespace Metrics {
+
+// Both have constant initializers, so they are ready before any static
+// constructors that might register metrics are run.
+static std::atomic<ServerMetrics *> servers(nullptr);
+static std::atomic<NamedGauge *> gauges(nullptr);
+
+
+Histogram::Histogram(){
+    for(unsigned i = 0; i<NumBuckets; i++)
+        buckets[i].store(0, std::memory_order_relaxed);
+}
+
+
+void Histogram::Record(unsigned long long value){
+    unsigned bucket = 0;
+    while((value>>bucket) && (bucket<NumBuckets-1))
+        bucket++;
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.Add();
+    total.Add(value);
+}
+
+
+unsigned long long Histogram::Percentile(unsigned p) const{
+
+    const unsigned long long n = count.Get();
+    if(n==0)
+        return 0;
+
+    const unsigned long long wanted = (n*p+99)/100;
+    unsigned long long seen = 0;
+
+    for(unsigned i = 0; i<NumBuckets; i++){
+        seen+=buckets[i].load(std::memory_order_relaxed);
+        if(seen>=wanted)
+            return (i==0)?0:(1ull<<i);
+    }
+
+    return 1ull<<(NumBuckets-1);
+}
+
+
+ServerMetrics::ServerMetrics(const std::string &n)
+  : name(n)
+  , live(true)
+  , next(nullptr){
+    ping_rtt_ms.Set(-1);
+}
+
+
+NamedGauge::NamedGauge(const char *n)
+  : name(n)
+  , next(nullptr){
+
+}
+
+
+ServerMetrics *RegisterServer(const std::string &name){
+    ServerMetrics *metrics = new ServerMetrics(name);
+
+    metrics->next = servers.load();
+    while(!servers.compare_exchange_weak(metrics->next, metrics)){}
+
+    return metrics;
+}
+
+
+void RetireServer(ServerMetrics *metrics){
+    metrics->live = false;
+}
+
+
+Gauge *RegisterGauge(const char *name){
+    NamedGauge *gauge = new NamedGauge(name);
+
+    gauge->next = gauges.load();
+    while(!gauges.compare_exchange_weak(gauge->next, gauge)){}
+
+    return &(gauge->gauge);
+}
+
+
+void Dump(std::string &out){
+
+    char buffer[256];
+
+    for(NamedGauge *g = gauges.load(); g!=nullptr; g = g->next){
+        snprintf(buffer, sizeof(buffer), "%s %lld\n", g->name, g->gauge.Get());
+        out+=buffer;
+    }
+
+    for(ServerMetrics *s = servers.load(); s!=nullptr; s = s->next){
+
+        const std::string prefix = "server." + s->name + (s->live?".":" (closed).");
+
+        snprintf(buffer, sizeof(buffer),
+            "bytes_in %llu\n"
+            "bytes_out %llu\n"
+            "lines_in %llu\n"
+            "lines_out %llu\n"
+            "parse_errors %llu\n"
+            "reconnects %llu\n"
+            "ping_rtt_ms %lld\n"
+            "lag_ms %lld\n",
+            s->bytes_in.Get(), s->bytes_out.Get(), s->lines_in.Get(),
+            s->lines_out.Get(), s->parse_errors.Get(), s->reconnects.Get(),
+            s->ping_rtt_ms.Get(), s->lag_ms.Get());
+
+        // Put the prefix on every line, so that the output is easy to grep.
+        const char *line = buffer;
+        while(*line!='\0'){
+            const char *end = line;
+            while(*end!='\n')
+                end++;
+            out+=prefix;
+            out.append(line, end+1);
+            line = end+1;
+        }
+
+        const Histogram &h = s->dispatch_us;
+        snprintf(buffer, sizeof(buffer),
+            "dispatch_us count %llu mean %llu p50 %llu p90 %llu p99 %llu max %llu\n",
+            h.Count(), h.Count()?(h.Total()/h.Count()):0, h.Percentile(50),
+            h.Percentile(90), h.Percentile(99), h.Percentile(100));
+        out+=prefix;
+        out+=buffer;
+    }
+}
+
+
+bool DumpToFile(const char *path){
+
+    std::string snapshot;
+    Dump(snapshot);
+
+    // Write next to the file and then move it into place, so that something
+    // watching the file never sees half a snapshot.
+    const std::string temp = std::string(path) + ".tmp";
+
+    FILE *file = fopen(temp.c_str(), "w");
+    if(!file)
+        return false;
+
+    const bool ok = fwrite(snapshot.c_str(), 1, snapshot.size(), file)==snapshot.size();
+    fclose(file);
+
+    if(!ok)
+        return false;
+
+#ifdef _WIN32
+    remove(path);
+#endif
+    return rename(temp.c_str(), path)==0;
+}
+
+}
+}
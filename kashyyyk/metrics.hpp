@@ -0,0 +1,146 @@
+#pragma once
+
+//! @file
+//! @brief Runtime metrics, such as per-server traffic counters and dispatch
+//! latency histograms.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Everything here is lock-free, and safe to update from any thread. Updating
+//! a metric is a single relaxed atomic add, so it is fine to do on hot paths.
+//!
+//! Metrics are kept in a registry that is only ever pushed onto. A Server that
+//! goes away retires its metrics instead of removing them, so that readers
+//! never need to lock, and so that the final values can still be seen.
+
+#include <atomic>
+#include <string>
+
+namespace Kashyyyk {
+namespace Metrics {
+
+//! @brief Monotonic counter
+class Counter {
+    std::atomic<unsigned long long> value;
+public:
+    Counter()
+      : value(0){}
+
+    inline void Add(unsigned long long n = 1){
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline unsigned long long Get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+
+//! @brief Value that can go up and down, such as a queue depth
+class Gauge {
+    std::atomic<long long> value;
+public:
+    Gauge()
+      : value(0){}
+
+    inline void Set(long long n){
+        value.store(n, std::memory_order_relaxed);
+    }
+
+    inline void Add(long long n = 1){
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    inline void Sub(long long n = 1){
+        value.fetch_sub(n, std::memory_order_relaxed);
+    }
+
+    inline long long Get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+};
+
+
+//! @brief Histogram with power of two buckets.
+//!
+//! Bucket @p i counts values in [2^(i-1), 2^i), and bucket 0 counts zeroes.
+//! This is plenty to tell a 2us handler from a 2ms one.
+class Histogram {
+public:
+    static const unsigned NumBuckets = 32;
+private:
+    std::atomic<unsigned long long> buckets[NumBuckets];
+    Counter count;
+    Counter total;
+public:
+    Histogram();
+
+    void Record(unsigned long long value);
+
+    inline unsigned long long Count() const {return count.Get();}
+    inline unsigned long long Total() const {return total.Get();}
+
+    //! @brief Returns an upper bound on the @p p th percentile.
+    unsigned long long Percentile(unsigned p) const;
+};
+
+
+//! @brief Metrics for a single Server
+struct ServerMetrics {
+    ServerMetrics(const std::string &n);
+
+    //! Name of the server. Does not change after registration.
+    const std::string name;
+
+    //! False once the owning Server has been destroyed.
+    std::atomic<bool> live;
+
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter lines_in;
+    Counter lines_out;
+    //! Lines that could not be parsed (IRC_badMessage).
+    Counter parse_errors;
+    Counter reconnects;
+    //! Microseconds spent in Server::GiveMessage for each incoming message.
+    Histogram dispatch_us;
+    //! Last measured round trip time to the server, or -1 if unknown.
+    Gauge ping_rtt_ms;
+    //! How long our current PING has gone unanswered, or 0 if there is none.
+    Gauge lag_ms;
+
+    //! Next item in the registry. Set once before the item is published.
+    ServerMetrics *next;
+};
+
+
+//! @brief Named Gauge in the registry
+struct NamedGauge {
+    NamedGauge(const char *n);
+
+    //! Must be a string literal or otherwise live forever.
+    const char *const name;
+    Gauge gauge;
+    NamedGauge *next;
+};
+
+//! @brief Adds a new ServerMetrics to the registry. The result is never freed.
+ServerMetrics *RegisterServer(const std::string &name);
+
+//! @brief Marks @p metrics as belonging to a Server that no longer exists.
+void RetireServer(ServerMetrics *metrics);
+
+//! @brief Adds a new Gauge to the registry. @p name must live forever.
+Gauge *RegisterGauge(const char *name);
+
+//! @brief Appends a human readable snapshot of every metric to @p out, one
+//! metric per line.
+void Dump(std::string &out);
+
+//! @brief Writes a snapshot to @p path, replacing whatever was there.
+//! @return true on success.
+bool DumpToFile(const char *path);
+
+}
+}
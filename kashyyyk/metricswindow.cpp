@@ -0,0 +1,160 @@
+#include "metricswindow.hpp"
+#include "metrics.hpp"
+#include "background.hpp"
+#include "prefs.hpp"
+#include "socket.h"
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Browser.H>
+
+#include <string>
+#include <atomic>
+
+namespace Kashyyyk {
+
+static const double window_refresh = 1.0;
+
+static Fl_Browser *metrics_browser = nullptr;
+
+static void MetricsWindowRefresh_CB(void *p){
+
+    Fl_Window *window = static_cast<Fl_Window *>(p);
+
+    if(!window->shown())
+        return;
+
+    std::string snapshot;
+    Metrics::Dump(snapshot);
+
+    const int top = metrics_browser->topline();
+    metrics_browser->clear();
+
+    std::string::size_type start = 0, end;
+    while((end = snapshot.find('\n', start))!=std::string::npos){
+        metrics_browser->add(snapshot.substr(start, end-start).c_str());
+        start = end+1;
+    }
+
+    metrics_browser->topline(top);
+
+    Fl::repeat_timeout(window_refresh, MetricsWindowRefresh_CB, p);
+}
+
+
+void OpenMetricsWindow(){
+
+    static Fl_Double_Window *window = nullptr;
+
+    if(window==nullptr){
+        window = new Fl_Double_Window(480, 400, "Metrics");
+        metrics_browser = new Fl_Browser(0, 0, 480, 400);
+        metrics_browser->textfont(FL_COURIER);
+        // Server names are whatever the user typed, don't format them.
+        metrics_browser->format_char(0);
+        window->resizable(metrics_browser);
+        window->end();
+    }
+
+    window->show();
+
+    if(!Fl::has_timeout(MetricsWindowRefresh_CB, window))
+        Fl::add_timeout(0.0, MetricsWindowRefresh_CB, window);
+
+}
+
+
+//! Writes out a snapshot of the metrics on a TaskGroup thread.
+class MetricsDumpTask : public Task {
+    std::string path;
+    WSocket *listener;
+public:
+    MetricsDumpTask(const std::string &p, WSocket *l)
+      : path(p)
+      , listener(l){
+
+    }
+
+    void Run() override;
+
+    //! Set while a MetricsDumpTask is queued or running, so that a slow disk
+    //! can't cause snapshots to pile up.
+    static std::atomic<bool> pending;
+};
+
+std::atomic<bool> MetricsDumpTask::pending(false);
+
+
+void MetricsDumpTask::Run(){
+
+    if(!path.empty())
+        Metrics::DumpToFile(path.c_str());
+
+    if(listener!=nullptr){
+        WSocket *client;
+        std::string snapshot;
+
+        while((client = Accept_Socket(listener, 0))!=nullptr){
+            if(snapshot.empty())
+                Metrics::Dump(snapshot);
+
+            Write_Socket(client, snapshot.c_str());
+            Disconnect_Socket(client);
+            Destroy_Socket(client);
+        }
+    }
+
+    pending = false;
+}
+
+
+struct MetricsDumpSettings {
+    double interval;
+    std::string path;
+    WSocket *listener;
+};
+
+
+static void MetricsDump_CB(void *p){
+
+    MetricsDumpSettings *settings = static_cast<MetricsDumpSettings *>(p);
+
+    if(!MetricsDumpTask::pending.exchange(true))
+        Thread::AddLongRunningTask(new MetricsDumpTask(settings->path, settings->listener));
+
+    Fl::repeat_timeout(settings->interval, MetricsDump_CB, p);
+}
+
+
+void StartMetricsDump(){
+
+    Fl_Preferences &prefs = GetPreferences();
+
+    int interval = 0, port = 0;
+    std::string path;
+
+    GetAndExist(prefs, "sys.metrics.dump.interval", interval, 0);
+    GetAndExist(prefs, "sys.metrics.dump.port", port, 0);
+    GetAndExist(prefs, "sys.metrics.dump.path", path, "");
+
+    if(interval<=0)
+        return;
+
+    MetricsDumpSettings *settings = new MetricsDumpSettings();
+    settings->interval = interval;
+    settings->path = path;
+    settings->listener = nullptr;
+
+    if(port>0){
+        settings->listener = Create_Socket();
+        if(Listen_Socket(settings->listener, port, 1)!=eSuccess){
+            Destroy_Socket(settings->listener);
+            settings->listener = nullptr;
+        }
+    }
+
+    Fl::add_timeout(settings->interval, MetricsDump_CB, settings);
+
+}
+
+}
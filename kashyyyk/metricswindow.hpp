@@ -0,0 +1,33 @@
+#pragma once
+
+//! @file
+//! @brief Front ends for @link Kashyyyk::Metrics @endlink, a debug window and
+//! a periodic dump to a file or a socket.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+
+class Fl_Widget;
+
+namespace Kashyyyk {
+
+//! Opens the Metrics window, which shows a live snapshot of every metric.
+void OpenMetricsWindow();
+
+//! @brief FLTK Callback wrapper for OpenMetricsWindow
+inline void OpenMetricsWindow_CB(Fl_Widget *w, void *p){
+    OpenMetricsWindow();
+}
+
+//! @brief Starts periodically dumping metrics, if enabled in the preferences.
+//!
+//! `sys.metrics.dump.interval` is the interval in seconds, and 0 disables
+//! dumping entirely. Every interval, a snapshot is written to the file named
+//! by `sys.metrics.dump.path`, if it is not empty, and is sent to any client
+//! that has connected to `sys.metrics.dump.port` on loopback, if it is not 0.
+//!
+//! Must be called on the main thread. The actual dumping happens on the long
+//! running TaskGroup.
+void StartMetricsDump();
+
+}
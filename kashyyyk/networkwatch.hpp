@@ -14,6 +14,11 @@ class NetworkWatch {
     static void ThreadFunction(NetworkWatch *that);
 
     std::atomic<bool> live;
+    //! Set to wake the group up after a short wait whether or not anything
+    //! can be read.
+    std::atomic<bool> retry;
+    //! True while the thread may be in a PollSet that never times out.
+    std::atomic<bool> sleeping;
     Monitor monitor;
 
     struct SocketSet *socket_set;
@@ -32,6 +37,13 @@ public:
             PokeSet(socket_set);
     }
 
+    //! Wakes the group up in about 100ms, even if no socket becomes readable.
+    inline void RetrySoon() {
+        retry = true;
+        if(sleeping)
+            NotifyAll();
+    }
+
 };
 
 
@@ -11,7 +11,7 @@ static int file = -1;
 void Kashyyyk_ShortLog_WriteLine(const char *str){
 
     char s[] = {'k', 'a', 's', 'h', 'y', 'y', 'y', 'k', '_', 's', 'h',
-        'o', 'r', 't', '_', 'l', 'o', 'g', '_', 'X', 'X', 'X', 'X', 'X', 'X'};
+        'o', 'r', 't', '_', 'l', 'o', 'g', '_', 'X', 'X', 'X', 'X', 'X', 'X', '\0'};
 
     if(file<0)
       file = mkstemp(s);
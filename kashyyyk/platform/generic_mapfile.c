@@ -0,0 +1,58 @@
+#include "mapfile.h"
+
+#include <stdlib.h>
+
+/* No mmap here, so just read the whole file in.
+*/
+
+struct Kashyyyk_MappedFile {
+    char *data;
+    unsigned long size;
+};
+
+struct Kashyyyk_MappedFile *Kashyyyk_MapFile(const char *path){
+    struct Kashyyyk_MappedFile *file;
+    long size;
+    FILE *f = fopen(path, "rb");
+
+    if(f==NULL)
+      return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if(size<=0){
+        fclose(f);
+        return NULL;
+    }
+
+    file = malloc(sizeof(struct Kashyyyk_MappedFile));
+    file->data = malloc(size);
+    file->size = fread(file->data, 1, size, f);
+    fclose(f);
+
+    if(file->size==0){
+        Kashyyyk_UnmapFile(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+void Kashyyyk_UnmapFile(struct Kashyyyk_MappedFile *file){
+    free(file->data);
+    free(file);
+}
+
+const char *Kashyyyk_MappedData(const struct Kashyyyk_MappedFile *file){
+    return file->data;
+}
+
+unsigned long Kashyyyk_MappedSize(const struct Kashyyyk_MappedFile *file){
+    return file->size;
+}
+
+int Kashyyyk_SyncFile(FILE *file){
+    return fflush(file);
+}
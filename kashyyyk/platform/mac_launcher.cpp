@@ -1,6 +1,8 @@
 #include "../window.hpp"
 #include "../launcher.hpp"
 #include "cocoa_launcher.h"
+#include "../metricswindow.hpp"
+#include "../searchwindow.hpp"
 
 #include <FL/Fl_Menu_Item.H>
 #include <FL/Fl_Sys_Menu_Bar.H>
@@ -23,6 +25,7 @@ Kashyyyk::Launcher *CreateLauncher(void /*Thread::TaskGroup*/ *a){
             items[i++] = {0};
             items[i++] = {"&Edit",0,0,0,FL_SUBMENU},
                 items[i++] = {"Preferences", FL_COMMAND + ',', Launcher::Preferences_CB, launcher};
+                items[i++] = {"Search History", FL_COMMAND + 'f', Kashyyyk::OpenSearchWindow_CB, nullptr};
             items[i++] = {0};
             items[i++] = {"&Server",0,0,0,FL_SUBMENU},
                 items[i++] = {"Reconnect", FL_COMMAND + FL_SHIFT + 'a', Launcher::Reconnect_CB, launcher};
@@ -33,6 +36,7 @@ Kashyyyk::Launcher *CreateLauncher(void /*Thread::TaskGroup*/ *a){
             items[i++] = {"&Debug",0,0,0,FL_SUBMENU},
                 items[i++] = {"G_Reconnect", 0, Launcher::GDebugReconnect_CB, launcher},
                 items[i++] = {"G_Disconnect", 0, Launcher::GDebugDisconnect_CB, launcher},
+                items[i++] = {"Metrics", 0, Kashyyyk::OpenMetricsWindow_CB, nullptr},
             items[i++] = {0};
         items[i++] = {0};
 
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Read only views of whole files, memory mapped where the platform allows.
+ The view is of the file as it was when it was mapped, and never grows.
+*/
+
+struct Kashyyyk_MappedFile;
+
+/* Returns NULL if the file can't be opened or is empty.
+*/
+struct Kashyyyk_MappedFile *Kashyyyk_MapFile(const char *path);
+void Kashyyyk_UnmapFile(struct Kashyyyk_MappedFile *file);
+
+const char *Kashyyyk_MappedData(const struct Kashyyyk_MappedFile *file);
+unsigned long Kashyyyk_MappedSize(const struct Kashyyyk_MappedFile *file);
+
+/* Flushes `file' and asks the OS to put what has been written on the disk.
+ Returns 0 on success.
+*/
+int Kashyyyk_SyncFile(FILE *file);
+
+#ifdef __cplusplus
+}
+#endif
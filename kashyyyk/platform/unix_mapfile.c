@@ -0,0 +1,64 @@
+#ifdef __GNUC__
+#define _XOPEN_SOURCE 500
+#endif
+
+#include "mapfile.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+struct Kashyyyk_MappedFile {
+    void *data;
+    unsigned long size;
+};
+
+struct Kashyyyk_MappedFile *Kashyyyk_MapFile(const char *path){
+    struct Kashyyyk_MappedFile *file;
+    struct stat s;
+    void *data;
+    const int fd = open(path, O_RDONLY);
+
+    if(fd<0)
+      return NULL;
+
+    if((fstat(fd, &s)!=0) || (s.st_size==0)){
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /* The mapping keeps the file open by itself.
+    */
+    close(fd);
+
+    if(data==MAP_FAILED)
+      return NULL;
+
+    file = malloc(sizeof(struct Kashyyyk_MappedFile));
+    file->data = data;
+    file->size = s.st_size;
+    return file;
+}
+
+void Kashyyyk_UnmapFile(struct Kashyyyk_MappedFile *file){
+    munmap(file->data, file->size);
+    free(file);
+}
+
+const char *Kashyyyk_MappedData(const struct Kashyyyk_MappedFile *file){
+    return file->data;
+}
+
+unsigned long Kashyyyk_MappedSize(const struct Kashyyyk_MappedFile *file){
+    return file->size;
+}
+
+int Kashyyyk_SyncFile(FILE *file){
+    if(fflush(file)!=0)
+      return -1;
+    return fsync(fileno(file));
+}
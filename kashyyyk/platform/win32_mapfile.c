@@ -0,0 +1,68 @@
+#include "mapfile.h"
+
+#include <stdlib.h>
+#include <io.h>
+#include <windows.h>
+
+struct Kashyyyk_MappedFile {
+    HANDLE mapping;
+    const void *data;
+    unsigned long size;
+};
+
+struct Kashyyyk_MappedFile *Kashyyyk_MapFile(const char *path){
+    struct Kashyyyk_MappedFile *file;
+    HANDLE mapping;
+    const void *data;
+    DWORD size;
+    /* Let the log writer keep appending to a file while it is mapped.
+    */
+    HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ|FILE_SHARE_WRITE,
+      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if(handle==INVALID_HANDLE_VALUE)
+      return NULL;
+
+    size = GetFileSize(handle, NULL);
+    if((size==0) || (size==INVALID_FILE_SIZE)){
+        CloseHandle(handle);
+        return NULL;
+    }
+
+    mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, size, NULL);
+    CloseHandle(handle);
+    if(mapping==NULL)
+      return NULL;
+
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, size);
+    if(data==NULL){
+        CloseHandle(mapping);
+        return NULL;
+    }
+
+    file = malloc(sizeof(struct Kashyyyk_MappedFile));
+    file->mapping = mapping;
+    file->data = data;
+    file->size = size;
+    return file;
+}
+
+void Kashyyyk_UnmapFile(struct Kashyyyk_MappedFile *file){
+    UnmapViewOfFile(file->data);
+    CloseHandle(file->mapping);
+    free(file);
+}
+
+const char *Kashyyyk_MappedData(const struct Kashyyyk_MappedFile *file){
+    return file->data;
+}
+
+unsigned long Kashyyyk_MappedSize(const struct Kashyyyk_MappedFile *file){
+    return file->size;
+}
+
+int Kashyyyk_SyncFile(FILE *file){
+    if(fflush(file)!=0)
+      return -1;
+    return FlushFileBuffers((HANDLE)_get_osfhandle(_fileno(file)))?0:-1;
+}
@@ -1,4 +1,6 @@
 #include "prefs.hpp"
+#include "log.hpp"
+#include "settings.hpp"
 #include <utility>
 #include <cassert>
 #include <FL/Fl_Window.H>
@@ -80,8 +82,8 @@ static void Prefs_Theme_CB(Fl_Widget *w, void *p){
         Kashyyyk::GetPreferences().set("sys.appearance.theme", item->label());
         Kashyyyk::GetPreferences().flush();
         
-        printf("Set theme to %s\n", item->label());
-        Kashyyyk::LoadScheme(item->label());
+        KLOG_INFO(Prefs, "Set theme to %s", item->label());
+        Kashyyyk::ReloadSettings();
     }
 }
 
@@ -112,7 +114,8 @@ static void Prefs_Font_CB(Fl_Widget *w, void *p){
         } // info not null
 
         Kashyyyk::GetPreferences().set("sys.appearance.font", Font);
-        printf("Set font to %s (%i)\n", GetFontName(Font), Font);
+        KLOG_INFO(Prefs, "Set font to %s (%i)", GetFontName(Font), Font);
+        Kashyyyk::ReloadSettings();
     }
 
 }
@@ -138,6 +141,7 @@ void Enable_Button_CB(Fl_Widget *w, void *p){
     int enabled = b->value();
 
     Kashyyyk::GetPreferences().set(static_cast<const char *>(p), enabled);
+    Kashyyyk::ReloadSettings();
 
 }
 
@@ -154,9 +158,10 @@ void Toggle_Button_CB(Fl_Widget *w, void *p){
 
     int enabled = that->value();
 
-    printf("Setting %s to %i\n", to_set->second, enabled);
+    KLOG_INFO(Prefs, "Setting %s to %i", to_set->second, enabled);
 
     Kashyyyk::GetPreferences().set(to_set->second, enabled);
+    Kashyyyk::ReloadSettings();
 
     if(!enabled){
         to_set->first->value(1);
@@ -166,7 +171,6 @@ void Toggle_Button_CB(Fl_Widget *w, void *p){
 
 
 Fl_Preferences &Kashyyyk::GetPreferences(){
-    printf("Using config directory %s.\n", Kashyyyk_ConfigDirectory());
     static Fl_Preferences prefs(Kashyyyk_ConfigDirectory(), "FlyingJester", "Kashyyyk");
     return prefs;
 }
@@ -244,7 +248,7 @@ void OpenPreferencesWindow(){
             int font = 0;
             prefs.get("sys.appearance.font", font, FL_SCREEN);
             const Fl_Menu_Item *selected = theme_input->find_item(GetFontName(font));
-            printf("Last font setting was %s (%p)\n", GetFontName(font), static_cast<const void *>(selected));
+            KLOG_DEBUG(Prefs, "Last font setting was %s (%p)", GetFontName(font), static_cast<const void *>(selected));
 
             if(selected!=nullptr)
               font_input->picked(selected);
@@ -0,0 +1,438 @@
+#include "search.hpp"
+#include "intern.h"
+#include "platform/mapfile.h"
+
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+namespace Kashyyyk {
+namespace Search {
+
+//! Shorter terms are not indexed.
+static const unsigned long MinTermLength = 2;
+//! Longer terms are cut down to this many bytes.
+static const unsigned long MaxTermLength = 64;
+
+static const char FileMagic[4] = {'K', 'F', 'T', 'S'};
+static const uint32_t FileVersion = 1;
+
+//! @brief Start of an `.fts` file. Native byte order, like the `.idx` files.
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_terms;
+    uint32_t num_lines;
+};
+
+//! @brief One entry of the term table. Offsets are from the start of the file.
+struct FileTerm {
+    uint32_t term_offset;
+    uint32_t term_length;
+    uint32_t postings_offset;
+    uint32_t postings_count;
+};
+
+
+static void PutVarint(std::string &to, unsigned long n){
+    while(n>=0x80){
+        to.push_back(static_cast<char>((n&0x7F)|0x80));
+        n>>=7;
+    }
+    to.push_back(static_cast<char>(n));
+}
+
+
+static bool IsTermChar(unsigned char c){
+    return ((c>='a') && (c<='z')) || ((c>='A') && (c<='Z')) || ((c>='0') && (c<='9')) || (c=='_') || (c>=0x80);
+}
+
+
+void Tokenize(const char *text, std::vector<std::string> &out){
+
+    const std::vector<std::string>::size_type first = out.size();
+
+    while(*text!='\0'){
+
+        if(!IsTermChar(*text)){
+            text++;
+            continue;
+        }
+
+        const char *const start = text;
+        while(IsTermChar(*text))
+            text++;
+
+        const unsigned long length = std::min<unsigned long>(text-start, MaxTermLength);
+        if(length<MinTermLength)
+            continue;
+
+        out.push_back(std::string(start, length));
+        for(std::string::iterator i = out.back().begin(); i!=out.back().end(); i++){
+            if((*i>='A') && (*i<='Z'))
+                *i+='a'-'A';
+        }
+    }
+
+    std::sort(out.begin()+first, out.end());
+    out.erase(std::unique(out.begin()+first, out.end()), out.end());
+
+}
+
+
+std::string NickTerm(const char *nick){
+    // Can never be a word, since it starts with a control character.
+    std::string term(1, '\x01');
+    term.append(nick);
+    IRC_CaseFold(&term[1], term.c_str()+1, term.size()-1);
+    return term;
+}
+
+
+void SegmentIndex::Add(const char *from, const char *text){
+
+    scratch.clear();
+    Tokenize(text, scratch);
+    if(*from!='\0')
+        scratch.push_back(NickTerm(from));
+
+    for(std::vector<std::string>::const_iterator i = scratch.cbegin(); i!=scratch.cend(); i++){
+        Postings &postings = terms[*i];
+        PutVarint(postings.lines, (postings.count==0)?lines:(lines-postings.last));
+        postings.last = lines;
+        postings.count++;
+    }
+
+    lines++;
+
+}
+
+
+bool SegmentIndex::Write(const std::string &path) const {
+
+    typedef std::unordered_map<std::string, Postings>::const_iterator term_iterator;
+
+    std::vector<term_iterator> sorted;
+    sorted.reserve(terms.size());
+    for(term_iterator i = terms.cbegin(); i!=terms.cend(); i++)
+        sorted.push_back(i);
+
+    std::sort(sorted.begin(), sorted.end(), [](const term_iterator &a, const term_iterator &b){
+        return a->first<b->first;
+    });
+
+    const FileHeader header = {{FileMagic[0], FileMagic[1], FileMagic[2], FileMagic[3]}, FileVersion,
+        static_cast<uint32_t>(sorted.size()), static_cast<uint32_t>(lines)};
+
+    std::vector<FileTerm> table(sorted.size());
+    std::string strings, postings;
+
+    const unsigned long long strings_offset = sizeof(FileHeader)+(sizeof(FileTerm)*sorted.size());
+
+    for(std::vector<term_iterator>::size_type i = 0; i<sorted.size(); i++){
+        table[i].term_offset = strings_offset+strings.size();
+        table[i].term_length = sorted[i]->first.size();
+        table[i].postings_offset = postings.size();
+        table[i].postings_count = sorted[i]->second.count;
+
+        strings+=sorted[i]->first;
+        postings+=sorted[i]->second.lines;
+    }
+
+    const unsigned long long postings_offset = strings_offset+strings.size();
+    if(postings_offset+postings.size()>UINT32_MAX)
+        return false;
+
+    for(std::vector<FileTerm>::iterator i = table.begin(); i!=table.end(); i++)
+        i->postings_offset+=postings_offset;
+
+    // Written to the side and moved into place, so that a reader never sees
+    // half of one.
+    const std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if(!file)
+        return false;
+
+    fwrite(&header, sizeof(FileHeader), 1, file);
+    if(!table.empty())
+        fwrite(&table[0], sizeof(FileTerm), table.size(), file);
+    fwrite(strings.data(), 1, strings.size(), file);
+    fwrite(postings.data(), 1, postings.size(), file);
+
+    const bool written = (!ferror(file)) && (Kashyyyk_SyncFile(file)==0);
+    fclose(file);
+
+    if(!written){
+        remove(temporary.c_str());
+        return false;
+    }
+
+    return rename(temporary.c_str(), path.c_str())==0;
+}
+
+
+void SegmentIndex::Clear(){
+    terms.clear();
+    lines = 0;
+}
+
+
+bool IndexSegment(const std::string &directory, long number){
+
+    const ChatLog::Segment segment(directory, number);
+    if(!segment.Good())
+        return false;
+
+    SegmentIndex index;
+    ChatLog::Line line;
+
+    for(unsigned long i = 0; i<segment.Size(); i++){
+        segment.Read(i, line);
+        index.Add(line.from.c_str(), line.text.c_str());
+    }
+
+    return index.Write(ChatLog::SegmentPath(directory, number, "fts"));
+}
+
+
+//! @brief A mapped `.fts` file.
+class TermFile {
+    Kashyyyk_MappedFile *file;
+    const FileTerm *table;
+    unsigned long num_terms;
+
+    TermFile(const TermFile &) = delete;
+    TermFile &operator=(const TermFile &) = delete;
+public:
+    explicit TermFile(const std::string &path)
+      : file(Kashyyyk_MapFile(path.c_str()))
+      , table(nullptr)
+      , num_terms(0){
+
+        if(!file)
+            return;
+
+        const char *const data = Kashyyyk_MappedData(file);
+        const unsigned long size = Kashyyyk_MappedSize(file);
+
+        const FileHeader *const header = reinterpret_cast<const FileHeader *>(data);
+
+        if((size<sizeof(FileHeader)) || (memcmp(header->magic, FileMagic, 4)!=0) || (header->version!=FileVersion) ||
+            ((size-sizeof(FileHeader))/sizeof(FileTerm)<header->num_terms)){
+            Kashyyyk_UnmapFile(file);
+            file = nullptr;
+            return;
+        }
+
+        table = reinterpret_cast<const FileTerm *>(data+sizeof(FileHeader));
+        num_terms = header->num_terms;
+    }
+
+    ~TermFile(){
+        if(file)
+            Kashyyyk_UnmapFile(file);
+    }
+
+    bool Good() const {return file!=nullptr;}
+
+    //! Puts the lines that @p term is on onto @p out, in order.
+    void Lookup(const std::string &term, std::vector<unsigned long> &out) const {
+
+        const char *const data = Kashyyyk_MappedData(file);
+        const unsigned long size = Kashyyyk_MappedSize(file);
+
+        unsigned long low = 0, high = num_terms;
+        while(low<high){
+            const unsigned long middle = low+((high-low)>>1);
+            const FileTerm &entry = table[middle];
+
+            if((entry.term_offset>size) || (size-entry.term_offset<entry.term_length))
+                return;
+
+            const int compare = memcmp(data+entry.term_offset, term.data(), std::min<unsigned long>(entry.term_length, term.size()));
+
+            if((compare<0) || ((compare==0) && (entry.term_length<term.size())))
+                low = middle+1;
+            else if((compare>0) || (entry.term_length>term.size()))
+                high = middle;
+            else{
+                const unsigned char *at = reinterpret_cast<const unsigned char *>(data)+entry.postings_offset;
+                const unsigned char *const end = reinterpret_cast<const unsigned char *>(data)+size;
+                unsigned long line = 0;
+
+                if(entry.postings_offset>size)
+                    return;
+
+                out.reserve(entry.postings_count);
+                for(uint32_t i = 0; i<entry.postings_count; i++){
+                    unsigned long delta = 0;
+                    unsigned shift = 0;
+                    do{
+                        if(at==end)
+                            return;
+                        delta|=static_cast<unsigned long>(*at&0x7F)<<shift;
+                        shift+=7;
+                    }while(*(at++)&0x80);
+
+                    line = (i==0)?delta:(line+delta);
+                    out.push_back(line);
+                }
+                return;
+            }
+        }
+    }
+};
+
+
+//! Finds the lines of a segment that have every term in @p terms using its
+//! `.fts` file. Returns false if it doesn't have one.
+static bool LookupSegment(const std::string &directory, long number, const std::vector<std::string> &terms, std::vector<unsigned long> &out){
+
+    const TermFile file(ChatLog::SegmentPath(directory, number, "fts"));
+    if(!file.Good())
+        return false;
+
+    std::vector<std::vector<unsigned long> > postings(terms.size());
+    for(std::vector<std::string>::size_type i = 0; i<terms.size(); i++){
+        file.Lookup(terms[i], postings[i]);
+        if(postings[i].empty())
+            return true;
+    }
+
+    // Intersecting from the rarest term keeps every step small.
+    std::sort(postings.begin(), postings.end(), [](const std::vector<unsigned long> &a, const std::vector<unsigned long> &b){
+        return a.size()<b.size();
+    });
+
+    out.swap(postings[0]);
+
+    std::vector<unsigned long> both;
+    for(std::vector<std::vector<unsigned long> >::const_iterator i = postings.cbegin()+1; (i!=postings.cend()) && (!out.empty()); i++){
+        both.clear();
+        std::set_intersection(out.cbegin(), out.cend(), i->cbegin(), i->cend(), std::back_inserter(both));
+        out.swap(both);
+    }
+
+    return true;
+}
+
+
+//! Finds the lines of a segment that have every term in @p terms by reading
+//! the whole thing.
+static void ScanSegment(const ChatLog::Segment &segment, const std::vector<std::string> &terms, std::vector<unsigned long> &out){
+
+    std::vector<std::string> line_terms;
+    ChatLog::Line line;
+
+    for(unsigned long i = 0; i<segment.Size(); i++){
+        segment.Read(i, line);
+
+        line_terms.clear();
+        Tokenize(line.text.c_str(), line_terms);
+        if(!line.from.empty())
+            line_terms.push_back(NickTerm(line.from.c_str()));
+
+        bool matches = true;
+        for(std::vector<std::string>::const_iterator e = terms.cbegin(); matches && (e!=terms.cend()); e++)
+            matches = std::find(line_terms.cbegin(), line_terms.cend(), *e)!=line_terms.cend();
+
+        if(matches)
+            out.push_back(i);
+    }
+
+}
+
+
+//! Finds up to query.limit of the newest matches in one stream.
+static void FindInStream(const Query &query, const std::vector<std::string> &terms, const std::string &name, std::vector<Result> &out){
+
+    const std::string directory = ChatLog::StreamDirectory(name);
+    unsigned found = 0;
+
+    for(long number = ChatLog::NewestSegment(directory); (number>=0) && (found<query.limit); number--){
+
+        const ChatLog::Segment segment(directory, number);
+        if(!segment.Good())
+            continue;
+
+        // Lines are in time order, so whole segments can be skipped.
+        if((query.after!=0) && (segment.Time(segment.Size()-1)<query.after))
+            break;
+        if((query.before!=0) && (segment.Time(0)>=query.before))
+            continue;
+
+        std::vector<unsigned long> lines;
+        if(!LookupSegment(directory, number, terms, lines))
+            ScanSegment(segment, terms, lines);
+
+        for(std::vector<unsigned long>::const_reverse_iterator i = lines.crbegin(); (i!=lines.crend()) && (found<query.limit); i++){
+            // The index may be of more lines than are in the segment, if the
+            // log was cut short.
+            if(*i>=segment.Size())
+                continue;
+
+            const long long time = segment.Time(*i);
+            if(((query.after!=0) && (time<query.after)) || ((query.before!=0) && (time>=query.before)))
+                continue;
+
+            out.push_back(Result());
+            out.back().stream = name;
+            out.back().position = {directory, number, *i};
+            segment.Read(*i, out.back().line);
+            found++;
+        }
+    }
+
+}
+
+
+void Find(const Query &query, std::vector<Result> &out){
+
+    if(query.limit==0)
+        return;
+
+    std::vector<std::string> terms;
+    Tokenize(query.words.c_str(), terms);
+    if(!query.nick.empty())
+        terms.push_back(NickTerm(query.nick.c_str()));
+
+    if(terms.empty())
+        return;
+
+    // Split the same way as the stream names, so that they can be compared.
+    const std::string filter = ChatLog::StreamName(query.server, query.channel);
+    const std::string::size_type slash = filter.find('/');
+    const std::string server = filter.substr(0, slash), channel = filter.substr(slash+1);
+
+    std::vector<std::string> streams;
+    ChatLog::ListStreams(streams);
+
+    std::vector<Result> results;
+
+    for(std::vector<std::string>::const_iterator i = streams.cbegin(); i!=streams.cend(); i++){
+        const std::string::size_type stream_slash = i->find('/');
+        if(stream_slash==std::string::npos)
+            continue;
+        if((!query.server.empty()) && (i->compare(0, stream_slash, server)!=0))
+            continue;
+        if((!query.channel.empty()) && (i->compare(stream_slash+1, std::string::npos, channel)!=0))
+            continue;
+
+        FindInStream(query, terms, *i, results);
+    }
+
+    std::stable_sort(results.begin(), results.end(), [](const Result &a, const Result &b){
+        return a.line.time>b.line.time;
+    });
+
+    if(results.size()>query.limit)
+        results.resize(query.limit);
+
+    out.insert(out.end(), results.begin(), results.end());
+
+}
+
+}
+}
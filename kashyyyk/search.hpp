@@ -0,0 +1,104 @@
+#pragma once
+
+//! @file
+//! @brief Full text search over the chat history.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Each finished segment of the chat log has an inverted index next to it,
+//! `N.fts`, which maps every term in the segment to the lines it is on. The
+//! ChatLog writer builds it in memory with a SegmentIndex as lines are
+//! written, and writes it out when the segment is finished, so nothing is
+//! ever indexed twice and nothing but the writer thread does the indexing.
+//!
+//! An `.fts` file is a header, a table of terms sorted by their bytes, the
+//! terms themselves, and the line numbers of each term, delta coded as
+//! variable length integers. Lookups map the file and binary search the
+//! table, so a query only reads the few pages it needs no matter how much
+//! history there is. Segments that are still being written have no `.fts`
+//! yet, and are scanned instead. They are never more than a few MiB.
+//!
+//! Terms are runs of letters, digits, underscores and non-ASCII bytes, with
+//! ASCII letters lowercased. Who a line is from is indexed as a term of its
+//! own, so that searching by nick uses the index too.
+
+#include "chatlog.hpp"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace Kashyyyk {
+namespace Search {
+
+//! @brief Puts every distinct term in @p text onto the end of @p out.
+void Tokenize(const char *text, std::vector<std::string> &out);
+
+//! @brief Returns the term for lines from @p nick.
+std::string NickTerm(const char *nick);
+
+//! @brief Terms of one segment, as it is written.
+//!
+//! Line numbers are kept delta coded the same way they are written, so a
+//! whole segment's worth only takes a little more memory than the file.
+class SegmentIndex {
+    struct Postings {
+        unsigned long last;
+        unsigned long count;
+        std::string lines;
+    };
+
+    std::unordered_map<std::string, Postings> terms;
+    unsigned long lines;
+    std::vector<std::string> scratch;
+public:
+    SegmentIndex()
+      : lines(0){}
+
+    //! Adds the next line of the segment.
+    void Add(const char *from, const char *text);
+
+    //! Writes the index to @p path. Returns false if it can't.
+    bool Write(const std::string &path) const;
+
+    void Clear();
+};
+
+//! @brief Builds and writes the index of a segment that is already on disk.
+bool IndexSegment(const std::string &directory, long segment);
+
+struct Query {
+    //! Every term in these words must be on a line for it to match.
+    std::string words;
+    //! If not empty, only lines from this nick match.
+    std::string nick;
+    //! If not 0, only lines from at least this time match. Milliseconds since
+    //! the epoch.
+    long long after;
+    //! If not 0, only lines from before this time match.
+    long long before;
+    //! If not empty, only this server's history is searched.
+    std::string server;
+    //! If not empty, only this channel's history is searched.
+    std::string channel;
+    //! Most results to give back.
+    unsigned limit;
+};
+
+struct Result {
+    //! Stream the line is in, as given by ChatLog::StreamName.
+    std::string stream;
+    //! The place just before the line.
+    ChatLog::Position position;
+    ChatLog::Line line;
+};
+
+//! @brief Finds the newest lines that match @p query, newest first, and puts
+//! them onto the end of @p out.
+//!
+//! Safe to use from any thread while the log is being written.
+void Find(const Query &query, std::vector<Result> &out);
+
+}
+}
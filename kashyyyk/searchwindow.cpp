@@ -0,0 +1,187 @@
+#include "searchwindow.hpp"
+#include "search.hpp"
+#include "chatlog.hpp"
+
+#include <FL/Fl.H>
+#include <FL/Fl_Double_Window.H>
+#include <FL/Fl_Input.H>
+#include <FL/Fl_Int_Input.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Return_Button.H>
+#include <FL/Fl_Hold_Browser.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <FL/Fl_Text_Display.H>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+
+namespace Kashyyyk {
+
+//! Most results shown for one search.
+static const unsigned ResultLimit = 200;
+//! Lines shown on each side of a result when it is selected.
+static const unsigned ContextLines = 20;
+//! Lines read each time Earlier or Later is pressed.
+static const unsigned PageLines = 100;
+
+static Fl_Input *words_input = nullptr, *nick_input = nullptr, *days_input = nullptr;
+static Fl_Hold_Browser *results_browser = nullptr;
+static Fl_Text_Display *context_display = nullptr;
+static Fl_Text_Buffer *context_buffer = nullptr;
+
+static std::vector<Search::Result> results;
+
+//! What the context view shows is every line from context_begin to
+//! context_end.
+static ChatLog::Position context_begin, context_end;
+
+
+static void AppendLine(std::string &to, const ChatLog::Line &line, bool mark){
+
+    const time_t seconds = line.time/1000;
+    char when[32];
+    if(strftime(when, sizeof(when), "%Y-%m-%d %H:%M ", localtime(&seconds))==0)
+        when[0] = '\0';
+
+    to+=mark?"> ":"  ";
+    to+=when;
+    to+=line.from;
+    to.push_back('|');
+    to+=line.text;
+    to.push_back('\n');
+}
+
+
+static void Search_CB(Fl_Widget *w, void *p){
+
+    Search::Query query = {words_input->value(), nick_input->value(), 0, 0, "", "", ResultLimit};
+
+    const long days = atol(days_input->value());
+    if(days>0){
+        const long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        query.after = now-(days*86400000ll);
+    }
+
+    results.clear();
+    Search::Find(query, results);
+
+    results_browser->clear();
+    context_buffer->text("");
+
+    for(std::vector<Search::Result>::const_iterator i = results.cbegin(); i!=results.cend(); i++){
+        std::string line = i->stream + ' ';
+        AppendLine(line, i->line, false);
+        line.erase(line.end()-1);
+        results_browser->add(line.c_str());
+    }
+
+    if(results.empty())
+        results_browser->add("No matches.");
+
+}
+
+
+static void Result_CB(Fl_Widget *w, void *p){
+
+    const int selected = results_browser->value();
+    if((selected<1) || (static_cast<unsigned>(selected)>results.size()))
+        return;
+
+    const Search::Result &result = results[selected-1];
+
+    context_begin = result.position;
+    context_end = result.position;
+
+    std::vector<ChatLog::Line> lines;
+    const unsigned before = ChatLog::ReadBefore(context_begin, ContextLines, lines);
+    ChatLog::ReadAfter(context_end, ContextLines+1, lines);
+
+    std::string text;
+    for(std::vector<ChatLog::Line>::size_type i = 0; i<lines.size(); i++)
+        AppendLine(text, lines[i], i==before);
+
+    context_buffer->text(text.c_str());
+    context_display->scroll((before>4)?(before-4):0, 0);
+
+}
+
+
+static void Earlier_CB(Fl_Widget *w, void *p){
+
+    if(results_browser->value()<1)
+        return;
+
+    std::vector<ChatLog::Line> lines;
+    if(ChatLog::ReadBefore(context_begin, PageLines, lines)==0)
+        return;
+
+    std::string text;
+    for(std::vector<ChatLog::Line>::const_iterator i = lines.cbegin(); i!=lines.cend(); i++)
+        AppendLine(text, *i, false);
+
+    context_buffer->insert(0, text.c_str());
+    context_display->scroll(0, 0);
+
+}
+
+
+static void Later_CB(Fl_Widget *w, void *p){
+
+    if(results_browser->value()<1)
+        return;
+
+    std::vector<ChatLog::Line> lines;
+    if(ChatLog::ReadAfter(context_end, PageLines, lines)==0)
+        return;
+
+    std::string text;
+    for(std::vector<ChatLog::Line>::const_iterator i = lines.cbegin(); i!=lines.cend(); i++)
+        AppendLine(text, *i, false);
+
+    context_buffer->append(text.c_str());
+
+}
+
+
+void OpenSearchWindow(){
+
+    static Fl_Double_Window *window = nullptr;
+
+    if(window==nullptr){
+        window = new Fl_Double_Window(560, 480, "Search History");
+
+        words_input = new Fl_Input(56, 8, 200, 24, "Words");
+        nick_input = new Fl_Input(296, 8, 104, 24, "Nick");
+        days_input = new Fl_Int_Input(440, 8, 40, 24, "Days");
+        Fl_Return_Button *search_button = new Fl_Return_Button(488, 8, 64, 24, "Find");
+        search_button->callback(Search_CB);
+
+        results_browser = new Fl_Hold_Browser(8, 40, 544, 180);
+        results_browser->textfont(FL_COURIER);
+        // Channel names and lines are whatever people typed, don't format them.
+        results_browser->format_char(0);
+        results_browser->callback(Result_CB);
+
+        context_buffer = new Fl_Text_Buffer();
+        context_display = new Fl_Text_Display(8, 228, 544, 212);
+        context_display->buffer(context_buffer);
+        context_display->textfont(FL_COURIER);
+
+        Fl_Button *earlier = new Fl_Button(8, 448, 80, 24, "Earlier");
+        earlier->callback(Earlier_CB);
+        Fl_Button *later = new Fl_Button(96, 448, 80, 24, "Later");
+        later->callback(Later_CB);
+
+        window->resizable(context_display);
+        window->end();
+    }
+
+    window->show();
+
+}
+
+}
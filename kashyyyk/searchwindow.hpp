@@ -0,0 +1,25 @@
+#pragma once
+
+//! @file
+//! @brief A window to search the chat history with @link Kashyyyk::Search
+//! @endlink.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+
+class Fl_Widget;
+
+namespace Kashyyyk {
+
+//! @brief Opens the Search History window.
+//!
+//! Selecting a result shows the lines around it, read straight from the
+//! chat log. More of the log is only read when asked for.
+void OpenSearchWindow();
+
+//! @brief FLTK Callback wrapper for OpenSearchWindow
+inline void OpenSearchWindow_CB(Fl_Widget *w, void *p){
+    OpenSearchWindow();
+}
+
+}
@@ -2,11 +2,15 @@
 #include "servermessage.hpp"
 #include "channelmessage.hpp"
 #include "channel.hpp"
-#include "prefs.hpp"
+#include "settings.hpp"
 #include "background.hpp"
+#include "shards.hpp"
+#include "metrics.hpp"
+#include "log.hpp"
 #include "socket.h"
 #include "message.h"
 #include "parse.h"
+#include "tags.h"
 #include "csv.h"
 
 #include <FL/Fl_Group.H>
@@ -15,6 +19,10 @@
 #include <FL/Fl_Browser.H>
 
 #include <stack>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #ifdef SendMessage
 #undef SendMessage
@@ -25,20 +33,39 @@ using namespace Kashyyyk::ServerMessage;
 
 namespace Kashyyyk {
 
-Server::find_channel::find_channel(const std::string &s)
-  : n(s){
+//! How often, in seconds, each Server checks if it should PING or reconnect.
+static const double lag_check_period = 5.0;
+
+//! Prefix of the token sent in our PINGs, so that we can tell our PONGs apart.
+static const char ping_token_prefix[] = "yyy";
+
+//! Every capability we know how to make use of.
+static const unsigned long wanted_caps = IRC_cap_all;
+
+//! How long the server may go without reading anything we have queued for
+//! it, in milliseconds. The same as Write_Socket's deadline.
+static const long long write_deadline_ms = 5000;
+
+static long long SteadyMilliseconds(){
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+Server::find_channel::find_channel(const Interned &s)
+  : n(s.Handle()){
 
 }
 
 
 Server::find_channel::find_channel(const Channel *a)
-  : n(a->name) {
+  : n(a->key.Handle()) {
 
 }
 
 
 bool Server::find_channel::operator () (const std::unique_ptr<Channel> &a){
-    return a->name==n;
+    return a->key.Handle()==n;
 }
 
 
@@ -60,26 +87,42 @@ ServerConnectTask::ServerConnectTask(Server *aServer, WSocket *aSocket, long prt
   , socket(aSocket)
   , reconnect_channels(rc)
   , port(prt)
-  , promise(new PromiseValue<bool>(false)) {
+  , ssl(SSL){
 
 }
 
 void ServerConnectTask::Run(){
-    int err = Connect_Socket(socket, server->GetName().c_str(), port, 10000);
+    WSockErr err = Connect_Socket(socket, server->GetName().c_str(), port, 10000);
+    if(ssl && (err==eSuccess))
+      err = StartTLS_Socket(socket, server->GetName().c_str(), nullptr);
+    const bool connected = (err==eSuccess) || (err==eAlreadyConnected);
+
+    // Failures are not retried here. Server::CheckLag will try again, backing
+    // off a little more each time.
+    if(connected){
+        KLOG_INFO(Server, "Reconnected to %s.", server->GetName().c_str());
+
+        server->last_activity = SteadyMilliseconds();
+        server->Register();
+        if(reconnect_channels)
+          server->QueueRejoin();
+        server->WatchSocket();
+    }
+    else{
+        KLOG_WARNING(Server, "Could not reconnect to %s: %s", server->GetName().c_str(), ExplainError_Socket(err));
 
-    if(err!=eAlreadyConnected){
-        repeating = true;
-        //server->connected = false;
-        return;
+        server->lock();
+        server->lifecycle = Server::Disconnected;
+        server->unlock();
     }
-    
-    server->Enable();
-    
-    promise->SetReady();
-    promise->Finalize(true);
-    repeating = false;
-    reconnect_channels = true;
-    //server->connected = true;
+
+    Fl::lock();
+    if(connected){
+        server->reconnect_failures = 0;
+        server->Enable();
+    }
+    Fl::unlock();
+    Fl::awake();
 }
 
 
@@ -90,8 +133,8 @@ class ServerTask : public Task {
     Server *server;
     WSocket *socket;
     bool *task_died;
-
-    std::shared_ptr<PromiseValue<bool> > promise;
+    //! Value of Server::connections that old_state belongs to.
+    unsigned connection;
 
 public:
 
@@ -102,6 +145,7 @@ public:
     , server(aServer)
     , socket(aSocket)
     , task_died(deded)
+    , connection(0)
     , should_die(false){
         repeating = true;
     }
@@ -110,36 +154,64 @@ public:
 
         free(buffer);
 
+        if(old_state!=nullptr)
+          IRC_DestroyParseState(old_state);
+
         *task_died = true;
 
     }
 
     void Run() override {
+        bool lost = false;
         {
+            // The socket is only ever disconnected with the Server locked, so
+            // hold the lock while reading from it.
             AutoLocker<Server *> locker(server);
 
             if(should_die)
                 repeating = false;
 
-        }
+            if(connection!=server->connections){
+                connection = server->connections;
+                if(old_state!=nullptr){
+                    IRC_DestroyParseState(old_state);
+                    old_state = nullptr;
+                }
+            }
 
-        if(promise){
-            if(promise->IsReady()){
-                promise.reset();
+            // Nothing to read until the ServerConnectTask is done.
+            if(server->lifecycle==Server::Connecting)
                 return;
+
+            // Whatever the socket wouldn't take from SendMessages.
+            if(server->FlushOutgoing())
+                Thread::RetryTaskGroup(Shards::GetTaskGroup(server->shard));
+
+            if((State_Socket(socket)!=eConnected) || server->write_failed){
+                // Only losing the connection starts a reconnect here. Later
+                // attempts are up to CheckLag.
+                if(server->lifecycle==Server::Disconnected)
+                    return;
+                server->lifecycle = Server::Disconnected;
+                lost = true;
             }
+            else if(Length_Socket(socket)==0)
+                return;
+            else
+                Read_Socket(socket, &buffer);
         }
 
-        if(State_Socket(socket)!=eConnected){
-            server->Disable();
-            promise = server->Reconnect();
+        if(lost){
+            Fl::lock();
+            server->AutoReconnect();
+            Fl::unlock();
             return;
         }
 
-        if(Length_Socket(socket)==0)
-          return;
+        server->last_activity = SteadyMilliseconds();
 
-        Read_Socket(socket, &buffer);
+        Metrics::ServerMetrics *metrics = server->GetMetrics();
+        metrics->bytes_in.Add(strlen(buffer));
 
         struct IRC_ParseState *state;
         if(old_state==nullptr)
@@ -151,24 +223,42 @@ public:
         }
         struct IRC_Message *msg = IRC_ConsumeParse(state);
 
+        // The FLTK lock is taken once for everything in this read rather than
+        // once per line, so that the shards are not trading it back and forth.
+        bool fl_locked = false;
+
         while((msg!=nullptr) || (IRC_GetParseStatus(state)==IRC_badMessage)){
 
-            if(IRC_GetParseStatus(state)==IRC_unexpectedEnd){
-                old_state = state;
-                return;
-            }
+            metrics->lines_in.Add();
 
             if(IRC_GetParseStatus(state)!=IRC_badMessage){
-                Fl::lock();
+                if(!fl_locked){
+                    Fl::lock();
+                    fl_locked = true;
+                }
+
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
                 server->GiveMessage(msg);
-                Fl::unlock();
+                metrics->dispatch_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now()-start).count());
 
                 IRC_FreeMessage(msg);
             }
+            else
+              metrics->parse_errors.Add();
 
             msg = IRC_ConsumeParse(state);
         }
-        IRC_DestroyParseState(state);
+
+        if(fl_locked)
+          Fl::unlock();
+
+        // A read can end partway through a line. Keep the rest for the next
+        // read to finish, unless the connection changes before then.
+        if(IRC_GetParseStatus(state)==IRC_unexpectedEnd)
+          old_state = state;
+        else
+          IRC_DestroyParseState(state);
 
     }
 
@@ -182,11 +272,29 @@ Server::Server(const struct ServerState &init_state, Window *w)
   , last_channel(nullptr)
   , widget(new Fl_Group(0, 0, 800, 600))
   , channel_list(nullptr)
+  , shard(Shards::Assign())
   , task_died(false)
-  , network_task(new ServerTask(this, init_state.socket, &task_died)){
-    
+  , network_task(new ServerTask(this, init_state.socket, &task_died))
+  , metrics(Metrics::RegisterServer(init_state.name))
+  , connections(0)
+  , socket_watched(false)
+  , last_activity(SteadyMilliseconds())
+  , ping_sent(0)
+  , auto_reconnect(true)
+  , reconnect_failures(0)
+  , next_reconnect(0)
+  , highlight_generation(0)
+  , caps(0)
+  , lifecycle(Registering)
+  , nick_attempts(0)
+  , outgoing_progress(0)
+  , write_failed(false){
+
+    IRC_CapInit(&cap_negotiation, wanted_caps);
+
     CopyState(state, init_state);
     state.socket = init_state.socket;
+    wanted_nick = state.nick;
     
     Channel *channel = new Channel(this, "server");
     
@@ -199,21 +307,14 @@ Server::Server(const struct ServerState &init_state, Window *w)
 
     w->SetChannel(channel);
 
-    Thread::AddShortRunningTask(network_task);
-
-    Thread::AddSocketToTaskGroup(state.socket, Thread::GetShortThreadPool());
-
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Ping_Handler(this)));
-    // This should all be put in the call before construction
-
-    IRC_Message *msg_name = IRC_CreateUser(state.name.c_str(), "falcon", "millenium", state.real.c_str());
-    IRC_Message *msg_nick = IRC_CreateNick(state.nick.c_str());
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Pong_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Cap_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new Registration_Handler(this)));
+    Handlers.push_back(std::unique_ptr<MessageHandler>(new ISupport_Handler(this)));
 
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Debug_Handler()));
 
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new SendMessage_Handler(this, msg_name)));
-    Handlers.push_back(std::unique_ptr<MessageHandler>(new SendMessage_Handler(this, msg_nick)));
-
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Join_Handler(this)));
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Part_Handler(this)));
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Topic_Handler(this)));
@@ -225,28 +326,44 @@ Server::Server(const struct ServerState &init_state, Window *w)
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Nick_Handler(this)));
     Handlers.push_back(std::unique_ptr<MessageHandler>(new Notice_Handler(this)));
 
+    std::vector<std::string> autojoin;
     for(std::list<std::string>::const_iterator iter = state.channels.cbegin(); iter!=state.channels.cend(); iter++){
 
-        printf("Joining %s.\n", iter->c_str());
+        KLOG_INFO(Server, "Joining %s.", iter->c_str());
 
-        IRC_Message *msg = IRC_CreateJoin(1, iter->c_str());
-        SendMessage(msg);
         JoinChannel(iter->c_str());
-        Handlers.push_back(std::unique_ptr<MessageHandler>(new SendMessageOn_Handler<OnMsgType<IRC_welcome_num> >(this, msg)));
+        autojoin.push_back(*iter);
         
     }
+    lock();
+    QueueJoins_l(autojoin);
+    unlock();
+
+    // Nothing can be read until the ServerTask is running, so every handler
+    // is in place before the shard can give out a message. Handlers added
+    // after this point have to be added with the Server locked.
+    Thread::AddTask(Shards::GetTaskGroup(shard), network_task);
+
+    WatchSocket();
+
+    // The socket is already connected, and everything is ready for the reply.
+    Register();
+
+    KLOG_DEBUG(Server, "Creating Server %s on shard %u.", GetName().c_str(), shard);
 
-    printf("Creating Server.\n");
+    // Servers may be created on any thread, but timeouts belong to the main one.
+    Fl::awake(StartLagCheck_CB, this);
 }
 
 Server::~Server(){
-    printf("Closing Server.\n");
+    KLOG_DEBUG(Server, "Closing Server %s.", GetName().c_str());
+
+    Fl::remove_timeout(LagCheck_CB, this);
 
     lock();
     network_task->should_die = true;
     
-    if(IsConnected())
-        Thread::RemoveSocketFromTaskGroup(state.socket, Thread::GetShortThreadPool());
+    UnwatchSocket();
 
     while(!task_died){
         unlock();
@@ -260,6 +377,9 @@ Server::~Server(){
     Disconnect_Socket(state.socket);
     Destroy_Socket(state.socket);
 
+    Metrics::RetireServer(metrics);
+
+    Shards::Release(shard);
 
 }
 
@@ -269,8 +389,12 @@ void Server::SendMessage(IRC_Message *msg){
     std::string msg_r;
 
 
-    if(msg->type==IRC_nick){
+    // Once registered, the nick is only ours when the server says so, which
+    // NickReceived hears about. Before then, Register asks for it again.
+    if((msg->type==IRC_nick) && (lifecycle!=Registered)){
         state.nick = msg->parameters[0];
+        wanted_nick = state.nick;
+        highlight_generation++;
     }
     if((msg->type==IRC_privmsg) && (msg->num_parameters>1)){
         // TODO: Stop the evil empire that is freenode.
@@ -281,18 +405,280 @@ void Server::SendMessage(IRC_Message *msg){
         msg->parameters[swap_n] = msg_r.c_str();
     }
 
-    const char *str = IRC_MessageToString(msg);
+    SendMessages(&msg, 1);
+
+    if((swap_n>0) && (msg->num_parameters>swap_n))
+       msg->parameters[swap_n] = swap;
+}
+
+
+void Server::SendMessages(IRC_Message *const *msgs, unsigned long n){
+
+    std::string out;
+
+    for(unsigned long i = 0; i<n; i++){
+        const char *str = IRC_MessageToString(msgs[i]);
+
+        KLOG_DEBUG(Server, "Writing message %s", str);
+
+        out+=str;
+        free((void *)str);
+    }
+
+    metrics->bytes_out.Add(out.size());
+    metrics->lines_out.Add(n);
 
-    Write_Socket(state.socket, str);
+    {
+        std::lock_guard<std::mutex> guard(outgoing_lock);
+        if(outgoing.empty())
+            outgoing_progress = SteadyMilliseconds();
+        outgoing+=out;
+    }
 
-    printf("Writing message %s\n", str);
+    if(FlushOutgoing())
+        Thread::RetryTaskGroup(Shards::GetTaskGroup(shard));
 
-    free((void *)str);
+}
+
+
+bool Server::FlushOutgoing(){
+
+    std::lock_guard<std::mutex> guard(outgoing_lock);
+
+    if(outgoing.empty())
+        return false;
+
+    // Nothing queued for a lost connection is worth sending to the next one,
+    // which starts with Register.
+    if(write_failed || (State_Socket(state.socket)!=eConnected)){
+        outgoing.clear();
+        return false;
+    }
+
+    unsigned long written = 0;
+    if(WriteSome_Socket(state.socket, outgoing.data(), outgoing.size(), &written)!=eSuccess){
+        KLOG_WARNING(Server, "Could not write to %s.", GetName().c_str());
+        outgoing.clear();
+        write_failed = true;
+        return false;
+    }
+
+    const long long now = SteadyMilliseconds();
+
+    if(written!=0){
+        outgoing.erase(0, written);
+        outgoing_progress = now;
+    }
+    else if(now-outgoing_progress>=write_deadline_ms){
+        KLOG_WARNING(Server, "%s has not read anything in %lli seconds.", GetName().c_str(), write_deadline_ms/1000);
+        outgoing.clear();
+        write_failed = true;
+        return false;
+    }
+
+    return !outgoing.empty();
+
+}
+
+void Server::GiveMessage(IRC_Message *msg){
+
+    bool held = false;
+
+    if(HasCap(IRC_cap_batch)){
+        lock();
+        held = BatchMessage_l(msg);
+        unlock();
+    }
+
+    if(!held)
+        LockingReciever<Window, Monitor>::GiveMessage(msg);
 
-    if((swap_n>0) && (msg->num_parameters>swap_n))
-       msg->parameters[swap_n] = swap;
 }
 
+
+bool Server::BatchMessage_l(IRC_Message *msg){
+
+    if(msg->type==IRC_batch){
+        if(msg->num_parameters<1)
+            return false;
+
+        const char *ref = msg->parameters[0];
+
+        if((ref[0]=='+') && (msg->num_parameters>1)){
+            const bool netjoin = strcmp(msg->parameters[1], "netjoin")==0;
+            if((!netjoin) && (strcmp(msg->parameters[1], "netsplit")!=0))
+                return false;
+
+            Batch &batch = batches[ref+1];
+            batch.netjoin = netjoin;
+            batch.servers.clear();
+            batch.members.clear();
+
+            for(long i = 2; i<msg->num_parameters; i++){
+                if(!batch.servers.empty())
+                    batch.servers.push_back(' ');
+                batch.servers+=msg->parameters[i];
+            }
+
+            return true;
+        }
+        else if(ref[0]=='-'){
+            std::map<std::string, Batch>::iterator iter = batches.find(ref+1);
+            if(iter==batches.end())
+                return false;
+
+            ApplyBatch_l(iter->second);
+            batches.erase(iter);
+
+            return true;
+        }
+
+        return false;
+    }
+
+    if(batches.empty())
+        return false;
+
+    unsigned long len;
+    const char *ref = IRC_FindTag(msg, "batch", &len);
+    if(ref==nullptr)
+        return false;
+
+    std::map<std::string, Batch>::iterator iter = batches.find(std::string(ref, len));
+    if(iter==batches.end())
+        return false;
+
+    Batch &batch = iter->second;
+    from_reader r;
+
+    if(batch.netjoin && (msg->type==IRC_join) && (msg->num_parameters>0)){
+        batch.members.push_back({msg->parameters[0], r(msg)});
+        return true;
+    }
+    else if((!batch.netjoin) && (msg->type==IRC_quit)){
+        batch.members.push_back({std::string(), r(msg)});
+        return true;
+    }
+
+    // Anything else in the batch, such as the MODEs after a netjoin, is
+    // handled as usual.
+    return false;
+
+}
+
+
+void Server::ApplyBatch_l(const Batch &batch){
+
+    KLOG_INFO(Server, "Net%s of %lu users on %s (%s).", batch.netjoin?"join":"split",
+        static_cast<unsigned long>(batch.members.size()), GetName().c_str(), batch.servers.c_str());
+
+    if(!batch.netjoin){
+        std::map<Channel *, std::vector<Interned> > quits;
+
+        // Nicks that aren't interned aren't in any of our Channels.
+        for(std::vector<std::pair<std::string, std::string> >::const_iterator i = batch.members.cbegin(); i!=batch.members.cend(); i++){
+            const Interned nick = names.Find(i->second);
+            if(!nick)
+                continue;
+
+            const std::vector<Channel *> in = ChannelsWith_l(nick);
+            for(std::vector<Channel *>::const_iterator c = in.cbegin(); c!=in.cend(); c++)
+                quits[*c].push_back(nick);
+        }
+
+        for(std::map<Channel *, std::vector<Interned> >::const_iterator i = quits.cbegin(); i!=quits.cend(); i++)
+            i->first->BulkQuit(i->second, batch.servers);
+
+        return;
+    }
+
+    std::map<Channel *, std::vector<Interned> > joins;
+    for(std::vector<std::pair<std::string, std::string> >::const_iterator i = batch.members.cbegin(); i!=batch.members.cend(); i++){
+        Channel *channel = FindChannel_l(i->first.c_str());
+        if(channel!=nullptr)
+            joins[channel].push_back(names.Intern(i->second));
+    }
+
+    for(std::map<Channel *, std::vector<Interned> >::const_iterator i = joins.cbegin(); i!=joins.cend(); i++)
+        i->first->BulkJoin(i->second, batch.servers);
+
+}
+
+
+Channel *Server::FindChannel_l(const char *name){
+
+    // Anything that isn't interned can't be the name of a Channel.
+    const Interned key = names.Find(name);
+    if(!key)
+        return nullptr;
+
+    ChannelList::const_iterator iter = std::find_if(channels.cbegin(), channels.cend(), find_channel(key));
+    return (iter==channels.cend())?nullptr:iter->get();
+
+}
+
+
+bool Server::AddMember_l(const Interned &nick, Channel *channel){
+
+    std::vector<Channel *> &in = members[nick.Handle()];
+    if(std::find(in.cbegin(), in.cend(), channel)!=in.cend())
+        return false;
+
+    in.push_back(channel);
+    return true;
+
+}
+
+
+void Server::RemoveMember_l(const Interned &nick, Channel *channel){
+
+    std::unordered_map<const IRC_Interned *, std::vector<Channel *> >::iterator iter = members.find(nick.Handle());
+    if(iter==members.end())
+        return;
+
+    std::vector<Channel *> &in = iter->second;
+    std::vector<Channel *>::iterator i = std::find(in.begin(), in.end(), channel);
+    if(i==in.end())
+        return;
+
+    // Order doesn't matter, so the last one fills the gap.
+    *i = in.back();
+    in.pop_back();
+
+    // The handle is only kept alive by the Users that hold it.
+    if(in.empty())
+        members.erase(iter);
+
+}
+
+
+std::vector<Channel *> Server::ChannelsWith_l(const Interned &nick) const{
+
+    std::unordered_map<const IRC_Interned *, std::vector<Channel *> >::const_iterator iter = members.find(nick.Handle());
+    return (iter==members.cend())?std::vector<Channel *>():iter->second;
+
+}
+
+
+void Server::RenameMember_l(const Interned &from, const Interned &to){
+
+    // A change of case only is the same handle.
+    if(from==to)
+        return;
+
+    std::unordered_map<const IRC_Interned *, std::vector<Channel *> >::iterator iter = members.find(from.Handle());
+    if(iter==members.end())
+        return;
+
+    const std::vector<Channel *> in = std::move(iter->second);
+    members.erase(iter);
+
+    for(std::vector<Channel *>::const_iterator i = in.cbegin(); i!=in.cend(); i++)
+        AddMember_l(to, *i);
+
+}
+
+
 void Server::AddChannel_l(Channel *a){
     
     channels.push_back(std::move(std::unique_ptr<Channel>(a)));
@@ -302,7 +688,7 @@ void Server::AddChannel_l(Channel *a){
 
     channel_list->add(a->name.c_str());
 
-    printf("Added channel %s\n", a->name.c_str());
+    KLOG_DEBUG(Server, "Added channel %s", a->name.c_str());
 
 }
 void Server::AddChannel(Channel *a){
@@ -336,10 +722,9 @@ void Server::Show(Channel *chan){
 
     if((chan) && (chan!=last_channel)){
         if(last_channel)
-          last_channel->widget->hide();
+          last_channel->LoseFocus();
 
-        if(chan)
-          chan->widget->show();
+        chan->GiveFocus();
 
     }
 
@@ -389,31 +774,426 @@ std::shared_ptr<PromiseValue<Channel *> > Server::JoinChannel(const std::string
     return handler_raw->promise;
 }
 
-std::shared_ptr<PromiseValue<bool> > Server::Reconnect(){
-    
-    if((last_connection.get()) && (last_connection->IsReady())){
-        ServerConnectTask *task = new ServerConnectTask(this, state.socket, state.port, true);
+void Server::Reconnect(){
+
+    auto_reconnect = true;
+    reconnect_failures = 0;
+    next_reconnect = 0;
+
+    StartReconnect();
+
+}
+
+
+void Server::StartReconnect(){
+
+    lock();
+
+    if(lifecycle==Connecting){
+        unlock();
+        return;
+    }
+
+    lifecycle = Connecting;
+
+    UnwatchSocket();
+    Disconnect_Socket(state.socket);
+    connections++;
+    unlock();
+
+    Disable();
 
-        Thread::AddLongRunningTask(task);
+    ping_sent = 0;
+    metrics->lag_ms.Set(0);
 
-        last_connection = task->promise;
+    ServerConnectTask *task = new ServerConnectTask(this, state.socket, state.port, true, state.SSL);
+
+    metrics->reconnects.Add();
+
+    Thread::AddLongRunningTask(task);
+
+}
+
+
+void Server::AutoReconnect(){
+
+    if((!auto_reconnect) || (lifecycle==Connecting))
+        return;
+
+    const long long now = SteadyMilliseconds();
+    if(now<next_reconnect)
+        return;
+
+    // Wait 5 seconds after the first failure, doubling up to 5 minutes.
+    next_reconnect = now+std::min(5000ll<<std::min(reconnect_failures, 6u), 300000ll);
+    reconnect_failures++;
+
+    KLOG_INFO(Server, "Lost connection to %s, reconnecting.", GetName().c_str());
+
+    StartReconnect();
+
+}
+
+
+void Server::StartLagCheck_CB(void *p){
+    Fl::add_timeout(lag_check_period, LagCheck_CB, p);
+}
+
+
+void Server::LagCheck_CB(void *p){
+
+    Server *server = static_cast<Server *>(p);
+
+    server->CheckLag();
+
+    Fl::repeat_timeout(lag_check_period, LagCheck_CB, p);
+
+}
+
+
+void Server::CheckLag(){
+
+    // Don't judge a connection that is still being made.
+    if(lifecycle==Connecting)
+        return;
+
+    if(!IsConnected()){
+        AutoReconnect();
+        return;
+    }
+
+    const Settings &settings = GetSettings();
+    const int interval = settings.lag_ping_interval, timeout = settings.lag_timeout;
+
+    if(interval<=0)
+        return;
+
+    const long long now = SteadyMilliseconds();
+    const long long sent = ping_sent;
+
+    if(sent!=0){
+        const long long lag = now-sent;
+        metrics->lag_ms.Set(lag);
+
+        // A half-open connection looks perfectly healthy to State_Socket, so
+        // an unanswered PING is the only way to notice it.
+        if((timeout>0) && (lag>=timeout*1000ll)){
+            KLOG_WARNING(Server, "No PONG from %s in %lli seconds.", GetName().c_str(), lag/1000);
+            AutoReconnect();
+        }
+    }
+    else if(now-last_activity>=interval*1000ll){
+        char token[32];
+        snprintf(token, sizeof(token), "%s%lli", ping_token_prefix, now);
+
+        ping_sent = now;
+
+        IRC_Message *msg = IRC_CreatePing(token);
+        SendMessage(msg);
+        IRC_FreeMessage(msg);
+    }
+
+}
+
+
+void Server::PongReceived(const char *token){
+
+    if(strncmp(token, ping_token_prefix, sizeof(ping_token_prefix)-1)!=0)
+        return;
+
+    long long sent = strtoll(token+sizeof(ping_token_prefix)-1, nullptr, 10);
+
+    // Only the PONG for the outstanding PING counts. Anything else is stale.
+    if((sent==0) || (!ping_sent.compare_exchange_strong(sent, 0)))
+        return;
+
+    const long long rtt = SteadyMilliseconds()-sent;
+
+    metrics->ping_rtt_ms.Set(rtt);
+    metrics->lag_ms.Set(0);
+
+    KLOG_DEBUG(Server, "PONG from %s after %lli ms.", GetName().c_str(), rtt);
+
+}
+
+
+void Server::CapReceived(IRC_Message *msg){
+
+    IRC_Message *reply = nullptr;
+
+    if(msg->type==IRC_welcome_num){
+        // Servers that don't know CAP just ignore it and welcome us anyway.
+        if(cap_negotiation.state!=IRC_cap_done)
+            IRC_CapFinish(&cap_negotiation);
     }
+    else
+        reply = IRC_CapHandle(&cap_negotiation, msg);
+
+    caps = cap_negotiation.enabled;
+
+    if(reply!=nullptr){
+        SendMessage(reply);
+        IRC_FreeMessage(reply);
+    }
+
+    if(msg->type==IRC_welcome_num)
+        KLOG_INFO(Server, "Capabilities on %s: 0x%lx", GetName().c_str(), cap_negotiation.enabled);
+
+}
+
+
+void Server::ISupportReceived(IRC_Message *msg){
+
+    if(!IRC_ISupportParse(&isupport, msg))
+        return;
+
+    KLOG_INFO(Server, "%s uses casemapping %i.", GetName().c_str(), isupport.casemapping);
+
+    names.SetCaseMapping(isupport.fold);
+    highlight_generation++;
+
+}
+
+
+void Server::Register(){
+
+    IRC_Message *msgs[3];
+
+    lock();
+
+    // A new connection starts from scratch. Asking for the capabilities first
+    // makes the server wait for CAP END before finishing registration, so
+    // there is no need to hear from it before sending the rest.
+    msgs[0] = IRC_CapBegin(&cap_negotiation);
+    caps = 0;
+    batches.clear();
+
+    {
+        std::lock_guard<std::mutex> guard(outgoing_lock);
+        outgoing.clear();
+        write_failed = false;
+    }
+
+    lifecycle = Registering;
+    nick_attempts = 0;
+    if(state.nick!=wanted_nick){
+        state.nick = wanted_nick;
+        highlight_generation++;
+    }
+
+    msgs[1] = IRC_CreateNick(state.nick.c_str());
+    msgs[2] = IRC_CreateUser(state.name.c_str(), "falcon", "millenium", state.real.c_str());
+
+    SendMessages(msgs, 3);
+
+    unlock();
 
-    return last_connection;
+    for(unsigned i = 0; i<3; i++)
+        IRC_FreeMessage(msgs[i]);
 
 }
 
 
+//! Alternates that RegistrationReceived tries before giving up.
+static const unsigned max_nick_attempts = 8;
+
+//! Numbers that alternates after the underscores end in. Fixed, so that every
+//! attempt is different and the same ones are tried every time.
+static const unsigned alternate_numbers[max_nick_attempts-3] = {7, 42, 314, 808, 2718};
+
+//! Returns the alternate for @p nick to try on @p attempt, which starts at 1.
+//! The first few add underscores, and the rest end in a number, cutting the
+//! nick short if it is needed to fit in @p nicklen.
+static std::string AlternateNick(const std::string &nick, unsigned attempt, unsigned long nicklen){
+
+    assert((attempt>0) && (attempt<=max_nick_attempts));
+
+    std::string suffix;
+    if(attempt<=3)
+        suffix.assign(attempt, '_');
+    else
+        suffix = std::to_string(alternate_numbers[attempt-4]);
+
+    // Servers that have not sent NICKLEN yet may take more than the default.
+    const std::string::size_type limit = std::max<std::string::size_type>(nicklen, nick.size());
+    if(nick.size()+suffix.size()<=limit)
+        return nick+suffix;
+    if(suffix.size()>=limit)
+        return suffix;
+    return nick.substr(0, limit-suffix.size())+suffix;
+
+}
+
+
+void Server::RegistrationReceived(IRC_Message *msg){
+
+    if(msg->type==IRC_welcome_num){
+        lifecycle = Registered;
+
+        // The server says what our nick is, in case it changed it.
+        if((msg->num_parameters>0) && (state.nick!=msg->parameters[0])){
+            state.nick = msg->parameters[0];
+            highlight_generation++;
+        }
+
+        KLOG_INFO(Server, "Registered on %s as %s.", GetName().c_str(), state.nick.c_str());
+
+        std::vector<std::string> joins;
+        joins.swap(pending_joins);
+        SendJoins_l(joins);
+
+        return;
+    }
+
+    if(lifecycle==Registered){
+        // A NICK we sent was refused, so we still have the one we had, and
+        // wanted_nick is still the one to ask for after a reconnect.
+        if((msg->num_parameters>0) && (strcmp(msg->parameters[0], "*")!=0) &&
+          (state.nick!=msg->parameters[0])){
+            state.nick = msg->parameters[0];
+            highlight_generation++;
+        }
+        return;
+    }
+
+    if(nick_attempts>=max_nick_attempts){
+        KLOG_WARNING(Server, "Could not find a free nick on %s.", GetName().c_str());
+        return;
+    }
+
+    nick_attempts++;
+
+    const std::string taken = state.nick;
+    state.nick = AlternateNick(wanted_nick, nick_attempts, isupport.nicklen);
+    highlight_generation++;
+
+    KLOG_INFO(Server, "%s is taken on %s, trying %s.", taken.c_str(), GetName().c_str(), state.nick.c_str());
+
+    IRC_Message *msg_nick = IRC_CreateNick(state.nick.c_str());
+    SendMessages(&msg_nick, 1);
+    IRC_FreeMessage(msg_nick);
+
+}
+
+
+void Server::NickReceived(const char *from, const char *to){
+
+    // The server folds nicks with its casemapping, and so must we.
+    std::string from_folded = from, nick_folded = state.nick;
+    IRC_ISupportFold(&isupport, &from_folded[0], from_folded.c_str(), from_folded.size());
+    IRC_ISupportFold(&isupport, &nick_folded[0], nick_folded.c_str(), nick_folded.size());
+
+    if(from_folded!=nick_folded)
+        return;
+
+    state.nick = to;
+    wanted_nick = state.nick;
+    highlight_generation++;
+
+}
+
+
+void Server::QueueRejoin(){
+
+    std::vector<std::string> rejoin;
+
+    lock();
+
+    for(ChannelList::const_iterator i = channels.cbegin(); i!=channels.cend(); i++){
+        const std::string &name = (*i)->name;
+
+        // Skips the server channel and private conversations.
+        if(!IRC_ISupportIsChannel(&isupport, name.c_str()))
+            continue;
+
+        rejoin.push_back(name);
+    }
+
+    QueueJoins_l(rejoin);
+
+    unlock();
+
+}
+
+
+void Server::QueueJoins_l(const std::vector<std::string> &channels){
+
+    if(lifecycle==Registered){
+        SendJoins_l(channels);
+        return;
+    }
+
+    for(std::vector<std::string>::const_iterator i = channels.cbegin(); i!=channels.cend(); i++){
+        // A rejoin after a reconnect that never got welcomed may repeat some.
+        if(std::find(pending_joins.cbegin(), pending_joins.cend(), *i)==pending_joins.cend())
+            pending_joins.push_back(*i);
+    }
+
+}
+
+
+void Server::SendJoins_l(const std::vector<std::string> &channels){
+
+    std::vector<IRC_Message *> msgs;
+    std::vector<const char *> targets;
+    for(std::vector<std::string>::const_iterator i = channels.cbegin(); i!=channels.cend(); i++)
+        targets.push_back(i->c_str());
+
+    unsigned long n = 0;
+    while(n<targets.size()){
+        const unsigned long count = IRC_ISupportCoalesce(&isupport, "JOIN", targets.data()+n, targets.size()-n, 0);
+
+        std::string joined = targets[n];
+        for(unsigned long e = n+1; e<n+count; e++){
+            joined+=',';
+            joined+=targets[e];
+        }
+        n+=count;
+
+        msgs.push_back(IRC_CreateJoinSingle(joined.c_str()));
+    }
+
+    if(msgs.empty())
+        return;
+
+    SendMessages(msgs.data(), msgs.size());
+
+    for(std::vector<IRC_Message *>::iterator i = msgs.begin(); i!=msgs.end(); i++)
+        IRC_FreeMessage(*i);
+
+}
+
+
+void Server::WatchSocket(){
+    if(!socket_watched.exchange(true))
+        Thread::AddSocketToTaskGroup(state.socket, Shards::GetTaskGroup(shard));
+}
+
+
+void Server::UnwatchSocket(){
+    if(socket_watched.exchange(false))
+        Thread::RemoveSocketFromTaskGroup(state.socket, Shards::GetTaskGroup(shard));
+}
+
+
 void Server::Disconnect(){
-    last_connection.reset();
+    auto_reconnect = false;
+
+    lock();
+    lifecycle = Disconnected;
+    UnwatchSocket();
     Disconnect_Socket(state.socket);
+    connections++;
+    unlock();
+
+    ping_sent = 0;
     Disable();
 }
 
 
 bool Server::IsConnected() const{
     WSockErr e = State_Socket(state.socket);
-    return e==eConnected;
+    return (e==eConnected) && !write_failed;
 }
 
 
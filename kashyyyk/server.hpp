@@ -10,9 +10,16 @@
 #include "reciever.hpp"
 #include "promise.hpp"
 #include "autolocker.hpp"
+#include "intern.hpp"
+#include "cap.h"
+#include "isupport.h"
 
 #include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
 #include <memory>
+#include <mutex>
 #include <atomic>
 #include <string>
 #include <algorithm>
@@ -30,6 +37,8 @@ namespace std {class atomic_flag;}
 
 namespace Kashyyyk{
 
+namespace Metrics {struct ServerMetrics;}
+
 class Channel;
 class ServerTask;
 
@@ -39,14 +48,15 @@ class ServerConnectTask : public Task {
     WSocket * const socket;
     bool reconnect_channels;
     long port;
+    //! Starts TLS once connected. The socket keeps the last session it had,
+    //! so reconnecting to the same server resumes it.
+    bool ssl;
 public:
 
     ServerConnectTask(Server *aServer, WSocket *aSocket, long prt = 6665, bool reconnect_chans = true, bool SSL = false);
 
     void Run() override;
 
-    std::shared_ptr<PromiseValue<bool> > promise;
-
 };
 
 
@@ -60,9 +70,8 @@ public:
 //! much about the Server's Channels. In the case of server-only messages, such
 //! as PING or NOTICE messages, the Handler won't even touch any Channels. If
 //! the message has a clear target, such as a PRIVMSG, it will be sent to the
-//! appropriate channel. Other messages, such as QUITs, will be sent to all
-//! Channels. It will be up to the channels to decide if such Channel-specific
-//! messages with no codified target are relevant or not.
+//! appropriate channel. QUITs and NICKs have no target, so the Server keeps
+//! track of which Channels each nick is in and only tells those Channels.
 //!
 //! Other MessageHandlers do exist, such as listeners for JOIN success, or
 //! one-shot reactionary responses for registration.
@@ -80,6 +89,19 @@ public:
     
     //! Callback for reconnecting server.
     static void ReconnectServer_CB(Fl_Widget *, void *p);
+
+    //! @brief Where the connection is in its life.
+    //!
+    //! Disconnected becomes Connecting when a ServerConnectTask is started,
+    //! which goes on to Registering once the socket is connected, or back to
+    //! Disconnected if it could not be. The server's 001 makes it Registered.
+    //! Losing the connection or Disconnect make it Disconnected again.
+    enum Lifecycle {
+        Disconnected,
+        Connecting,
+        Registering,
+        Registered
+    };
     
     //!
     //! @brief IRC Server Information
@@ -110,13 +132,190 @@ protected:
     
     std::unique_ptr<Fl_Hold_Browser> channel_list;
 
+    //! Shard whose Thread runs network_task and whose NetworkWatch polls the
+    //! socket. See shards.hpp.
+    const unsigned shard;
+
     bool task_died;
     ServerTask * const network_task;
 
+    Metrics::ServerMetrics * const metrics;
+
+    //! Incremented every time the socket is reconnected, so that the
+    //! ServerTask knows to throw away any half-parsed line.
+    std::atomic<unsigned> connections;
+
+    //! True while the socket is in the shard's NetworkWatch.
+    std::atomic<bool> socket_watched;
+
+    //! @name Lag Detection
+    //! Times are milliseconds on the steady clock.
+    //! @{
+
+    //! Last time anything was read from the socket.
+    std::atomic<long long> last_activity;
+    //! When our outstanding PING was sent, or 0 if there isn't one.
+    std::atomic<long long> ping_sent;
+
+    //! False after Disconnect, so that the connection is left alone.
+    //! Only used with the FLTK lock held, as are the next two.
+    bool auto_reconnect;
+    //! Automatic reconnects since the last successful one, for backing off.
+    unsigned reconnect_failures;
+    //! Earliest time to try another automatic reconnect.
+    long long next_reconnect;
+
+    //! Adds the lag check timeout. Called on the main thread using Fl::awake.
+    static void StartLagCheck_CB(void *p);
+    //! Periodically calls CheckLag.
+    static void LagCheck_CB(void *p);
+
+    //! Sends a PING if the server has been quiet for `sys.lag.ping.interval`
+    //! seconds, and reconnects if a PING has gone unanswered for
+    //! `sys.lag.timeout` seconds or the socket has been lost.
+    //! Must be called on the main thread.
+    void CheckLag();
+
+    //! Reconnects if the last reconnect is finished and enough time has
+    //! passed since the last automatic attempt. Needs the FLTK lock.
+    void AutoReconnect();
+
+    //! @}
+
+    //! Changed whenever something Channels build their highlight words from
+    //! changes, so that they know to build them again.
+    std::atomic<unsigned> highlight_generation;
+
+    //! CAP negotiation for the current connection. Guarded by the Server's
+    //! lock, since it is only touched while handling messages.
+    struct IRC_CapNegotiation cap_negotiation;
+    //! Copy of cap_negotiation.enabled that can be read from any thread.
+    std::atomic<unsigned long> caps;
+
+    //! What the server told us in its 005s. Kept across reconnects, since the
+    //! last connection's values are the best guess until new ones arrive.
+    //! Guarded by the Server's lock.
+    struct IRC_ISupport isupport;
+
+    //! @name Batches
+    //! @{
+
+    //! @brief An open netsplit or netjoin BATCH.
+    //!
+    //! The QUITs or JOINs in it are held back until the BATCH ends, and then
+    //! each Channel applies them all at once.
+    struct Batch {
+        bool netjoin;
+        //! Servers named in the BATCH, for the summary line.
+        std::string servers;
+        //! Channel and nick of every JOIN, or just the nick of every QUIT.
+        std::vector<std::pair<std::string, std::string> > members;
+    };
+
+    //! Open Batches by reference tag. Guarded by the Server's lock.
+    std::map<std::string, Batch> batches;
+
+    //! Opens or closes a Batch if @p msg is a BATCH, or adds @p msg to an
+    //! open one. Returns true if @p msg should not be handled any further.
+    //! Must be called with the Server locked.
+    bool BatchMessage_l(IRC_Message *msg);
+
+    //! Gives every member of @p batch to the Channels in one go.
+    //! Must be called with the Server locked.
+    void ApplyBatch_l(const Batch &batch);
+
+    //! @}
+
+    //! Drops the connection and starts a ServerConnectTask, unless one is
+    //! already in progress. Needs the FLTK lock.
+    void StartReconnect();
+
+    //! @name Registration
+    //! @{
+
+    //! Only changed with the Server locked, but can be read from any thread.
+    std::atomic<Lifecycle> lifecycle;
+    //! The rest of these are guarded by the Server's lock.
+    //! The nick that the user asked for. state.nick is the one we have, which
+    //! may be an alternate if this one was taken.
+    std::string wanted_nick;
+    //! Alternates tried since Register.
+    unsigned nick_attempts;
+    //! Channels to join as soon as the server welcomes us.
+    std::vector<std::string> pending_joins;
+
+    //! Sends CAP LS, NICK and USER in a single write as soon as we are
+    //! connected, rather than waiting for the server to say something first.
+    void Register();
+    //! Rejoins every Channel once the server welcomes us.
+    void QueueRejoin();
+    //! Joins @p channels once the server welcomes us, or at once if it
+    //! already has. Must be called with the Server locked.
+    void QueueJoins_l(const std::vector<std::string> &channels);
+    //! Sends JOINs for @p channels in a single write, with as many in each
+    //! JOIN as TARGMAX and LINELEN allow.
+    //! Must be called with the Server locked.
+    void SendJoins_l(const std::vector<std::string> &channels);
+
+    //! @}
+
+    //! @name Output
+    //! Nothing ever waits for the socket to take what is written, since the
+    //! FLTK lock or the Server's lock is held by whoever writes.
+    //! @{
+
+    //! What the socket hasn't taken yet, oldest first.
+    std::string outgoing;
+    //! Guards outgoing and outgoing_progress. No other lock is ever taken
+    //! while holding it.
+    std::mutex outgoing_lock;
+    //! When the socket last took some of outgoing, or when outgoing stopped
+    //! being empty.
+    long long outgoing_progress;
+    //! Set when a write fails or the server stops reading for too long. The
+    //! ServerTask then treats the connection as lost.
+    std::atomic<bool> write_failed;
+
+    //! Writes all of @p msgs out the socket at once, or queues what the
+    //! socket won't take for the ServerTask to write later.
+    void SendMessages(IRC_Message *const *msgs, unsigned long n);
+    //! Writes as much of outgoing as the socket will take. Returns true if
+    //! some is left, in which case the shard should try again soon.
+    bool FlushOutgoing();
+
+    //! @}
+
+    //! Adds the socket to the shard's NetworkWatch.
+    void WatchSocket();
+    //! Removes the socket from the NetworkWatch, if it is in it. This must be
+    //! done before the socket is disconnected.
+    void UnwatchSocket();
+
     void Show(Channel *chan);
 
     void FocusChanged() const;
 
+    //! Nicks and channel names seen on this Server. Declared before channels,
+    //! since their Users hold handles into it.
+    InternTable names;
+
+    //! @name Membership
+    //! @{
+
+    //! The Channels that each nick is in, keyed by Interned::Handle, so that
+    //! a QUIT or NICK only goes to the Channels it concerns. Channels keep it
+    //! up to date as their Users change. Guarded by the Server's lock.
+    std::unordered_map<const IRC_Interned *, std::vector<Channel *> > members;
+
+    //! Records that @p nick is in @p channel. Returns false if it already
+    //! was. Must be called with the Server locked.
+    bool AddMember_l(const Interned &nick, Channel *channel);
+    //! Records that @p nick is no longer in @p channel.
+    //! Must be called with the Server locked.
+    void RemoveMember_l(const Interned &nick, Channel *channel);
+
+    //! @}
+
     ChannelList channels;
 
     struct ServerState state;
@@ -126,6 +325,7 @@ public:
     friend class Channel;
     friend class Window;
     friend class ServerConnectTask;
+    friend class ServerTask;
     friend class AutoLocker<Server *>;
 
     //! Constructs a server using an initial state
@@ -144,11 +344,42 @@ public:
     //! Retrieves a list of channels that are currently joined on this server. 
     const ChannelList &GetChannels() const{return channels;}
 
+    //! Returns the table that this Server's nicks and channel names are
+    //! interned in. Safe to use from any thread.
+    InternTable &Names() {return names;}
+
+    //! Returns the Channel named @p name, ignoring case, or nullptr.
+    //! @warning You must lock this Server before calling this.
+    Channel *FindChannel_l(const char *name);
+
+    //! Returns the Channels that @p nick is in.
+    //! @warning You must lock this Server before calling this.
+    std::vector<Channel *> ChannelsWith_l(const Interned &nick) const;
+
+    //! Moves every Channel that @p from is in over to @p to, after a NICK.
+    //! The Channels' own Users are renamed with Channel::RenameUser.
+    //! @warning You must lock this Server before calling this.
+    void RenameMember_l(const Interned &from, const Interned &to);
+
+    //! Returns the characters that can come before a nick to show its
+    //! channel mode, such as "@+".
+    //! @warning You must lock this Server before calling this.
+    const char *UserPrefixes_l() const {return isupport.prefix_chars;}
+
+    //! Changes whenever our nick or the casemapping change. Safe to use from
+    //! any thread. Changes to the global highlight words are noticed through
+    //! the Settings generation instead.
+    unsigned HighlightGeneration() const {return highlight_generation.load();}
+
+    //! Returns the metrics for this server. Safe to use from any thread.
+    Metrics::ServerMetrics *GetMetrics() const {return metrics;}
+
     //! @brief Returns if this server is connected
     bool IsConnected() const;
     
-    //! Maintains the state of the last attempt to connect (in progress, succeeded, failed)
-    mutable std::shared_ptr<PromiseValue<bool> > last_connection;
+    //! @brief Returns where the connection is in its life. Safe to use from
+    //! any thread.
+    Lifecycle GetLifecycle() const {return lifecycle.load();}
     
     //! @brief Add a new chat widget group.
     //! This whill resize the group given to the correct proportions.
@@ -157,6 +388,10 @@ public:
     //! Sends the message out the server's socket socket.
     virtual void SendMessage(IRC_Message *msg) override;
 
+    //! Gives the message to the Handlers, unless it is part of a netsplit or
+    //! netjoin BATCH, which are held back and applied together.
+    void GiveMessage(IRC_Message *msg) override;
+
     //! Attempts to join the specified channel.
     //! Returns a promise that represents the join.
     std::shared_ptr<PromiseValue<Channel *> > JoinChannel(const std::string &channel, int dummy_);
@@ -166,11 +401,49 @@ public:
     //! @warning This message should only be used if you have sent a JOIN message out this Server's socket.
     std::shared_ptr<PromiseValue<Channel *> > JoinChannel(const std::string &channel);
     
+    //! @brief Called with the last parameter of every PONG.
+    //!
+    //! If it answers the PING sent by CheckLag, the round trip time is
+    //! recorded in the metrics.
+    void PongReceived(const char *token);
+
+    //! @brief Called with every CAP and 001 message.
+    //!
+    //! Continues CAP negotiation, and sends any reply it needs.
+    void CapReceived(IRC_Message *msg);
+
+    //! @brief Called with every 001, 433 and 437.
+    //!
+    //! Sends any JOINs waiting for the 001. If our nick is taken before
+    //! then, tries alternates of it until one is accepted.
+    //! Must be called with the Server locked.
+    void RegistrationReceived(IRC_Message *msg);
+
+    //! @brief Called with the nicks in every NICK.
+    //!
+    //! If @p from is our nick, @p to becomes our nick, and the one that
+    //! Register asks for after a reconnect.
+    //! Must be called with the Server locked.
+    void NickReceived(const char *from, const char *to);
+
+    //! @brief Called with every 005.
+    //!
+    //! If the server's casemapping changed, Names() starts folding by it.
+    //! Must be called with the Server locked.
+    void ISupportReceived(IRC_Message *msg);
+
+    //! @brief Returns true if @p cap was negotiated on the current connection.
+    //!
+    //! Safe to use from any thread.
+    bool HasCap(enum IRC_capability cap) const {
+        return (caps.load(std::memory_order_relaxed) & cap)!=0;
+    }
+
     //! Attempt to rejoin
-    std::shared_ptr<PromiseValue<bool> >  Reconnect();
-    //! Attempt to rejoin with a new state
-    std::shared_ptr<PromiseValue<bool> >  Reconnect(const struct ServerState &init_state);
-    //! Disconnect this server.
+    //!
+    //! This also resets the backoff of automatic reconnects.
+    void Reconnect();
+    //! Disconnect this server. It will not be automatically reconnected.
     //! @todo Make this better than just dropping the connection.
     void Disconnect();
 
@@ -195,10 +468,12 @@ public:
     void Highlight() const;
 
     //! Functional-style object for finding a certain Channel in a Server
+    //! Should not be used after the Interned or Channel used to construct it
+    //! is freed.
     class find_channel {
-        const std::string &n;
+        const IRC_Interned *n;
     public:
-        find_channel(const std::string &s);
+        find_channel(const Interned &s);
         find_channel(const Channel *);
         bool operator () (const std::unique_ptr<Channel> &);
     };
@@ -1,17 +1,24 @@
 #include "serverdatabase.hpp"
 
 #include "autolocker.hpp"
+#include "background.hpp"
+#include "log.hpp"
 #include "csv.h"
 
 #include <cassert>
 #include <cstdlib>
-#include <climits>
-#include <ctime>
+#include <cstdio>
 #include "monitor.hpp"
 #include <string>
-#include <sstream>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
 
 #include "platform/strdup.h"
+#include "platform/mapfile.h"
 
 namespace Kashyyyk {
 
@@ -21,60 +28,493 @@ equals_uid::equals_uid(const char * &target)
 
 }
 
-//! @typedef rand_holder
-//! A type that is as close as possible to the maximum entropy value.
-#if USHRT_MAX >= RAND_MAX
-typedef unsigned short rand_holder;
-#elif UINT_MAX >= RAND_MAX
-typedef unsigned int rand_holder;
-#elif ULONG_MAX >= RAND_MAX
-typedef unsigned long rand_holder;
-#elif ULLONG_MAX >= RAND_MAX
-typedef unsigned long long rand_holder;
+//! @name UIDs
+//! UIDs come from a xorshift128+ generator that is seeded once. They only
+//! need to be unique, not secret.
+//! @{
+
+static std::mutex uid_mutex;
+static bool uid_seeded = false;
+static unsigned long long uid_state[2];
+
+static unsigned long long SplitMix64(unsigned long long &x){
+    unsigned long long z = (x+=0x9E3779B97F4A7C15ull);
+    z = (z ^ (z>>30))*0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z>>27))*0x94D049BB133111EBull;
+    return z ^ (z>>31);
+}
+
+
+static unsigned long long XorShift128Plus(){
+    unsigned long long s1 = uid_state[0];
+    const unsigned long long s0 = uid_state[1];
+    uid_state[0] = s0;
+    s1^=s1<<23;
+    uid_state[1] = s1 ^ s0 ^ (s1>>17) ^ (s0>>26);
+    return uid_state[1]+s0;
+}
+
+//! @}
+
+
+const char *ServerDB::GenerateUID(){
+
+    unsigned long long r[2];
+
+    {
+        std::lock_guard<std::mutex> guard(uid_mutex);
+
+        if(!uid_seeded){
+            // random_device is allowed to be deterministic, so the clock is
+            // mixed in as well.
+            std::random_device device;
+            unsigned long long seed = (static_cast<unsigned long long>(device())<<32) ^ device();
+            seed^=std::chrono::high_resolution_clock::now().time_since_epoch().count();
+
+            uid_state[0] = SplitMix64(seed);
+            uid_state[1] = SplitMix64(seed);
+            uid_seeded = true;
+        }
+
+        r[0] = XorShift128Plus();
+        r[1] = XorShift128Plus();
+    }
+
+    char uid[33];
+    snprintf(uid, sizeof(uid), "%016llx%016llx", r[0], r[1]);
+
+    return strdup(uid);
+
+}
+
+
+//! @name Database file
+//! The file is a list of records, each a "[key]" line followed by one
+//! "name=value" line per field. Backslashes and line breaks in values are
+//! escaped. Lists, like autojoin channels, are a line per item.
+//! @{
+
+static const char store_header[] = "# Kashyyyk server database 1\n";
+static const char global_key[] = "global";
+
+static std::string ServerKey(const char *uid){
+    return std::string("server ")+uid;
+}
+
+
+static std::string GroupKey(const char *uid){
+    return std::string("group ")+uid;
+}
+
+
+static void PutField(std::string &out, const char *name, const std::string &value){
+    out+=name;
+    out.push_back('=');
+
+    for(std::string::const_iterator i = value.cbegin(); i!=value.cend(); i++){
+        switch(*i){
+            case '\\':
+                out+="\\\\";
+            break;
+            case '\n':
+                out+="\\n";
+            break;
+            case '\r':
+                out+="\\r";
+            break;
+            default:
+                out.push_back(*i);
+        }
+    }
+
+    out.push_back('\n');
+}
+
+
+static void PutField(std::string &out, const char *name, long value){
+    char number[32];
+    snprintf(number, sizeof(number), "%li", value);
+    out+=name;
+    out.push_back('=');
+    out+=number;
+    out.push_back('\n');
+}
+
+
+static void PutKey(std::string &out, const std::string &key){
+    out.push_back('[');
+    out+=key;
+    out+="]\n";
+}
+
+
+static std::string SerializeServer(const ServerData &server){
+    std::string out;
+    PutKey(out, ServerKey(server.UID));
+
+    PutField(out, "name",     server.name);
+    PutField(out, "address",  server.address);
+    PutField(out, "port",     server.port);
+    PutField(out, "ssl",      server.SSL);
+    PutField(out, "globalidentity", server.global);
+    PutField(out, "nickname", server.nick);
+    PutField(out, "username", server.user);
+    PutField(out, "realname", server.real);
+    PutField(out, "authtype", server.auth_type);
+    PutField(out, "auth.username", server.username);
+    PutField(out, "auth.password", server.password);
+
+    for(std::vector<std::string>::const_iterator i = server.autojoin_channels.cbegin(); i!=server.autojoin_channels.cend(); i++)
+        PutField(out, "autojoin", *i);
+    for(std::vector<std::string>::const_iterator i = server.group_UIDs.cbegin(); i!=server.group_UIDs.cend(); i++)
+        PutField(out, "group", *i);
+
+    out.push_back('\n');
+    return out;
+}
+
+
+static std::string SerializeGlobal(const ServerData &global){
+    std::string out;
+    PutKey(out, global_key);
+
+    PutField(out, "nickname", global.nick);
+    PutField(out, "username", global.user);
+    PutField(out, "realname", global.real);
+
+    out.push_back('\n');
+    return out;
+}
+
+
+template<typename T>
+static void PutOptField(std::string &out, const std::string &name, const OptData<T> &data){
+    PutField(out, (name+".enabled").c_str(), data.apply);
+    PutField(out, name.c_str(), data.value);
+}
+
+
+static std::string SerializeGroup(const GroupData &group){
+    std::string out;
+    PutKey(out, GroupKey(group.UID));
+
+    PutField(out, "name", group.name);
+    PutOptField(out, "nickname", group.nick);
+    PutOptField(out, "username", group.user);
+    PutOptField(out, "realname", group.real);
+    PutOptField(out, "ssl", group.SSL);
+    PutOptField(out, "globalidentity", group.global);
+    PutOptField(out, "authtype", group.auth_type);
+    PutField(out, "auth.enabled",  group.auth.apply);
+    PutField(out, "auth.username", group.auth.value[0]);
+    PutField(out, "auth.password", group.auth.value[1]);
+
+    out.push_back('\n');
+    return out;
+}
+
+
+static std::string Unescape(const char *value, const char *end){
+    std::string out;
+    out.reserve(end-value);
+
+    while(value!=end){
+        if((*value=='\\') && (value+1!=end)){
+            value++;
+            out.push_back((*value=='n')?'\n':(*value=='r')?'\r':*value);
+        }
+        else
+            out.push_back(*value);
+        value++;
+    }
+
+    return out;
+}
+
+
+static void SetServerField(ServerData &server, const std::string &name, const std::string &value){
+    if(name=="name")
+        server.name = value;
+    else if(name=="address")
+        server.address = value;
+    else if(name=="port")
+        server.port = atoi(value.c_str());
+    else if(name=="ssl")
+        server.SSL = atoi(value.c_str())!=0;
+    else if(name=="globalidentity")
+        server.global = atoi(value.c_str())!=0;
+    else if(name=="nickname")
+        server.nick = value;
+    else if(name=="username")
+        server.user = value;
+    else if(name=="realname")
+        server.real = value;
+    else if(name=="authtype")
+        server.auth_type = static_cast<enum AuthType>(atoi(value.c_str()));
+    else if(name=="auth.username")
+        server.username = value;
+    else if(name=="auth.password")
+        server.password = value;
+    else if(name=="autojoin")
+        server.autojoin_channels.push_back(value);
+    else if(name=="group")
+        server.group_UIDs.push_back(value);
+}
+
+
+static void SetGroupField(GroupData &group, const std::string &name, const std::string &value){
+    const int number = atoi(value.c_str());
+
+    if(name=="name")
+        group.name = value;
+    else if(name=="nickname.enabled")
+        group.nick.apply = number!=0;
+    else if(name=="nickname")
+        group.nick.value = value;
+    else if(name=="username.enabled")
+        group.user.apply = number!=0;
+    else if(name=="username")
+        group.user.value = value;
+    else if(name=="realname.enabled")
+        group.real.apply = number!=0;
+    else if(name=="realname")
+        group.real.value = value;
+    else if(name=="ssl.enabled")
+        group.SSL.apply = number!=0;
+    else if(name=="ssl")
+        group.SSL.value = number!=0;
+    else if(name=="globalidentity.enabled")
+        group.global.apply = number!=0;
+    else if(name=="globalidentity")
+        group.global.value = number!=0;
+    else if(name=="authtype.enabled")
+        group.auth_type.apply = number!=0;
+    else if(name=="authtype")
+        group.auth_type.value = static_cast<enum AuthType>(number);
+    else if(name=="auth.enabled")
+        group.auth.apply = number!=0;
+    else if(name=="auth.username")
+        group.auth.value[0] = value;
+    else if(name=="auth.password")
+        group.auth.value[1] = value;
+}
+
+//! @}
+
+
+struct ServerDB::Store : public std::enable_shared_from_this<ServerDB::Store> {
+
+    struct Record {
+        //! Records are written in the order they were first put.
+        unsigned long long order;
+        std::string text;
+    };
+
+    const std::string path;
+
+    //! Guards everything below it.
+    std::mutex mutex;
+    std::unordered_map<std::string, Record> records;
+    unsigned long long next_order;
+    //! True if records changed since they were last written out.
+    bool dirty;
+    //! True while a StoreTask is queued, so that a burst of changes only
+    //! queues one.
+    bool queued;
+
+    //! Held for all of a write, so that an older snapshot can never replace
+    //! a newer one.
+    std::mutex write_mutex;
+
+    Store(const std::string &p)
+      : path(p)
+      , next_order(0)
+      , dirty(false)
+      , queued(false){
+
+    }
+
+    //! Adds a record that is already on disk.
+    void Adopt(const std::string &key, const std::string &text);
+    //! Sets a record, and queues a write if it changed.
+    void Put(const std::string &key, const std::string &text);
+    //! Removes a record, and queues a write if it existed.
+    void Remove(const std::string &key);
+    //! Writes out the records if they changed since the last write.
+    void Write();
+
+private:
+    void Changed_l();
+};
+
+
+//! Writes out a ServerDB::Store on a TaskGroup thread.
+class StoreTask : public Task {
+    std::shared_ptr<ServerDB::Store> store;
+public:
+    StoreTask(const std::shared_ptr<ServerDB::Store> &s)
+      : store(s){
+
+    }
+
+    void Run() override {
+        store->Write();
+    }
+};
+
+
+void ServerDB::Store::Adopt(const std::string &key, const std::string &text){
+    std::lock_guard<std::mutex> guard(mutex);
+
+    Record &record = records[key];
+    record.order = next_order++;
+    record.text = text;
+}
+
+
+void ServerDB::Store::Put(const std::string &key, const std::string &text){
+    std::lock_guard<std::mutex> guard(mutex);
+
+    std::unordered_map<std::string, Record>::iterator iter = records.find(key);
+    if(iter==records.end()){
+        Record record = {next_order++, text};
+        records.insert(std::make_pair(key, record));
+    }
+    else if(iter->second.text!=text)
+        iter->second.text = text;
+    else
+        return;
+
+    Changed_l();
+}
+
+
+void ServerDB::Store::Remove(const std::string &key){
+    std::lock_guard<std::mutex> guard(mutex);
+
+    if(records.erase(key)!=0)
+        Changed_l();
+}
+
+
+void ServerDB::Store::Changed_l(){
+    dirty = true;
+
+    if(queued)
+        return;
+
+    queued = true;
+    Thread::AddShortRunningTask(new StoreTask(shared_from_this()));
+}
+
+
+void ServerDB::Store::Write(){
+
+    std::lock_guard<std::mutex> writing(write_mutex);
+
+    std::vector<std::pair<unsigned long long, std::string> > snapshot;
+
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+
+        queued = false;
+        if(!dirty)
+            return;
+        dirty = false;
+
+        snapshot.reserve(records.size());
+        for(std::unordered_map<std::string, Record>::const_iterator i = records.cbegin(); i!=records.cend(); i++)
+            snapshot.push_back(std::make_pair(i->second.order, i->second.text));
+    }
+
+    std::sort(snapshot.begin(), snapshot.end());
+
+    // Written to the side and moved into place, so that a crash never leaves
+    // half a database.
+    const std::string temp = path + ".tmp";
+
+    bool ok = false;
+    FILE *file = fopen(temp.c_str(), "wb");
+    if(file){
+        fputs(store_header, file);
+        for(std::vector<std::pair<unsigned long long, std::string> >::const_iterator i = snapshot.cbegin(); i!=snapshot.cend(); i++)
+            fwrite(i->second.data(), 1, i->second.size(), file);
+
+        ok = (!ferror(file)) && (Kashyyyk_SyncFile(file)==0);
+        fclose(file);
+    }
+
+#ifdef _WIN32
+    if(ok)
+        remove(path.c_str());
 #endif
+    if(ok)
+        ok = rename(temp.c_str(), path.c_str())==0;
 
+    if(!ok){
+        remove(temp.c_str());
+        KLOG_WARNING(Prefs, "Could not write the server database to %s.", path.c_str());
+
+        // Try again with the next change, or the next Flush.
+        std::lock_guard<std::mutex> guard(mutex);
+        dirty = true;
+    }
+
+}
 
-//! This is the number you adjust to change the end size of UIDs.
-static const unsigned uid_coefficient = 16;
-//! This is the number of calls for entropy that will be made to fill a UID.
-static const size_t uid_len = uid_coefficient/sizeof(rand_holder);
 
 struct ServerDB::ServerDB_Impl{
     Monitor mutex;
     ServerData global;
     std::vector<ServerDataP> list;
     std::vector<std::string>groups;
+    //! Empty unless a database file was opened.
+    std::shared_ptr<Store> store;
 };
 
-const char *ServerDB::GenerateUID(){
 
-    assert(uid_coefficient >= sizeof(rand_holder));
+struct ServerDB::GroupDB::GroupDB_Impl{
+    Monitor mutex;
+    ServerData global;
+    std::vector<GroupDataP> list;
+    //! The owning ServerDB's Store.
+    std::shared_ptr<Store> store;
+};
+
 
-    std::stringstream str_value;
+ServerDB::GroupDB::GroupDB()
+  : guts(new GroupDB_Impl()){
 
-    srand(time(nullptr));
+}
 
-    for(unsigned i = 0; i < uid_len; i++){
-        rand_holder r = rand();
-        str_value << r;
-    }
 
-    return strdup(str_value.str().c_str());
+ServerDB::GroupDB::~GroupDB(){
 
 }
 
+
 ServerDB::ServerDB()
   : guts(new ServerDB_Impl()){
 
 }
 
 ServerDB::~ServerDB(){
+    Flush();
+}
 
+
+struct ServerData *ServerDB::GetGlobal(){
+    return &guts->global;
 }
 
 
-    struct ServerData *GetGlobal();
-    void SetGlobal(struct ServerData *);
+void ServerDB::SetGlobal(struct ServerData *global){
+    guts->global.nick = global->nick;
+    guts->global.user = global->user;
+    guts->global.real = global->real;
+
+    MarkDirty(&guts->global);
+}
 
 
 void ServerDB::LoadServer(struct ServerData *server, Fl_Preferences &prefs){
@@ -96,20 +536,17 @@ void ServerDB::LoadServer(struct ServerData *server, Fl_Preferences &prefs){
     GetAndExist(prefs, ServerPrefix+"autojoin", autojoin, "");
     GetAndExist(prefs, ServerPrefix+"groupuids", groupuids, "");
 
-    const char **channels = FJ::CSV::ParseString(autojoin);
-    const char **groups   = FJ::CSV::ParseString(groupuids);
+    const FJ::CSV::Elements channels = FJ::CSV::Split(autojoin);
+    const FJ::CSV::Elements groups   = FJ::CSV::Split(groupuids);
 
-    for(int i = 0; channels[i]!=nullptr; i++){
-        server->autojoin_channels.push_back(std::string(channels[i]));
+    for(FJ::CSV::Elements::iterator i = channels.begin(); i!=channels.end(); i++){
+        server->autojoin_channels.push_back((*i).str());
     }
 
-    for(int i = 0; groups[i]!=nullptr; i++){
-        server->group_UIDs.push_back(std::string(groups[i]));
+    for(FJ::CSV::Elements::iterator i = groups.begin(); i!=groups.end(); i++){
+        server->group_UIDs.push_back((*i).str());
     }
 
-    FJ::CSV::FreeParse(channels);
-    FJ::CSV::FreeParse(groups);
-
     free(autojoin);
     free(groupuids);
 }
@@ -121,14 +558,14 @@ struct ServerData *ServerDB::GenerateServer() const{
     ret->UID = GenerateUID();
 
      // Clean data
-    ret->name = '\0';
-    ret->address = '\0';
+    ret->name.clear();
+    ret->address.clear();
     ret->port = 0;
     ret->SSL = false;
     ret->global = true;
-    ret->nick = '\0';
-    ret->user = '\0';
-    ret->real = '\0';
+    ret->nick.clear();
+    ret->user.clear();
+    ret->real.clear();
     ret->autojoin_channels.clear();
 
     return ret;
@@ -137,6 +574,13 @@ struct ServerData *ServerDB::GenerateServer() const{
 
 void ServerDB::MarkDirty(const struct ServerData *server) const{
 
+    if(guts->store){
+        if(server==&guts->global)
+            guts->store->Put(global_key, SerializeGlobal(*server));
+        else
+            guts->store->Put(ServerKey(server->UID), SerializeServer(*server));
+    }
+
     for(CallBackVector::const_iterator iter = CallBacks.cbegin(); iter!=CallBacks.cend(); iter++){
         iter->first(server, iter->second);
     }
@@ -161,14 +605,13 @@ void ServerDB::open(Fl_Preferences &prefs){
 
     char *groups;
     GetAndExist(prefs, "sys.group_uids", groups, "");
-    const char **group_uids = FJ::CSV::ParseString(groups);
-    free(groups);
+    const FJ::CSV::Elements group_uids = FJ::CSV::Split(groups);
 
-    for(int i = 0; group_uids[i]!=nullptr; i++){
-        guts->groups.push_back(group_uids[i]);
+    for(FJ::CSV::Elements::iterator i = group_uids.begin(); i!=group_uids.end(); i++){
+        guts->groups.push_back((*i).str());
     }
 
-    FJ::CSV::FreeParse(group_uids);
+    free(groups);
 
     for(int i = 0; server_uids[i]!=nullptr; i++){
         struct ServerData *server = new ServerData();
@@ -195,6 +638,111 @@ start:
     GetAndExist(prefs, "sys.global.username", guts->global.user, "KashyyykUser");
     GetAndExist(prefs, "sys.global.realname", guts->global.real, "KashyyykUser");
 
+    if(guts->store)
+        guts->store->Put(global_key, SerializeGlobal(guts->global));
+
+}
+
+
+bool ServerDB::open(const std::string &path){
+    AutoLocker<const ServerDB * const> locker(this);
+
+    Flush();
+
+    guts->store.reset();
+    group.guts->store.reset();
+
+    clear();
+    group.clear();
+    guts->groups.clear();
+
+    std::string text;
+    FILE *file = fopen(path.c_str(), "rb");
+    if(file){
+        char buffer[4096];
+        size_t len;
+        while((len = fread(buffer, 1, sizeof(buffer), file))!=0)
+            text.append(buffer, len);
+        fclose(file);
+    }
+
+    ServerData *server = nullptr;
+    GroupData  *group_data = nullptr;
+    ServerData *global = nullptr;
+
+    const char *line = text.c_str(), *const text_end = line+text.size();
+    while(line<text_end){
+        const char *line_end = static_cast<const char *>(memchr(line, '\n', text_end-line));
+        if(!line_end)
+            line_end = text_end;
+
+        if(*line=='['){
+            const char *key_end = static_cast<const char *>(memchr(line, ']', line_end-line));
+            const std::string key(line+1, key_end?key_end:line_end);
+
+            server = nullptr;
+            group_data = nullptr;
+            global = nullptr;
+
+            if(key.compare(0, 7, "server ")==0){
+                server = new ServerData();
+                server->UID = strdup(key.c_str()+7);
+                server->global = true;
+                push_back(ServerDataP(server));
+            }
+            else if(key.compare(0, 6, "group ")==0){
+                group_data = new GroupData();
+                group_data->UID = strdup(key.c_str()+6);
+                group.push_back(group_data);
+                guts->groups.push_back(group_data->UID);
+            }
+            else if(key==global_key)
+                global = &guts->global;
+        }
+        else if(*line!='#'){
+            const char *equals = static_cast<const char *>(memchr(line, '=', line_end-line));
+            if(equals){
+                const std::string name(line, equals);
+                const std::string value = Unescape(equals+1, line_end);
+
+                if(server)
+                    SetServerField(*server, name, value);
+                else if(group_data)
+                    SetGroupField(*group_data, name, value);
+                else if(global)
+                    SetServerField(*global, name, value);
+            }
+        }
+
+        line = line_end+1;
+    }
+
+    std::shared_ptr<Store> store = std::make_shared<Store>(path);
+
+    for(iterator iter = begin(); iter!=end(); iter++){
+        store->Adopt(ServerKey((*iter)->UID), SerializeServer(**iter));
+
+        for(std::vector<std::string>::const_iterator i = (*iter)->group_UIDs.cbegin(); i!=(*iter)->group_UIDs.cend(); i++){
+            if(std::find(guts->groups.cbegin(), guts->groups.cend(), *i)==guts->groups.cend())
+                guts->groups.push_back(*i);
+        }
+    }
+
+    for(GroupDB::iterator iter = group.begin(); iter!=group.end(); iter++)
+        store->Adopt(GroupKey((*iter)->UID), SerializeGroup(**iter));
+
+    store->Adopt(global_key, SerializeGlobal(guts->global));
+
+    guts->store = store;
+    group.guts->store = store;
+
+    return file!=nullptr;
+}
+
+
+void ServerDB::Flush() const{
+    if(guts->store)
+        guts->store->Write();
 }
 
 
@@ -286,22 +834,30 @@ ServerDB::reverse_iterator ServerDB::rend(void) const{
 
 
 ServerDB::iterator ServerDB::erase(iterator iter){
+    if(guts->store)
+        guts->store->Remove(ServerKey((*iter)->UID));
     return guts->list.erase(iter);
 }
 
 
 void ServerDB::push_back(ServerDataP a){
     a->owner = this;
+    if(guts->store)
+        guts->store->Put(ServerKey(a->UID), SerializeServer(*a));
     guts->list.push_back(std::move(a));
 }
 
 
 void ServerDB::push_back(struct ServerData *a){
-    guts->list.push_back(ServerDataP(a));
+    push_back(ServerDataP(a));
 }
 
 
 void ServerDB::clear(){
+    if(guts->store){
+        for(iterator iter = begin(); iter!=end(); iter++)
+            guts->store->Remove(ServerKey((*iter)->UID));
+    }
     guts->list.clear();
 }
 
@@ -311,13 +867,6 @@ size_t ServerDB::size() const{
 }
 
 
-struct ServerDB::GroupDB::GroupDB_Impl{
-    Monitor mutex;
-    ServerData global;
-    std::vector<GroupDataP> list;
-};
-
-
 void ServerDB::GroupDB::lock() const {
     guts->mutex.Lock();
 }
@@ -424,17 +973,28 @@ struct GroupData *ServerDB::GroupDB::GenerateGroup() const {
 }
 
 
+void ServerDB::GroupDB::MarkDirty(const struct GroupData *group) const{
+    if(guts->store)
+        guts->store->Put(GroupKey(group->UID), SerializeGroup(*group));
+}
+
+
 void ServerDB::GroupDB::push_back(GroupDataP data){
-    push_back(data.get());
+    push_back(data.release());
 }
 
 
 void ServerDB::GroupDB::push_back(struct GroupData *group){
+    MarkDirty(group);
     guts->list.push_back(GroupDataP(group));
 }
 
 
 void ServerDB::GroupDB::clear(){
+    if(guts->store){
+        for(iterator iter = begin(); iter!=end(); iter++)
+            guts->store->Remove(GroupKey((*iter)->UID));
+    }
     guts->list.clear();
 }
 
@@ -466,6 +1026,8 @@ ServerDB::GroupDB::reverse_iterator ServerDB::GroupDB::rend(void) const{
 
 
 ServerDB::GroupDB::iterator ServerDB::GroupDB::erase(iterator i){
+    if(guts->store)
+        guts->store->Remove(GroupKey((*i)->UID));
     return guts->list.erase(i);
 }
 
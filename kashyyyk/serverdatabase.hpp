@@ -1,5 +1,19 @@
 #pragma once
 
+//! @file
+//! @brief The database of servers and groups the user has set up.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! A ServerDB can be loaded from the preferences, or kept in a database file
+//! of its own with open(const std::string &). In that case, every record that
+//! is marked dirty, added or removed is written back to the file by a
+//! background Task. Only the changed records are serialized, on the thread
+//! that changed them. A burst of changes is written out together, to a new
+//! file that then replaces the old one, so the UI never waits on the disk
+//! and a crash never leaves half a database behind.
+
 #include "prefs.hpp"
 
 #include <memory>
@@ -102,14 +116,33 @@ class ServerDB{
     std::unique_ptr<struct ServerDB_Impl> guts;
 public:
 
+    //! @brief Database file writer. Opaque outside of serverdatabase.cpp.
+    struct Store;
+
     ServerDB();
+    //! Writes out anything not yet on disk, and waits for it.
     ~ServerDB();
 
+    //! @brief Returns a new, random UID. Free it with free().
+    //!
+    //! Safe to use from any thread.
     static const char *GenerateUID();
 
     void open(Fl_Preferences &);
     void save(Fl_Preferences &) const;
 
+    //! @brief Loads every server and group from the database file at @p path,
+    //! and writes all changes back to it from then on.
+    //!
+    //! Returns false if there is no database at @p path yet. The ServerDB is
+    //! then empty, and anything put in it is written to @p path, so it can be
+    //! filled in from the old preferences with open(Fl_Preferences &).
+    bool open(const std::string &path);
+
+    //! @brief Writes out any changes that are not on disk yet, and waits for
+    //! them. Does nothing unless a database file was opened.
+    void Flush() const;
+
     struct ServerData *GetGlobal();
     void SetGlobal(struct ServerData *);
 
@@ -119,6 +152,14 @@ public:
     }
 
     struct ServerData *GenerateServer() const;
+
+    //! @brief Queues @p server to be written out, and calls every callback in
+    //! CallBacks.
+    //!
+    //! Only @p server is serialized, and the write happens later on a
+    //! background thread, so this is cheap to call after every edit. Also
+    //! used for GetGlobal.
+    //! @warning Don't change @p server on another thread while this runs.
     void MarkDirty(const struct ServerData *) const;
 
     void lock() const;
@@ -170,8 +211,12 @@ public:
         struct GroupDB_Impl;
         std::unique_ptr<struct GroupDB_Impl> guts;
 
+        friend class ServerDB;
     public:
 
+        GroupDB();
+        ~GroupDB();
+
         void lock() const;
         void unlock() const;
 
@@ -192,6 +237,10 @@ public:
         }
 
         struct GroupData *GenerateGroup() const;
+
+        //! @brief Queues @p group to be written out. See ServerDB::MarkDirty.
+        void MarkDirty(const struct GroupData *) const;
+
         void push_back(GroupDataP);
         void push_back(struct GroupData *);
 
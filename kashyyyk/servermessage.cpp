@@ -29,6 +29,130 @@ bool Ping_Handler::HandleMessage(IRC_Message *msg){
 }
 
 
+Pong_Handler::Pong_Handler(Server *s)
+  : Message_Handler(s) {
+
+}
+
+bool Pong_Handler::HandleMessage(IRC_Message *msg){
+    if((msg->type==IRC_pong) && (msg->num_parameters>0)){
+
+        const char *token = msg->parameters[msg->num_parameters-1];
+        if(token[0]==':')
+          token++;
+
+        server->PongReceived(token);
+
+    }
+
+    return false;
+}
+
+
+Cap_Handler::Cap_Handler(Server *s)
+  : Message_Handler(s) {
+
+}
+
+bool Cap_Handler::HandleMessage(IRC_Message *msg){
+    if((msg->type==IRC_cap) || (msg->type==IRC_welcome_num))
+        server->CapReceived(msg);
+
+    return false;
+}
+
+
+ISupport_Handler::ISupport_Handler(Server *s)
+  : Message_Handler(s) {
+
+}
+
+bool ISupport_Handler::HandleMessage(IRC_Message *msg){
+    if(msg->type==IRC_isupport_num)
+        server->ISupportReceived(msg);
+
+    return false;
+}
+
+
+Registration_Handler::Registration_Handler(Server *s)
+  : Message_Handler(s) {
+
+}
+
+bool Registration_Handler::HandleMessage(IRC_Message *msg){
+    if((msg->type==IRC_welcome_num) || (msg->type==IRC_nick_in_use_num) ||
+      (msg->type==IRC_nick_unavailable_num))
+        server->RegistrationReceived(msg);
+
+    return false;
+}
+
+
+Quit_Handler::Quit_Handler(Server *s)
+  : Message_Handler(s){
+
+}
+
+
+bool Quit_Handler::HandleMessage(IRC_Message *msg){
+
+    if((msg->type!=IRC_quit) || (msg->from==nullptr))
+        return false;
+
+    from_reader r;
+
+    // If the nick isn't interned, they aren't in any Channel.
+    const Interned nick = server->Names().Find(r(msg));
+    if(!nick)
+        return false;
+
+    // A copy, since each Channel takes itself out of the Server's as the
+    // user is removed.
+    const std::vector<Channel *> in = server->ChannelsWith_l(nick);
+    const char *reason = (msg->num_parameters>0)?msg->parameters[0]:"";
+
+    for(std::vector<Channel *>::const_iterator i = in.cbegin(); i!=in.cend(); i++)
+        (*i)->QuitUser(nick, reason);
+
+    return false;
+}
+
+
+Nick_Handler::Nick_Handler(Server *s)
+  : Message_Handler(s){
+
+}
+
+
+bool Nick_Handler::HandleMessage(IRC_Message *msg){
+
+    if((msg->type!=IRC_nick) || (msg->from==nullptr) || (msg->num_parameters<1))
+        return false;
+
+    from_reader r;
+
+    server->NickReceived(r(msg), msg->parameters[0]);
+
+    const Interned from = server->Names().Find(r(msg));
+    if(!from)
+        return false;
+
+    const std::vector<Channel *> in = server->ChannelsWith_l(from);
+    if(in.empty())
+        return false;
+
+    const Interned to = server->Names().Intern(msg->parameters[0]);
+
+    for(std::vector<Channel *>::const_iterator i = in.cbegin(); i!=in.cend(); i++)
+        (*i)->RenameUser(from, to, msg->parameters[0]);
+
+    server->RenameMember_l(from, to);
+
+    return false;
+}
+
+
 const std::string Notice_Handler::server_s = "server";
 
 
@@ -41,15 +165,14 @@ Notice_Handler::Notice_Handler(Server *s)
 bool Notice_Handler::HandleMessage(IRC_Message *msg){
 
     if((msg->type==IRC_notice) || (msg->type==IRC_your_host_num) || (msg->type==IRC_topic_extra_num)){
-        Server::ChannelList::const_iterator server_chan =
-          std::find_if(server->GetChannels().cbegin(), server->GetChannels().cend(), Server::find_channel(server_s));
+        Channel *server_chan = server->FindChannel_l(server_s.c_str());
 
-        if(server_chan==server->GetChannels().cend()){
-            fprintf(stderr, "Warning: server channel not found for Server %s.\n", server->GetName().c_str());
+        if(server_chan==nullptr){
+            KLOG_WARNING(Server, "Server channel not found for Server %s.", server->GetName().c_str());
             return false; // Wait, what?
         }
 
-        server_chan->get()->GiveMessage(msg);
+        server_chan->GiveMessage(msg);
     }
 
     return false;
@@ -4,7 +4,7 @@
 #include "server.hpp"
 #include "channel.hpp"
 #include "message.hpp"
-#include "platform/strcasestr.h"
+#include "log.hpp"
 #include "message.h"
 #include <atomic>
 
@@ -103,10 +103,9 @@ public:
     bool HandleMessage(IRC_Message *msg) override {
         if( (msg->type==type) && (msg->num_parameters>n)){
             
-            Server::ChannelList::const_iterator iter =
-              std::find_if(server->GetChannels().cbegin(), server->GetChannels().cend(), Server::find_channel(msg->parameters[n]));
-            if(iter!=server->GetChannels().cend()){
-                iter->get()->GiveMessage(msg);
+            Channel *channel = server->FindChannel_l(msg->parameters[n]);
+            if(channel!=nullptr){
+                channel->GiveMessage(msg);
             }
         }
 
@@ -148,9 +147,29 @@ public:
 
 };
 
-// Known specializations
-typedef ServerToAllChannels_Handler<IRC_quit> Quit_Handler;
-typedef ServerToAllChannels_Handler<IRC_nick> Nick_Handler;
+//! @brief Handler for QUIT messages
+//!
+//! Tells only the Channels that the quitting nick was in.
+class Quit_Handler : public Message_Handler {
+public:
+    Quit_Handler(Server *s);
+    ~Quit_Handler() override {}
+
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
+
+//! @brief Handler for NICK messages
+//!
+//! Renames the user in only the Channels that the old nick was in.
+class Nick_Handler : public Message_Handler {
+public:
+    Nick_Handler(Server *s);
+    ~Nick_Handler() override {}
+
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
 
 
 // Delivers notifications to
@@ -169,11 +188,11 @@ public:
 // Listens for an expected channel JOIN, and adds the channel when
 // it is recieved.
 class JoinChannel_Handler : public Message_Handler {
-    std::string channel_name;
+    Interned channel_name;
 public:
     JoinChannel_Handler(Server *s, const std::string &n)
       : Message_Handler(s)
-      , channel_name(n)
+      , channel_name(s->Names().Intern(n))
       , promise(new PromiseValue<Channel *>(nullptr)) {
 
     }
@@ -185,15 +204,11 @@ public:
         if(msg->type!=IRC_join)
           return false;
 
-        char *str = IRC_MessageToString(msg);
-        printf("Join handler examining message %s\nWe are looking for %s.\n", str, channel_name.c_str());
-        free(str);
-
+        KLOG_DEBUG(Channel, "Join handler looking for %s got a JOIN for %s.", channel_name.c_str(), msg->parameters[0]);
 
-        if(strcasestr(msg->parameters[0], channel_name.c_str())!=msg->parameters[0]){
-            printf("Found %s. Not %s.\n", msg->parameters[0], channel_name.c_str());
+        // The name is in the table already, so this only finds it.
+        if(server->Names().Find(msg->parameters[0])!=channel_name)
             return false;
-        }
 
         Fl::lock();
         Channel * channel = new Channel(server, msg->parameters[0]);
@@ -220,6 +235,46 @@ public:
 };
 
 
+//! Passes PONGs to Server::PongReceived, to measure lag.
+class Pong_Handler : public Message_Handler {
+public:
+    Pong_Handler(Server *s);
+    ~Pong_Handler() override {};
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
+
+
+//! Passes CAP and 001 messages to Server::CapReceived.
+class Cap_Handler : public Message_Handler {
+public:
+    Cap_Handler(Server *s);
+    ~Cap_Handler() override {};
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
+
+
+//! Passes 005 messages to Server::ISupportReceived.
+class ISupport_Handler : public Message_Handler {
+public:
+    ISupport_Handler(Server *s);
+    ~ISupport_Handler() override {};
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
+
+
+//! Passes 001, 433 and 437 messages to Server::RegistrationReceived.
+class Registration_Handler : public Message_Handler {
+public:
+    Registration_Handler(Server *s);
+    ~Registration_Handler() override {};
+    bool HandleMessage(IRC_Message *msg) override;
+
+};
+
+
 
 }
 }
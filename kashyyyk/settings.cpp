@@ -0,0 +1,109 @@
+#include "settings.hpp"
+#include "prefs.hpp"
+#include "log.hpp"
+#include "csv.h"
+
+#include <FL/Enumerations.H>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+
+namespace Kashyyyk {
+
+static const Settings defaults = {
+    0,
+    "gtk+", FL_SCREEN,
+    true, std::vector<std::string>(),
+    30, 120,
+    200, 4096, 300
+};
+
+static std::atomic<const Settings *> current(&defaults);
+
+//! Every snapshot ever published, so that none are freed while in use.
+static std::vector<std::unique_ptr<const Settings> > published;
+
+typedef std::pair<SettingsCallback, void *> Callback;
+static std::mutex callback_mutex;
+static std::vector<Callback> callbacks;
+
+
+const Settings &GetSettings(){
+    return *current.load(std::memory_order_acquire);
+}
+
+
+void ReloadSettings(){
+
+    Fl_Preferences &prefs = GetPreferences();
+    const Settings &old_settings = GetSettings();
+
+    Settings *settings = new Settings(defaults);
+    settings->generation = old_settings.generation+1;
+
+    {
+        char *theme = nullptr;
+        prefs.get("sys.appearance.theme", theme, defaults.theme.c_str());
+        settings->theme = theme;
+        free(theme);
+    }
+
+    prefs.get("sys.appearance.font", settings->font, defaults.font);
+
+    int pling = defaults.pling;
+    prefs.get("sys.pling.enabled", pling, pling);
+    settings->pling = pling;
+
+    {
+        char *words = nullptr;
+        prefs.get("sys.highlight.words", words, "");
+        const FJ::CSV::Elements elements = FJ::CSV::Split(words);
+        for(FJ::CSV::Elements::iterator i = elements.begin(); i!=elements.end(); i++)
+            settings->highlight_words.push_back((*i).str());
+        free(words);
+    }
+
+    GetAndExist(prefs, "sys.lag.ping.interval", settings->lag_ping_interval, defaults.lag_ping_interval);
+    GetAndExist(prefs, "sys.lag.timeout", settings->lag_timeout, defaults.lag_timeout);
+
+    prefs.get("sys.chatlog.scrollback", settings->chatlog_scrollback, defaults.chatlog_scrollback);
+
+    int max_lines = defaults.channel_max_lines;
+    prefs.get("sys.channel.maxlines", max_lines, max_lines);
+    settings->channel_max_lines = std::max(max_lines, 1);
+
+    prefs.get("sys.channel.unload.timeout", settings->channel_unload_timeout, defaults.channel_unload_timeout);
+
+    published.push_back(std::unique_ptr<const Settings>(settings));
+    current.store(settings, std::memory_order_release);
+
+    KLOG_DEBUG(Prefs, "Published settings generation %u.", settings->generation);
+
+    std::vector<Callback> to_call;
+    {
+        std::lock_guard<std::mutex> guard(callback_mutex);
+        to_call = callbacks;
+    }
+
+    for(std::vector<Callback>::const_iterator i = to_call.cbegin(); i!=to_call.cend(); i++)
+        i->first(old_settings, *settings, i->second);
+
+}
+
+
+void AddSettingsCallback(SettingsCallback callback, void *arg){
+    std::lock_guard<std::mutex> guard(callback_mutex);
+    callbacks.push_back(Callback(callback, arg));
+}
+
+
+void RemoveSettingsCallback(SettingsCallback callback, void *arg){
+    std::lock_guard<std::mutex> guard(callback_mutex);
+    callbacks.erase(std::remove(callbacks.begin(), callbacks.end(), Callback(callback, arg)), callbacks.end());
+}
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+//! @file
+//! @brief Typed, immutable snapshots of the preferences.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Fl_Preferences looks every value up by name in a tree, which is too slow
+//! for code that runs on every message. Such code reads a Settings instead,
+//! which is loaded from the preferences once and published again whenever
+//! they are changed through the Preferences window.
+//!
+//! Publishing swaps a single pointer. Snapshots are never changed or freed
+//! once published, so GetSettings is one atomic load and the result can be
+//! used for as long as the caller likes. Old snapshots are kept until exit;
+//! preferences only change when the user changes them, so there are only
+//! ever a handful.
+
+#include <string>
+#include <vector>
+
+namespace Kashyyyk {
+
+//! @brief The preferences that are read outside of startup.
+struct Settings {
+    //! Starts at 0 for the defaults, and goes up by one for every publish.
+    unsigned generation;
+
+    //! `sys.appearance.theme`
+    std::string theme;
+    //! `sys.appearance.font`
+    int font;
+
+    //! `sys.pling.enabled`
+    bool pling;
+    //! `sys.highlight.words`, split at commas.
+    std::vector<std::string> highlight_words;
+
+    //! `sys.lag.ping.interval`, in seconds. 0 or less disables pinging.
+    int lag_ping_interval;
+    //! `sys.lag.timeout`, in seconds. 0 or less never times out.
+    int lag_timeout;
+
+    //! `sys.chatlog.scrollback`, lines of history shown in a new Channel.
+    int chatlog_scrollback;
+    //! `sys.channel.maxlines`, lines a Channel keeps. At least 1.
+    unsigned channel_max_lines;
+    //! `sys.channel.unload.timeout`, seconds a hidden Channel keeps its
+    //! widgets. 0 keeps them forever.
+    int channel_unload_timeout;
+};
+
+//! @brief Returns the current Settings. Safe to use from any thread.
+//!
+//! Until ReloadSettings is first called, these are the defaults.
+const Settings &GetSettings();
+
+//! @brief Reads the Settings from the preferences again and publishes them.
+//!
+//! Calls every SettingsCallback afterwards. Must be called on the main
+//! thread, after any change to a preference that is in Settings.
+void ReloadSettings();
+
+//! @brief Called after new Settings are published, with the old and the new.
+typedef void (*SettingsCallback)(const Settings &old_settings, const Settings &new_settings, void *arg);
+
+//! @brief Calls @p callback with @p arg whenever Settings are published.
+void AddSettingsCallback(SettingsCallback callback, void *arg);
+void RemoveSettingsCallback(SettingsCallback callback, void *arg);
+
+}
@@ -0,0 +1,108 @@
+#include "shards.hpp"
+#include "networkwatch.hpp"
+#include "metrics.hpp"
+#include "log.hpp"
+
+#include <list>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cassert>
+
+namespace Kashyyyk {
+namespace Shards {
+
+//! Most shards that will be started, no matter how many cores there are.
+static const unsigned MaxShards = 64;
+
+struct Shard {
+    Thread::TaskGroup *group;
+    std::unique_ptr<NetworkWatch> watch;
+    std::unique_ptr<Thread> thread;
+    //! Servers assigned to this shard.
+    std::atomic<unsigned> servers;
+
+    Shard(const char *metric_name)
+      : group(Thread::CreateTaskGroup(metric_name))
+      , watch(new NetworkWatch(group))
+      , servers(0){
+        Thread::AddWatchToTaskGroup(watch.get(), group);
+        thread.reset(new Thread(group));
+    }
+
+    ~Shard(){
+        thread.reset();
+        watch.reset();
+        Thread::DestroyTaskGroup(group);
+    }
+};
+
+static std::vector<std::unique_ptr<Shard> > shards;
+
+//! Metrics keeps the name of each gauge, so these outlive the shards.
+static std::list<std::string> gauge_names;
+
+
+void Init(unsigned count){
+    assert(shards.empty());
+
+    if(count==0)
+      count = std::thread::hardware_concurrency();
+    if(count==0)
+      count = 1;
+    if(count>MaxShards)
+      count = MaxShards;
+
+    for(unsigned i = 0; i<count; i++){
+        char name[32];
+        snprintf(name, sizeof(name), "tasks.shard%u.depth", i);
+        gauge_names.push_back(name);
+
+        shards.push_back(std::unique_ptr<Shard>(new Shard(gauge_names.back().c_str())));
+    }
+
+    KLOG_INFO(Server, "Started %u network shards.", count);
+}
+
+
+void Close(){
+    shards.clear();
+}
+
+
+unsigned Count(){
+    return shards.size();
+}
+
+
+unsigned Assign(){
+    assert(!shards.empty());
+
+    unsigned least = 0;
+    for(unsigned i = 1; i<shards.size(); i++){
+        if(shards[i]->servers<shards[least]->servers)
+          least = i;
+    }
+
+    shards[least]->servers++;
+    return least;
+}
+
+
+void Release(unsigned shard){
+    assert(shard<shards.size());
+    assert(shards[shard]->servers>0);
+    shards[shard]->servers--;
+}
+
+
+Thread::TaskGroup *GetTaskGroup(unsigned shard){
+    assert(shard<shards.size());
+    return shards[shard]->group;
+}
+
+}
+}
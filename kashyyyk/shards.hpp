@@ -0,0 +1,55 @@
+#pragma once
+
+//! @file
+//! @brief Network event loops that Servers are spread across.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Each shard is a TaskGroup with its own NetworkWatch and its own Thread.
+//! A Server is given a shard when it is created and keeps it for its whole
+//! life. Its ServerTask is only ever run by that shard's Thread, and its
+//! socket is only ever polled by that shard's NetworkWatch, so Servers on
+//! different shards never wait on each other to read or parse.
+//!
+//! Only reading and parsing run in parallel. Every message is still handled
+//! under the FLTK lock, since handlers update widgets directly, so handling
+//! does not get faster with more shards. `yyyloadtest --servers N --shards M`
+//! measures this, with a mutex standing in for the FLTK lock.
+//!
+//! The number of shards is `sys.network.shards`, or one per core if that is
+//! 0 or unset.
+
+#include "background.hpp"
+
+namespace Kashyyyk {
+namespace Shards {
+
+//! @brief Starts @p count shards, or one per core if @p count is 0.
+//!
+//! Must be called once, on the main thread, before any Server is created.
+void Init(unsigned count);
+
+//! @brief Stops every shard.
+//!
+//! Servers that are still alive are no longer read from, and must not be
+//! destroyed afterwards, since their ServerTasks need a shard's Thread to
+//! finish. This is only meant for when the program exits.
+void Close();
+
+//! @brief Returns how many shards were started.
+unsigned Count();
+
+//! @brief Picks the shard with the fewest Servers and counts one more on it.
+unsigned Assign();
+
+//! @brief Counts one less Server on @p shard.
+void Release(unsigned shard);
+
+//! @brief Returns the TaskGroup of @p shard.
+//!
+//! It has a NetworkWatch, so Thread::AddSocketToTaskGroup can be used with it.
+Thread::TaskGroup *GetTaskGroup(unsigned shard);
+
+}
+}
@@ -3,6 +3,9 @@
 #include "server.hpp"
 #include "background.hpp"
 #include "prefs.hpp"
+#include "metricswindow.hpp"
+#include "searchwindow.hpp"
+#include "log.hpp"
 #include "socket.h"
 #include "message.h"
 #include "serverlist.hpp"
@@ -55,7 +58,7 @@ public:
         if(event==FL_FOCUS){
             Window::window_order.remove(owner);
             Window::window_order.push_back(owner);
-            printf("Focusing %p\n", static_cast<const void *>(owner));
+            KLOG_DEBUG(UI, "Focusing %p", static_cast<const void *>(owner));
         }
         return T::handle(event);
 
@@ -149,13 +152,6 @@ void WindowCallbacks::ChannelList_CB(Fl_Widget *w, void *p){
 }
 
 
-void AskToConnectAgain_Task::Run(){
-    promise.Finalize(fl_choice("Could not connect to %s. Try again?", fl_no, fl_yes, nullptr, name.c_str()));
-    promise.SetReady();
-    Fl::awake();
-}
-
-
 // Considered a long-running task.
 class ConnectToServer_Task : public Task {
     Window *window;
@@ -170,45 +166,62 @@ public:
 
     }
 
+    void Run() override;
+
+};
+
+
+// Run by the Window's TaskGroup, on the main thread. Trying again queues a
+// new ConnectToServer_Task, so no thread waits on the answer.
+class AskToConnectAgain_Task : public Task {
+    Window *window;
+    struct Server::ServerState state;
+public:
+    AskToConnectAgain_Task(Window *win, const struct Server::ServerState &that_state)
+      : window(win){
+        Server::CopyState(state, that_state);
+    }
+
+    virtual ~AskToConnectAgain_Task(){}
+
     void Run() override {
-        WSockErr err;
-try_connect:
-        state.socket = Create_Socket();
+        if(fl_choice("Could not connect to %s. Try again?", fl_no, fl_yes, nullptr, state.name.c_str())==1)
+            Thread::AddLongRunningTask(new ConnectToServer_Task(window, state));
+    }
 
-        if(!state.socket){
-            printf("Could not create a socket.\n");
-        }
+};
 
-        err = Connect_Socket(state.socket, state.name.c_str(), state.port, 10000);
-        if(!err){
-            
-            Server * s = new Server(state, window);
-            Fl::lock();
-            window->AddServer(s);
-            Fl::unlock();
-        }
-        else{
-            printf("Couldn't connect. Asking if we should try again.\n");
 
-            PromiseValue<int> promise(0);
+void ConnectToServer_Task::Run(){
+    WSockErr err;
+    state.socket = Create_Socket();
 
-            Task *task = new AskToConnectAgain_Task(promise, state.name);
+    if(!state.socket){
+        KLOG_ERROR(Net, "Could not create a socket.");
+    }
 
-            Thread::AddTask(window->task_group, task);
+    err = Connect_Socket(state.socket, state.name.c_str(), state.port, 10000);
+    if((!err) && state.SSL)
+      err = StartTLS_Socket(state.socket, state.name.c_str(), nullptr);
+    if(!err){
+        
+        Server * s = new Server(state, window);
+        Fl::lock();
+        window->AddServer(s);
+        Fl::unlock();
+    }
+    else{
+        KLOG_INFO(Net, "Couldn't connect. Asking if we should try again.");
 
-            Fl::awake();
+        Destroy_Socket(state.socket);
+        state.socket = nullptr;
 
-            while(!promise.IsReady()){}
+        Thread::AddTask(window->task_group, new AskToConnectAgain_Task(window, state));
 
-            bool again = (promise.Finish()==1);
-            if(again){
-                Destroy_Socket(state.socket);
-                goto try_connect;
-            }
-        }
+        Fl::awake();
     }
+}
 
-};
 
 void WindowCallbacks::ConnectToServer_CB(Fl_Widget *w, void *p){
     WindowCallbacks::ConnectToServer(static_cast<Window *>(p));
@@ -218,7 +231,7 @@ void WindowCallbacks::ConnectToServer(Window *win){
 
     assert(win);
 
-    DoubleInput_Return r = DoubleInput("Enter Server Address", "URL", "", "Port", "6667");
+    DoubleInput_Return r = DoubleInput("Enter Server Address", "URL", "", "Port (+ for TLS)", "6667");
 
     std::unique_ptr<void, void(*)(void *)> rone((void *)r.one, free);
     std::unique_ptr<void, void(*)(void *)> rtwo((void *)r.two, free);
@@ -226,17 +239,20 @@ void WindowCallbacks::ConnectToServer(Window *win){
     if(r.value==0)
       return;
     std::string inp = r.one;
-    long port = atol(r.two);
+
+    // Like most IRC clients, a port such as +6697 means TLS.
+    const bool ssl = (r.two[0]=='+');
+    long port = atol(r.two+(ssl?1:0));
     if(!port)
-      port = 6667;
+      port = ssl?6697:6667;
 
-    printf("%s %s %ld\n", r.one, r.two, port);
+    KLOG_DEBUG(UI, "Connect dialog gave %s %s, using port %ld%s", r.one, r.two, port, ssl?" with TLS":"");
 
     if(inp.empty())
       return;
 
     // TODO: Make this NOT hardcoded
-    struct Server::ServerState state = {inp, "KashyyykUser", "KashyyykUserName", "KashyyykReal", nullptr, port, false};
+    struct Server::ServerState state = {inp, "KashyyykUser", "KashyyykUserName", "KashyyykReal", nullptr, port, ssl};
 
     Thread::AddLongRunningTask(new ConnectToServer_Task(win, state));
 
@@ -260,7 +276,7 @@ public:
 
     void Run() override {
         delete window;
-        printf("We deleted a window!\n");
+        KLOG_DEBUG(UI, "We deleted a window!");
     }
 
 };
@@ -323,6 +339,7 @@ Window::Window(int w, int h, Thread::TaskGroup *tg, Launcher *l, bool osx)
             items[i++] = {0};
             items[i++] = {"&Edit",0,0,0,FL_SUBMENU},
                 items[i++] = {"Preferences", FL_COMMAND + FL_SHIFT + 'p', OpenPreferencesWindow_CB, this};
+                items[i++] = {"Search History", FL_COMMAND + 'f', OpenSearchWindow_CB, this};
             items[i++] = {0};
             items[i++] = {"&Server",0,0,0,FL_SUBMENU},
                 items[i++] = {"Reconnect", FL_F + 5, WindowCallbacks::ChangeNick_CB, this};
@@ -330,6 +347,9 @@ Window::Window(int w, int h, Thread::TaskGroup *tg, Launcher *l, bool osx)
                 items[i++] = {"Change Nick", FL_COMMAND + 'k', WindowCallbacks::ChangeNick_CB, this};
                 items[i++] = {"Join Channel", FL_COMMAND + 'j', WindowCallbacks::JoinChannel_CB, this};
 			items[i++] = {0};
+            items[i++] = {"&Debug",0,0,0,FL_SUBMENU},
+                items[i++] = {"Metrics", 0, OpenMetricsWindow_CB, this};
+            items[i++] = {0};
         items[i++] = {0};
 
         menubar = new Fl_Menu_Bar(-2, 0, w+4, 24);
@@ -348,10 +368,10 @@ Window::~Window(){
     if(launcher){
         launcher->Release(this);
 
-        printf("Released from launcher.\n");
+        KLOG_DEBUG(UI, "Released from launcher.");
     }
     else
-      printf("Did not release from launcher.\n");
+      KLOG_DEBUG(UI, "Did not release from launcher.");
 }
 
 
@@ -474,7 +494,7 @@ void Window::AutoJoinServers(void){
         int i = 0;
         while(iter!=nullptr){
 
-            printf("Connecting to %s.\n", iter);
+            KLOG_INFO(Server, "Connecting to %s.", iter);
 
             char *address;
             int port;
@@ -483,9 +503,11 @@ void Window::AutoJoinServers(void){
                 continue;
             }
             prefs.get((std::string("server.")+iter+".port").c_str(), port, 6665);
+            int ssl;
+            prefs.get((std::string("server.")+iter+".ssl").c_str(), ssl, 0);
 
             // TODO: Make this NOT hardcoded
-            struct Server::ServerState state = {address, "KashyyykUser", "KashyyykUserName", "KashyyykReal", nullptr, port, false};
+            struct Server::ServerState state = {address, "KashyyykUser", "KashyyykUserName", "KashyyykReal", nullptr, port, ssl!=0};
             Thread::AddLongRunningTask(new ConnectToServer_Task(this, state));
 
             iter = servers[++i];
@@ -508,12 +530,9 @@ void Window::AutoJoinChannels(void){
 
 */
 
-std::shared_ptr<PromiseValue<bool> > Window::ReconnectLastServer(){
+void Window::ReconnectLastServer(){
     if(last_server)
-      return last_server->Reconnect();
-
-    return std::shared_ptr<PromiseValue<bool> >(nullptr);
-
+      last_server->Reconnect();
 }
 
 void  Window::DisconnectLastServer(){
@@ -538,7 +557,7 @@ Fl_Tree_Item *Window::FindChannel(const char *a){
 */
 
 void Window::ForgetLauncher(){
-    printf("Forgot launcher.\n");
+    KLOG_DEBUG(UI, "Forgot launcher.");
     launcher = nullptr;
 }
 
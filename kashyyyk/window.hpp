@@ -2,7 +2,6 @@
 
 #include "autolocker.hpp"
 #include "background.hpp"
-#include "promise.hpp"
 #include "platform/pling.h"
 #include "monitor.hpp"
 
@@ -45,20 +44,6 @@ public:
 };
 
 
-class AskToConnectAgain_Task : public Task {
-    PromiseValue<int> &promise;
-    const std::string &name;
-public:
-    AskToConnectAgain_Task(PromiseValue<int> &p, const std::string &n)
-      : promise(p)
-      , name(n) {}
-
-    virtual ~AskToConnectAgain_Task(){}
-
-    void Run() override;
-};
-
-
 class Window {
 public:
     Thread::TaskGroup *task_group;
@@ -132,7 +117,7 @@ public:
 
     void ForgetLauncher();
 
-    std::shared_ptr<PromiseValue<bool> >  ReconnectLastServer();
+    void ReconnectLastServer();
     void DisconnectLastServer();
 
     void GDebugReconnectLastServer();
@@ -1,3 +1,5 @@
+#include "csv.h"
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -86,7 +88,6 @@ const char *CSV_ConstructString(const char **a, char delimiter){
          Then, it provides room for the NULL.
         */
         while(b!=NULL){
-            printf("Parse 1: %s\n", b);
             len+=strlen(b)+1;
             b = a[i++];
         }
@@ -99,7 +100,6 @@ const char *CSV_ConstructString(const char **a, char delimiter){
 		return ret_str;
 	}
 	
-    printf("Parse n: %i\n", len);
     r = malloc(len);
     r[len-1] = '\0';
 
@@ -114,8 +114,6 @@ const char *CSV_ConstructString(const char **a, char delimiter){
 
             memcpy(c, b, olen);
 
-            printf("Parse 2: %s\n", c);
-
             c[olen] = delimiter;
 
             c+=olen+1;
@@ -153,3 +151,60 @@ void CSV_FreeParse(const char **a){
     free(a);
 
 }
+
+
+int CSV_NextSpan(const char *a, unsigned long len, char delimiter, unsigned long *offset, struct CSV_Span *span){
+    unsigned long at = *offset;
+    const char *end;
+
+    assert(a);
+
+    while((at<len) && (a[at]==delimiter))
+      at++;
+
+    if(at>=len){
+        *offset = len;
+        return 0;
+    }
+
+    end = memchr(a+at, delimiter, len-at);
+
+    span->offset = at;
+    span->length = ((end==NULL)?len:(unsigned long)(end-a))-at;
+
+    *offset = span->offset+span->length;
+    return 1;
+}
+
+unsigned long CSV_SplitSpans(const char *a, unsigned long len, char delimiter, struct CSV_Span *spans, unsigned long max){
+    unsigned long offset = 0, n = 0;
+    struct CSV_Span span;
+
+    while(CSV_NextSpan(a, len, delimiter, &offset, &span)){
+        if(n<max)
+          spans[n] = span;
+        n++;
+    }
+
+    return n;
+}
+
+unsigned long CSV_SplitInPlace(char *a, char delimiter, const char **elements, unsigned long max){
+    const unsigned long len = strlen(a);
+    unsigned long offset = 0, n = 0;
+    struct CSV_Span span;
+
+    assert(max>0);
+
+    while(CSV_NextSpan(a, len, delimiter, &offset, &span)){
+        if(n+1<max)
+          elements[n++] = a+span.offset;
+        /* The NUL is no longer a delimiter, so step over it.
+        */
+        if(offset<len)
+          a[offset++] = '\0';
+    }
+
+    elements[n] = NULL;
+    return n;
+}
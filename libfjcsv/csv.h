@@ -13,12 +13,43 @@ const char **CSV_ParseString(const char *, char);
 const char *CSV_ConstructString(const char **, char);
 void CSV_FreeParse(const char **);
 
+/* The functions below never allocate or copy. They skip empty elements, so
+ runs of delimiters act as one, and leading and trailing ones are ignored.
+ Delimiters are found with memchr, which the C library vectorises.
+*/
+
+/* An element, as an offset and a length into the string it came from.
+*/
+struct CSV_Span {
+    unsigned long offset, length;
+};
+
+/* Finds the first element in the first `len' bytes of `a' that starts at
+ or after `*offset'. Returns 1, fills in `span' and moves `*offset' past the
+ element if there is one, and returns 0 otherwise.
+*/
+int CSV_NextSpan(const char *a, unsigned long len, char delimiter, unsigned long *offset, struct CSV_Span *span);
+
+/* Fills in the spans of up to `max' elements of the first `len' bytes of
+ `a'. Returns how many elements there are, which may be more than `max'.
+*/
+unsigned long CSV_SplitSpans(const char *a, unsigned long len, char delimiter, struct CSV_Span *spans, unsigned long max);
+
+/* Splits `a' in place, by writing a NUL over every delimiter. Puts pointers
+ to up to `max'-1 of the elements in `elements', then a NULL, so that it can
+ be used like the result of CSV_ParseString but must not be freed. Returns
+ how many pointers it put before the NULL. `max' must not be 0.
+*/
+unsigned long CSV_SplitInPlace(char *a, char delimiter, const char **elements, unsigned long max);
+
 #ifdef __cplusplus
 }
 
 #include <string>
 #include <vector>
+#include <iterator>
 #include <algorithm>
+#include <cstring>
 
 namespace FJ {
 
@@ -91,6 +122,104 @@ namespace FJ {
             CSV_FreeParse(a);
         }
 
+        //! @brief One element of a split string, viewed in place.
+        class Element {
+            const char *data_;
+            unsigned long size_;
+        public:
+            Element(const char *d, unsigned long s)
+              : data_(d)
+              , size_(s){}
+
+            //! Not NUL terminated.
+            const char *data() const {return data_;}
+            unsigned long size() const {return size_;}
+
+            std::string str() const {return std::string(data_, size_);}
+
+            bool operator == (const char *a) const {
+                return (strncmp(data_, a, size_)==0) && (a[size_]=='\0');
+            }
+        };
+
+        //! @brief The elements of a string, found one at a time as they are
+        //! iterated over.
+        //!
+        //! Nothing is allocated or copied, so the string must outlive the
+        //! Elements and its iterators. Empty elements are skipped, like
+        //! CSV_NextSpan.
+        class Elements {
+            const char *text;
+            unsigned long length;
+            char delimiter;
+        public:
+            Elements(const char *a, unsigned long len, char d)
+              : text(a)
+              , length(len)
+              , delimiter(d){}
+
+            class iterator : public std::iterator<std::forward_iterator_tag, Element> {
+                const Elements *elements;
+                unsigned long offset;
+                struct CSV_Span span;
+
+                void Next(){
+                    if(!CSV_NextSpan(elements->text, elements->length, elements->delimiter, &offset, &span))
+                        elements = nullptr;
+                }
+            public:
+                //! The end iterator.
+                iterator()
+                  : elements(nullptr)
+                  , offset(0){}
+
+                explicit iterator(const Elements *e)
+                  : elements(e)
+                  , offset(0){
+                    Next();
+                }
+
+                Element operator * () const {
+                    return Element(elements->text+span.offset, span.length);
+                }
+
+                iterator &operator ++ (){
+                    Next();
+                    return *this;
+                }
+
+                iterator operator ++ (int){
+                    iterator that = *this;
+                    Next();
+                    return that;
+                }
+
+                bool operator == (const iterator &that) const {
+                    return (elements==that.elements) && ((elements==nullptr) || (offset==that.offset));
+                }
+
+                bool operator != (const iterator &that) const {
+                    return !(*this==that);
+                }
+            };
+
+            iterator begin() const {return iterator(this);}
+            iterator end() const {return iterator();}
+        };
+
+        inline Elements Split(const char *a, char delimiter = ','){
+            return Elements(a, strlen(a), delimiter);
+        }
+
+        inline Elements Split(char *const a, char delimiter = ','){
+            return Elements(a, strlen(a), delimiter);
+        }
+
+        template<typename T>
+        Elements Split(const T &a, char delimiter = ','){
+            return Elements(a.c_str(), a.size(), delimiter);
+        }
+
     }
 
 }
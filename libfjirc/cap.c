@@ -0,0 +1,216 @@
+#include "cap.h"
+#include "message.h"
+#include "loginternal.h"
+
+#include <string.h>
+
+static IRC_allocator Alloc;
+static IRC_deallocator Dealloc;
+
+struct IRC_CapEntry {
+    const char *name;
+    enum IRC_capability cap;
+};
+
+static const struct IRC_CapEntry IRC_CapTable[] = {
+    {"multi-prefix", IRC_cap_multi_prefix},
+    {"away-notify", IRC_cap_away_notify},
+    {"extended-join", IRC_cap_extended_join},
+    {"batch", IRC_cap_batch},
+    {"server-time", IRC_cap_server_time},
+    {"echo-message", IRC_cap_echo_message},
+    {"userhost-in-names", IRC_cap_userhost_in_names},
+    {NULL, 0}
+};
+
+const char *IRC_CapName(enum IRC_capability cap){
+    const struct IRC_CapEntry *e = IRC_CapTable;
+    for(; e->name!=NULL; e++){
+        if(e->cap==cap)
+          return e->name;
+    }
+    return NULL;
+}
+
+enum IRC_capability IRC_CapFromName(const char *name, unsigned long len){
+    const struct IRC_CapEntry *e = IRC_CapTable;
+    for(; e->name!=NULL; e++){
+        if((strlen(e->name)==len) && (memcmp(e->name, name, len)==0))
+          return e->cap;
+    }
+    return 0;
+}
+
+/* Reads a space separated capability list, such as the last parameter of an
+ LS or ACK. Values ("sasl=PLAIN") are ignored. Capabilities prefixed with a
+ '-' are put in `removed' instead of the result. `removed' can be NULL.
+*/
+static unsigned long IRC_CapParseList(const char *list, unsigned long *removed){
+    unsigned long caps = 0;
+
+    if(removed!=NULL)
+      *removed = 0;
+
+    while(*list!='\0'){
+        const char *end, *name_end;
+        int remove = 0;
+
+        while(*list==' ')
+          list++;
+
+        /* Modifiers from before 302. Only removal means anything now.
+        */
+        while((*list=='-') || (*list=='~') || (*list=='=')){
+            if(*list=='-')
+              remove = 1;
+            list++;
+        }
+
+        end = list;
+        while((*end!='\0') && (*end!=' '))
+          end++;
+
+        name_end = list;
+        while((name_end!=end) && (*name_end!='='))
+          name_end++;
+
+        if(name_end!=list){
+            const enum IRC_capability cap = IRC_CapFromName(list, name_end-list);
+            if(!remove)
+              caps|=cap;
+            else if(removed!=NULL)
+              *removed|=cap;
+        }
+
+        list = end;
+    }
+
+    return caps;
+}
+
+/* Builds a CAP REQ for every capability in `caps'.
+*/
+static struct IRC_Message *IRC_CapRequest(unsigned long caps){
+    struct IRC_Message *msg;
+    const struct IRC_CapEntry *e = IRC_CapTable;
+    unsigned long len = 1;
+    char *list;
+
+    for(; e->name!=NULL; e++){
+        if(caps & e->cap)
+          len+=strlen(e->name)+1;
+    }
+
+    IRC_GetAllocators(&Alloc, &Dealloc);
+    list = Alloc(len);
+    list[0] = '\0';
+
+    for(e = IRC_CapTable; e->name!=NULL; e++){
+        if((caps & e->cap)==0)
+          continue;
+        if(list[0]!='\0')
+          strcat(list, " ");
+        strcat(list, e->name);
+    }
+
+    msg = IRC_CreateCap("REQ", list);
+    Dealloc(list);
+    return msg;
+}
+
+void IRC_CapInit(struct IRC_CapNegotiation *neg, unsigned long wanted){
+    neg->state = IRC_cap_idle;
+    neg->wanted = wanted;
+    neg->available = 0;
+    neg->requested = 0;
+    neg->enabled = 0;
+}
+
+struct IRC_Message *IRC_CapBegin(struct IRC_CapNegotiation *neg){
+    IRC_CapInit(neg, neg->wanted);
+    neg->state = IRC_cap_listing;
+    return IRC_CreateCap("LS", "302");
+}
+
+void IRC_CapFinish(struct IRC_CapNegotiation *neg){
+    neg->state = IRC_cap_done;
+    neg->requested = 0;
+}
+
+/* Replies look like `CAP <nick> <subcommand> [*] :<list>'. The '*' means
+ that more lines of the same reply are coming.
+*/
+struct IRC_Message *IRC_CapHandle(struct IRC_CapNegotiation *neg, const struct IRC_Message *msg){
+    const char *subcommand, *list;
+    int more;
+
+    if((msg->type!=IRC_cap) || (msg->num_parameters<3))
+      return NULL;
+
+    subcommand = msg->parameters[1];
+    list = msg->parameters[msg->num_parameters-1];
+    more = (msg->num_parameters>3) && (strcmp(msg->parameters[2], "*")==0);
+
+    if(list[0]==':')
+      list++;
+
+    IRC_LOG_DEBUG(("CAP %s: %s", subcommand, list));
+
+    if(strcmp(subcommand, "LS")==0){
+        if(neg->state!=IRC_cap_listing)
+          return NULL;
+
+        neg->available|=IRC_CapParseList(list, NULL);
+        if(more)
+          return NULL;
+
+        neg->requested = neg->available & neg->wanted;
+        if(neg->requested==0){
+            IRC_CapFinish(neg);
+            return IRC_CreateCap("END", NULL);
+        }
+
+        neg->state = IRC_cap_requesting;
+        return IRC_CapRequest(neg->requested);
+    }
+    else if(strcmp(subcommand, "NEW")==0){
+        /* Any newly offered capability we want is asked for straight away.
+         Registration is over by now, so there is no END to send afterwards.
+        */
+        unsigned long fresh = IRC_CapParseList(list, NULL) & ~(neg->available);
+        neg->available|=fresh;
+        fresh&=neg->wanted & ~(neg->enabled);
+
+        if((fresh==0) || (neg->state!=IRC_cap_done))
+          return NULL;
+
+        neg->requested|=fresh;
+        return IRC_CapRequest(fresh);
+    }
+    else if(strcmp(subcommand, "DEL")==0){
+        const unsigned long gone = IRC_CapParseList(list, NULL);
+        neg->available&=~gone;
+        neg->enabled&=~gone;
+        return NULL;
+    }
+    else if((strcmp(subcommand, "ACK")==0) || (strcmp(subcommand, "NAK")==0)){
+        /* A REQ is acknowledged or refused as a whole.
+        */
+        if(subcommand[0]=='A'){
+            unsigned long removed;
+            const unsigned long added = IRC_CapParseList(list, &removed);
+            neg->enabled = (neg->enabled | added) & ~removed;
+            neg->requested&=~(added | removed);
+        }
+        else
+          neg->requested&=~IRC_CapParseList(list, NULL);
+
+        if(neg->state!=IRC_cap_requesting)
+          return NULL;
+
+        IRC_CapFinish(neg);
+        return IRC_CreateCap("END", NULL);
+    }
+
+    return NULL;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+struct IRC_Message;
+
+/* IRCv3 capability negotiation.
+ The client sends CAP LS 302 before registering, which makes the server hold
+ registration until CAP END. Every CAP reply is given to IRC_CapHandle, which
+ returns the next message to send, if any. Capabilities are bits, so that
+ anything holding a copy of `enabled' can test them cheaply.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum IRC_capability {
+  IRC_cap_multi_prefix      = 1<<0,
+  IRC_cap_away_notify       = 1<<1,
+  IRC_cap_extended_join     = 1<<2,
+  IRC_cap_batch             = 1<<3,
+  IRC_cap_server_time       = 1<<4,
+  IRC_cap_echo_message      = 1<<5,
+  IRC_cap_userhost_in_names = 1<<6,
+/*Aliases*/
+  IRC_cap_all               = (1<<7)-1
+};
+
+enum IRC_capState {IRC_cap_idle, IRC_cap_listing, IRC_cap_requesting,
+  IRC_cap_done};
+
+struct IRC_CapNegotiation {
+  enum IRC_capState state;
+  /* Capabilities we would like to have. */
+  unsigned long wanted;
+  /* Capabilities the server has offered, out of the ones we know. */
+  unsigned long available;
+  /* Capabilities in our outstanding REQ. */
+  unsigned long requested;
+  /* Capabilities the server has acknowledged. */
+  unsigned long enabled;
+};
+
+/* Returns the name of a single capability, or NULL.
+*/
+const char *IRC_CapName(enum IRC_capability cap);
+
+/* Returns the capability named by the first `len' bytes of `name', or 0 if it
+ is not one we know about.
+*/
+enum IRC_capability IRC_CapFromName(const char *name, unsigned long len);
+
+void IRC_CapInit(struct IRC_CapNegotiation *neg, unsigned long wanted);
+
+/* Resets `neg' and returns the CAP LS 302 that starts negotiation.
+*/
+struct IRC_Message *IRC_CapBegin(struct IRC_CapNegotiation *neg);
+
+/* Handles a CAP message from the server. Returns the reply to send, which is
+ a CAP REQ or a CAP END, or NULL if there is nothing to send. Messages that
+ are not CAP are ignored.
+*/
+struct IRC_Message *IRC_CapHandle(struct IRC_CapNegotiation *neg, const struct IRC_Message *msg);
+
+/* Ends negotiation without the server's help, for instance when a server
+ that does not know CAP welcomes us anyway.
+*/
+void IRC_CapFinish(struct IRC_CapNegotiation *neg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,4 +1,7 @@
 #include "channel.h"
+#include "state.h"
+#include "nickindex.h"
+#include "intern.h"
 #include "message.h"
 #include <string.h>
 
@@ -20,12 +23,34 @@ struct IRC_Channel *IRC_ChannelUnwrap(struct IRC_ChannelHolder *a){
 static IRC_allocator Alloc;
 static IRC_deallocator Dealloc;
 
+void IRC_InitChannel(struct IRC_Channel *a, const char *name, struct IRC_State *state){
+    a->name = name;
+    a->num_members = 0;
+    a->users = NULL;
+    a->mode = NULL;
+    a->umode = NULL;
+    a->OnUserAdd = NULL;
+    a->OnUserRemove = NULL;
+    a->state = state;
+    a->userdata = NULL;
+}
+
 void IRC_ChannelAddUser(struct IRC_Channel *a, struct IRC_User *user){
 
+    struct IRC_UserHolder *h;
+
     IRC_GetAllocators(&Alloc, NULL);
 
-    {
-        struct IRC_UserHolder *h = Alloc(sizeof(struct IRC_UserHolder));
+    h = Alloc(sizeof(struct IRC_UserHolder));
+    h->user = user;
+    h->userdata = NULL;
+
+    if(a->users==NULL){
+        h->next = h;
+        h->prev = h;
+        a->users = h;
+    }
+    else{
         struct IRC_UserHolder *first = a->users;
         struct IRC_UserHolder *last  = IRC_UserPrev(a->users);
 
@@ -33,9 +58,13 @@ void IRC_ChannelAddUser(struct IRC_Channel *a, struct IRC_User *user){
         last->next  = h;
         h->next = first;
         h->prev = last;
-
     }
 
+    a->num_members++;
+
+    if((a->state!=NULL) && (a->state->nicks!=NULL))
+      IRC_NickIndexAdd(a->state->nicks, a, h);
+
     if(a->OnUserAdd!=NULL)
       a->OnUserAdd(a, user);
 
@@ -45,12 +74,24 @@ void IRC_ChannelRemoveUserR(struct IRC_Channel *a, struct IRC_UserHolder *user){
 
     IRC_GetAllocators(NULL, &Dealloc);
 
-    IRC_UserNext(user)->prev = IRC_UserPrev(user);
-    IRC_UserPrev(user)->next = IRC_UserNext(user);
+    if((a->state!=NULL) && (a->state->nicks!=NULL))
+      IRC_NickIndexRemove(a->state->nicks, a, user);
+
+    if(IRC_UserNext(user)==user)
+      a->users = NULL;
+    else{
+        IRC_UserNext(user)->prev = IRC_UserPrev(user);
+        IRC_UserPrev(user)->next = IRC_UserNext(user);
+        if(a->users==user)
+          a->users = IRC_UserNext(user);
+    }
+
+    a->num_members--;
 
     if(a->OnUserRemove!=NULL)
       a->OnUserRemove(a, user->user);
 
+    Dealloc((void *)user->user->name);
     Dealloc(user->user);
     Dealloc(user);
 
@@ -59,6 +100,9 @@ void IRC_ChannelRemoveUserR(struct IRC_Channel *a, struct IRC_UserHolder *user){
 void IRC_ChannelRemoveUser(struct IRC_Channel *a, struct IRC_User *user){
 
     struct IRC_UserHolder *h = a->users;
+    if(h==NULL)
+      return;
+
     do{
         if(h->user==user){
             IRC_ChannelRemoveUserR(a, h);
@@ -72,8 +116,28 @@ void IRC_ChannelRemoveUser(struct IRC_Channel *a, struct IRC_User *user){
 void IRC_ChannelRemoveUserName(struct IRC_Channel *a, const char *name){
 
     struct IRC_UserHolder *h = a->users;
+
+    /* With an index, there is no need to look through the whole channel.
+    */
+    if((a->state!=NULL) && (a->state->nicks!=NULL)){
+        unsigned long i = 0, n;
+        const struct IRC_NickMembership *m = IRC_NickIndexFind(a->state->nicks, name, &n);
+        for(; i<n; i++){
+            if(m[i].channel==a){
+                IRC_ChannelRemoveUserR(a, m[i].holder);
+                return;
+            }
+        }
+        return;
+    }
+
+    if(h==NULL)
+      return;
+
+    /* Compared as the index would, so that both find the same user.
+    */
     do{
-        if(strcmp(h->user->name, name)==0){
+        if(IRC_CaseEqual(h->user->name, name)){
             IRC_ChannelRemoveUserR(a, h);
             return;
         }
@@ -3,6 +3,7 @@
 
 struct IRC_Channel;
 struct IRC_MessageHolder;
+struct IRC_State;
 
 typedef void (*IRC_ChannelUserCallback)(struct IRC_Channel *, struct IRC_User *);
 
@@ -19,11 +20,29 @@ struct IRC_Channel {
     IRC_ChannelUserCallback OnUserAdd;
     IRC_ChannelUserCallback OnUserRemove;
 
+    /* The state this channel is part of, or NULL. Its nick index is kept up
+     to date as users are added and removed.
+    */
+    struct IRC_State *state;
+
     void *userdata;
 };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sets up an empty channel named `name' in `state', which may be NULL. A
+ channel must be set up this way, or else zeroed, before anything else is done
+ with it.
+*/
+void IRC_InitChannel(struct IRC_Channel *a, const char *name, struct IRC_State *state);
+
 /* In a multithreaded environment it is up to the application to
   perform appropriate locking before calling these functions.
+
+  A channel owns its users once they are added. A user and its name are both
+  freed when it is removed.
 */
 void IRC_ChannelAddUser(struct IRC_Channel *a, struct IRC_User *user);
 void IRC_ChannelRemoveUser(struct IRC_Channel *a, struct IRC_User *user);
@@ -46,3 +65,7 @@ struct IRC_ChannelHolder{
 struct IRC_ChannelHolder *IRC_ChannelNext(struct IRC_ChannelHolder *a);
 struct IRC_ChannelHolder *IRC_ChannelPrev(struct IRC_ChannelHolder *a);
 struct IRC_Channel *IRC_ChannelUnwrap(struct IRC_ChannelHolder *a);
+
+#ifdef __cplusplus
+}
+#endif
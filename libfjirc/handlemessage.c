@@ -1,7 +1,36 @@
 #include "handlemessage.h"
+#include "channel.h"
+#include "nickindex.h"
 #include <stdlib.h>
+#include <string.h>
+
+/* Returns a copy of the nick at the start of a message's `from', which is
+ ":nick!user@host", or NULL if there isn't one.
+*/
+static char *IRC_NickFromPrefix(const char *from){
+    const char *end;
+
+    if(from==NULL)
+      return NULL;
+
+    if(*from==':')
+      from++;
+
+    end = from;
+    while((*end!='\0') && (*end!='!') && (*end!='@'))
+      end++;
+
+    if(end==from)
+      return NULL;
+
+    return IRC_Strndup(from, end-from);
+}
 
 int IRC_CanApplyMessage(struct IRC_State *state, struct IRC_Message *msg){
+    IRC_deallocator dealloc;
+    char *nick;
+    int r;
+
     switch(msg->type){
 
       case IRC_mt_null:
@@ -10,16 +39,22 @@ int IRC_CanApplyMessage(struct IRC_State *state, struct IRC_Message *msg){
         */
       case IRC_join:
       case IRC_part:
-      case IRC_quit:
       case IRC_squit:
       case IRC_topic:
         return 0;
 
       case IRC_privmsg:
-        if(msg->from==NULL)
+      case IRC_quit:
+      case IRC_nick:
+        if((nick = IRC_NickFromPrefix(msg->from))==NULL)
           return 0;
-        if(IRC_StateContainsUser(state, msg->from))
-          return 1;
+
+        r = IRC_StateContainsUser(state, nick);
+
+        IRC_GetAllocators(NULL, &dealloc);
+        dealloc(nick);
+
+        return r;
 
       default:
         return 0;
@@ -27,3 +62,44 @@ int IRC_CanApplyMessage(struct IRC_State *state, struct IRC_Message *msg){
     }
 
 }
+
+void IRC_ApplyMessage(struct IRC_State *state, struct IRC_Message *msg){
+    const struct IRC_NickMembership *m;
+    IRC_deallocator dealloc;
+    unsigned long i, n;
+    char *nick;
+
+    if(state->nicks==NULL)
+      return;
+
+    if((msg->type!=IRC_quit) && (msg->type!=IRC_nick))
+      return;
+
+    if((nick = IRC_NickFromPrefix(msg->from))==NULL)
+      return;
+
+    IRC_GetAllocators(NULL, &dealloc);
+
+    if(msg->type==IRC_quit){
+        /* Only the channels the user is in are touched. Each removal takes
+         the channel out of the index, so just keep taking the first one.
+        */
+        while((m = IRC_NickIndexFind(state->nicks, nick, &n))!=NULL)
+          IRC_ChannelRemoveUserR(m->channel, m->holder);
+    }
+    else if(msg->num_parameters>0){
+        /* The users are renamed where they are, and then the index. The
+         memberships are no longer valid once the index has changed.
+        */
+        m = IRC_NickIndexFind(state->nicks, nick, &n);
+        for(i = 0; i<n; i++){
+            struct IRC_User *user = m[i].holder->user;
+            dealloc((void *)user->name);
+            user->name = IRC_Strdup(msg->parameters[0]);
+        }
+
+        IRC_NickIndexRename(state->nicks, nick, msg->parameters[0]);
+    }
+
+    dealloc(nick);
+}
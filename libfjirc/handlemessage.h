@@ -2,8 +2,20 @@
 #include "message.h"
 #include "state.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Checks if an incoming message is applicable to the given state
 */
 int IRC_CanApplyMessage(struct IRC_State *state, struct IRC_Message *msg);
 
+/* Applies a QUIT or NICK to every channel in the state that the user is in,
+ and no others. A QUIT removes the user, and a NICK renames them in place.
+ Anything else is ignored, as is everything if the state has no nick index.
+*/
 void IRC_ApplyMessage(struct IRC_State *state, struct IRC_Message *msg);
+
+#ifdef __cplusplus
+}
+#endif
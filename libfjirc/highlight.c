@@ -0,0 +1,290 @@
+#include "highlight.h"
+#include "isupport.h"
+#include "message.h"
+
+#include <string.h>
+
+struct IRC_HighlightPattern {
+    /* Casefolded. */
+    char *text;
+    unsigned long len;
+    unsigned flags;
+    long id;
+    /* Next pattern that ends in the same state, or -1. */
+    long next;
+};
+
+struct IRC_Highlighter {
+    unsigned char fold[256];
+
+    struct IRC_HighlightPattern *patterns;
+    unsigned long num_patterns, max_patterns;
+
+    /* Bytes are first mapped to a class, so that the transition table only
+     needs a column for each distinct byte in the patterns, plus class 0 for
+     every other byte.
+    */
+    unsigned short classes[256];
+    unsigned long num_classes;
+
+    /* delta[state*num_classes+class] is the next state. Every entry is
+     filled in, so scanning never needs to follow failure links. State 0 is
+     the root. NULL if the highlighter is not compiled.
+    */
+    long *delta;
+    /* First pattern that ends at each state, or -1. */
+    long *out;
+    /* Nearest state along the failure links that has a pattern ending at
+     it, or 0 if there isn't one.
+    */
+    long *dict;
+    unsigned long num_states;
+
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+};
+
+/* Letters, digits, anything that isn't ASCII, and the specials allowed in
+ nicks.
+*/
+static int IRC_IsNickChar(char c){
+    const unsigned char u = c;
+    if(((u>='a') && (u<='z')) || ((u>='A') && (u<='Z')) || ((u>='0') && (u<='9')) || (u>=0x80))
+      return 1;
+    return (u!='\0') && (strchr("[]\\`^{}|-_", u)!=NULL);
+}
+
+static void IRC_FreeAutomaton(struct IRC_Highlighter *h){
+    if(h->delta!=NULL)
+      h->dealloc(h->delta);
+    if(h->out!=NULL)
+      h->dealloc(h->out);
+    if(h->dict!=NULL)
+      h->dealloc(h->dict);
+    h->delta = NULL;
+    h->out = NULL;
+    h->dict = NULL;
+    h->num_states = 0;
+}
+
+struct IRC_Highlighter *IRC_CreateHighlighter(const unsigned char *fold){
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+    struct IRC_Highlighter *h;
+
+    IRC_GetAllocators(&alloc, &dealloc);
+
+    h = alloc(sizeof(struct IRC_Highlighter));
+    if(h==NULL)
+      return NULL;
+
+    if(fold==NULL)
+      IRC_BuildFoldTable(IRC_casemap_rfc1459, h->fold);
+    else
+      memcpy(h->fold, fold, 256);
+
+    h->patterns = NULL;
+    h->num_patterns = 0;
+    h->max_patterns = 0;
+    h->num_classes = 0;
+    h->delta = NULL;
+    h->out = NULL;
+    h->dict = NULL;
+    h->num_states = 0;
+    h->alloc = alloc;
+    h->dealloc = dealloc;
+
+    return h;
+}
+
+void IRC_DestroyHighlighter(struct IRC_Highlighter *h){
+    IRC_HighlighterClear(h);
+    h->dealloc(h);
+}
+
+int IRC_HighlighterAdd(struct IRC_Highlighter *h, const char *pattern, unsigned long len, unsigned flags, long id){
+    struct IRC_HighlightPattern *p;
+    unsigned long i = 0;
+
+    if(len==0)
+      return 1;
+
+    if(h->num_patterns==h->max_patterns){
+        const unsigned long max_patterns = (h->max_patterns==0)?8:(h->max_patterns<<1);
+        struct IRC_HighlightPattern *patterns = h->alloc(sizeof(struct IRC_HighlightPattern)*max_patterns);
+        if(patterns==NULL)
+          return 0;
+
+        if(h->patterns!=NULL){
+            memcpy(patterns, h->patterns, sizeof(struct IRC_HighlightPattern)*h->num_patterns);
+            h->dealloc(h->patterns);
+        }
+        h->patterns = patterns;
+        h->max_patterns = max_patterns;
+    }
+
+    p = h->patterns+h->num_patterns;
+    p->text = h->alloc(len);
+    if(p->text==NULL)
+      return 0;
+
+    for(; i<len; i++)
+      p->text[i] = h->fold[(unsigned char)pattern[i]];
+    p->len = len;
+    p->flags = flags;
+    p->id = id;
+    p->next = -1;
+
+    h->num_patterns++;
+    return 1;
+}
+
+void IRC_HighlighterClear(struct IRC_Highlighter *h){
+    unsigned long i = 0;
+    for(; i<h->num_patterns; i++)
+      h->dealloc(h->patterns[i].text);
+
+    if(h->patterns!=NULL)
+      h->dealloc(h->patterns);
+
+    h->patterns = NULL;
+    h->num_patterns = 0;
+    h->max_patterns = 0;
+
+    IRC_FreeAutomaton(h);
+}
+
+int IRC_HighlighterCompile(struct IRC_Highlighter *h){
+    unsigned short folded_class[256];
+    unsigned long max_states = 1, num_classes = 1, i, e;
+    long *fail, *queue;
+    unsigned long queue_front = 0, queue_back = 0;
+
+    IRC_FreeAutomaton(h);
+
+    if(h->num_patterns==0)
+      return 1;
+
+    /* Give each distinct byte of the patterns its own class.
+    */
+    memset(folded_class, 0, sizeof(folded_class));
+    for(i = 0; i<h->num_patterns; i++){
+        const struct IRC_HighlightPattern *p = h->patterns+i;
+        for(e = 0; e<p->len; e++){
+            const unsigned char c = p->text[e];
+            if(folded_class[c]==0)
+              folded_class[c] = num_classes++;
+        }
+        max_states+=p->len;
+    }
+
+    for(i = 0; i<256; i++)
+      h->classes[i] = folded_class[h->fold[i]];
+    h->num_classes = num_classes;
+
+    h->delta = h->alloc(sizeof(long)*max_states*num_classes);
+    h->out = h->alloc(sizeof(long)*max_states);
+    h->dict = h->alloc(sizeof(long)*max_states);
+    fail = h->alloc(sizeof(long)*max_states);
+    queue = h->alloc(sizeof(long)*max_states);
+
+    if((h->delta==NULL) || (h->out==NULL) || (h->dict==NULL) || (fail==NULL) || (queue==NULL)){
+        if(fail!=NULL)
+          h->dealloc(fail);
+        if(queue!=NULL)
+          h->dealloc(queue);
+        IRC_FreeAutomaton(h);
+        return 0;
+    }
+
+    for(i = 0; i<max_states*num_classes; i++)
+      h->delta[i] = -1;
+    for(i = 0; i<max_states; i++){
+        h->out[i] = -1;
+        h->dict[i] = 0;
+    }
+
+    /* Build the trie.
+    */
+    h->num_states = 1;
+    for(i = 0; i<h->num_patterns; i++){
+        struct IRC_HighlightPattern *p = h->patterns+i;
+        long s = 0;
+        for(e = 0; e<p->len; e++){
+            long *t = h->delta+(s*num_classes)+folded_class[(unsigned char)p->text[e]];
+            if(*t<0)
+              *t = h->num_states++;
+            s = *t;
+        }
+        p->next = h->out[s];
+        h->out[s] = i;
+    }
+
+    /* Fill in the missing transitions breadth first, so that the row of a
+     state's failure link is always complete before the state's own row.
+    */
+    for(i = 0; i<num_classes; i++){
+        long *t = h->delta+i;
+        if(*t<0)
+          *t = 0;
+        else{
+            fail[*t] = 0;
+            queue[queue_back++] = *t;
+        }
+    }
+
+    while(queue_front!=queue_back){
+        const long s = queue[queue_front++];
+        for(i = 0; i<num_classes; i++){
+            long *t = h->delta+(s*num_classes)+i;
+            const long through_fail = h->delta[(fail[s]*num_classes)+i];
+            if(*t<0)
+              *t = through_fail;
+            else{
+                fail[*t] = through_fail;
+                h->dict[*t] = (h->out[through_fail]>=0)?through_fail:h->dict[through_fail];
+                queue[queue_back++] = *t;
+            }
+        }
+    }
+
+    h->dealloc(fail);
+    h->dealloc(queue);
+
+    return 1;
+}
+
+int IRC_HighlighterScan(const struct IRC_Highlighter *h, const char *text, unsigned long len, struct IRC_HighlightMatch *match){
+    unsigned long i = 0;
+    long s = 0;
+
+    if(h->delta==NULL)
+      return 0;
+
+    for(; i<len; i++){
+        long o;
+        s = h->delta[(s*h->num_classes)+h->classes[(unsigned char)text[i]]];
+
+        for(o = (h->out[s]>=0)?s:h->dict[s]; o>0; o = h->dict[o]){
+            long p = h->out[o];
+            for(; p>=0; p = h->patterns[p].next){
+                const struct IRC_HighlightPattern *pattern = h->patterns+p;
+                const unsigned long start = i+1-pattern->len;
+
+                if((pattern->flags & IRC_HIGHLIGHT_WORD_START) && (start>0) && IRC_IsNickChar(text[start-1]))
+                  continue;
+                if((pattern->flags & IRC_HIGHLIGHT_WORD_END) && (i+1<len) && IRC_IsNickChar(text[i+1]))
+                  continue;
+
+                if(match!=NULL){
+                    match->id = pattern->id;
+                    match->start = start;
+                    match->len = pattern->len;
+                }
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
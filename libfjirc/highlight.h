@@ -0,0 +1,57 @@
+#pragma once
+
+/* Matches many highlight words against a line at once.
+ Patterns are added to a highlighter, which is then compiled into a single
+ automaton (Aho-Corasick, with every transition filled in), so that scanning
+ a line looks at each byte exactly once no matter how many patterns there
+ are. Matching ignores case, as given by a fold table from isupport.h.
+
+ A highlighter must be compiled again after patterns are added, and is not
+ locked. Scanning an uncompiled highlighter never matches.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct IRC_Highlighter;
+
+/* The pattern must not be preceded by a nick character. */
+#define IRC_HIGHLIGHT_WORD_START 1
+/* The pattern must not be followed by a nick character. */
+#define IRC_HIGHLIGHT_WORD_END 2
+#define IRC_HIGHLIGHT_WORD (IRC_HIGHLIGHT_WORD_START|IRC_HIGHLIGHT_WORD_END)
+
+struct IRC_HighlightMatch {
+    long id;
+    unsigned long start, len;
+};
+
+/* `fold' may be NULL for RFC 1459 casefolding. It is copied.
+*/
+struct IRC_Highlighter *IRC_CreateHighlighter(const unsigned char *fold);
+void IRC_DestroyHighlighter(struct IRC_Highlighter *h);
+
+/* Adds the first `len' bytes of `pattern'. `id' is given back when it
+ matches. Empty patterns are ignored. Returns 0 if there was no memory.
+*/
+int IRC_HighlighterAdd(struct IRC_Highlighter *h, const char *pattern, unsigned long len, unsigned flags, long id);
+
+/* Removes every pattern. The highlighter will not match until it is compiled
+ again.
+*/
+void IRC_HighlighterClear(struct IRC_Highlighter *h);
+
+/* Builds the automaton. Returns 0 if there was no memory, in which case the
+ highlighter will not match anything.
+*/
+int IRC_HighlighterCompile(struct IRC_Highlighter *h);
+
+/* Finds the match that ends first in the first `len' bytes of `text'.
+ Returns nonzero and fills in `match', which may be NULL, if there is one.
+*/
+int IRC_HighlighterScan(const struct IRC_Highlighter *h, const char *text, unsigned long len, struct IRC_HighlightMatch *match);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,6 +1,7 @@
 #include "input.h"
 #include "message.h"
 #include "messageinternal.h"
+#include "loginternal.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -64,7 +65,7 @@ struct IRC_Message *IRC_GenerateMessage(const char *to, const char *input){
             }
         }
 
-        printf("Processing %s (%s) message %s.\n", type_str, IRC_GetMessageToken(type), input);
+        IRC_LOG_DEBUG(("Processing %s (%s) message %s.", type_str, IRC_GetMessageToken(type), input));
 
         Dealloc((void *)type_str);
 
@@ -73,25 +74,17 @@ struct IRC_Message *IRC_GenerateMessage(const char *to, const char *input){
 
     }
     else
-      printf("Processing %s message %s.\n", IRC_GetMessageToken(type), input);
+      IRC_LOG_DEBUG(("Processing %s message %s.", IRC_GetMessageToken(type), input));
 
 
     if((type==IRC_nick) || (type==IRC_join)){
-        GENERATE_MSG(msg, 1, type);
-        SET_PARAM(msg, 0, input);
-        r_msg = msg;
-    }
-    else if(type==IRC_privmsg){
-        GENERATE_MSG(msg, 2, type);
-        SET_PARAM(msg, 0, to);
-        SET_PARAM(msg, 1, input);
-        r_msg = msg;
+        r_msg = IRC_BuildMessage(type, 1, &input);
     }
     else{
-        GENERATE_MSG(msg, 2, type);
-        SET_PARAM(msg, 0, to);
-        SET_PARAM(msg, 1, input);
-        r_msg = msg;
+        const char *params[2];
+        params[0] = to;
+        params[1] = input;
+        r_msg = IRC_BuildMessage(type, 2, params);
     }
 
     return r_msg;
@@ -0,0 +1,297 @@
+#include "intern.h"
+#include "isupport.h"
+#include "message.h"
+
+#include <string.h>
+
+struct IRC_Interned {
+    struct IRC_Interned *next;
+    unsigned long hash;
+    unsigned long refs;
+    unsigned long len;
+    /* Both point just past the end of the struct, in the same allocation.
+    */
+    char *key;
+    char *string;
+};
+
+struct IRC_InternTable {
+    struct IRC_Interned **buckets;
+    unsigned long num_buckets; /* Always a power of two. */
+    unsigned long count;
+
+    /* Lowercase form of every byte. */
+    unsigned char fold[256];
+
+    IRC_internLock lock;
+    IRC_internLock unlock;
+    void *arg;
+
+    /* Kept so that the table is freed the way it was allocated, even if the
+     allocators change.
+    */
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+};
+
+#define IRC_INTERN_INITIAL_BUCKETS 256
+
+#define LOCK_TABLE(T)\
+    if(T->lock!=NULL)\
+      T->lock(T->arg)
+
+#define UNLOCK_TABLE(T)\
+    if(T->unlock!=NULL)\
+      T->unlock(T->arg)
+
+static char IRC_FoldChar(char c){
+    if((c>='A') && (c<='^'))
+      return c+('a'-'A');
+    return c;
+}
+
+void IRC_CaseFold(char *to, const char *from, unsigned long len){
+    unsigned long i = 0;
+    for(; i<len; i++)
+      to[i] = IRC_FoldChar(from[i]);
+}
+
+int IRC_CaseEqual(const char *a, const char *b){
+    while((*a!='\0') && (IRC_FoldChar(*a)==IRC_FoldChar(*b))){
+        a++;
+        b++;
+    }
+    return IRC_FoldChar(*a)==IRC_FoldChar(*b);
+}
+
+static void IRC_InternFold(const unsigned char *fold, char *to, const char *from, unsigned long len){
+    unsigned long i = 0;
+    for(; i<len; i++)
+      to[i] = fold[(unsigned char)from[i]];
+}
+
+/* FNV-1a over the casefolded bytes.
+*/
+static unsigned long IRC_InternHash(const unsigned char *fold, const char *a, unsigned long len){
+    unsigned long hash = 2166136261ul, i = 0;
+    for(; i<len; i++){
+        hash^=fold[(unsigned char)a[i]];
+        hash = (hash*16777619ul) & 0xFFFFFFFFul;
+    }
+    return hash;
+}
+
+static int IRC_InternMatches(const unsigned char *fold, const struct IRC_Interned *e, unsigned long hash, const char *a, unsigned long len){
+    unsigned long i = 0;
+    if((e->hash!=hash) || (e->len!=len))
+      return 0;
+    for(; i<len; i++){
+        if(fold[(unsigned char)a[i]]!=(unsigned char)e->key[i])
+          return 0;
+    }
+    return 1;
+}
+
+static struct IRC_Interned *IRC_InternLookup(struct IRC_InternTable *table, unsigned long hash, const char *a, unsigned long len){
+    struct IRC_Interned *e = table->buckets[hash & (table->num_buckets-1)];
+    while((e!=NULL) && (!IRC_InternMatches(table->fold, e, hash, a, len)))
+      e = e->next;
+    return e;
+}
+
+/* Doubles the number of buckets. If there isn't memory for it, the table just
+ stays the size it is.
+*/
+static void IRC_InternGrow(struct IRC_InternTable *table){
+    const unsigned long num_buckets = table->num_buckets<<1;
+    struct IRC_Interned **buckets = table->alloc(sizeof(struct IRC_Interned *)*num_buckets);
+    unsigned long i = 0;
+
+    if(buckets==NULL)
+      return;
+
+    memset(buckets, 0, sizeof(struct IRC_Interned *)*num_buckets);
+
+    for(; i<table->num_buckets; i++){
+        struct IRC_Interned *e = table->buckets[i];
+        while(e!=NULL){
+            struct IRC_Interned *next = e->next;
+            const unsigned long b = e->hash & (num_buckets-1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+
+    table->dealloc(table->buckets);
+    table->buckets = buckets;
+    table->num_buckets = num_buckets;
+}
+
+struct IRC_InternTable *IRC_CreateInternTable(IRC_internLock lock, IRC_internLock unlock, void *arg){
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+    struct IRC_InternTable *table;
+
+    IRC_GetAllocators(&alloc, &dealloc);
+
+    table = alloc(sizeof(struct IRC_InternTable));
+    table->num_buckets = IRC_INTERN_INITIAL_BUCKETS;
+    table->buckets = alloc(sizeof(struct IRC_Interned *)*table->num_buckets);
+    memset(table->buckets, 0, sizeof(struct IRC_Interned *)*table->num_buckets);
+    table->count = 0;
+    IRC_BuildFoldTable(IRC_casemap_rfc1459, table->fold);
+    table->lock = lock;
+    table->unlock = unlock;
+    table->arg = arg;
+    table->alloc = alloc;
+    table->dealloc = dealloc;
+
+    return table;
+}
+
+void IRC_DestroyInternTable(struct IRC_InternTable *table){
+    unsigned long i = 0;
+    for(; i<table->num_buckets; i++){
+        struct IRC_Interned *e = table->buckets[i];
+        while(e!=NULL){
+            struct IRC_Interned *next = e->next;
+            table->dealloc(e);
+            e = next;
+        }
+    }
+    table->dealloc(table->buckets);
+    table->dealloc(table);
+}
+
+const struct IRC_Interned *IRC_Intern(struct IRC_InternTable *table, const char *a, unsigned long len){
+    unsigned long hash;
+    struct IRC_Interned *e;
+
+    LOCK_TABLE(table);
+
+    hash = IRC_InternHash(table->fold, a, len);
+    e = IRC_InternLookup(table, hash, a, len);
+
+    if(e==NULL){
+        e = table->alloc(sizeof(struct IRC_Interned)+(len+1)*2);
+        e->hash = hash;
+        e->refs = 0;
+        e->len = len;
+        e->key = (char *)(e+1);
+        e->string = e->key+len+1;
+
+        IRC_InternFold(table->fold, e->key, a, len);
+        e->key[len] = '\0';
+        memcpy(e->string, a, len);
+        e->string[len] = '\0';
+
+        if(table->count>=table->num_buckets)
+          IRC_InternGrow(table);
+
+        e->next = table->buckets[hash & (table->num_buckets-1)];
+        table->buckets[hash & (table->num_buckets-1)] = e;
+        table->count++;
+    }
+
+    e->refs++;
+
+    UNLOCK_TABLE(table);
+
+    return e;
+}
+
+const struct IRC_Interned *IRC_InternFind(struct IRC_InternTable *table, const char *a, unsigned long len){
+    unsigned long hash;
+    struct IRC_Interned *e;
+
+    LOCK_TABLE(table);
+
+    hash = IRC_InternHash(table->fold, a, len);
+    e = IRC_InternLookup(table, hash, a, len);
+    if(e!=NULL)
+      e->refs++;
+
+    UNLOCK_TABLE(table);
+
+    return e;
+}
+
+const struct IRC_Interned *IRC_InternRetain(struct IRC_InternTable *table, const struct IRC_Interned *a){
+    LOCK_TABLE(table);
+    ((struct IRC_Interned *)a)->refs++;
+    UNLOCK_TABLE(table);
+    return a;
+}
+
+void IRC_InternRelease(struct IRC_InternTable *table, const struct IRC_Interned *a){
+    struct IRC_Interned *e = (struct IRC_Interned *)a;
+
+    LOCK_TABLE(table);
+
+    if(--(e->refs)==0){
+        struct IRC_Interned **link = table->buckets+(e->hash & (table->num_buckets-1));
+        while(*link!=e)
+          link = &((*link)->next);
+        *link = e->next;
+
+        table->count--;
+        table->dealloc(e);
+    }
+
+    UNLOCK_TABLE(table);
+}
+
+const char *IRC_InternString(const struct IRC_Interned *a){
+    return a->string;
+}
+
+unsigned long IRC_InternLength(const struct IRC_Interned *a){
+    return a->len;
+}
+
+void IRC_InternSetCaseMapping(struct IRC_InternTable *table, const unsigned char fold[256]){
+    struct IRC_Interned *all = NULL;
+    unsigned long i = 0;
+
+    LOCK_TABLE(table);
+
+    if(memcmp(table->fold, fold, 256)!=0){
+        memcpy(table->fold, fold, 256);
+
+        /* Pull every entry out into one list, then put them back where their
+         new hashes say they go. This needs no memory, so it can't fail
+         halfway.
+        */
+        for(; i<table->num_buckets; i++){
+            struct IRC_Interned *e = table->buckets[i];
+            while(e!=NULL){
+                struct IRC_Interned *next = e->next;
+                IRC_InternFold(fold, e->key, e->string, e->len);
+                e->hash = IRC_InternHash(fold, e->string, e->len);
+                e->next = all;
+                all = e;
+                e = next;
+            }
+            table->buckets[i] = NULL;
+        }
+
+        while(all!=NULL){
+            struct IRC_Interned *next = all->next;
+            const unsigned long b = all->hash & (table->num_buckets-1);
+            all->next = table->buckets[b];
+            table->buckets[b] = all;
+            all = next;
+        }
+    }
+
+    UNLOCK_TABLE(table);
+}
+
+unsigned long IRC_InternCount(struct IRC_InternTable *table){
+    unsigned long count;
+    LOCK_TABLE(table);
+    count = table->count;
+    UNLOCK_TABLE(table);
+    return count;
+}
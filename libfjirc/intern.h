@@ -0,0 +1,74 @@
+#pragma once
+
+/* String interning for nicks, channel names and hosts.
+ A table holds one copy of every string it has been given. Strings are keyed
+ by their casefolded bytes, so "Nick" and "nICK" give the same handle, and two
+ handles from the same table are equal names exactly when they are the same
+ pointer. The string a handle shows is the spelling it was first interned
+ with.
+
+ Handles are reference counted. Every handle returned by IRC_Intern,
+ IRC_InternFind or IRC_InternRetain must be given back with IRC_InternRelease,
+ and the string is freed when the last one is.
+
+ A table can be given a lock, which is held around every lookup and every
+ change to a reference count. Otherwise, all use of a table and its handles
+ must be serialized by the caller.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct IRC_InternTable;
+struct IRC_Interned;
+
+typedef void (*IRC_internLock)(void *);
+
+/* RFC 1459 casefolding, in which {}|~ are the lowercase forms of []\^.
+ `to' and `from' may be the same. Tables start out folding this way too.
+*/
+void IRC_CaseFold(char *to, const char *from, unsigned long len);
+
+/* Nonzero if `a' and `b' are the same under RFC 1459 casefolding.
+*/
+int IRC_CaseEqual(const char *a, const char *b);
+
+/* `lock' and `unlock' may be NULL, in which case the table is not locked.
+*/
+struct IRC_InternTable *IRC_CreateInternTable(IRC_internLock lock, IRC_internLock unlock, void *arg);
+/* Frees the table and every string in it, whether or not it is still
+ referenced.
+*/
+void IRC_DestroyInternTable(struct IRC_InternTable *table);
+
+/* Returns a referenced handle for the first `len' bytes of `a', adding it to
+ the table if it is not already there.
+*/
+const struct IRC_Interned *IRC_Intern(struct IRC_InternTable *table, const char *a, unsigned long len);
+/* Like IRC_Intern, but returns NULL instead of adding anything.
+*/
+const struct IRC_Interned *IRC_InternFind(struct IRC_InternTable *table, const char *a, unsigned long len);
+
+const struct IRC_Interned *IRC_InternRetain(struct IRC_InternTable *table, const struct IRC_Interned *a);
+void IRC_InternRelease(struct IRC_InternTable *table, const struct IRC_Interned *a);
+
+/* NUL terminated. Valid for as long as the handle is.
+*/
+const char *IRC_InternString(const struct IRC_Interned *a);
+unsigned long IRC_InternLength(const struct IRC_Interned *a);
+
+/* Changes how the table folds case. `fold' gives the lowercase form of every
+ byte, as made by IRC_BuildFoldTable in isupport.h. Existing handles stay
+ valid, but two strings that only became equal under the new folding keep
+ their separate handles, and lookups will find one of them.
+*/
+void IRC_InternSetCaseMapping(struct IRC_InternTable *table, const unsigned char fold[256]);
+
+/* Number of distinct strings in the table.
+*/
+unsigned long IRC_InternCount(struct IRC_InternTable *table);
+
+#ifdef __cplusplus
+}
+#endif
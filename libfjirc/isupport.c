@@ -0,0 +1,257 @@
+#include "isupport.h"
+#include "message.h"
+#include "loginternal.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+void IRC_BuildFoldTable(enum IRC_caseMapping casemapping, unsigned char fold[256]){
+    int i = 0;
+    for(; i<256; i++)
+      fold[i] = i;
+
+    for(i = 'A'; i<='Z'; i++)
+      fold[i] = i+('a'-'A');
+
+    /* RFC 1459 considers []\ to be the uppercase forms of {}|, and strict
+     RFC 1459 stops there. Plain RFC 1459 adds ~ and ^.
+    */
+    if(casemapping!=IRC_casemap_ascii){
+        fold['['] = '{';
+        fold[']'] = '}';
+        fold['\\'] = '|';
+    }
+    if(casemapping==IRC_casemap_rfc1459)
+      fold['^'] = '~';
+}
+
+/* Copies at most `size'-1 bytes of `len' into `to' and NUL terminates it.
+*/
+static void IRC_ISupportCopy(char *to, unsigned long size, const char *from, unsigned long len){
+    if(len>=size)
+      len = size-1;
+    memcpy(to, from, len);
+    to[len] = '\0';
+}
+
+static void IRC_ISupportDefaultPrefix(struct IRC_ISupport *isupport){
+    strcpy(isupport->prefix_modes, "ov");
+    strcpy(isupport->prefix_chars, "@+");
+}
+
+static void IRC_ISupportDefaultChanModes(struct IRC_ISupport *isupport){
+    strcpy(isupport->chanmodes[0], "b");
+    strcpy(isupport->chanmodes[1], "k");
+    strcpy(isupport->chanmodes[2], "l");
+    strcpy(isupport->chanmodes[3], "imnpst");
+}
+
+void IRC_ISupportInit(struct IRC_ISupport *isupport){
+    isupport->casemapping = IRC_casemap_rfc1459;
+    IRC_BuildFoldTable(isupport->casemapping, isupport->fold);
+
+    IRC_ISupportDefaultPrefix(isupport);
+    strcpy(isupport->chantypes, "#&");
+    IRC_ISupportDefaultChanModes(isupport);
+
+    isupport->nicklen = 9;
+    isupport->linelen = 512;
+    isupport->num_targmax = 0;
+}
+
+static void IRC_ISupportParsePrefix(struct IRC_ISupport *isupport, const char *value, unsigned long len){
+    const char *close = memchr(value, ')', len);
+
+    /* An empty PREFIX means there are no prefixes at all.
+    */
+    if((len==0) || (value[0]!='(') || (close==NULL)){
+        isupport->prefix_modes[0] = '\0';
+        isupport->prefix_chars[0] = '\0';
+        return;
+    }
+
+    IRC_ISupportCopy(isupport->prefix_modes, IRC_ISUPPORT_PREFIX_MAX, value+1, close-(value+1));
+    IRC_ISupportCopy(isupport->prefix_chars, IRC_ISUPPORT_PREFIX_MAX, close+1, len-((close+1)-value));
+}
+
+static void IRC_ISupportParseChanModes(struct IRC_ISupport *isupport, const char *value, unsigned long len){
+    const char *end = value+len;
+    int group = 0;
+
+    for(; group<4; group++){
+        const char *comma = value;
+        while((comma!=end) && (*comma!=','))
+          comma++;
+
+        IRC_ISupportCopy(isupport->chanmodes[group], IRC_ISUPPORT_CHANMODES_MAX, value, comma-value);
+
+        value = (comma==end)?end:(comma+1);
+    }
+}
+
+/* TARGMAX=PRIVMSG:4,NOTICE:4,JOIN:,KICK:1
+*/
+static void IRC_ISupportParseTargMax(struct IRC_ISupport *isupport, const char *value, unsigned long len){
+    const char *end = value+len;
+
+    isupport->num_targmax = 0;
+
+    while((value!=end) && (isupport->num_targmax<IRC_ISUPPORT_TARGMAX_MAX)){
+        struct IRC_TargMax *t = isupport->targmax+isupport->num_targmax;
+        const char *comma = value, *colon;
+        while((comma!=end) && (*comma!=','))
+          comma++;
+
+        colon = value;
+        while((colon!=comma) && (*colon!=':'))
+          colon++;
+
+        IRC_ISupportCopy(t->command, IRC_ISUPPORT_COMMAND_MAX, value, colon-value);
+        t->max = (colon==comma)?0:strtoul(colon+1, NULL, 10);
+
+        if(t->command[0]!='\0')
+          isupport->num_targmax++;
+
+        value = (comma==end)?end:(comma+1);
+    }
+}
+
+static int IRC_ISupportKeyIs(const char *key, unsigned long key_len, const char *name){
+    return (strlen(name)==key_len) && (memcmp(key, name, key_len)==0);
+}
+
+/* Returns nonzero if the casemapping changed.
+*/
+static int IRC_ISupportToken(struct IRC_ISupport *isupport, const char *token){
+    const char *key = token, *value;
+    unsigned long key_len, value_len;
+    int negate = 0;
+
+    if(*key=='-'){
+        negate = 1;
+        key++;
+    }
+
+    value = key;
+    while((*value!='\0') && (*value!='='))
+      value++;
+    key_len = value-key;
+
+    if(*value=='=')
+      value++;
+    value_len = strlen(value);
+
+    if(IRC_ISupportKeyIs(key, key_len, "CASEMAPPING")){
+        enum IRC_caseMapping casemapping = IRC_casemap_rfc1459;
+        if((!negate) && (strcmp(value, "ascii")==0))
+          casemapping = IRC_casemap_ascii;
+        else if((!negate) && (strcmp(value, "strict-rfc1459")==0))
+          casemapping = IRC_casemap_strict_rfc1459;
+
+        if(casemapping==isupport->casemapping)
+          return 0;
+
+        isupport->casemapping = casemapping;
+        IRC_BuildFoldTable(casemapping, isupport->fold);
+        return 1;
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "PREFIX")){
+        if(negate)
+          IRC_ISupportDefaultPrefix(isupport);
+        else
+          IRC_ISupportParsePrefix(isupport, value, value_len);
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "CHANTYPES")){
+        if(negate)
+          strcpy(isupport->chantypes, "#&");
+        else
+          IRC_ISupportCopy(isupport->chantypes, IRC_ISUPPORT_CHANTYPES_MAX, value, value_len);
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "CHANMODES")){
+        if(negate)
+          IRC_ISupportDefaultChanModes(isupport);
+        else
+          IRC_ISupportParseChanModes(isupport, value, value_len);
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "NICKLEN")){
+        isupport->nicklen = negate?9:strtoul(value, NULL, 10);
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "LINELEN")){
+        isupport->linelen = negate?512:strtoul(value, NULL, 10);
+        if(isupport->linelen<512)
+          isupport->linelen = 512;
+    }
+    else if(IRC_ISupportKeyIs(key, key_len, "TARGMAX")){
+        if(negate)
+          isupport->num_targmax = 0;
+        else
+          IRC_ISupportParseTargMax(isupport, value, value_len);
+    }
+
+    return 0;
+}
+
+/* :server 005 nick TOKEN TOKEN=value ... :are supported by this server
+*/
+int IRC_ISupportParse(struct IRC_ISupport *isupport, const struct IRC_Message *msg){
+    long i = 1;
+    int changed = 0;
+
+    if(msg->type!=IRC_isupport_num)
+      return 0;
+
+    for(; i<msg->num_parameters; i++){
+        const char *token = msg->parameters[i];
+
+        /* The human readable part at the end has spaces in it.
+        */
+        if((token[0]=='\0') || (strchr(token, ' ')!=NULL))
+          continue;
+
+        IRC_LOG_DEBUG(("ISUPPORT %s", token));
+
+        if(IRC_ISupportToken(isupport, token))
+          changed = 1;
+    }
+
+    return changed;
+}
+
+void IRC_ISupportFold(const struct IRC_ISupport *isupport, char *to, const char *from, unsigned long len){
+    unsigned long i = 0;
+    for(; i<len; i++)
+      to[i] = isupport->fold[(unsigned char)from[i]];
+}
+
+int IRC_ISupportIsChannel(const struct IRC_ISupport *isupport, const char *name){
+    return (name[0]!='\0') && (strchr(isupport->chantypes, name[0])!=NULL);
+}
+
+unsigned long IRC_ISupportTargMax(const struct IRC_ISupport *isupport, const char *command){
+    unsigned i = 0;
+    for(; i<isupport->num_targmax; i++){
+        if(strcmp(isupport->targmax[i].command, command)==0)
+          return isupport->targmax[i].max;
+    }
+    return 0;
+}
+
+unsigned long IRC_ISupportCoalesce(const struct IRC_ISupport *isupport, const char *command, const char *const *targets, unsigned long n, unsigned long extra){
+    const unsigned long max = IRC_ISupportTargMax(isupport, command);
+    /* "COMMAND " at the start and a CR LF at the end.
+    */
+    unsigned long len = strlen(command)+1+extra+2;
+    unsigned long i = 0;
+
+    for(; i<n; i++){
+        if((max!=0) && (i==max))
+          break;
+
+        len+=strlen(targets[i])+((i==0)?0:1);
+
+        if((len>isupport->linelen) && (i!=0))
+          break;
+    }
+
+    return i;
+}
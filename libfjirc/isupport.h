@@ -0,0 +1,90 @@
+#pragma once
+
+struct IRC_Message;
+
+/* RPL_ISUPPORT (005), which tells the client what the server supports and
+ how it compares names. Each 005 only adds to or changes what is already
+ known, so keep one IRC_ISupport per connection and give it every 005.
+ Anything the server never mentions keeps its RFC 1459 default.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum IRC_caseMapping {IRC_casemap_ascii, IRC_casemap_rfc1459,
+  IRC_casemap_strict_rfc1459};
+
+#define IRC_ISUPPORT_PREFIX_MAX 16
+#define IRC_ISUPPORT_CHANTYPES_MAX 16
+#define IRC_ISUPPORT_CHANMODES_MAX 64
+#define IRC_ISUPPORT_TARGMAX_MAX 16
+#define IRC_ISUPPORT_COMMAND_MAX 16
+
+struct IRC_TargMax {
+  char command[IRC_ISUPPORT_COMMAND_MAX];
+  /* 0 means no limit. */
+  unsigned long max;
+};
+
+struct IRC_ISupport {
+  enum IRC_caseMapping casemapping;
+  /* Lowercase form of every byte under `casemapping'. */
+  unsigned char fold[256];
+
+  /* PREFIX=(ov)@+ gives modes "ov" and chars "@+", most powerful first. */
+  char prefix_modes[IRC_ISUPPORT_PREFIX_MAX];
+  char prefix_chars[IRC_ISUPPORT_PREFIX_MAX];
+
+  char chantypes[IRC_ISUPPORT_CHANTYPES_MAX];
+
+  /* The four comma separated groups of CHANMODES: modes that always take a
+   list, always take a parameter, take one only when set, and never take
+   one.
+  */
+  char chanmodes[4][IRC_ISUPPORT_CHANMODES_MAX];
+
+  unsigned long nicklen;
+  unsigned long linelen;
+
+  struct IRC_TargMax targmax[IRC_ISUPPORT_TARGMAX_MAX];
+  unsigned num_targmax;
+};
+
+/* Sets the RFC 1459 defaults.
+*/
+void IRC_ISupportInit(struct IRC_ISupport *isupport);
+
+/* Reads the tokens of a 005 into `isupport'. Returns nonzero if the
+ casemapping changed, in which case anything folded with the old one needs to
+ be folded again. Messages that are not 005 are ignored.
+*/
+int IRC_ISupportParse(struct IRC_ISupport *isupport, const struct IRC_Message *msg);
+
+/* Fills in `fold' for a casemapping.
+*/
+void IRC_BuildFoldTable(enum IRC_caseMapping casemapping, unsigned char fold[256]);
+
+/* Folds `len' bytes of `from' into `to', which may be the same.
+*/
+void IRC_ISupportFold(const struct IRC_ISupport *isupport, char *to, const char *from, unsigned long len);
+
+/* Returns nonzero if `name' starts with one of the CHANTYPES.
+*/
+int IRC_ISupportIsChannel(const struct IRC_ISupport *isupport, const char *name);
+
+/* Returns the most targets `command' may be given at once, or 0 if there is
+ no limit.
+*/
+unsigned long IRC_ISupportTargMax(const struct IRC_ISupport *isupport, const char *command);
+
+/* Returns how many of the `n' `targets' fit in a single `command', given
+ TARGMAX and LINELEN, with `extra' bytes of the line set aside for anything
+ after the targets. Always at least 1 if `n' is not 0, since a target that
+ won't fit on its own can't be sent any other way.
+*/
+unsigned long IRC_ISupportCoalesce(const struct IRC_ISupport *isupport, const char *command, const char *const *targets, unsigned long n, unsigned long extra);
+
+#ifdef __cplusplus
+}
+#endif
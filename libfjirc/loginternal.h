@@ -0,0 +1,47 @@
+#pragma once
+#include "message.h"
+
+/* Logging macros for use inside libfjirc.
+ Arguments are given in an extra set of parentheses, since C89 has no
+ variadic macros:
+
+   IRC_LOG_DEBUG(("Type: (%s)", type));
+
+ Any level less severe than IRC_LOG_LEVEL compiles to nothing, including the
+ evaluation of its arguments. IRC_LOG_LEVEL is a number, since the
+ preprocessor can't see the values of enum IRC_logLevel: 0 for none, up to 4
+ for debug.
+*/
+
+#ifndef IRC_LOG_LEVEL
+#define IRC_LOG_LEVEL 4
+#endif
+
+void IRC_LogError(const char *fmt, ...);
+void IRC_LogWarning(const char *fmt, ...);
+void IRC_LogInfo(const char *fmt, ...);
+void IRC_LogDebug(const char *fmt, ...);
+
+#if IRC_LOG_LEVEL >= 1
+#define IRC_LOG_ERROR(ARGS) IRC_LogError ARGS
+#else
+#define IRC_LOG_ERROR(ARGS)
+#endif
+
+#if IRC_LOG_LEVEL >= 2
+#define IRC_LOG_WARNING(ARGS) IRC_LogWarning ARGS
+#else
+#define IRC_LOG_WARNING(ARGS)
+#endif
+
+#if IRC_LOG_LEVEL >= 3
+#define IRC_LOG_INFO(ARGS) IRC_LogInfo ARGS
+#else
+#define IRC_LOG_INFO(ARGS)
+#endif
+
+#if IRC_LOG_LEVEL >= 4
+#define IRC_LOG_DEBUG(ARGS) IRC_LogDebug ARGS
+#else
+#define IRC_LOG_DEBUG(ARGS)
+#endif
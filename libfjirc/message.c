@@ -2,6 +2,7 @@
 #include "message.h"
 #include "message.h"
 #include "messageinternal.h"
+#include "loginternal.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -28,6 +29,29 @@ void IRC_ResetAllocators(){
     Dealloc = free;
 }
 
+static IRC_logger Logger = NULL;
+static enum IRC_logLevel LoggerLevel = IRC_log_none;
+
+void IRC_SetLogger(IRC_logger a, enum IRC_logLevel level){
+    Logger = a;
+    LoggerLevel = (a==NULL)?IRC_log_none:level;
+}
+
+#define IRC_LOG_FUNCTION(NAME, LEVEL)\
+    void NAME(const char *fmt, ...){\
+        va_list args;\
+        if((Logger==NULL) || (LoggerLevel<LEVEL))\
+          return;\
+        va_start(args, fmt);\
+        Logger(LEVEL, fmt, args);\
+        va_end(args);\
+    }
+
+IRC_LOG_FUNCTION(IRC_LogError, IRC_log_error)
+IRC_LOG_FUNCTION(IRC_LogWarning, IRC_log_warning)
+IRC_LOG_FUNCTION(IRC_LogInfo, IRC_log_info)
+IRC_LOG_FUNCTION(IRC_LogDebug, IRC_log_debug)
+
 char *IRC_Strdup(const char * a){
     unsigned long len = strlen(a)+1;
     char * r = Alloc(len);
@@ -99,8 +123,11 @@ char * IRC_MessageToString(struct IRC_Message *msg){
     char *m;
     const char *type = IRC_GetMessageToken(msg->type);
 
+    if(msg->tags!=NULL)
+      len = 2+strlen(msg->tags);
+
     if(msg->from!=NULL)
-      len = 1+strlen(msg->from);
+      len+=1+strlen(msg->from);
 
     len+=strlen(type)+1;
 
@@ -114,6 +141,11 @@ char * IRC_MessageToString(struct IRC_Message *msg){
 
 
     m = calloc(len, 1);
+    if(msg->tags!=NULL){
+        strcat(m, "@");
+        strcat(m, msg->tags);
+        strcat(m, " ");
+    }
     if(msg->from!=NULL){
         strcat(m, msg->from);
         strcat(m, " ");
@@ -128,8 +160,11 @@ char * IRC_MessageToString(struct IRC_Message *msg){
         strcat(m, " ");
     }
 
-    m[len-3] = '\r';
-    m[len-2] = '\n';
+    /* Replace the space after the last word, which would otherwise end up in
+     a trailing parameter.
+    */
+    m[len-4] = '\r';
+    m[len-3] = '\n';
 
     return m;
 
@@ -192,6 +227,18 @@ const char *IRC_GetMessageToken(enum IRC_messageType a){
         return "474";
       case IRC_join_invite_only_num:
         return "473";
+      case IRC_cap:
+        return "CAP";
+      case IRC_batch:
+        return "BATCH";
+      case IRC_away:
+        return "AWAY";
+      case IRC_isupport_num:
+        return "005";
+      case IRC_nick_in_use_num:
+        return "433";
+      case IRC_nick_unavailable_num:
+        return "437";
       default:
         return NULL;
     }
@@ -213,152 +260,217 @@ enum IRC_messageType IRC_GetTokenEnum(const char * a){
 }
 
 
+struct IRC_Message *IRC_AllocMessage(enum IRC_messageType type, long n,
+  unsigned long bytes, char **text){
+    const unsigned long params_size = sizeof(const char *)*((n>=1)?n:1);
+    struct IRC_Message *msg = Alloc(sizeof(struct IRC_Message)+params_size+bytes);
+    long i;
+
+    msg->type = type;
+    msg->from = NULL;
+    msg->tags = NULL;
+    msg->num_parameters = n;
+    msg->parameters = (const char **)(msg+1);
+
+    for(i = 0; i<n; i++)
+      msg->parameters[i] = NULL;
+
+    *text = ((char *)msg->parameters)+params_size;
+
+    return msg;
+}
+
+const char *IRC_PutMessageText(char **text, const char *a, unsigned long len){
+    char *to = *text;
+    memcpy(to, a, len);
+    to[len] = '\0';
+    *text = to+len+1;
+    return to;
+}
+
+struct IRC_Message *IRC_BuildMessage(enum IRC_messageType type, long n,
+  const char *const *params){
+    unsigned long bytes = 0;
+    struct IRC_Message *msg;
+    char *text;
+    long i;
+
+    for(i = 0; i<n; i++)
+      bytes+=strlen(params[i])+1;
+
+    msg = IRC_AllocMessage(type, n, bytes, &text);
+
+    for(i = 0; i<n; i++)
+      msg->parameters[i] = IRC_PutMessageText(&text, params[i], strlen(params[i]));
+
+    return msg;
+}
+
+struct IRC_Message *IRC_SetMessageFrom(struct IRC_Message *msg, const char *from){
+    unsigned long bytes = strlen(from)+1;
+    struct IRC_Message *to;
+    char *text;
+    long i;
+
+    if(msg->tags!=NULL)
+      bytes+=strlen(msg->tags)+1;
+    for(i = 0; i<msg->num_parameters; i++)
+      bytes+=strlen(msg->parameters[i])+1;
+
+    to = IRC_AllocMessage(msg->type, msg->num_parameters, bytes, &text);
+
+    if(msg->tags!=NULL)
+      to->tags = IRC_PutMessageText(&text, msg->tags, strlen(msg->tags));
+    to->from = IRC_PutMessageText(&text, from, strlen(from));
+    for(i = 0; i<msg->num_parameters; i++)
+      to->parameters[i] = IRC_PutMessageText(&text, msg->parameters[i], strlen(msg->parameters[i]));
+
+    IRC_FreeMessage(msg);
+
+    return to;
+}
+
 void IRC_FreeMessage(struct IRC_Message *a){
-    int i = 0;
-    for(; i<a->num_parameters; i++)
-      free((void *)a->parameters[i]);
-    free((void *)a->from);
-    free((void *)a);
+    Dealloc(a);
 }
 
 struct IRC_Message *IRC_CreatePass(const char *a){
-    GENERATE_MSG(msg, 1, IRC_pass);
-    SET_PARAM(msg, 0, a);
-    return msg;
+    return IRC_BuildMessage(IRC_pass, 1, &a);
 }
 
 struct IRC_Message *IRC_CreatePing(const char *a){
-    GENERATE_MSG(msg, 1, IRC_ping);
-    SET_PARAM(msg, 0, a);
-    return msg;
+    return IRC_BuildMessage(IRC_ping, 1, &a);
 }
 
 struct IRC_Message *IRC_CreatePong(const char *a){
-    GENERATE_MSG(msg, 1, IRC_pong);
-    SET_PARAM(msg, 0, a);
-    return msg;
+    return IRC_BuildMessage(IRC_pong, 1, &a);
 }
 
 struct IRC_Message *IRC_CreatePongFromPing(struct IRC_Message *a){
-    GENERATE_MSG(msg, 1, IRC_pong);
-    SET_PARAM(msg, 0, a->parameters[0]);
-    return msg;
+    return IRC_BuildMessage(IRC_pong, 1, a->parameters);
 }
 
 struct IRC_Message *IRC_CreateNick(const char *a){
-    GENERATE_MSG(msg, IRC_NICK_PARAM_NUM, IRC_nick);
-    SET_PARAM(msg, 0, a);
-    return msg;
+    return IRC_BuildMessage(IRC_nick, IRC_NICK_PARAM_NUM, &a);
 }
 
 
 struct IRC_Message *IRC_CreateUser(const char *name, const char *host, const char *server, const char *realname){
-    GENERATE_MSG(msg, IRC_USER_PARAM_NUM, IRC_user);
-    SET_PARAM(msg, 0, name);
-    SET_PARAM(msg, 1, host);
-    SET_PARAM(msg, 2, server);
-    SET_PARAM(msg, 3, ":");
-    SET_PARAM(msg, 4, realname);
-    return msg;
+    const char *params[IRC_USER_PARAM_NUM];
+    params[0] = name;
+    params[1] = host;
+    params[2] = server;
+    params[3] = ":";
+    params[4] = realname;
+    return IRC_BuildMessage(IRC_user, IRC_USER_PARAM_NUM, params);
 }
 
 
 struct IRC_Message *IRC_CreateOper(const char *name, const char *pass){
-    GENERATE_MSG(msg, IRC_OPER_PARAM_NUM, IRC_oper);
-    SET_PARAM(msg, 0, name);
-    SET_PARAM(msg, 1, pass);
-    return msg;
+    const char *params[IRC_OPER_PARAM_NUM];
+    params[0] = name;
+    params[1] = pass;
+    return IRC_BuildMessage(IRC_oper, IRC_OPER_PARAM_NUM, params);
 }
 
 
 struct IRC_Message *IRC_CreateMode(const char *name, const char *mode){
-    GENERATE_MSG(msg, IRC_MODE_PARAM_NUM, IRC_mode);
-    SET_PARAM(msg, 0, name);
-    SET_PARAM(msg, 1, mode);
-    return msg;
+    const char *params[IRC_MODE_PARAM_NUM];
+    params[0] = name;
+    params[1] = mode;
+    return IRC_BuildMessage(IRC_mode, IRC_MODE_PARAM_NUM, params);
 }
 
 
 struct IRC_Message *IRC_CreateService(const char *name, const char *visibility, const char *id){
-    GENERATE_MSG(msg, IRC_SERVICE_PARAM_NUM, IRC_service);
-    SET_PARAM(msg, 0, name);
-    SET_EMPTY_PARAM(msg, 1);
-    SET_PARAM(msg, 2, visibility);
-    SET_EMPTY_PARAM(msg, 3);
-    SET_EMPTY_PARAM(msg, 4);
-    SET_PARAM(msg, 5, id);
-    return msg;
+    const char *params[IRC_SERVICE_PARAM_NUM];
+    params[0] = name;
+    params[1] = "";
+    params[2] = visibility;
+    params[3] = "";
+    params[4] = "";
+    params[5] = id;
+    return IRC_BuildMessage(IRC_service, IRC_SERVICE_PARAM_NUM, params);
 }
 
 
 struct IRC_Message *IRC_CreateQuit(const char *a){ /* Can take NULL */
-    GENERATE_MSG(msg, IRC_QUIT_PARAM_NUM, IRC_quit);
-    SET_PARAM_DEFAULT(msg, 0, a);
-    return msg;
+    if(a==NULL)
+      a = "";
+    return IRC_BuildMessage(IRC_quit, 1, &a);
 }
 
 
 struct IRC_Message *IRC_CreateSQuit(const char *s, const char *comment){
-    GENERATE_MSG(msg, IRC_QUIT_PARAM_NUM, IRC_squit);
-    SET_PARAM(msg, 0, s);
-    SET_PARAM(msg, 1, comment);
-    return msg;
+    const char *params[2];
+    params[0] = s;
+    params[1] = comment;
+    return IRC_BuildMessage(IRC_squit, 2, params);
 }
 
-struct IRC_Message *IRC_CreateJoin(long n, ...){
-    long i;
+/* The channels are gone through twice, once to size the message and once to
+ fill it in, so that they don't need to be gathered up anywhere first.
+*/
+static struct IRC_Message *IRC_CreateFromList(enum IRC_messageType t, long n, va_list *channels_p, va_list *again_p){
+    unsigned long bytes = 0;
+    struct IRC_Message *msg;
+    char *text;
     const char *a;
-    va_list channels;
-    GENERATE_MSG(msg, n, IRC_join);
-    if(n==0)
-      return msg;
+    long i;
 
-    va_start(channels, n);
+    for(i=0; i<n; i++)
+      bytes+=strlen(va_arg(*channels_p, const char *))+1;
+
+    msg = IRC_AllocMessage(t, n, bytes, &text);
 
     for(i=0; i<n; i++){
-        a = va_arg(channels, const char *);
-        SET_PARAM(msg, i, a);
+        a = va_arg(*again_p, const char *);
+        msg->parameters[i] = IRC_PutMessageText(&text, a, strlen(a));
     }
+
+    return msg;
+}
+
+struct IRC_Message *IRC_CreateJoin(long n, ...){
+    struct IRC_Message *msg;
+    va_list channels, again;
+
+    va_start(channels, n);
+    va_start(again, n);
+    msg = IRC_CreateFromList(IRC_join, n, &channels, &again);
+    va_end(again);
     va_end(channels);
+
     return msg;
 }
 
 
 struct IRC_Message *IRC_CreatePart(long n, ...){
-    long i;
-    const char *a;
-    va_list channels;
-    GENERATE_MSG(msg, n, IRC_part);
-    if(n==0)
-      return msg;
+    struct IRC_Message *msg;
+    va_list channels, again;
 
     va_start(channels, n);
-
-    for(i=0; i<n; i++){
-        a = va_arg(channels, const char *);
-        SET_PARAM(msg, i, a);
-    }
+    va_start(again, n);
+    msg = IRC_CreateFromList(IRC_part, n, &channels, &again);
+    va_end(again);
     va_end(channels);
+
     return msg;
 }
 
 
 struct IRC_Message *IRC_CreateJoinSingle(const char *s){
-    GENERATE_MSG(msg, 1, IRC_join);
-    SET_PARAM(msg, 1, s);
-    return msg;
+    return IRC_BuildMessage(IRC_join, 1, &s);
 }
 
 
 struct IRC_Message *IRC_CreatePartSingle(const char *s){
-    GENERATE_MSG(msg, 1, IRC_part);
-    SET_PARAM(msg, 1, s);
-    return msg;
+    return IRC_BuildMessage(IRC_part, 1, &s);
 }
 
 
 struct IRC_Message *IRC_CreateV(long n, const char **v, enum IRC_messageType t){
-    int i = 0, e = 0;
+    long i = 0;
 
     if(n==0)
       n = 0xFFFFFFFF;
@@ -367,14 +479,7 @@ struct IRC_Message *IRC_CreateV(long n, const char **v, enum IRC_messageType t){
       i++;
     }
 
-    {
-        GENERATE_MSG(msg, i, t);
-        while(e<i){
-          SET_PARAM(msg, e, v[e]);
-          e++;
-        }
-        return msg;
-    }
+    return IRC_BuildMessage(t, i, v);
 }
 
 
@@ -388,23 +493,36 @@ struct IRC_Message *IRC_CreatePartV(long n, const char **v){
 }
 
 struct IRC_Message *IRC_CreateTopic(const char *channel, const char *newtopic){
-    if(newtopic==NULL){
-        GENERATE_MSG(msg, 1, IRC_topic);
-        SET_PARAM(msg, 0, channel);
-        return msg;
-    }
-
-    {
-        GENERATE_MSG(msg, 2, IRC_topic);
-        SET_PARAM(msg, 0, channel);
-        SET_PARAM(msg, 1, newtopic);
-        return msg;
-    }
+    const char *params[2];
+    params[0] = channel;
+    params[1] = newtopic;
+    return IRC_BuildMessage(IRC_topic, (newtopic==NULL)?1:2, params);
 }
 
 struct IRC_Message *IRC_CreatePrivateMessage(const char *to, const char *amsg){
-    GENERATE_MSG(msg, 2, IRC_privmsg);
-    SET_PARAM(msg, 0, to);
-    SET_PARAM(msg, 1, amsg);
+    const char *params[2];
+    params[0] = to;
+    params[1] = amsg;
+    return IRC_BuildMessage(IRC_privmsg, 2, params);
+}
+
+struct IRC_Message *IRC_CreateCap(const char *subcommand, const char *arg){
+    const unsigned long sub_len = strlen(subcommand);
+    struct IRC_Message *msg;
+    char *text, *colon;
+
+    if(arg==NULL)
+      return IRC_BuildMessage(IRC_cap, 1, &subcommand);
+
+    msg = IRC_AllocMessage(IRC_cap, 2, sub_len+strlen(arg)+3, &text);
+    msg->parameters[0] = IRC_PutMessageText(&text, subcommand, sub_len);
+
+    /* The argument goes in with a preceding colon.
+    */
+    colon = text;
+    *(text++) = ':';
+    IRC_PutMessageText(&text, arg, strlen(arg));
+    msg->parameters[1] = colon;
+
     return msg;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdarg.h>
 
 typedef void *(*IRC_allocator)(unsigned long);
 typedef void (*IRC_deallocator)(void *);
@@ -15,6 +16,17 @@ void IRC_SetAllocators(IRC_allocator, IRC_deallocator);
 void IRC_GetAllocators(IRC_allocator *, IRC_deallocator *);
 void IRC_ResetAllocators();
 
+/* Diagnostics. Nothing is logged until a logger is set. The logger is called
+ for every message at or more severe than `level', and may be called from any
+ thread that uses the library. Pass NULL to stop logging.
+ Messages less severe than IRC_LOG_LEVEL are removed at compile time.
+*/
+enum IRC_logLevel {IRC_log_none, IRC_log_error, IRC_log_warning, IRC_log_info,
+  IRC_log_debug};
+typedef void (*IRC_logger)(enum IRC_logLevel, const char *, va_list);
+
+void IRC_SetLogger(IRC_logger, enum IRC_logLevel level);
+
 char *IRC_Strdup(const char * a);
 char *IRC_Strndup(const char * a, unsigned long n);
 
@@ -24,6 +36,8 @@ enum IRC_messageType {IRC_mt_null, IRC_error_m, IRC_ping, IRC_pong, IRC_pass,
   IRC_namelist_start_num, IRC_namelist_end_num, IRC_topic_num,
   IRC_no_topic_num, IRC_not_registered_num, IRC_welcome_num, IRC_your_host_num,
   IRC_topic_extra_num, IRC_join_ban_num, IRC_join_invite_only_num,
+  IRC_cap, IRC_batch, IRC_away, IRC_isupport_num, IRC_nick_in_use_num,
+  IRC_nick_unavailable_num,
 /*Aliases*/
   IRC_namelist_num = IRC_namelist_start_num
   };
@@ -32,12 +46,20 @@ const char *IRC_GetMessageToken(enum IRC_messageType a);
 enum IRC_messageType IRC_GetTokenEnum(const char * a);
 
 /* `from' can be NULL.
+ `tags' is the raw IRCv3 tag section without the leading '@', exactly as it
+ was recieved, or NULL if there was none. See tags.h to read it.
+
+ A message and every string it points to are a single allocation, made by the
+ parser or one of the IRC_Create functions, and freed with IRC_FreeMessage.
+ The pointers can be swapped out for others for a while, but must be put back
+ before the message is freed.
 */
 struct IRC_Message {
   enum IRC_messageType type;
   const char *from;
   long num_parameters;
   const char **parameters;
+  const char *tags;
 };
 
 struct IRC_MessageHolder{
@@ -74,8 +96,9 @@ struct IRC_Message *IRC_MessageUnwrap(struct IRC_MessageHolder *a);
 #define IRC_PRIVMSG_PARAM_NUM 2
 #define IRC_CHANNELFAIL_PARAM_NUM 1
 
-#define IRC_SetMessageFrom(s, a)\
-    s->from = IRC_Strdup(a);
+/* Returns a copy of `msg' that is from `a', and frees `msg'.
+*/
+struct IRC_Message *IRC_SetMessageFrom(struct IRC_Message *msg, const char *a);
 
 void IRC_FreeMessage(struct IRC_Message*);
 
@@ -113,6 +136,8 @@ struct IRC_Message *IRC_CreatePartV(long n, const char **v);
  /* Can take NULL for n */
 struct IRC_Message *IRC_CreateTopic(const char *channel, const char *newtopic);
 struct IRC_Message *IRC_CreatePrivateMessage(const char *to, const char *msg);
+ /* `arg' can be NULL. If not, it is sent as the trailing parameter. */
+struct IRC_Message *IRC_CreateCap(const char *subcommand, const char *arg);
 
 #ifdef __cplusplus
 }
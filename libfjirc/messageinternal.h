@@ -1,49 +1,24 @@
 #pragma once
 
-/* Be careful.
+/* Every IRC_Message is a single allocation. The struct comes first, then its
+ parameters array, and then the text of `tags', `from' and every parameter,
+ each NUL terminated. The pointers in the struct all point into the same
+ block, so IRC_FreeMessage has only the one thing to free.
 */
 
-#define ALLOC_MSG Alloc(sizeof(struct IRC_Message))
-
-#define NEW_MSG(X) struct IRC_Message * X = ALLOC_MSG
-
-#define ALLOC_PARAMS(X, N)\
-    X->num_parameters = N;\
-    X->parameters = Alloc(sizeof(const char *)*((N>=1)?N:1));\
-
-#define GENERATE_MSG(X, N, T)\
-    NEW_MSG(X);\
-    X->from = NULL;\
-    ALLOC_PARAMS(X, N);\
-    X->type = T
-
-#define SET_EMPTY_PARAM(X, N)\
-    X->parameters[N] = Alloc(1);\
-    *(char *)(X->parameters[N]) = '\0'
-
-#define SET_PARAM(X, N, TO)\
-    do{\
-    unsigned long len = strlen(TO)+1;\
-    char * f = Alloc(len);\
-    memcpy(f, TO, len);\
-    X->parameters[N] = f;\
-    }while(0)
-
+/* Allocates a message of type `type' with room for `n' parameters and
+ `bytes' bytes of text, counting the NULs. `from', `tags' and the parameters
+ are all left NULL, and `*text' is set to where the first string goes.
+*/
+struct IRC_Message *IRC_AllocMessage(enum IRC_messageType type, long n,
+  unsigned long bytes, char **text);
 
-#define SET_PARAM_WITH_PRECEDING_COLON(X, N, TO)\
-    do{\
-    unsigned long len = strlen(TO)+2;\
-    char * f = Alloc(len);\
-    f[0] = ':';\
-    memcpy(f+1, TO, len);\
-    X->parameters[N] = f;\
-    }while(0)
+/* Copies `len' bytes of `a' to `*text' and NUL terminates them, then moves
+ `*text' past them. Returns the copy.
+*/
+const char *IRC_PutMessageText(char **text, const char *a, unsigned long len);
 
-/* Set's X->parameters[N] to TO if TO is not NULL.
- Otherwise, sets it to "".
+/* Builds a message from the `n' NUL terminated strings in `params'.
 */
-#define SET_PARAM_DEFAULT(X, N, TO)\
-    if(TO!=NULL)\
-      SET_PARAM(X, N, TO);\
-    else\
-      SET_EMPTY_PARAM(X, N)
+struct IRC_Message *IRC_BuildMessage(enum IRC_messageType type, long n,
+  const char *const *params);
@@ -0,0 +1,262 @@
+#include "nickindex.h"
+#include "user.h"
+#include "isupport.h"
+#include "message.h"
+
+#include <string.h>
+
+struct IRC_NickEntry {
+    struct IRC_NickEntry *next;
+    unsigned long hash;
+    unsigned long len;
+    /* Casefolded nick, just past the end of the struct in the same
+     allocation.
+    */
+    char *key;
+
+    unsigned long num_channels;
+    unsigned long max_channels;
+    struct IRC_NickMembership *channels;
+};
+
+struct IRC_NickIndex {
+    struct IRC_NickEntry **buckets;
+    unsigned long num_buckets; /* Always a power of two. */
+    unsigned long count;
+
+    /* Lowercase form of every byte. */
+    unsigned char fold[256];
+
+    /* Kept so that the index is freed the way it was allocated, even if the
+     allocators change.
+    */
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+};
+
+#define IRC_NICKINDEX_INITIAL_BUCKETS 64
+#define IRC_NICKINDEX_INITIAL_CHANNELS 4
+
+/* FNV-1a over the casefolded bytes.
+*/
+static unsigned long IRC_NickIndexHash(const unsigned char *fold, const char *a, unsigned long len){
+    unsigned long hash = 2166136261ul, i = 0;
+    for(; i<len; i++){
+        hash^=fold[(unsigned char)a[i]];
+        hash = (hash*16777619ul) & 0xFFFFFFFFul;
+    }
+    return hash;
+}
+
+static struct IRC_NickEntry **IRC_NickIndexLookup(struct IRC_NickIndex *index, const char *a, unsigned long len){
+    const unsigned long hash = IRC_NickIndexHash(index->fold, a, len);
+    struct IRC_NickEntry **link = index->buckets+(hash & (index->num_buckets-1));
+
+    while(*link!=NULL){
+        const struct IRC_NickEntry *e = *link;
+        if((e->hash==hash) && (e->len==len)){
+            unsigned long i = 0;
+            while((i<len) && (index->fold[(unsigned char)a[i]]==(unsigned char)e->key[i]))
+              i++;
+            if(i==len)
+              return link;
+        }
+        link = &((*link)->next);
+    }
+
+    return link;
+}
+
+/* Doubles the number of buckets. If there isn't memory for it, the index just
+ stays the size it is.
+*/
+static void IRC_NickIndexGrow(struct IRC_NickIndex *index){
+    const unsigned long num_buckets = index->num_buckets<<1;
+    struct IRC_NickEntry **buckets = index->alloc(sizeof(struct IRC_NickEntry *)*num_buckets);
+    unsigned long i = 0;
+
+    if(buckets==NULL)
+      return;
+
+    memset(buckets, 0, sizeof(struct IRC_NickEntry *)*num_buckets);
+
+    for(; i<index->num_buckets; i++){
+        struct IRC_NickEntry *e = index->buckets[i];
+        while(e!=NULL){
+            struct IRC_NickEntry *next = e->next;
+            const unsigned long b = e->hash & (num_buckets-1);
+            e->next = buckets[b];
+            buckets[b] = e;
+            e = next;
+        }
+    }
+
+    index->dealloc(index->buckets);
+    index->buckets = buckets;
+    index->num_buckets = num_buckets;
+}
+
+/* Makes an entry for `a', with room for a few channels, and puts it in the
+ index.
+*/
+static struct IRC_NickEntry *IRC_NickIndexInsert(struct IRC_NickIndex *index, const char *a, unsigned long len){
+    struct IRC_NickEntry *e = index->alloc(sizeof(struct IRC_NickEntry)+len+1);
+    unsigned long i = 0, b;
+
+    e->hash = IRC_NickIndexHash(index->fold, a, len);
+    e->len = len;
+    e->key = (char *)(e+1);
+    for(; i<len; i++)
+      e->key[i] = index->fold[(unsigned char)a[i]];
+    e->key[len] = '\0';
+
+    e->num_channels = 0;
+    e->max_channels = IRC_NICKINDEX_INITIAL_CHANNELS;
+    e->channels = index->alloc(sizeof(struct IRC_NickMembership)*e->max_channels);
+
+    if(index->count>=index->num_buckets)
+      IRC_NickIndexGrow(index);
+
+    b = e->hash & (index->num_buckets-1);
+    e->next = index->buckets[b];
+    index->buckets[b] = e;
+    index->count++;
+
+    return e;
+}
+
+static void IRC_NickIndexFreeEntry(struct IRC_NickIndex *index, struct IRC_NickEntry *e){
+    index->dealloc(e->channels);
+    index->dealloc(e);
+}
+
+/* Adds `m' to the channels of `e', making room if needed.
+*/
+static void IRC_NickEntryAppend(struct IRC_NickIndex *index, struct IRC_NickEntry *e, const struct IRC_NickMembership *m){
+    if(e->num_channels==e->max_channels){
+        struct IRC_NickMembership *channels = index->alloc(sizeof(struct IRC_NickMembership)*e->max_channels*2);
+        memcpy(channels, e->channels, sizeof(struct IRC_NickMembership)*e->num_channels);
+        index->dealloc(e->channels);
+        e->channels = channels;
+        e->max_channels*=2;
+    }
+
+    e->channels[e->num_channels++] = *m;
+}
+
+struct IRC_NickIndex *IRC_CreateNickIndex(void){
+    IRC_allocator alloc;
+    IRC_deallocator dealloc;
+    struct IRC_NickIndex *index;
+
+    IRC_GetAllocators(&alloc, &dealloc);
+
+    index = alloc(sizeof(struct IRC_NickIndex));
+    index->num_buckets = IRC_NICKINDEX_INITIAL_BUCKETS;
+    index->buckets = alloc(sizeof(struct IRC_NickEntry *)*index->num_buckets);
+    memset(index->buckets, 0, sizeof(struct IRC_NickEntry *)*index->num_buckets);
+    index->count = 0;
+    IRC_BuildFoldTable(IRC_casemap_rfc1459, index->fold);
+    index->alloc = alloc;
+    index->dealloc = dealloc;
+
+    return index;
+}
+
+void IRC_DestroyNickIndex(struct IRC_NickIndex *index){
+    unsigned long i = 0;
+    for(; i<index->num_buckets; i++){
+        struct IRC_NickEntry *e = index->buckets[i];
+        while(e!=NULL){
+            struct IRC_NickEntry *next = e->next;
+            IRC_NickIndexFreeEntry(index, e);
+            e = next;
+        }
+    }
+    index->dealloc(index->buckets);
+    index->dealloc(index);
+}
+
+void IRC_NickIndexAdd(struct IRC_NickIndex *index, struct IRC_Channel *channel, struct IRC_UserHolder *holder){
+    const char *nick = holder->user->name;
+    const unsigned long len = strlen(nick);
+    struct IRC_NickEntry *e = *IRC_NickIndexLookup(index, nick, len);
+    struct IRC_NickMembership m;
+
+    if(e==NULL)
+      e = IRC_NickIndexInsert(index, nick, len);
+
+    m.channel = channel;
+    m.holder = holder;
+    IRC_NickEntryAppend(index, e, &m);
+}
+
+void IRC_NickIndexRemove(struct IRC_NickIndex *index, struct IRC_Channel *channel, struct IRC_UserHolder *holder){
+    const char *nick = holder->user->name;
+    struct IRC_NickEntry **link = IRC_NickIndexLookup(index, nick, strlen(nick));
+    struct IRC_NickEntry *e = *link;
+    unsigned long i = 0;
+
+    if(e==NULL)
+      return;
+
+    while((i<e->num_channels) &&
+      ((e->channels[i].channel!=channel) || (e->channels[i].holder!=holder)))
+      i++;
+
+    if(i==e->num_channels)
+      return;
+
+    /* Order doesn't matter, so the last one just takes its place.
+    */
+    e->channels[i] = e->channels[--(e->num_channels)];
+
+    if(e->num_channels==0){
+        *link = e->next;
+        index->count--;
+        IRC_NickIndexFreeEntry(index, e);
+    }
+}
+
+void IRC_NickIndexRename(struct IRC_NickIndex *index, const char *from, const char *to){
+    const unsigned long from_len = strlen(from), to_len = strlen(to);
+    struct IRC_NickEntry **link = IRC_NickIndexLookup(index, from, from_len);
+    struct IRC_NickEntry *e = *link, *into;
+    unsigned long i = 0;
+
+    if(e==NULL)
+      return;
+
+    /* Only the case changed, so the entry already has the right key.
+    */
+    if(IRC_NickIndexLookup(index, to, to_len)==link)
+      return;
+
+    *link = e->next;
+    index->count--;
+
+    into = *IRC_NickIndexLookup(index, to, to_len);
+    if(into==NULL)
+      into = IRC_NickIndexInsert(index, to, to_len);
+
+    for(; i<e->num_channels; i++)
+      IRC_NickEntryAppend(index, into, e->channels+i);
+
+    IRC_NickIndexFreeEntry(index, e);
+}
+
+const struct IRC_NickMembership *IRC_NickIndexFind(struct IRC_NickIndex *index, const char *nick, unsigned long *n){
+    const struct IRC_NickEntry *e = *IRC_NickIndexLookup(index, nick, strlen(nick));
+
+    if(e==NULL){
+        *n = 0;
+        return NULL;
+    }
+
+    *n = e->num_channels;
+    return e->channels;
+}
+
+unsigned long IRC_NickIndexCount(struct IRC_NickIndex *index){
+    return index->count;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+/* Index of which channels every nick is in, for a single server connection.
+ Nicks are keyed by their RFC 1459 casefolded bytes, so "Nick" and "nICK" are
+ the same entry.
+
+ An IRC_State keeps one of these up to date through IRC_ChannelAddUser and
+ IRC_ChannelRemoveUser*, so finding a nick's channels does not mean walking
+ every channel's user list. All use of an index must be serialized by the
+ caller, just as with the channels themselves.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct IRC_Channel;
+struct IRC_UserHolder;
+struct IRC_NickIndex;
+
+/* A channel that a nick is in, and the nick's place in its user list.
+*/
+struct IRC_NickMembership {
+    struct IRC_Channel *channel;
+    struct IRC_UserHolder *holder;
+};
+
+struct IRC_NickIndex *IRC_CreateNickIndex(void);
+void IRC_DestroyNickIndex(struct IRC_NickIndex *index);
+
+/* Records that `holder', whose user's name is the nick, is in `channel'.
+*/
+void IRC_NickIndexAdd(struct IRC_NickIndex *index, struct IRC_Channel *channel, struct IRC_UserHolder *holder);
+/* Forgets that `holder' is in `channel'. The nick is dropped from the index
+ when it is in no channels at all.
+*/
+void IRC_NickIndexRemove(struct IRC_NickIndex *index, struct IRC_Channel *channel, struct IRC_UserHolder *holder);
+/* Moves every channel `from' is in over to `to'. The users' names are left
+ alone.
+*/
+void IRC_NickIndexRename(struct IRC_NickIndex *index, const char *from, const char *to);
+
+/* Returns the channels `nick' is in, and sets `*n' to how many there are, or
+ returns NULL if it is in none. Valid until the index is next changed.
+*/
+const struct IRC_NickMembership *IRC_NickIndexFind(struct IRC_NickIndex *index, const char *nick, unsigned long *n);
+
+/* Number of distinct nicks in the index.
+*/
+unsigned long IRC_NickIndexCount(struct IRC_NickIndex *index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,5 +1,7 @@
 #include "message.h"
 #include "parse.h"
+#include "messageinternal.h"
+#include "loginternal.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -47,8 +49,14 @@ static unsigned long IRC_GetNextLength(struct IRC_ParseState *state){
 struct IRC_ParseState *IRC_StitchParse(struct IRC_ParseState * old, const char *input){
     char *newinput;
     struct IRC_ParseState *state;
+    unsigned len;
 
-    unsigned len = old->len - (old->cursor - old->text) + strlen(input);
+    /* The old input ended on a whole message, so there is nothing to join.
+    */
+    if(*old->cursor=='\0')
+      return IRC_InitParse(input);
+
+    len = old->len - (old->cursor - old->text) + strlen(input);
     IRC_GetAllocators(&Alloc, &Dealloc);
 
     newinput = Alloc(len+1);
@@ -94,9 +102,11 @@ unsigned long IRC_CountParameters(const char * const text){
       return 1;
 
     /* If we are in the middle/at the start of a word, move past it.
+      A ':' only means anything at the start of a word, so it can be part of
+      one, as in TARGMAX=JOIN:3 or an IPv6 host.
     */
 
-    while((*a!='\0') && (*a!=' ') && (*a!=':'))
+    while((*a!='\0') && (*a!=' '))
       a++;
 
 
@@ -118,12 +128,44 @@ unsigned long IRC_CountParameters(const char * const text){
       return 1;
 
     /* Count this word and continue.
-      If we have hit a ':', it will be picked up by this new call.
+      If the next word starts with a ':', it will be picked up by this new call.
     */
     return 1+IRC_CountParameters(a);
 }
 
-void IRC_ParseParameter(const char * to[], const char * const text){
+/* Length of a trailing parameter, which is the rest of the text except for its
+ last character.
+*/
+static unsigned long IRC_TrailingLength(const char *a){
+    const unsigned long len = strlen(a);
+    return (len>0)?len-1:0;
+}
+
+/* Returns how many bytes the parameters in `text' will take up in a message,
+ counting their NULs. This goes through `text' just as IRC_ParseParameter does.
+*/
+static unsigned long IRC_ParameterBytes(const char * const text){
+    const char *a = text, *b;
+    while(*a==' ')
+      a++;
+
+    if((*a=='\0') || (*a=='\r'))
+        return 0;
+
+    if(*a==':')
+        return IRC_TrailingLength(a+1)+1;
+
+    b = a;
+
+    while((*b!='\0') && (*b!='\r') && (*b!=' '))
+      b++;
+
+    return (b-a)+1+IRC_ParameterBytes(b);
+}
+
+/* Copies the parameters in `text' into `to', putting their text at `*into'.
+*/
+static void IRC_ParseParameter(const char * to[], char **into, const char * const text){
     const char *a = text, *b;
     while(*a==' ')
       a++;
@@ -139,28 +181,31 @@ void IRC_ParseParameter(const char * to[], const char * const text){
     */
     if(*a==':'){
         a++;
-        to[0] = IRC_Strndup(a, strlen(a)-1);
+        to[0] = IRC_PutMessageText(into, a, IRC_TrailingLength(a));
         return;
     }
 
     b = a;
 
-    while((*b!='\0') && (*b!='\r') && (*b!=' ') && (*b!=':'))
+    while((*b!='\0') && (*b!='\r') && (*b!=' '))
       b++;
 
-    to[0] = IRC_Strndup(a, b-a);
+    to[0] = IRC_PutMessageText(into, a, b-a);
 
     a = b;
 
-    IRC_ParseParameter(&(to[1]), a);
+    IRC_ParseParameter(&(to[1]), into, a);
     return;
 
 }
 
 struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
-    const char *from, *a;
+    const char *from, *tags, *a;
+    unsigned long from_len = 0, tags_len = 0;
     enum IRC_messageType msgtype;
     struct IRC_Message *msg;
+    char *text;
+    long i;
     unsigned long l = IRC_GetNextLength(state);
 
     if(state->status==IRC_unexpectedEnd)
@@ -184,9 +229,9 @@ struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
     */
     IRC_GetAllocators(&Alloc, &Dealloc);
 
-    /* Be sure the buffer is large enough to hold our raw message.
+    /* Be sure the buffer is large enough to hold our raw message and its NUL.
     */
-    if(l>state->bufferlen){
+    if(l>=state->bufferlen){
 
         /* We don't explicitly rely on Dealloc being capable of handling NULL.
         */
@@ -207,7 +252,7 @@ struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
     state->buffer[l] = '\0';
     memcpy(state->buffer, state->cursor, l);
 
-    printf("Dumping message.\n%s\n", state->buffer);
+    IRC_LOG_DEBUG(("Parsing message %s", state->buffer));
     state->cursor+=l+1;
 
     a = state->buffer;
@@ -217,6 +262,31 @@ struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
     while((*a!='\0') && (*a==' '))
       a++;
 
+    /* Get the IRCv3 tags if there are any. They are only copied, and are not
+     looked at any further unless someone asks for a tag.
+    */
+    if(*a=='@'){
+        const char *b = a+1;
+        while((*b!='\0') && (*b!=' '))
+          b++;
+
+        tags = a+1;
+        tags_len = b-tags;
+
+        a = b;
+        while(*a==' ')
+          a++;
+
+        /* Tags on their own aren't a message.
+        */
+        if(*a=='\0'){
+            state->status = IRC_badMessage;
+            return NULL;
+        }
+    }
+    else
+      tags = NULL;
+
     /* Get the sender if applicable.
      This is usually signified with a ':'
     */
@@ -229,47 +299,54 @@ struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
           b++;
         len = b-a;
 
-        from = IRC_Strndup(a, len);
+        from = a;
+        from_len = len;
 
-        /* Put `a' at the start of the next word.
+        /* Put `a' at the start of the next word, if there is one.
         */
         a = b;
-        a++;
+        if(*a!='\0')
+          a++;
     }
     else
       from = NULL;
 
+    /* Without a command word there is no message, and nothing after `a' to
+     look at.
+    */
+    if(*a=='\0'){
+        state->status = IRC_badMessage;
+        return NULL;
+    }
+
     /* Get the message type.
     */
     {
-        /* Prepare a buffer to hold the type and pass it for comparison.
+        /* The type is NUL terminated in place just long enough to look it up.
+         `b' points into our own buffer, so this is fine.
         */
-        char *type;
-        unsigned long len;
+        char *b = state->buffer+((a+1)-state->buffer);
+        char end;
 
         /* Find the length of the word. We drop the colon.
         */
-        const char *b = a+1;
         while((*b!='\0') && (*b!=' ') && (*b!=':'))
           b++;
 
-        len = b-a;
-
-        type = IRC_Strndup(a, len);
-
-        printf("Type: (%s)\n", type);
+        end = *b;
+        *b = '\0';
 
-        msgtype = IRC_GetTokenEnum(type);
+        msgtype = IRC_GetTokenEnum(a);
 
-        Dealloc(type);
+        *b = end;
         /* Put `a' at the start of the next word.
         */
         a = b;
 
-        /* Only skip ahead if we aren't at a ':'.
-          This helps parsing the parameters.
+        /* Only skip ahead if we are at a space, so `a' stays on a ':' for
+          the parameters, or on the NUL if there aren't any.
         */
-        if(*b!=':')
+        if(*b==' ')
           a++;
     }
 
@@ -277,27 +354,34 @@ struct IRC_Message *IRC_ConsumeParse(struct IRC_ParseState *state){
     */
     if(msgtype == IRC_mt_null){
         /* Message type we don't understand. Or it was malformed or something.
-          Clean up after ourselves, set the status to reflect what is up, and
-          return a NULL to notify the application that we don't know what we
-          are looking at.
+          Set the status to reflect what is up, and return a NULL to notify
+          the application that we don't know what we are looking at.
         */
-        if(from!=NULL)
-          Dealloc((void *)from);
-
         state->status = IRC_badMessage;
         return NULL;
     }
 
-    /* We now have enough information to prepare a message.
+    /* We now have enough information to prepare a message. It is sized first,
+     so that everything can go into a single allocation.
     */
-    msg = Alloc(sizeof(struct IRC_Message));
+    msg = IRC_AllocMessage(msgtype, IRC_CountParameters(a),
+      ((tags!=NULL)?tags_len+1:0) + ((from!=NULL)?from_len+1:0) + IRC_ParameterBytes(a),
+      &text);
 
-    msg->from = from;
-    msg->type = msgtype;
-    msg->num_parameters = IRC_CountParameters(a);
-    msg->parameters = Alloc(msg->num_parameters*sizeof(const char *));
+    if(tags!=NULL)
+      msg->tags = IRC_PutMessageText(&text, tags, tags_len);
+    if(from!=NULL)
+      msg->from = IRC_PutMessageText(&text, from, from_len);
 
-    IRC_ParseParameter(msg->parameters, a);
+    IRC_ParseParameter(msg->parameters, &text, a);
+
+    /* A message with nothing after its type is still counted as having one
+     parameter.
+    */
+    for(i = 0; i<msg->num_parameters; i++){
+        if(msg->parameters[i]==NULL)
+          msg->parameters[i] = "";
+    }
 
     state->status = IRC_inProgress;
 
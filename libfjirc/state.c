@@ -1,16 +1,38 @@
 #include "state.h"
 #include "channel.h"
+#include "nickindex.h"
+#include "intern.h"
 #include <stdlib.h>
 #include <string.h>
 
+void IRC_InitState(struct IRC_State *state, const char *name){
+    state->name = name;
+    state->channels = NULL;
+    state->nicks = IRC_CreateNickIndex();
+    state->user = NULL;
+}
+
+void IRC_CloseState(struct IRC_State *state){
+    if(state->nicks!=NULL)
+      IRC_DestroyNickIndex(state->nicks);
+    state->nicks = NULL;
+}
+
 int IRC_StateContainsUser(struct IRC_State *state, const char *name){
     struct IRC_ChannelHolder *h = state->channels;
+    unsigned long n;
+
+    if(state->nicks!=NULL)
+      return IRC_NickIndexFind(state->nicks, name, &n)!=NULL;
+
+    /* Without an index, every channel has to be looked through.
+    */
     if(h!=NULL)
       do{
           struct IRC_UserHolder *u = h->channel->users;
           if(u!=NULL)
             do{
-                if(strcmp(u->user->name, name)==0)
+                if(IRC_CaseEqual(u->user->name, name))
                   return 1;
                 u = IRC_UserNext(u);
             }while(u!=h->channel->users);
@@ -4,12 +4,35 @@
 */
 
 struct IRC_ChannelHolder;
+struct IRC_NickIndex;
 
 struct IRC_State {
     const char *name;
     struct IRC_ChannelHolder *channels;
 
+    /* Which channels every nick is in. Channels whose `state' is this one keep
+     it up to date as their users come and go.
+    */
+    struct IRC_NickIndex *nicks;
+
     void *user; /* applicatin-defined data to associate with this state. */
 };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sets up an empty state with its own nick index.
+*/
+void IRC_InitState(struct IRC_State *state, const char *name);
+/* Frees the nick index. The channels are left to the application.
+*/
+void IRC_CloseState(struct IRC_State *state);
+
+/* `name' is a nick, without any user or host.
+*/
 int IRC_StateContainsUser(struct IRC_State *state, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
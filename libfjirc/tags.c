@@ -0,0 +1,158 @@
+#include "tags.h"
+#include "message.h"
+
+#include <string.h>
+
+static IRC_allocator Alloc;
+
+const char *IRC_FindTag(const struct IRC_Message *msg, const char *key, unsigned long *len){
+    const char *a = msg->tags;
+    const unsigned long key_len = strlen(key);
+
+    if(a==NULL)
+      return NULL;
+
+    while(*a!='\0'){
+        /* Find the end of this tag and of its key.
+        */
+        const char *end = a, *key_end;
+        while((*end!='\0') && (*end!=';'))
+          end++;
+
+        key_end = a;
+        while((key_end!=end) && (*key_end!='='))
+          key_end++;
+
+        if(((unsigned long)(key_end-a)==key_len) && (memcmp(a, key, key_len)==0)){
+            const char *value = (key_end==end)?end:(key_end+1);
+            if(len!=NULL)
+              *len = end-value;
+            return value;
+        }
+
+        a = end;
+        if(*a==';')
+          a++;
+    }
+
+    return NULL;
+}
+
+int IRC_HasTag(const struct IRC_Message *msg, const char *key){
+    return IRC_FindTag(msg, key, NULL)!=NULL;
+}
+
+unsigned long IRC_UnescapeTag(char *to, const char *value, unsigned long len){
+    unsigned long i = 0, n = 0;
+
+    while(i<len){
+        if(value[i]!='\\'){
+            to[n++] = value[i++];
+            continue;
+        }
+
+        /* A lone backslash at the end is dropped.
+        */
+        i++;
+        if(i==len)
+          break;
+
+        switch(value[i]){
+            case ':':
+              to[n++] = ';';
+              break;
+            case 's':
+              to[n++] = ' ';
+              break;
+            case 'r':
+              to[n++] = '\r';
+              break;
+            case 'n':
+              to[n++] = '\n';
+              break;
+            default:
+              /* Includes an escaped backslash. Unknown escapes are just the
+               escaped character.
+              */
+              to[n++] = value[i];
+        }
+        i++;
+    }
+
+    to[n] = '\0';
+    return n;
+}
+
+char *IRC_GetTag(const struct IRC_Message *msg, const char *key){
+    unsigned long len;
+    char *r;
+    const char *value = IRC_FindTag(msg, key, &len);
+
+    if(value==NULL)
+      return NULL;
+
+    IRC_GetAllocators(&Alloc, NULL);
+
+    r = Alloc(len+1);
+    IRC_UnescapeTag(r, value, len);
+    return r;
+}
+
+/* Reads exactly `n' digits. Returns -1 if any of them aren't.
+*/
+static long ReadNumber(const char *a, unsigned n){
+    long r = 0;
+    unsigned i = 0;
+    for(; i<n; i++){
+        if((a[i]<'0') || (a[i]>'9'))
+          return -1;
+        r = (r*10)+(a[i]-'0');
+    }
+    return r;
+}
+
+int IRC_GetTagTime(const struct IRC_Message *msg, unsigned long *seconds, unsigned *milliseconds){
+    unsigned long len;
+    long year, month, day, hour, minute, second, ms = 0, era, yoe, doy, doe;
+    const char *a = IRC_FindTag(msg, "time", &len);
+
+    /* YYYY-MM-DDThh:mm:ss, optionally followed by .sss, then Z
+    */
+    if((a==NULL) || (len<20) || (a[4]!='-') || (a[7]!='-') || (a[10]!='T') ||
+      (a[13]!=':') || (a[16]!=':'))
+      return 0;
+
+    year = ReadNumber(a, 4);
+    month = ReadNumber(a+5, 2);
+    day = ReadNumber(a+8, 2);
+    hour = ReadNumber(a+11, 2);
+    minute = ReadNumber(a+14, 2);
+    second = ReadNumber(a+17, 2);
+
+    if((year<1970) || (month<1) || (month>12) || (day<1) || (day>31) ||
+      (hour<0) || (minute<0) || (second<0))
+      return 0;
+
+    if((len>=24) && (a[19]=='.')){
+        ms = ReadNumber(a+20, 3);
+        if(ms<0)
+          return 0;
+    }
+
+    /* Days since the epoch from the civil date, counting years from March so
+     that leap days fall at the end.
+    */
+    if(month<=2)
+      year--;
+    era = year/400;
+    yoe = year-era*400;
+    doy = (153*(month+((month>2)?-3:9))+2)/5+day-1;
+    doe = yoe*365+yoe/4-yoe/100+doy;
+
+    *seconds = (unsigned long)(era*146097+doe-719468)*86400ul +
+      hour*3600ul + minute*60ul + second;
+    if(milliseconds!=NULL)
+      *milliseconds = ms;
+
+    return 1;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+struct IRC_Message;
+
+/* IRCv3 message tags.
+ The parser only copies the tag section of a message into `tags', without the
+ leading '@'. Nothing in it is split or unescaped until one of these is used,
+ so messages with large tag sections that nobody looks at cost very little.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Finds the raw, still escaped value of `key'. Returns a pointer into
+ msg->tags and sets `len' to the length of the value, or returns NULL if the
+ message has no such tag. A tag without a value has an empty value.
+ `len' can be NULL.
+*/
+const char *IRC_FindTag(const struct IRC_Message *msg, const char *key, unsigned long *len);
+
+/* Returns nonzero if the message has the tag `key'.
+*/
+int IRC_HasTag(const struct IRC_Message *msg, const char *key);
+
+/* Returns the unescaped value of `key', or NULL if the message has no such
+ tag. The result is allocated with the libfjirc allocators.
+*/
+char *IRC_GetTag(const struct IRC_Message *msg, const char *key);
+
+/* Unescapes `len' bytes of a tag value into `to', which must be able to hold
+ at least len+1 bytes. `to' is NUL terminated. Returns the new length.
+*/
+unsigned long IRC_UnescapeTag(char *to, const char *value, unsigned long len);
+
+/* Decodes the server-time tag ("time", as in 2011-10-19T16:40:51.620Z) into
+ seconds and milliseconds since the Unix epoch. Returns nonzero on success.
+ `milliseconds' can be NULL.
+*/
+int IRC_GetTagTime(const struct IRC_Message *msg, unsigned long *seconds, unsigned *milliseconds);
+
+#ifdef __cplusplus
+}
+#endif
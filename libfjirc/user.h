@@ -13,7 +13,14 @@ struct IRC_UserHolder {
     void *userdata;
 };
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct IRC_UserHolder *IRC_UserNext(struct IRC_UserHolder *a);
 struct IRC_UserHolder *IRC_UserPrev(struct IRC_UserHolder *a);
 struct IRC_User *IRC_UserUnwrap(struct IRC_UserHolder *a);
 
+#ifdef __cplusplus
+}
+#endif
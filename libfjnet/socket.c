@@ -3,6 +3,72 @@
 #include <errno.h>
 #define LIBFJNET_INTERNAL
 #include "socket_definition.h"
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+static WSockLogger Logger = NULL;
+static enum WSockLogLevel LoggerLevel = eLogNone;
+
+void SetLogger_Socket(WSockLogger aLogger, enum WSockLogLevel aLevel){
+    Logger = aLogger;
+    LoggerLevel = (aLogger==NULL)?eLogNone:aLevel;
+}
+
+/* C89 has no variadic macros, so the arguments go in an extra set of
+ parentheses. Levels less severe than FJNET_LOG_LEVEL (0 for none, up to 4
+ for debug) compile to nothing.
+*/
+#ifndef FJNET_LOG_LEVEL
+#define FJNET_LOG_LEVEL 4
+#endif
+
+#if FJNET_LOG_LEVEL >= 1
+static void Log_Socket(enum WSockLogLevel aLevel, const char *fmt, va_list args){
+    if((Logger!=NULL) && (LoggerLevel>=aLevel))
+      Logger(aLevel, fmt, args);
+}
+#endif
+
+void Message_Socket(enum WSockLogLevel aLevel, const char *fmt, ...){
+#if FJNET_LOG_LEVEL >= 1
+    va_list args;
+    if(aLevel>FJNET_LOG_LEVEL)
+      return;
+    va_start(args, fmt);
+    Log_Socket(aLevel, fmt, args);
+    va_end(args);
+#endif
+}
+
+#define FJNET_LOG_FUNCTION(NAME, LEVEL)\
+    static void NAME(const char *fmt, ...){\
+        va_list args;\
+        va_start(args, fmt);\
+        Log_Socket(LEVEL, fmt, args);\
+        va_end(args);\
+    }
+
+#if FJNET_LOG_LEVEL >= 1
+FJNET_LOG_FUNCTION(LogError_Socket, eLogError)
+#define FJNET_LOG_ERROR(ARGS) LogError_Socket ARGS
+#else
+#define FJNET_LOG_ERROR(ARGS)
+#endif
+
+#if FJNET_LOG_LEVEL >= 3
+FJNET_LOG_FUNCTION(LogInfo_Socket, eLogInfo)
+#define FJNET_LOG_INFO(ARGS) LogInfo_Socket ARGS
+#else
+#define FJNET_LOG_INFO(ARGS)
+#endif
+
+#if FJNET_LOG_LEVEL >= 4
+FJNET_LOG_FUNCTION(LogDebug_Socket, eLogDebug)
+#define FJNET_LOG_DEBUG(ARGS) LogDebug_Socket ARGS
+#else
+#define FJNET_LOG_DEBUG(ARGS)
+#endif
 
 /*
 enum WSockErr {eSuccess, eFailure, eNotConnected, eAlreadyConnected};
@@ -21,6 +87,10 @@ const char *ExplainError_Socket(enum WSockErr err){
             return "Connection Timed Out.";
         case eAlreadyConnected:
             return "Already Connected.";
+        case eInProgress:
+            return "In Progress.";
+        case eNoTLS:
+            return "Not Built With TLS.";
         default:
         ;
     }
@@ -54,7 +124,7 @@ void InitSock(){}
 
 #define CLOSE_SOCKET close
 
-#define PRINT_LAST_ERROR perror
+#define PRINT_LAST_ERROR(STR) FJNET_LOG_ERROR(("%s: %s", STR, strerror(errno)))
 
 static int GetPendingBytes(FJNET_SOCKET socket, unsigned long *len){
 
@@ -101,7 +171,7 @@ static void MakeNonBlocking(FJNET_SOCKET socket){
 	ioctlsocket(socket, FIONBIO, &m);
 }
 
-#define PRINT_LAST_ERROR(STR) printf(STR " %ld\n", WSAGetLastError())
+#define PRINT_LAST_ERROR(STR) FJNET_LOG_ERROR(("%s: %ld", STR, (long)WSAGetLastError()))
 
 #define CLOSE_SOCKET(S) shutdown(S, SD_SEND); closesocket(S)
 
@@ -130,7 +200,7 @@ const int SO_NREAD = 0x1020;
 
 #define CLOSE_SOCKET close
 
-#define PRINT_LAST_ERROR perror
+#define PRINT_LAST_ERROR(STR) FJNET_LOG_ERROR(("%s: %s", STR, strerror(errno)))
 
 static int GetPendingBytes(FJNET_SOCKET socket, unsigned long *len){
 	struct pollfd pfd;
@@ -163,12 +233,19 @@ struct WSocket *Create_Socket(void){
     struct WSocket *lSock = malloc(sizeof(struct WSocket));
     lSock->sockaddr = malloc(sizeof(struct sockaddr_in));
     memset(lSock->sockaddr, 0, sizeof(struct sockaddr_in));
+    lSock->tls = NULL;
+    lSock->ring = NULL;
     return lSock;
 }
 
 void Destroy_Socket(struct WSocket *aSocket){
 
     assert(aSocket);
+    /* It must be removed from any SocketSet first. */
+    assert(aSocket->ring==NULL);
+
+    if(aSocket->tls)
+      DestroyTLS_Socket(aSocket);
 
     free(aSocket->sockaddr);
     free(aSocket);
@@ -187,7 +264,7 @@ enum WSockErr Connect_Socket(struct WSocket *aSocket, const char *aTo, unsigned
         unsigned long len = strlen(aTo);
         assert(len<=0xFE);
         strncpy(aSocket->hostname, aTo, 0xFE);
-        printf("Connection to %s\n", aSocket->hostname);
+        FJNET_LOG_INFO(("Connecting to %s", aSocket->hostname));
     }
 
     aSocket->host = gethostbyname(aSocket->hostname);
@@ -212,6 +289,7 @@ enum WSockErr Connect_Socket(struct WSocket *aSocket, const char *aTo, unsigned
 	){
 
         PRINT_LAST_ERROR("Error Creating Socket");
+        aSocket->sock = 0;
         return eFailure;
     }
 
@@ -232,7 +310,6 @@ enum WSockErr Connect_Socket(struct WSocket *aSocket, const char *aTo, unsigned
 	){
         struct timeval time;
         fd_set set;
-        fprintf(stderr, "Waiting for connection...\n");
 
         FD_ZERO(&set);
         FD_SET(aSocket->sock,&set);
@@ -241,21 +318,34 @@ enum WSockErr Connect_Socket(struct WSocket *aSocket, const char *aTo, unsigned
         time.tv_usec=(timeout%1000)*1000;
 
         err = select(aSocket->sock+1, NULL, &set, NULL, &time);
-        fprintf(stderr, "err %i\n", err);
         if(err==0){
             CLOSE_SOCKET(aSocket->sock);
+            aSocket->sock = 0;
             return eTimeout;
         }
+
+        /* Writable only means the attempt is over, not that it worked. */
+        if(err>0){
+            const int status = (int)CheckError(aSocket->sock);
+            if(status!=0){
+                FJNET_LOG_INFO(("Could not connect to %s: %s", aTo, strerror(status)));
+                CLOSE_SOCKET(aSocket->sock);
+                aSocket->sock = 0;
+                return (status==ECONNREFUSED)?eRefused:eFailure;
+            }
+        }
     }
 
 
     if(err<0){
+        const int error = errno;
 
 		PRINT_LAST_ERROR("Error occured attempting to connect");
 
         CLOSE_SOCKET(aSocket->sock);
+        aSocket->sock = 0;
 
-        switch(errno){
+        switch(error){
         case ECONNREFUSED:
           return eRefused;
         case EISCONN:
@@ -265,7 +355,7 @@ enum WSockErr Connect_Socket(struct WSocket *aSocket, const char *aTo, unsigned
         return eFailure;
     }
 
-    printf("Connected to %s on port number %lu. Using socket %i.\n", aTo, aPortNum, aSocket->sock);
+    FJNET_LOG_INFO(("Connected to %s on port number %lu. Using socket %i.", aTo, aPortNum, (int)aSocket->sock));
 
     return eSuccess;
 }
@@ -275,6 +365,8 @@ enum WSockErr Disconnect_Socket(struct WSocket *aSocket){
     assert(aSocket!=NULL);
     if(aSocket->sock){
 		InitSock();
+        if(aSocket->tls)
+          CloseTLS_Socket(aSocket);
         CLOSE_SOCKET(aSocket->sock);
         aSocket->sock = 0;
     }
@@ -284,7 +376,16 @@ enum WSockErr Disconnect_Socket(struct WSocket *aSocket){
 /* char streams are NUL terminated. */
 enum WSockErr Read_Socket(struct WSocket *aSocket, char **aTo){
 
-    unsigned long l = Length_Socket(aSocket);
+    unsigned long l;
+
+    if(UsingTLS_Socket(aSocket))
+      return ReadTLS_Socket(aSocket, aTo);
+#ifdef USE_IO_URING
+    if(UsingRing_Socket(aSocket))
+      return ReadRing_Socket(aSocket, aTo);
+#endif
+
+    l = Length_Socket(aSocket);
 
     assert(aSocket!=NULL);
     assert(aSocket->sock!=0);
@@ -297,7 +398,7 @@ enum WSockErr Read_Socket(struct WSocket *aSocket, char **aTo){
     if(l!=0){
 		InitSock();
 		if(recv(aSocket->sock, *aTo, l, 0)!=l){
-			perror("Read_Socket failure");
+			PRINT_LAST_ERROR("Read_Socket failure");
 			return eFailure;
 			return eFailure;
 		}
@@ -308,10 +409,27 @@ enum WSockErr Read_Socket(struct WSocket *aSocket, char **aTo){
     return eSuccess;
 }
 
+/* Waits until aSocket can be written to again. Used when a send only took
+ part of the buffer, which happens under load with non-blocking sockets.
+*/
+static int WaitWritable(FJNET_SOCKET socket, long timeout){
+    struct timeval time;
+    fd_set set;
+
+    FD_ZERO(&set);
+    FD_SET(socket, &set);
+
+    time.tv_sec=timeout/1000;
+    time.tv_usec=(timeout%1000)*1000;
+
+    return select(socket+1, NULL, &set, NULL, &time);
+}
+
 enum WSockErr Write_Socket(struct WSocket *aSocket, const char *aToWrite){
 
     long err = 0;
-    unsigned long len;
+    unsigned long len, at = 0;
+    time_t deadline;
     assert(aSocket!=NULL);
     assert(aSocket->sock!=0);
     assert(aToWrite!=NULL);
@@ -322,17 +440,214 @@ enum WSockErr Write_Socket(struct WSocket *aSocket, const char *aToWrite){
         return eSuccess;
 
 	InitSock();
-    err = send(aSocket->sock, aToWrite, strlen(aToWrite), 0);
+
+    if(UsingTLS_Socket(aSocket))
+      return WriteTLS_Socket(aSocket, aToWrite, len);
+#ifdef USE_IO_URING
+    if(UsingRing_Socket(aSocket))
+      return WriteRing_Socket(aSocket, aToWrite, len);
+#endif
+
+    deadline = time(NULL)+FJNET_WRITE_DEADLINE;
+
+    while(at<len){
+        err = send(aSocket->sock, aToWrite+at, len-at, 0);
+
+        if(err<0){
+            if(
+#if defined USE_WINSOCK
+            (WSAGetLastError()==WSAEWOULDBLOCK)
+#else
+            (errno==EWOULDBLOCK) || (errno==EAGAIN) || (errno==EINTR)
+#endif
+            ){
+                /* A peer that never reads would otherwise keep us here
+                 forever. */
+                if((time(NULL)>=deadline) || (WaitWritable(aSocket->sock, 1000)<0))
+                    break;
+                continue;
+            }
+            break;
+        }
+
+        at+=err;
+    }
 
     if(err<0){
-		perror("Write_Socket failure");
+		PRINT_LAST_ERROR("Write_Socket failure");
 		return eFailure;
 	}
     return eSuccess;
 }
 
+enum WSockErr WriteSome_Socket(struct WSocket *aSocket, const char *aData,
+                               unsigned long aLength, unsigned long *aWritten){
+
+    long err;
+    assert(aSocket!=NULL);
+    assert(aSocket->sock!=0);
+    assert(aData!=NULL);
+    assert(aWritten!=NULL);
+
+    *aWritten = 0;
+
+    if(aLength==0)
+        return eSuccess;
+
+	InitSock();
+
+    if(UsingTLS_Socket(aSocket))
+      return WriteSomeTLS_Socket(aSocket, aData, aLength, aWritten);
+#ifdef USE_IO_URING
+    /* The ring keeps whatever the kernel hasn't taken yet. */
+    if(UsingRing_Socket(aSocket)){
+        const enum WSockErr e = WriteRing_Socket(aSocket, aData, aLength);
+        if(e==eSuccess)
+          *aWritten = aLength;
+        return e;
+    }
+#endif
+
+    while(*aWritten<aLength){
+        err = send(aSocket->sock, aData+*aWritten, aLength-*aWritten, 0);
+
+        if(err<0){
+#if defined USE_WINSOCK
+            if(WSAGetLastError()==WSAEWOULDBLOCK)
+                break;
+#else
+            if(errno==EINTR)
+                continue;
+            if((errno==EWOULDBLOCK) || (errno==EAGAIN))
+                break;
+#endif
+            PRINT_LAST_ERROR("WriteSome_Socket failure");
+            return eFailure;
+        }
+
+        *aWritten+=err;
+    }
+
+    return eSuccess;
+}
+
+enum WSockErr Listen_Socket(struct WSocket *aSocket, unsigned long aPortNum, int aLoopback){
+
+    int yes = 1;
+    assert(aSocket!=NULL);
+
+	InitSock();
+
+    strncpy(aSocket->hostname, aLoopback?"localhost":"", 0xFE);
+    aSocket->host = NULL;
+
+    aSocket->sockaddr->sin_family = AF_INET;
+    aSocket->sockaddr->sin_port = htons(aPortNum);
+    aSocket->sockaddr->sin_addr.s_addr = htonl(aLoopback?INADDR_LOOPBACK:INADDR_ANY);
+
+    aSocket->sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+    if(
+#if defined USE_WINSOCK
+	(aSocket->sock==INVALID_SOCKET)
+#elif defined USE_BSDSOCK || defined USE_CYGSOCK
+	(aSocket->sock<0)
+#endif
+	){
+        PRINT_LAST_ERROR("Error Creating Socket");
+        return eFailure;
+    }
+
+    setsockopt(aSocket->sock, SOL_SOCKET, SO_REUSEADDR, (const void *)&yes, sizeof(int));
+
+    if((bind(aSocket->sock, (const void *)aSocket->sockaddr, sizeof(struct sockaddr_in))!=0) ||
+       (listen(aSocket->sock, 16)!=0)){
+        PRINT_LAST_ERROR("Error listening on socket");
+        CLOSE_SOCKET(aSocket->sock);
+        aSocket->sock = 0;
+        return eFailure;
+    }
+
+    MakeNonBlocking(aSocket->sock);
+
+    return eSuccess;
+}
+
+unsigned long Port_Socket(struct WSocket *aSocket){
+
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(struct sockaddr_in);
+    assert(aSocket!=NULL);
+
+    if(getsockname(aSocket->sock, (void *)&addr, &len)!=0)
+        return 0;
+
+    return ntohs(addr.sin_port);
+}
+
+struct WSocket *Accept_Socket(struct WSocket *aSocket, long timeout){
+
+    struct WSocket *lSock = NULL;
+    socklen_t len = sizeof(struct sockaddr_in);
+    FJNET_SOCKET s;
+    struct timeval time;
+    fd_set set;
+    int err;
+
+    assert(aSocket!=NULL);
+    assert(aSocket->sock!=0);
+
+	InitSock();
+
+    FD_ZERO(&set);
+    FD_SET(aSocket->sock, &set);
+
+    time.tv_sec=timeout/1000;
+    time.tv_usec=(timeout%1000)*1000;
+
+    err = select(aSocket->sock+1, &set, NULL, NULL, (timeout<0)?NULL:&time);
+    if(err<=0)
+      return NULL;
+
+    lSock = Create_Socket();
+
+    s = accept(aSocket->sock, (void *)lSock->sockaddr, &len);
+
+    if(
+#if defined USE_WINSOCK
+	(s==INVALID_SOCKET)
+#elif defined USE_BSDSOCK || defined USE_CYGSOCK
+	(s<0)
+#endif
+	){
+        Destroy_Socket(lSock);
+        return NULL;
+    }
+
+    lSock->sock = s;
+    lSock->host = NULL;
+    strncpy(lSock->hostname, inet_ntoa(lSock->sockaddr->sin_addr), 0xFE);
+
+    MakeNonBlocking(lSock->sock);
+
+    return lSock;
+}
+
 
 enum WSockErr State_Socket(struct WSocket *aSocket){
+    /* Disconnected or failed sockets are set to 0, which is a valid fd. */
+    if(aSocket->sock==0)
+      return eNotConnected;
+    if(UsingTLS_Socket(aSocket)){
+        const enum WSockErr err = StateTLS_Socket(aSocket);
+        if(err!=eConnected)
+          return err;
+    }
+#ifdef USE_IO_URING
+    /* The ring has already seen any error, without asking the socket. */
+    if(UsingRing_Socket(aSocket))
+      return StateRing_Socket(aSocket);
+#endif
     return CheckError(aSocket->sock);
 }
 
@@ -352,16 +667,24 @@ unsigned long Length_Socket(struct WSocket *aSocket){
     assert(aSocket!=NULL);
     assert(aSocket->sock!=0);
 
+#ifdef USE_IO_URING
+    if(UsingRing_Socket(aSocket))
+      return LengthRing_Socket(aSocket);
+#endif
+
 	r = GetPendingBytes(aSocket->sock, &len);
 
     if(r<0){
-		perror("ioctl error in GetPendingBytes");
+		PRINT_LAST_ERROR("ioctl error in GetPendingBytes");
         return 0;
 	}
 
     memcpy(&f, &len, llen);
 
+    if(UsingTLS_Socket(aSocket))
+      f = LengthTLS_Socket(aSocket, f);
+
     if(f>0)
-        printf("%lu bytes pending\n", f);
+        FJNET_LOG_DEBUG(("%lu bytes pending", f));
     return f;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "status.h"
+#include <stdarg.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -7,6 +8,14 @@ extern "C" {
 
 const char *ExplainError_Socket(enum WSockErr);
 
+/* Diagnostics. Nothing is logged until a logger is set. The logger is called
+ for every message at or more severe than aLevel, from whichever thread is
+ using the socket. Pass NULL to stop logging.
+ Messages less severe than FJNET_LOG_LEVEL are removed at compile time.
+*/
+typedef void (*WSockLogger)(enum WSockLogLevel, const char *, va_list);
+void SetLogger_Socket(WSockLogger aLogger, enum WSockLogLevel aLevel);
+
 /* Intended lifetime:
  Create_Socket, Connect_Socket, Read_Socket/Write_Socket...
 ...Read_Socket/Write_Socket, Disconnect_Socket, Destroy_Socket.
@@ -30,14 +39,84 @@ enum WSockErr Disconnect_Socket(struct WSocket *aSocket);
 enum WSockErr Read_Socket(struct WSocket *aSocket, char **aTo);
 enum WSockErr Write_Socket(struct WSocket *aSocket, const char *aToWrite);
 
+/* Writes as much of aData as aSocket will take right now, and sets aWritten
+ to how much that was. Unlike Write_Socket it never waits, so the rest is up
+ to the caller to offer again later. eFailure means the connection is gone.
+*/
+enum WSockErr WriteSome_Socket(struct WSocket *aSocket, const char *aData,
+                               unsigned long aLength, unsigned long *aWritten);
+
 enum WSockErr State_Socket(struct WSocket *aSocket);
 
+/* Server side. Listen_Socket binds to aPortNum and begins listening. A port
+ number of 0 lets the stack choose one, which Port_Socket will then report.
+ If aLoopback is nonzero, only connections from this machine are accepted.
+*/
+enum WSockErr Listen_Socket(struct WSocket *aSocket, unsigned long aPortNum,
+                            int aLoopback);
+unsigned long Port_Socket(struct WSocket *aSocket);
+
+/* Returns a new, connected socket, or NULL if no connection arrived within
+ timeout milliseconds. A negative timeout waits forever. The returned socket
+ should be destroyed with Destroy_Socket like any other.
+*/
+struct WSocket *Accept_Socket(struct WSocket *aSocket, long timeout);
+
 /* Gets the number of pending bytes. This can increase at any time, so
  you should only trust this to see if there are any pending bytes at all,
  or to get a minimum number of incuming bytes.
 */
 unsigned long Length_Socket(struct WSocket *aSocket);
 
+/* TLS. Only available if libfjnet was built with USE_OPENSSL. Otherwise, these
+ all return eNoTLS, NULL, or 0.
+
+ StartTLS_Socket starts a client handshake on a connected socket. aServerName
+ is sent to the server for SNI, and its certificate must be valid for that
+ name. If aSession is NULL, the last session that the server gave this same
+ socket is offered instead, as long as it was for the same aServerName. A
+ server that accepts it skips the full handshake.
+
+ The handshake never blocks. It carries on inside Length_Socket and
+ Read_Socket as the server's replies arrive, so it moves along whenever the
+ socket polls readable, just like reading does. Anything written before it
+ finishes is held and sent as soon as it does. Once a socket is using TLS,
+ Read_Socket, Write_Socket, Length_Socket and State_Socket all work on the
+ decrypted stream, and Disconnect_Socket ends the TLS session as well.
+
+ Where the system supports it, encryption is offloaded to the kernel.
+*/
+enum WSockErr StartTLS_Socket(struct WSocket *aSocket, const char *aServerName,
+                              struct WSockSession *aSession);
+
+/* Server side of StartTLS_Socket, for a socket from Accept_Socket. aCertFile
+ and aKeyFile are PEM files with the certificate chain and its private key.
+*/
+enum WSockErr AcceptTLS_Socket(struct WSocket *aSocket, const char *aCertFile,
+                               const char *aKeyFile);
+
+/* Carries on the handshake, if there is one. Returns eSuccess once it is
+ done, or if the socket does not use TLS, eInProgress while it is waiting on
+ the other side, and eFailure if it failed.
+*/
+enum WSockErr Handshake_Socket(struct WSocket *aSocket);
+
+/* Returns nonzero if the handshake resumed an earlier session. */
+int Resumed_Socket(struct WSocket *aSocket);
+
+/* Returns the newest session that the server gave aSocket, or NULL. Pass it to
+ StartTLS_Socket on another socket to resume it there. Free it with
+ FreeSession_Socket.
+*/
+struct WSockSession *GetSession_Socket(struct WSocket *aSocket);
+void FreeSession_Socket(struct WSockSession *aSession);
+
+/* Trusts certificates issued by the authorities in the PEM file aCAFile, as
+ well as the system's. Meant for testing against a local server with a self
+ signed certificate. Call before the first StartTLS_Socket.
+*/
+enum WSockErr SetAuthority_Socket(const char *aCAFile);
+
 #ifdef __cplusplus
 }
 #endif
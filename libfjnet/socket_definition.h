@@ -3,6 +3,8 @@
 #error Do not include this file! Only use socket.h!
 #endif
 
+#include "status.h"
+
 #if (defined USE_CYGSOCK) || (defined USE_BSDSOCK)
 typedef int FJNET_SOCKET;
 #elif defined USE_WINSOCK
@@ -10,13 +12,49 @@ typedef int FJNET_SOCKET;
 typedef SOCKET FJNET_SOCKET;
 #endif
 
+struct WSockTLS;
+struct WSockRing;
+
 struct WSocket{
     char hostname[0xFF];
     struct sockaddr_in *sockaddr;
     struct hostent *host;
     FJNET_SOCKET sock;
+    /* NULL until TLS is first used. Outlives Disconnect_Socket, so that the
+     session can be resumed on the next connection. */
+    struct WSockTLS *tls;
+    /* NULL unless the socket is in an io_uring SocketSet. */
+    struct WSockRing *ring;
 };
 
+/* Used by socket.c to hand sockets that are using TLS to tls.c. */
+int UsingTLS_Socket(struct WSocket *aSocket);
+enum WSockErr ReadTLS_Socket(struct WSocket *aSocket, char **aTo);
+enum WSockErr WriteTLS_Socket(struct WSocket *aSocket, const char *aToWrite, unsigned long aLength);
+enum WSockErr WriteSomeTLS_Socket(struct WSocket *aSocket, const char *aData,
+                                  unsigned long aLength, unsigned long *aWritten);
+unsigned long LengthTLS_Socket(struct WSocket *aSocket, unsigned long aRawLength);
+enum WSockErr StateTLS_Socket(struct WSocket *aSocket);
+/* Ends the TLS session, but keeps what is needed to resume it. */
+void CloseTLS_Socket(struct WSocket *aSocket);
+void DestroyTLS_Socket(struct WSocket *aSocket);
+
+/* Used by socket.c, when built with USE_IO_URING, to hand sockets whose data
+ comes through an io_uring SocketSet to uring.c. */
+int UsingRing_Socket(struct WSocket *aSocket);
+enum WSockErr ReadRing_Socket(struct WSocket *aSocket, char **aTo);
+enum WSockErr WriteRing_Socket(struct WSocket *aSocket, const char *aToWrite, unsigned long aLength);
+unsigned long LengthRing_Socket(struct WSocket *aSocket);
+enum WSockErr StateRing_Socket(struct WSocket *aSocket);
+
+/* Longest a write waits, in seconds, for a peer that has stopped reading
+ before it gives up. Measured against time(), so it holds no matter how often
+ the waits in between return. */
+#define FJNET_WRITE_DEADLINE 5
+
+/* Logs a message through the logger set with SetLogger_Socket. */
+void Message_Socket(enum WSockLogLevel aLevel, const char *fmt, ...);
+
 #define NANO_IN_MICRO 1000
 #define MICRO_IN_MILLI 1000
 #define NANO_IN_MILLI (NANO_IN_MICRO*MICRO_IN_MILLI)
@@ -1,5 +1,7 @@
 #pragma once
 
 struct WSocket;
-enum WSockErr {eConnected = 0, eSuccess = 0, eFailure, eNotConnected, eRefused, eTimeout, eAlreadyConnected};
+struct WSockSession;
+enum WSockErr {eConnected = 0, eSuccess = 0, eFailure, eNotConnected, eRefused, eTimeout, eAlreadyConnected, eInProgress, eNoTLS};
 enum WSockType {eRead = 1, eWrite = 2, eError = 4};
+enum WSockLogLevel {eLogNone, eLogError, eLogWarning, eLogInfo, eLogDebug};
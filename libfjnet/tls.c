@@ -0,0 +1,707 @@
+#include "socket.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#define LIBFJNET_INTERNAL
+#include "socket_definition.h"
+
+/* TLS for WSockets. See socket.h for how it is used.
+
+ A WSocket gets a WSockTLS the first time it uses TLS. The SSL object only
+ lives as long as the connection, but the newest session that the server gave
+ us, and the name it was for, stay until the socket is destroyed. This makes
+ reconnecting the same socket to the same server resume that session instead
+ of doing a full handshake.
+
+ Reads happen on a network thread, and writes can come from any thread, so
+ everything that touches the SSL object holds the WSockTLS's lock.
+*/
+
+#ifdef USE_OPENSSL
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#if (defined USE_BSDSOCK) || (defined USE_CYGSOCK)
+#include <sys/select.h>
+#include <sys/time.h>
+#endif
+
+enum TLSState {eTLSHandshaking, eTLSReady, eTLSClosed, eTLSBroken};
+
+/* Largest TLS record. Reads are made in pieces this large. */
+#define TLS_READ_SIZE 0x4000
+
+struct WSockTLS{
+    CRYPTO_RWLOCK *lock;
+    SSL *ssl;
+    enum TLSState state;
+    /* Newest session from the server, and the server name it was for. */
+    SSL_SESSION *session;
+    char server_name[0xFF];
+    /* Everything written before the handshake was done. */
+    char *held;
+    unsigned long held_length;
+};
+
+static CRYPTO_ONCE client_once = CRYPTO_ONCE_STATIC_INIT;
+static SSL_CTX *client_context = NULL;
+
+/* One server context is kept, so that sessions from it can be resumed. */
+static CRYPTO_ONCE server_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_RWLOCK *server_lock = NULL;
+static SSL_CTX *server_context = NULL;
+static char *server_cert = NULL, *server_key = NULL;
+
+static void LogErrors(const char *aWhat, SSL *aSSL){
+    char buffer[0x100];
+    unsigned long err;
+
+    if(aSSL){
+        const long verify = SSL_get_verify_result(aSSL);
+        if(verify!=X509_V_OK)
+          Message_Socket(eLogError, "%s: %s", aWhat, X509_verify_cert_error_string(verify));
+    }
+
+    while((err = ERR_get_error())!=0){
+        ERR_error_string_n(err, buffer, sizeof(buffer));
+        Message_Socket(eLogError, "%s: %s", aWhat, buffer);
+    }
+}
+
+/* Called by OpenSSL whenever the server gives us a new session. Runs inside
+ SSL calls, so the lock is already held.
+*/
+static int NewSession(SSL *ssl, SSL_SESSION *session){
+    struct WSocket *const socket = SSL_get_app_data(ssl);
+    struct WSockTLS *const tls = socket->tls;
+
+    if(tls->session)
+      SSL_SESSION_free(tls->session);
+    tls->session = session;
+
+    /* Keep the reference that OpenSSL gave us. */
+    return 1;
+}
+
+static void SetCommonOptions(SSL_CTX *aContext){
+    SSL_CTX_set_min_proto_version(aContext, TLS1_2_VERSION);
+    SSL_CTX_set_mode(aContext, SSL_MODE_ENABLE_PARTIAL_WRITE|SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_ENABLE_KTLS
+    /* Hands the symmetric crypto to the kernel once the handshake is done,
+     where it is supported. Silently stays in user space where it is not. */
+    SSL_CTX_set_options(aContext, SSL_OP_ENABLE_KTLS);
+#endif
+}
+
+static void CreateClientContext(void){
+    client_context = SSL_CTX_new(TLS_client_method());
+    if(!client_context){
+        LogErrors("Could not create a TLS context", NULL);
+        return;
+    }
+
+    SetCommonOptions(client_context);
+    SSL_CTX_set_default_verify_paths(client_context);
+    SSL_CTX_set_verify(client_context, SSL_VERIFY_PEER, NULL);
+
+    /* Sessions are kept on each WSocket, not in OpenSSL's cache. */
+    SSL_CTX_set_session_cache_mode(client_context, SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(client_context, NewSession);
+}
+
+static void CreateServerLock(void){
+    server_lock = CRYPTO_THREAD_lock_new();
+}
+
+static SSL_CTX *ClientContext(void){
+    CRYPTO_THREAD_run_once(&client_once, CreateClientContext);
+    return client_context;
+}
+
+static struct WSockTLS *GetTLS(struct WSocket *aSocket){
+    if(!aSocket->tls){
+        aSocket->tls = calloc(1, sizeof(struct WSockTLS));
+        aSocket->tls->lock = CRYPTO_THREAD_lock_new();
+        aSocket->tls->state = eTLSClosed;
+    }
+    return aSocket->tls;
+}
+
+/* Waits up to a second for aSocket to be ready for what SSL_get_error said
+ OpenSSL wants.
+*/
+static int WaitFor(FJNET_SOCKET aSocket, int aError){
+    struct timeval time;
+    fd_set set;
+
+    FD_ZERO(&set);
+    FD_SET(aSocket, &set);
+
+    time.tv_sec = 1;
+    time.tv_usec = 0;
+
+    return select(aSocket+1, (aError==SSL_ERROR_WANT_READ)?&set:NULL,
+      (aError==SSL_ERROR_WANT_WRITE)?&set:NULL, NULL, &time);
+}
+
+/* Writes all of aData, waiting on the socket as needed, but for no longer
+ than FJNET_WRITE_DEADLINE. The handshake must be done, and the lock held.
+*/
+static enum WSockErr WriteAll_l(struct WSocket *aSocket, const char *aData, unsigned long aLength){
+    struct WSockTLS *const tls = aSocket->tls;
+    const time_t deadline = time(NULL)+FJNET_WRITE_DEADLINE;
+    unsigned long at = 0;
+
+    while(at<aLength){
+        const unsigned long left = aLength-at;
+        int r, error;
+
+        ERR_clear_error();
+        r = SSL_write(tls->ssl, aData+at, (left>0x40000000ul)?0x40000000:(int)left);
+
+        if(r>0){
+            at+=r;
+            continue;
+        }
+
+        error = SSL_get_error(tls->ssl, r);
+        if((error==SSL_ERROR_WANT_READ) || (error==SSL_ERROR_WANT_WRITE)){
+            /* The lock is held while we wait, which keeps ReadTLS_Socket out
+             too, so a peer that never reads must not keep us here. Part of
+             a record may be written, so the session can't carry on. */
+            if(time(NULL)>=deadline){
+                Message_Socket(eLogError, "TLS write to %s timed out.", aSocket->hostname);
+                tls->state = eTLSBroken;
+                return eFailure;
+            }
+
+            if(WaitFor(aSocket->sock, error)>=0)
+              continue;
+        }
+
+        LogErrors("TLS write failed", tls->ssl);
+        tls->state = eTLSBroken;
+        return eFailure;
+    }
+
+    return eSuccess;
+}
+
+/* Carries on the handshake. The lock must be held. */
+static enum WSockErr Handshake_l(struct WSocket *aSocket){
+    struct WSockTLS *const tls = aSocket->tls;
+    int r;
+
+    if(tls->state==eTLSReady)
+      return eSuccess;
+    if(tls->state!=eTLSHandshaking)
+      return eFailure;
+
+    ERR_clear_error();
+    r = SSL_do_handshake(tls->ssl);
+
+    if(r!=1){
+        const int error = SSL_get_error(tls->ssl, r);
+        if((error==SSL_ERROR_WANT_READ) || (error==SSL_ERROR_WANT_WRITE))
+          return eInProgress;
+
+        LogErrors("TLS handshake failed", tls->ssl);
+        tls->state = eTLSBroken;
+        return eFailure;
+    }
+
+    tls->state = eTLSReady;
+
+    Message_Socket(eLogInfo, "TLS handshake with %s done with %s%s%s.", aSocket->hostname,
+      SSL_get_version(tls->ssl), SSL_session_reused(tls->ssl)?", resumed":"",
+      BIO_get_ktls_send(SSL_get_wbio(tls->ssl))?", kernel offload":"");
+
+    if(tls->held){
+        const enum WSockErr err = WriteAll_l(aSocket, tls->held, tls->held_length);
+        free(tls->held);
+        tls->held = NULL;
+        tls->held_length = 0;
+        return err;
+    }
+
+    return eSuccess;
+}
+
+/* Puts ssl on aSocket and starts the handshake. */
+static enum WSockErr Begin(struct WSocket *aSocket, SSL *ssl){
+    struct WSockTLS *const tls = aSocket->tls;
+    enum WSockErr err;
+
+    SSL_set_app_data(ssl, aSocket);
+
+    if(SSL_set_fd(ssl, (int)aSocket->sock)!=1){
+        LogErrors("Could not start TLS", ssl);
+        SSL_free(ssl);
+        return eFailure;
+    }
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    if(tls->ssl)
+      SSL_free(tls->ssl);
+    free(tls->held);
+    tls->held = NULL;
+    tls->held_length = 0;
+
+    tls->ssl = ssl;
+    tls->state = eTLSHandshaking;
+    err = Handshake_l(aSocket);
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    return (err==eFailure)?eFailure:eSuccess;
+}
+
+enum WSockErr StartTLS_Socket(struct WSocket *aSocket, const char *aServerName,
+                              struct WSockSession *aSession){
+
+    SSL_CTX *const context = ClientContext();
+    struct WSockTLS *tls;
+    SSL *ssl;
+
+    assert(aSocket!=NULL);
+    assert(aServerName!=NULL);
+
+    if((!context) || (aSocket->sock==0))
+      return eFailure;
+
+    ssl = SSL_new(context);
+    if(!ssl){
+        LogErrors("Could not start TLS", NULL);
+        return eFailure;
+    }
+
+    /* Addresses are checked against the certificate's IP addresses, and are
+     never sent for SNI. */
+    if(!X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), aServerName)){
+        SSL_set_tlsext_host_name(ssl, aServerName);
+        SSL_set1_host(ssl, aServerName);
+    }
+
+    SSL_set_connect_state(ssl);
+
+    tls = GetTLS(aSocket);
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    if(strcmp(tls->server_name, aServerName)!=0){
+        if(tls->session)
+          SSL_SESSION_free(tls->session);
+        tls->session = NULL;
+        strncpy(tls->server_name, aServerName, sizeof(tls->server_name)-1);
+    }
+
+    if(aSession)
+      SSL_set_session(ssl, (SSL_SESSION *)aSession);
+    else if(tls->session)
+      SSL_set_session(ssl, tls->session);
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    return Begin(aSocket, ssl);
+}
+
+enum WSockErr AcceptTLS_Socket(struct WSocket *aSocket, const char *aCertFile,
+                               const char *aKeyFile){
+
+    SSL *ssl = NULL;
+
+    assert(aSocket!=NULL);
+    assert(aCertFile!=NULL);
+    assert(aKeyFile!=NULL);
+
+    CRYPTO_THREAD_run_once(&server_once, CreateServerLock);
+    CRYPTO_THREAD_write_lock(server_lock);
+
+    if((!server_context) || (strcmp(server_cert, aCertFile)!=0) || (strcmp(server_key, aKeyFile)!=0)){
+        SSL_CTX *context = SSL_CTX_new(TLS_server_method());
+
+        if(context){
+            SetCommonOptions(context);
+            if((SSL_CTX_use_certificate_chain_file(context, aCertFile)!=1) ||
+              (SSL_CTX_use_PrivateKey_file(context, aKeyFile, SSL_FILETYPE_PEM)!=1)){
+                SSL_CTX_free(context);
+                context = NULL;
+            }
+        }
+
+        if(context){
+            /* SSLs that are still using the old one have their own
+             reference to it. */
+            SSL_CTX_free(server_context);
+            free(server_cert);
+            free(server_key);
+
+            server_context = context;
+            server_cert = malloc(strlen(aCertFile)+1);
+            server_key = malloc(strlen(aKeyFile)+1);
+            strcpy(server_cert, aCertFile);
+            strcpy(server_key, aKeyFile);
+        }
+    }
+
+    if(server_context && (strcmp(server_cert, aCertFile)==0))
+      ssl = SSL_new(server_context);
+
+    CRYPTO_THREAD_unlock(server_lock);
+
+    if(!ssl){
+        LogErrors("Could not accept TLS", NULL);
+        return eFailure;
+    }
+
+    SSL_set_accept_state(ssl);
+    GetTLS(aSocket);
+
+    return Begin(aSocket, ssl);
+}
+
+enum WSockErr Handshake_Socket(struct WSocket *aSocket){
+    enum WSockErr err;
+
+    if(!UsingTLS_Socket(aSocket))
+      return eSuccess;
+
+    CRYPTO_THREAD_write_lock(aSocket->tls->lock);
+    err = Handshake_l(aSocket);
+    CRYPTO_THREAD_unlock(aSocket->tls->lock);
+
+    return err;
+}
+
+int Resumed_Socket(struct WSocket *aSocket){
+    int resumed;
+
+    if(!UsingTLS_Socket(aSocket))
+      return 0;
+
+    CRYPTO_THREAD_read_lock(aSocket->tls->lock);
+    resumed = (aSocket->tls->state==eTLSReady) && SSL_session_reused(aSocket->tls->ssl);
+    CRYPTO_THREAD_unlock(aSocket->tls->lock);
+
+    return resumed;
+}
+
+struct WSockSession *GetSession_Socket(struct WSocket *aSocket){
+    SSL_SESSION *session = NULL;
+
+    if(!aSocket->tls)
+      return NULL;
+
+    CRYPTO_THREAD_read_lock(aSocket->tls->lock);
+    if(aSocket->tls->session && SSL_SESSION_is_resumable(aSocket->tls->session)){
+        session = aSocket->tls->session;
+        SSL_SESSION_up_ref(session);
+    }
+    CRYPTO_THREAD_unlock(aSocket->tls->lock);
+
+    return (struct WSockSession *)session;
+}
+
+void FreeSession_Socket(struct WSockSession *aSession){
+    SSL_SESSION_free((SSL_SESSION *)aSession);
+}
+
+enum WSockErr SetAuthority_Socket(const char *aCAFile){
+    SSL_CTX *const context = ClientContext();
+
+    if((!context) || (SSL_CTX_load_verify_locations(context, aCAFile, NULL)!=1)){
+        LogErrors("Could not load certificate authorities", NULL);
+        return eFailure;
+    }
+
+    return eSuccess;
+}
+
+int UsingTLS_Socket(struct WSocket *aSocket){
+    return (aSocket->tls!=NULL) && (aSocket->tls->ssl!=NULL);
+}
+
+enum WSockErr ReadTLS_Socket(struct WSocket *aSocket, char **aTo){
+    struct WSockTLS *const tls = aSocket->tls;
+    unsigned long length = 0;
+    enum WSockErr err;
+    char *to;
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    err = Handshake_l(aSocket);
+
+    if(err==eInProgress)
+      err = eSuccess;
+    else if(err==eSuccess){
+        while(1){
+            int r, error;
+
+            to = realloc(*aTo, length+TLS_READ_SIZE+1);
+            if(!to){
+                err = eFailure;
+                break;
+            }
+            *aTo = to;
+
+            ERR_clear_error();
+            r = SSL_read(tls->ssl, *aTo+length, TLS_READ_SIZE);
+
+            /* Like a plain read, only take what has already arrived. Going
+             on while the peer keeps writing could read without end. Once
+             OpenSSL holds nothing more, the socket will poll readable again
+             for the rest. */
+            if(r>0){
+                length+=r;
+                if(SSL_has_pending(tls->ssl))
+                  continue;
+                break;
+            }
+
+            error = SSL_get_error(tls->ssl, r);
+            if((error==SSL_ERROR_WANT_READ) || (error==SSL_ERROR_WANT_WRITE))
+              break;
+
+            if(error==SSL_ERROR_ZERO_RETURN)
+              tls->state = eTLSClosed;
+            else{
+                LogErrors("TLS read failed", tls->ssl);
+                tls->state = eTLSBroken;
+                err = eFailure;
+            }
+            break;
+        }
+    }
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    to = realloc(*aTo, length+1);
+    if(!to)
+      return eFailure;
+    *aTo = to;
+    (*aTo)[length] = '\0';
+
+    return err;
+}
+
+/* Keeps aData to be written once the handshake is done. The lock must be
+ held. */
+static enum WSockErr Hold_l(struct WSocket *aSocket, const char *aData, unsigned long aLength){
+    struct WSockTLS *const tls = aSocket->tls;
+    char *const held = realloc(tls->held, tls->held_length+aLength);
+
+    if(!held)
+      return eFailure;
+
+    memcpy(held+tls->held_length, aData, aLength);
+    tls->held = held;
+    tls->held_length+=aLength;
+    return eSuccess;
+}
+
+enum WSockErr WriteTLS_Socket(struct WSocket *aSocket, const char *aToWrite, unsigned long aLength){
+    struct WSockTLS *const tls = aSocket->tls;
+    enum WSockErr err;
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    err = Handshake_l(aSocket);
+
+    if(err==eInProgress)
+      err = Hold_l(aSocket, aToWrite, aLength);
+    else if(err==eSuccess)
+      err = WriteAll_l(aSocket, aToWrite, aLength);
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    return err;
+}
+
+enum WSockErr WriteSomeTLS_Socket(struct WSocket *aSocket, const char *aData,
+                                  unsigned long aLength, unsigned long *aWritten){
+    struct WSockTLS *const tls = aSocket->tls;
+    enum WSockErr err;
+
+    *aWritten = 0;
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    err = Handshake_l(aSocket);
+
+    if(err==eInProgress){
+        err = Hold_l(aSocket, aData, aLength);
+        if(err==eSuccess)
+          *aWritten = aLength;
+    }
+    else if(err==eSuccess){
+        while(*aWritten<aLength){
+            const unsigned long left = aLength-*aWritten;
+            int r, error;
+
+            ERR_clear_error();
+            r = SSL_write(tls->ssl, aData+*aWritten, (left>0x40000000ul)?0x40000000:(int)left);
+
+            if(r>0){
+                *aWritten+=r;
+                continue;
+            }
+
+            /* OpenSSL expects the same bytes to be offered again, which the
+             caller does, since it keeps everything that wasn't written. */
+            error = SSL_get_error(tls->ssl, r);
+            if((error==SSL_ERROR_WANT_READ) || (error==SSL_ERROR_WANT_WRITE))
+              break;
+
+            LogErrors("TLS write failed", tls->ssl);
+            tls->state = eTLSBroken;
+            err = eFailure;
+            break;
+        }
+    }
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    return err;
+}
+
+unsigned long LengthTLS_Socket(struct WSocket *aSocket, unsigned long aRawLength){
+    struct WSockTLS *const tls = aSocket->tls;
+    unsigned long length = 0;
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    if(Handshake_l(aSocket)==eSuccess){
+        length = SSL_pending(tls->ssl)+aRawLength;
+
+        /* Whole records that OpenSSL has read but not yet decrypted. */
+        if((length==0) && SSL_has_pending(tls->ssl))
+          length = 1;
+    }
+
+    CRYPTO_THREAD_unlock(tls->lock);
+
+    return length;
+}
+
+enum WSockErr StateTLS_Socket(struct WSocket *aSocket){
+    enum TLSState state;
+
+    CRYPTO_THREAD_read_lock(aSocket->tls->lock);
+    state = aSocket->tls->state;
+    CRYPTO_THREAD_unlock(aSocket->tls->lock);
+
+    switch(state){
+        case eTLSBroken:
+            return eFailure;
+        case eTLSClosed:
+            return eNotConnected;
+        default:
+        ;
+    }
+    return eConnected;
+}
+
+void CloseTLS_Socket(struct WSocket *aSocket){
+    struct WSockTLS *const tls = aSocket->tls;
+
+    CRYPTO_THREAD_write_lock(tls->lock);
+
+    if(tls->ssl){
+        /* Sends close_notify if the socket will take it, without waiting for
+         the other side's. */
+        if(tls->state==eTLSReady){
+            ERR_clear_error();
+            SSL_shutdown(tls->ssl);
+        }
+        SSL_free(tls->ssl);
+        tls->ssl = NULL;
+    }
+
+    tls->state = eTLSClosed;
+
+    free(tls->held);
+    tls->held = NULL;
+    tls->held_length = 0;
+
+    CRYPTO_THREAD_unlock(tls->lock);
+}
+
+void DestroyTLS_Socket(struct WSocket *aSocket){
+    struct WSockTLS *const tls = aSocket->tls;
+
+    CloseTLS_Socket(aSocket);
+
+    if(tls->session)
+      SSL_SESSION_free(tls->session);
+    CRYPTO_THREAD_lock_free(tls->lock);
+    free(tls);
+
+    aSocket->tls = NULL;
+}
+
+#else /* USE_OPENSSL */
+
+enum WSockErr StartTLS_Socket(struct WSocket *aSocket, const char *aServerName,
+                              struct WSockSession *aSession){
+    Message_Socket(eLogError, "TLS was asked for, but libfjnet was built without it");
+    return eNoTLS;
+}
+
+enum WSockErr AcceptTLS_Socket(struct WSocket *aSocket, const char *aCertFile,
+                               const char *aKeyFile){
+    return eNoTLS;
+}
+
+enum WSockErr Handshake_Socket(struct WSocket *aSocket){
+    return eSuccess;
+}
+
+int Resumed_Socket(struct WSocket *aSocket){
+    return 0;
+}
+
+struct WSockSession *GetSession_Socket(struct WSocket *aSocket){
+    return NULL;
+}
+
+void FreeSession_Socket(struct WSockSession *aSession){}
+
+enum WSockErr SetAuthority_Socket(const char *aCAFile){
+    return eNoTLS;
+}
+
+/* No socket ever gets a WSockTLS, so socket.c never calls the rest. */
+int UsingTLS_Socket(struct WSocket *aSocket){
+    return 0;
+}
+
+enum WSockErr ReadTLS_Socket(struct WSocket *aSocket, char **aTo){
+    return eNoTLS;
+}
+
+enum WSockErr WriteTLS_Socket(struct WSocket *aSocket, const char *aToWrite, unsigned long aLength){
+    return eNoTLS;
+}
+
+enum WSockErr WriteSomeTLS_Socket(struct WSocket *aSocket, const char *aData,
+                                  unsigned long aLength, unsigned long *aWritten){
+    return eNoTLS;
+}
+
+unsigned long LengthTLS_Socket(struct WSocket *aSocket, unsigned long aRawLength){
+    return aRawLength;
+}
+
+enum WSockErr StateTLS_Socket(struct WSocket *aSocket){
+    return eNoTLS;
+}
+
+void CloseTLS_Socket(struct WSocket *aSocket){}
+
+void DestroyTLS_Socket(struct WSocket *aSocket){}
+
+#endif /* USE_OPENSSL */
@@ -0,0 +1,827 @@
+#define _GNU_SOURCE
+#include "poll.h"
+#include "socket.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/poll.h>
+#include <sys/utsname.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define LIBFJNET_INTERNAL
+#include "socket_definition.h"
+
+/*  io_uring backend, for Linux. It uses the kernel interface directly rather
+    than liburing, whose header is not C89.
+
+    On Linux 6.0 or later, each socket in the set has a multishot recv that
+    takes buffers from a ring the set provides. Data is copied from there into
+    the socket's own WSockRing, and Read_Socket and Length_Socket read it from
+    there, so there is no FIONREAD or recv for every message. Writes are queued
+    on the WSockRing and sent by the ring. While a send is in flight, more
+    writes are added to the next one rather than each being sent alone.
+
+    Sockets using TLS still read and write through OpenSSL, and only use the
+    ring to wait for data, with a multishot poll. So does every socket if the
+    kernel cannot provide buffers. If there is no usable io_uring at all, the
+    set falls back to poll().
+
+    Only the thread calling PollSet waits on the ring, but any thread that
+    writes also collects whatever has completed, so sends keep moving when
+    nothing is polling.
+
+    Every send is linked to a timeout of FJNET_WRITE_DEADLINE, so a peer that
+    stops reading fails the socket rather than holding its output forever.
+
+    Sockets must be removed from the set before they are disconnected, since
+    the ring holds its own reference to them. Removing a socket throws away
+    anything it received that was not yet read. Anything still queued for it
+    keeps going out from the ring on a duplicate of its descriptor, for up to
+    FJNET_WRITE_DEADLINE more seconds, so RemoveFromSet never waits on the
+    other side.
+*/
+
+#define SQ_ENTRIES 256
+#define CQ_ENTRIES 4096
+
+#define BUFFER_GROUP 0
+#define BUFFER_COUNT 256
+#define BUFFER_SIZE 4096
+
+/* Kept in the low bits of each request's user_data, next to the WSockRing it
+ is for. WSockRings are allocated, so these bits are always free. A user_data
+ of 0 (a NOP or a cancel) needs nothing done. */
+enum RingOp {eRingNone, eRingReceive, eRingPoll, eRingSend, eRingOpMask = 7};
+
+struct WSockRing{
+    struct SocketSet *set;
+    /* NULL once removed from the set. It is freed when the kernel is done
+     with it, which may be later. */
+    struct WSocket *socket;
+    FJNET_SOCKET fd;
+    /* If data comes through the ring. Otherwise the ring only polls. */
+    int receive;
+    /* If the multishot recv or poll is outstanding. */
+    int armed;
+    /* Requests the kernel has for this WSockRing. */
+    unsigned ops;
+    /* eConnected until the other side hangs up or there is an error. */
+    enum WSockErr state;
+
+    /* Received but not read yet. */
+    char *in;
+    unsigned long in_length, in_capacity;
+
+    /* Written but not sent yet. */
+    char *out;
+    unsigned long out_length, out_capacity;
+
+    /* Being sent. */
+    char *sending;
+    unsigned long sending_length, sending_at, sending_capacity;
+    int send_in_flight;
+    /* For the timeout linked to the send in flight. The kernel reads it when
+     the send is submitted. */
+    struct __kernel_timespec send_timeout;
+
+    /* Set once removed, if what was queued is still being sent. fd is then
+     our own duplicate, closed by FreeEntry, and sending stops at
+     drain_deadline. */
+    int draining;
+    time_t drain_deadline;
+};
+
+struct SocketSet{
+    pthread_mutex_t mutex;
+
+    /* -1 if there is no io_uring, and poll() is used instead. */
+    int ring;
+
+    void *sq_map, *cq_map;
+    size_t sq_map_size, cq_map_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries, sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* NULL if the kernel cannot provide buffers. */
+    struct io_uring_buf_ring *buffers;
+    char *buffer_memory;
+    unsigned short buffer_tail;
+
+    struct WSockRing **entries;
+    unsigned num_entries;
+
+    /* How many times sockets have become readable since PollSet last
+     returned. */
+    int events;
+
+    /* Only used by the poll() fallback. */
+    int Pipe[2];
+    struct pollfd *pollfds;
+    unsigned pollfds_capacity;
+};
+
+static int Enter(int ring, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t size){
+    return syscall(__NR_io_uring_enter, ring, to_submit, min_complete, flags, arg, size);
+}
+
+static void *Append(char *to, unsigned long *length, unsigned long *capacity, const char *from, unsigned long n){
+    if(*length+n>*capacity){
+        unsigned long new_capacity = (*capacity)?(*capacity):BUFFER_SIZE;
+        while(*length+n>new_capacity)
+          new_capacity<<=1;
+        to = realloc(to, new_capacity);
+        if(!to)
+          return NULL;
+        *capacity = new_capacity;
+    }
+    memcpy(to+*length, from, n);
+    *length+=n;
+    return to;
+}
+
+/* Makes everything queued so far visible to the kernel, and returns how many
+ it has not taken yet. Must hold the mutex. */
+static unsigned Unsubmitted_l(struct SocketSet *set){
+    __atomic_store_n(set->sq_tail, set->sq_local_tail, __ATOMIC_RELEASE);
+    return set->sq_local_tail-__atomic_load_n(set->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Hands everything queued so far to the kernel. Must hold the mutex.
+
+ GETEVENTS with nothing to wait for also moves any completions that
+ overflowed back onto the completion queue. */
+static void Submit_l(struct SocketSet *set){
+    const unsigned to_submit = Unsubmitted_l(set);
+    int err;
+
+    if(!to_submit)
+      return;
+
+    do{
+        err = Enter(set->ring, to_submit, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }while((err<0) && (errno==EINTR));
+
+    if(err<0)
+      Message_Socket(eLogError, "io_uring_enter failed: %s", strerror(errno));
+}
+
+/* Returns a cleared SQE. Must hold the mutex. */
+static struct io_uring_sqe *GetSQE_l(struct SocketSet *set, struct WSockRing *entry, enum RingOp op){
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    if(set->sq_local_tail-__atomic_load_n(set->sq_head, __ATOMIC_ACQUIRE)>=set->sq_entries)
+      Submit_l(set);
+
+    index = set->sq_local_tail&*set->sq_mask;
+    sqe = set->sqes+index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->user_data = (__u64)(unsigned long)entry | op;
+
+    set->sq_array[index] = index;
+    set->sq_local_tail++;
+
+    if(entry)
+      entry->ops++;
+
+    return sqe;
+}
+
+static void Arm_l(struct WSockRing *entry){
+    struct io_uring_sqe *const sqe = GetSQE_l(entry->set, entry, entry->receive?eRingReceive:eRingPoll);
+
+    sqe->fd = entry->fd;
+    if(entry->receive){
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+    }
+    else{
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->poll32_events = POLLIN;
+    }
+
+    entry->armed = 1;
+}
+
+static void Cancel_l(struct WSockRing *entry, enum RingOp op){
+    struct io_uring_sqe *const sqe = GetSQE_l(entry->set, NULL, eRingNone);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (__u64)(unsigned long)entry | op;
+}
+
+static void Wake_l(struct SocketSet *set){
+    GetSQE_l(set, NULL, eRingNone)->opcode = IORING_OP_NOP;
+}
+
+/* Sends what is in sending, or else what is in out, with a timeout linked to
+ it. */
+static void Send_l(struct WSockRing *entry){
+    struct SocketSet *const set = entry->set;
+    struct io_uring_sqe *sqe;
+    long timeout = FJNET_WRITE_DEADLINE;
+
+    if(entry->sending_at==entry->sending_length){
+        char *const swap = entry->sending;
+        const unsigned long swap_capacity = entry->sending_capacity;
+
+        if(entry->out_length==0)
+          return;
+
+        entry->sending = entry->out;
+        entry->sending_capacity = entry->out_capacity;
+        entry->sending_length = entry->out_length;
+        entry->sending_at = 0;
+
+        entry->out = swap;
+        entry->out_capacity = swap_capacity;
+        entry->out_length = 0;
+    }
+
+    if(entry->draining){
+        timeout = entry->drain_deadline-time(NULL);
+        if(timeout<1)
+          timeout = 1;
+    }
+
+    /* The send and its timeout must reach the kernel together, or the link
+     is lost. */
+    if(set->sq_local_tail-__atomic_load_n(set->sq_head, __ATOMIC_ACQUIRE)+2>set->sq_entries)
+      Submit_l(set);
+
+    sqe = GetSQE_l(set, entry, eRingSend);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = entry->fd;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->addr = (__u64)(unsigned long)(entry->sending+entry->sending_at);
+    sqe->len = entry->sending_length-entry->sending_at;
+    sqe->msg_flags = MSG_NOSIGNAL;
+
+    entry->send_timeout.tv_sec = timeout;
+    entry->send_timeout.tv_nsec = 0;
+
+    sqe = GetSQE_l(set, NULL, eRingNone);
+    sqe->opcode = IORING_OP_LINK_TIMEOUT;
+    sqe->addr = (__u64)(unsigned long)&entry->send_timeout;
+    sqe->len = 1;
+
+    entry->send_in_flight = 1;
+}
+
+static void FreeEntry(struct WSockRing *entry){
+    if(entry->draining)
+      close(entry->fd);
+    free(entry->in);
+    free(entry->out);
+    free(entry->sending);
+    free(entry);
+}
+
+static void RecycleBuffer_l(struct SocketSet *set, unsigned short id){
+    struct io_uring_buf *const buffer = set->buffers->bufs+(set->buffer_tail&(BUFFER_COUNT-1));
+
+    buffer->addr = (__u64)(unsigned long)(set->buffer_memory+id*BUFFER_SIZE);
+    buffer->len = BUFFER_SIZE;
+    buffer->bid = id;
+
+    set->buffer_tail++;
+    __atomic_store_n(&set->buffers->tail, set->buffer_tail, __ATOMIC_RELEASE);
+}
+
+static void Complete_l(struct SocketSet *set, const struct io_uring_cqe *cqe){
+    struct WSockRing *const entry = (struct WSockRing *)(unsigned long)(cqe->user_data&~(__u64)eRingOpMask);
+    const enum RingOp op = (enum RingOp)(cqe->user_data&eRingOpMask);
+    const int more = (cqe->flags&IORING_CQE_F_MORE)!=0;
+
+    if(!entry){
+        assert(op==eRingNone);
+        return;
+    }
+
+    switch(op){
+        case eRingReceive:
+        if(cqe->flags&IORING_CQE_F_BUFFER){
+            const unsigned short id = cqe->flags>>IORING_CQE_BUFFER_SHIFT;
+            if(entry->socket && (cqe->res>0)){
+                char *const in = Append(entry->in, &entry->in_length, &entry->in_capacity,
+                  set->buffer_memory+id*BUFFER_SIZE, cqe->res);
+                if(in)
+                  entry->in = in;
+                else
+                  entry->state = eFailure;
+                set->events++;
+            }
+            RecycleBuffer_l(set, id);
+        }
+        /* Fall through, since the end of a multishot is the same for both. */
+        case eRingPoll:
+        if((op==eRingPoll) && entry->socket && (cqe->res>0))
+          set->events++;
+
+        if(more)
+          break;
+
+        entry->armed = 0;
+        entry->ops--;
+
+        if(!entry->socket)
+          break;
+
+        /* Out of buffers, or the kernel ended it for its own reasons. */
+        if((cqe->res>0) || (cqe->res==-ENOBUFS) || (cqe->res==-EOVERFLOW)){
+            Arm_l(entry);
+            break;
+        }
+
+        if(cqe->res==-ECANCELED)
+          break;
+
+        if(cqe->res==0)
+          entry->state = eNotConnected;
+        else{
+            Message_Socket(eLogError, "io_uring receive from %s failed: %s", entry->socket->hostname, strerror(-cqe->res));
+            entry->state = eFailure;
+        }
+        set->events++;
+        break;
+
+        case eRingSend:
+        entry->ops--;
+        entry->send_in_flight = 0;
+
+        if((!entry->socket) && (!entry->draining))
+          break;
+
+        if(cqe->res>=0)
+          entry->sending_at+=cqe->res;
+        else if((cqe->res!=-EAGAIN) && (cqe->res!=-EINTR)){
+            const char *const to = entry->socket?entry->socket->hostname:"a removed socket";
+            /* The linked timeout cancels the send. */
+            if(cqe->res==-ECANCELED)
+              Message_Socket(eLogError, "io_uring send to %s timed out", to);
+            else
+              Message_Socket(eLogError, "io_uring send to %s failed: %s", to, strerror(-cqe->res));
+            entry->state = eFailure;
+            entry->sending_at = entry->sending_length = entry->out_length = 0;
+            if(entry->socket)
+              set->events++;
+            break;
+        }
+
+        if(entry->socket || (time(NULL)<entry->drain_deadline))
+          Send_l(entry);
+        break;
+
+        default:
+        ;
+    }
+
+    if((!entry->socket) && (entry->ops==0))
+      FreeEntry(entry);
+}
+
+/* Handles everything that has completed. Must hold the mutex. */
+static void Reap_l(struct SocketSet *set){
+    unsigned head = *set->cq_head;
+    const unsigned tail = __atomic_load_n(set->cq_tail, __ATOMIC_ACQUIRE);
+
+    for(; head!=tail; head++)
+      Complete_l(set, set->cqes+(head&*set->cq_mask));
+
+    __atomic_store_n(set->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* Submits, first making sure that the thread in PollSet hears about anything
+ that was reaped by another thread since @p events was read. */
+static void SubmitFrom_l(struct SocketSet *set, int events){
+    if(set->events!=events)
+      Wake_l(set);
+    Submit_l(set);
+}
+
+/* Multishot recv needs Linux 6.0, and there is no feature flag for it. */
+static int HasMultishotReceive(void){
+    struct utsname name;
+    int major = 0;
+
+    if(uname(&name)!=0)
+      return 0;
+
+    sscanf(name.release, "%d", &major);
+    return major>=6;
+}
+
+static int SetupRing(struct SocketSet *set){
+    struct io_uring_params params;
+    struct io_uring_buf_reg registration;
+    unsigned short i;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = CQ_ENTRIES;
+
+    set->ring = syscall(__NR_io_uring_setup, SQ_ENTRIES, &params);
+    if(set->ring<0){
+        Message_Socket(eLogWarning, "io_uring is not available: %s. Using poll.", strerror(errno));
+        return 0;
+    }
+
+    if(!(params.features&IORING_FEAT_EXT_ARG) || !(params.features&IORING_FEAT_NODROP)){
+        Message_Socket(eLogWarning, "This kernel's io_uring is too old. Using poll.");
+        close(set->ring);
+        return 0;
+    }
+
+    set->sq_map_size = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+    set->cq_map_size = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+
+    if(params.features&IORING_FEAT_SINGLE_MMAP){
+        if(set->cq_map_size>set->sq_map_size)
+          set->sq_map_size = set->cq_map_size;
+        set->cq_map_size = 0;
+    }
+
+    set->sq_map = mmap(NULL, set->sq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, set->ring, IORING_OFF_SQ_RING);
+    set->cq_map = (set->cq_map_size==0)?set->sq_map:
+      mmap(NULL, set->cq_map_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, set->ring, IORING_OFF_CQ_RING);
+    set->sqes = mmap(NULL, params.sq_entries*sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, set->ring, IORING_OFF_SQES);
+
+    if((set->sq_map==MAP_FAILED) || (set->cq_map==MAP_FAILED) || (set->sqes==MAP_FAILED)){
+        Message_Socket(eLogError, "Could not map the io_uring: %s. Using poll.", strerror(errno));
+        close(set->ring);
+        return 0;
+    }
+
+    set->sq_head = (unsigned *)((char *)set->sq_map+params.sq_off.head);
+    set->sq_tail = (unsigned *)((char *)set->sq_map+params.sq_off.tail);
+    set->sq_mask = (unsigned *)((char *)set->sq_map+params.sq_off.ring_mask);
+    set->sq_array = (unsigned *)((char *)set->sq_map+params.sq_off.array);
+    set->sq_entries = params.sq_entries;
+    set->sq_local_tail = *set->sq_tail;
+
+    set->cq_head = (unsigned *)((char *)set->cq_map+params.cq_off.head);
+    set->cq_tail = (unsigned *)((char *)set->cq_map+params.cq_off.tail);
+    set->cq_mask = (unsigned *)((char *)set->cq_map+params.cq_off.ring_mask);
+    set->cqes = (struct io_uring_cqe *)((char *)set->cq_map+params.cq_off.cqes);
+
+    /* Provided buffers need 5.19, and multishot recv needs 6.0. Without
+     them, the ring just polls. */
+    if(!HasMultishotReceive())
+      return 1;
+
+    set->buffers = mmap(NULL, BUFFER_COUNT*sizeof(struct io_uring_buf), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(set->buffers==MAP_FAILED){
+        set->buffers = NULL;
+        return 1;
+    }
+
+    memset(&registration, 0, sizeof(struct io_uring_buf_reg));
+    registration.ring_addr = (__u64)(unsigned long)set->buffers;
+    registration.ring_entries = BUFFER_COUNT;
+    registration.bgid = BUFFER_GROUP;
+
+    if(syscall(__NR_io_uring_register, set->ring, IORING_REGISTER_PBUF_RING, &registration, 1)<0){
+        Message_Socket(eLogInfo, "io_uring can not provide buffers: %s. Polling with it instead.", strerror(errno));
+        munmap(set->buffers, BUFFER_COUNT*sizeof(struct io_uring_buf));
+        set->buffers = NULL;
+        return 1;
+    }
+
+    set->buffer_memory = malloc(BUFFER_COUNT*BUFFER_SIZE);
+    for(i = 0; i<BUFFER_COUNT; i++)
+      RecycleBuffer_l(set, i);
+
+    return 1;
+}
+
+struct SocketSet *GenerateSocketSet(struct WSocket **sockets, unsigned num_sockets){
+    unsigned i = 0;
+    struct SocketSet *set = calloc(1, sizeof(struct SocketSet));
+
+    pthread_mutex_init(&set->mutex, NULL);
+
+    if(!SetupRing(set)){
+        set->ring = -1;
+        pipe(set->Pipe);
+        fcntl(set->Pipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(set->Pipe[1], F_SETFL, O_NONBLOCK);
+    }
+
+    for(; i<num_sockets; i++)
+      AddToSet(sockets[i], set);
+
+    return set;
+}
+
+void FreeSocketSet(struct SocketSet *set){
+    unsigned i = 0;
+
+    if(set->ring>=0){
+        /* Closing the ring cancels everything still in it. Removed sockets
+         that were waiting on it are leaked. */
+        close(set->ring);
+        munmap(set->sqes, set->sq_entries*sizeof(struct io_uring_sqe));
+        if(set->cq_map!=set->sq_map)
+          munmap(set->cq_map, set->cq_map_size);
+        munmap(set->sq_map, set->sq_map_size);
+        if(set->buffers)
+          munmap(set->buffers, BUFFER_COUNT*sizeof(struct io_uring_buf));
+        free(set->buffer_memory);
+    }
+    else{
+        close(set->Pipe[0]);
+        close(set->Pipe[1]);
+        free(set->pollfds);
+    }
+
+    for(; i<set->num_entries; i++){
+        set->entries[i]->socket->ring = NULL;
+        FreeEntry(set->entries[i]);
+    }
+    free(set->entries);
+
+    pthread_mutex_destroy(&set->mutex);
+    free(set);
+}
+
+
+void PokeSet(struct SocketSet *set){
+    if(set->ring<0){
+        char r = '\a';
+        write(set->Pipe[1], &r, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&set->mutex);
+    Wake_l(set);
+    Submit_l(set);
+    pthread_mutex_unlock(&set->mutex);
+}
+
+
+void AddToSet(struct WSocket *socket, struct SocketSet *set){
+    struct WSockRing *const entry = calloc(1, sizeof(struct WSockRing));
+
+    assert(socket->ring==NULL);
+
+    entry->set = set;
+    entry->socket = socket;
+    entry->fd = socket->sock;
+    entry->state = eConnected;
+    /* OpenSSL must read the socket itself. */
+    entry->receive = (set->buffers!=NULL) && !UsingTLS_Socket(socket);
+
+    pthread_mutex_lock(&set->mutex);
+
+    set->entries = realloc(set->entries, (set->num_entries+1)*sizeof(struct WSockRing *));
+    set->entries[set->num_entries++] = entry;
+    socket->ring = entry;
+
+    if(set->ring>=0){
+        Arm_l(entry);
+        Submit_l(set);
+    }
+
+    pthread_mutex_unlock(&set->mutex);
+
+    if(set->ring<0)
+      PokeSet(set);
+}
+
+void RemoveFromSet(struct WSocket *socket, struct SocketSet *set){
+    struct WSockRing *const entry = socket->ring;
+    unsigned i = 0;
+    int events, fd = -1;
+
+    assert(entry!=NULL);
+    assert(entry->set==set);
+
+    pthread_mutex_lock(&set->mutex);
+
+    events = set->events;
+    Reap_l(set);
+
+    for(; i<set->num_entries; i++){
+        if(set->entries[i]==entry){
+            set->entries[i] = set->entries[--set->num_entries];
+            break;
+        }
+    }
+
+    socket->ring = NULL;
+    entry->socket = NULL;
+
+    if(set->ring>=0){
+        if(entry->armed)
+          Cancel_l(entry, entry->receive?eRingReceive:eRingPoll);
+
+        /* Anything already written is left to the ring to send, on a
+         descriptor of its own, since the caller is about to close this one.
+         The caller may hold locks that the rest of the program needs, so
+         this must not wait. */
+        if((entry->state==eConnected) && (entry->send_in_flight || entry->out_length))
+          fd = dup(socket->sock);
+
+        if(fd>=0){
+            entry->fd = fd;
+            entry->draining = 1;
+            entry->drain_deadline = time(NULL)+FJNET_WRITE_DEADLINE;
+            if(!entry->send_in_flight)
+              Send_l(entry);
+        }
+        else if(entry->send_in_flight)
+          Cancel_l(entry, eRingSend);
+
+        SubmitFrom_l(set, events);
+    }
+
+    if(entry->ops==0)
+      FreeEntry(entry);
+
+    pthread_mutex_unlock(&set->mutex);
+
+    if(set->ring<0)
+      PokeSet(set);
+}
+
+void RemoveFromSetAndClose(struct WSocket *socket, struct SocketSet *set){
+    RemoveFromSet(socket, set);
+
+    Disconnect_Socket(socket);
+}
+
+
+int IsPartOfSet(struct WSocket *socket, struct SocketSet *set){
+    return (socket->ring!=NULL) && (socket->ring->set==set);
+}
+
+
+static int PollFallback(struct SocketSet *set, unsigned ms_timeout){
+    unsigned i, n;
+    int r;
+
+    pthread_mutex_lock(&set->mutex);
+
+    n = set->num_entries+1;
+    if(n>set->pollfds_capacity){
+        set->pollfds = realloc(set->pollfds, n*sizeof(struct pollfd));
+        set->pollfds_capacity = n;
+    }
+
+    set->pollfds[0].fd = set->Pipe[0];
+    set->pollfds[0].events = POLLIN;
+    for(i = 1; i<n; i++){
+        set->pollfds[i].fd = set->entries[i-1]->fd;
+        set->pollfds[i].events = POLLIN;
+    }
+
+    pthread_mutex_unlock(&set->mutex);
+
+    r = poll(set->pollfds, n, (ms_timeout==0)?-1:(int)ms_timeout);
+
+    if((r>0) && (set->pollfds[0].revents&POLLIN)){
+        char buffer[0x10];
+        read(set->Pipe[0], buffer, sizeof(buffer));
+        r--;
+    }
+
+    return (r<0)?0:r;
+}
+
+int PollSet(enum WSockType t, struct SocketSet *set, unsigned ms_timeout){
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec timeout;
+    unsigned to_submit;
+    int n;
+
+    assert(t==eRead);
+
+    if(set->ring<0)
+      return PollFallback(set, ms_timeout);
+
+    pthread_mutex_lock(&set->mutex);
+
+    Reap_l(set);
+
+    if(set->events==0){
+        /* Anything queued goes in with the wait, in one system call. If
+         another thread submits it first, the kernel just takes less. */
+        to_submit = Unsubmitted_l(set);
+
+        pthread_mutex_unlock(&set->mutex);
+
+        memset(&arg, 0, sizeof(struct io_uring_getevents_arg));
+        if(ms_timeout!=0){
+            timeout.tv_sec = ms_timeout/1000;
+            timeout.tv_nsec = (ms_timeout%1000)*1000000;
+            arg.ts = (__u64)(unsigned long)&timeout;
+        }
+
+        Enter(set->ring, to_submit, 1, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(struct io_uring_getevents_arg));
+
+        pthread_mutex_lock(&set->mutex);
+
+        Reap_l(set);
+    }
+
+    n = set->events;
+    set->events = 0;
+
+    pthread_mutex_unlock(&set->mutex);
+
+    return n;
+}
+
+
+int UsingRing_Socket(struct WSocket *aSocket){
+    return (aSocket->ring!=NULL) && aSocket->ring->receive;
+}
+
+enum WSockErr ReadRing_Socket(struct WSocket *aSocket, char **aTo){
+    struct WSockRing *const entry = aSocket->ring;
+    char *to;
+
+    pthread_mutex_lock(&entry->set->mutex);
+
+    to = realloc(*aTo, entry->in_length+1);
+    if(to){
+        memcpy(to, entry->in, entry->in_length);
+        to[entry->in_length] = '\0';
+        entry->in_length = 0;
+        *aTo = to;
+    }
+
+    pthread_mutex_unlock(&entry->set->mutex);
+
+    return to?eSuccess:eFailure;
+}
+
+enum WSockErr WriteRing_Socket(struct WSocket *aSocket, const char *aToWrite, unsigned long aLength){
+    struct WSockRing *const entry = aSocket->ring;
+    struct SocketSet *const set = entry->set;
+    enum WSockErr err = eSuccess;
+    int events;
+
+    pthread_mutex_lock(&set->mutex);
+
+    /* A send that has finished may have more waiting behind it. */
+    events = set->events;
+    Reap_l(set);
+
+    if(entry->state!=eConnected)
+      err = entry->state;
+    else{
+        char *const out = Append(entry->out, &entry->out_length, &entry->out_capacity, aToWrite, aLength);
+        if(!out)
+          err = eFailure;
+        else{
+            entry->out = out;
+            /* Otherwise, it goes out with the next one. */
+            if(!entry->send_in_flight)
+              Send_l(entry);
+        }
+    }
+
+    SubmitFrom_l(set, events);
+
+    pthread_mutex_unlock(&set->mutex);
+
+    return err;
+}
+
+unsigned long LengthRing_Socket(struct WSocket *aSocket){
+    unsigned long length;
+
+    pthread_mutex_lock(&aSocket->ring->set->mutex);
+    length = aSocket->ring->in_length;
+    pthread_mutex_unlock(&aSocket->ring->set->mutex);
+
+    return length;
+}
+
+enum WSockErr StateRing_Socket(struct WSocket *aSocket){
+    enum WSockErr state;
+
+    pthread_mutex_lock(&aSocket->ring->set->mutex);
+    /* What was received before a hang up can still be read. */
+    state = (aSocket->ring->in_length!=0)?eConnected:aSocket->ring->state;
+    pthread_mutex_unlock(&aSocket->ring->set->mutex);
+
+    return state;
+}
@@ -0,0 +1,51 @@
+#include "alloccount.h"
+#include <stdlib.h>
+#include <string.h>
+
+static struct AllocCount counter = {0, 0};
+
+void AllocCount_Get(struct AllocCount *to){
+    memcpy(to, &counter, sizeof(struct AllocCount));
+}
+
+#ifdef __GLIBC__
+
+/* glibc exports its allocator under these names so that it can be wrapped. */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void  __libc_free(void *);
+
+int AllocCount_Available(void){
+    return 1;
+}
+
+void *malloc(size_t size){
+    counter.allocations++;
+    counter.bytes+=size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size){
+    counter.allocations++;
+    counter.bytes+=n*size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size){
+    counter.allocations++;
+    counter.bytes+=size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr){
+    __libc_free(ptr);
+}
+
+#else
+
+int AllocCount_Available(void){
+    return 0;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#pragma once
+
+/* Counts every heap allocation made by the process, including those made by
+ libfjirc, libfjcsv and operator new. This works by replacing malloc and
+ friends, and is only available with glibc. Elsewhere AllocCount_Available
+ returns 0 and the counters never move.
+
+ The counters are not atomic. Only read them from single threaded code.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct AllocCount {
+    unsigned long allocations;
+    unsigned long bytes;
+};
+
+int  AllocCount_Available(void);
+void AllocCount_Get(struct AllocCount *to);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,743 @@
+//! @file
+//! @brief yyybench, microbenchmarks for the parser and message dispatch.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Reports nanoseconds, heap allocations and heap bytes per operation for the
+//! hot paths of the client.
+//!
+//! Usage:
+//!   yyybench [--filter TEXT] [--time SECONDS] [--json FILE]
+//!
+//! Anything the benchmarked code prints goes to stdout, and the report goes to
+//! stderr, so run with stdout redirected to /dev/null.
+
+#include "alloccount.h"
+#include "reciever.hpp"
+#include "message.hpp"
+#include "intern.hpp"
+#include "highlight.hpp"
+#include "parse.h"
+#include "tags.h"
+#include "message.h"
+#include "csv.h"
+#include "state.h"
+#include "channel.h"
+#include "handlemessage.h"
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Kashyyyk {
+namespace Tools {
+
+//! A realistic mix of what a busy network sends.
+static const char *const line_mix[] = {
+    ":nick!~user@host.example.com PRIVMSG #chan0 :hello there, how is everyone doing today?\r\n",
+    ":other!~other@198.51.100.7 PRIVMSG #chan1 :nick: did you see the release notes?\r\n",
+    ":someone!~some@gateway/web/irccloud.com/x-abcdef JOIN #chan2\r\n",
+    ":leaver!~leave@host.example.net PART #chan0 :Leaving\r\n",
+    ":quitter!~quit@203.0.113.44 QUIT :Ping timeout: 240 seconds\r\n",
+    ":renamed!~re@host.example.org NICK :renamed_\r\n",
+    "PING :irc.example.net\r\n",
+    ":irc.example.net NOTICE * :*** Looking up your hostname...\r\n",
+    ":irc.example.net 372 nick :- Welcome to the network. Please be excellent to each other.\r\n",
+    ":irc.example.net 353 nick = #chan0 :@op +voiced alice bob carol dave erin frank grace heidi ivan judy\r\n",
+    ":irc.example.net 366 nick #chan0 :End of /NAMES list.\r\n",
+    ":irc.example.net 332 nick #chan1 :The topic of the channel is long enough to be realistic\r\n",
+    ":irc.example.net 005 nick CHANTYPES=# PREFIX=(ov)@+ NETWORK=Example :are supported\r\n",
+    ":chatty!~chat@host.example.com PRIVMSG #chan3 :another message that goes on for a little while\r\n",
+    ":chatty!~chat@host.example.com PRIVMSG #chan3 :and another one\r\n",
+    ":bot!~bot@services.example.net NOTICE nick :You are now identified\r\n",
+};
+
+static const unsigned line_mix_size = sizeof(line_mix)/sizeof(line_mix[0]);
+
+//! A PRIVMSG as sent by a server with message-tags, server-time and
+//! account-tag enabled.
+static const char tagged_line[] =
+    "@account=chatty;batch=yXNAbvnRHTRBv;msgid=63E1033A051D4B41B1AB1FA3CF4B243E;"
+    "time=2011-10-19T16:40:51.620Z;+draft/reply=a6d2d4e5f8a1b3c7;+example.com/client=Kashyyyk\\s0.1 "
+    ":chatty!~chat@host.example.com PRIVMSG #chan3 :another message that goes on for a little while\r\n";
+
+
+//! @brief Result of a single benchmark.
+struct BenchResult {
+    std::string name;
+    unsigned long long ops;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_op;
+};
+
+
+//! @brief Runs @p f, which performs @p ops_per_call operations, until at least
+//! @p min_seconds have elapsed.
+static BenchResult RunBench(const std::string &name, unsigned long ops_per_call,
+    double min_seconds, const std::function<void()> &f){
+
+    // Warm up caches and any lazily initialized state.
+    f();
+
+    struct AllocCount before, after;
+    unsigned long long calls = 0;
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point now = start;
+    const std::chrono::duration<double> limit(min_seconds);
+
+    AllocCount_Get(&before);
+
+    do{
+        for(int i = 0; i<16; i++)
+            f();
+        calls+=16;
+        now = std::chrono::steady_clock::now();
+    }while((now-start)<limit);
+
+    AllocCount_Get(&after);
+
+    const double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now-start).count();
+    const double ops = calls*ops_per_call;
+
+    return {name, (unsigned long long)ops, ns/ops,
+        (after.allocations-before.allocations)/ops,
+        (after.bytes-before.bytes)/ops};
+}
+
+
+static void ParseAll(const char *input){
+    struct IRC_ParseState *state = IRC_InitParse(input);
+    struct IRC_Message *msg = IRC_ConsumeParse(state);
+
+    while((msg!=nullptr) || (IRC_GetParseStatus(state)==IRC_badMessage)){
+        if(msg!=nullptr)
+            IRC_FreeMessage(msg);
+        msg = IRC_ConsumeParse(state);
+    }
+
+    IRC_DestroyParseState(state);
+}
+
+
+static std::vector<IRC_Message *> ParseToVector(const char *input){
+    std::vector<IRC_Message *> messages;
+    struct IRC_ParseState *state = IRC_InitParse(input);
+    struct IRC_Message *msg = IRC_ConsumeParse(state);
+
+    while((msg!=nullptr) || (IRC_GetParseStatus(state)==IRC_badMessage)){
+        if(msg!=nullptr)
+            messages.push_back(msg);
+        msg = IRC_ConsumeParse(state);
+    }
+
+    IRC_DestroyParseState(state);
+    return messages;
+}
+
+
+//! Mirrors Kashyyyk::User.
+struct BenchUser {
+    Interned nick;
+    std::string mode;
+};
+
+
+//! @brief Stand in for Channel.
+//!
+//! Channel builds FLTK widgets on construction, which needs a display, so the
+//! list operations from Channel::AddUser_l and Channel::RemoveUser_l are
+//! reproduced here without the widget updates.
+class BenchChannel : public TypedReciever<void> {
+public:
+    InternTable &names;
+    std::string name;
+    Interned key;
+    std::list<BenchUser> Users;
+    unsigned long long seen;
+
+    BenchChannel(InternTable &t, const std::string &n)
+      : TypedReciever<void>(nullptr)
+      , names(t)
+      , name(n)
+      , key(t.Intern(n))
+      , seen(0){}
+
+    void SendMessage(IRC_Message *msg) override {}
+
+    void AddHandler(MessageHandler *h){
+        Handlers.push_back(std::unique_ptr<MessageHandler>(h));
+    }
+
+    void AddUser_l(const char *user){
+        const unsigned long prefix = strspn(user, "~&@%+");
+        Users.push_back({names.Intern(user+prefix), std::string(user, prefix)});
+    }
+
+    void RemoveUser_l(const char *user_c){
+
+        const Interned nick = names.Find(user_c);
+        if(!nick)
+            return;
+
+        std::list<BenchUser>::iterator iter = Users.begin();
+        while(iter!=Users.end()){
+            if(iter->nick==nick){
+                Users.erase(iter);
+                break;
+            }
+            iter++;
+        }
+    }
+
+};
+
+
+class Count_Handler : public MessageHandler {
+    BenchChannel *channel;
+public:
+    Count_Handler(BenchChannel *c) : channel(c){}
+    bool HandleMessage(IRC_Message *msg) override {
+        channel->seen++;
+        return false;
+    }
+};
+
+
+//! @brief Stand in for Server, with the same handler set in the same order.
+class BenchServer : public TypedReciever<void> {
+public:
+    typedef std::list<std::unique_ptr<BenchChannel> > ChannelList;
+    InternTable names;
+    //! Same as Server::members
+    std::unordered_map<const IRC_Interned *, std::vector<BenchChannel *> > members;
+    ChannelList channels;
+
+    BenchServer()
+      : TypedReciever<void>(nullptr){}
+
+    void SendMessage(IRC_Message *msg) override {
+        char *str = IRC_MessageToString(msg);
+        free(str);
+    }
+
+    void AddHandler(MessageHandler *h){
+        Handlers.push_back(std::unique_ptr<MessageHandler>(h));
+    }
+
+    class find_channel {
+        const IRC_Interned *n;
+    public:
+        find_channel(const Interned &s) : n(s.Handle()){}
+        bool operator () (const std::unique_ptr<BenchChannel> &c){
+            return c->key.Handle()==n;
+        }
+    };
+
+    BenchChannel *FindChannel_l(const char *name){
+        const Interned key = names.Find(name);
+        if(!key)
+            return nullptr;
+
+        ChannelList::const_iterator iter = std::find_if(channels.cbegin(), channels.cend(), find_channel(key));
+        return (iter==channels.cend())?nullptr:iter->get();
+    }
+
+};
+
+
+class BenchPing_Handler : public MessageHandler {
+    BenchServer *server;
+public:
+    BenchPing_Handler(BenchServer *s) : server(s){}
+    bool HandleMessage(IRC_Message *msg) override {
+        if(msg->type==IRC_ping){
+            IRC_Message *pong = IRC_CreatePongFromPing(msg);
+            server->SendMessage(pong);
+            IRC_FreeMessage(pong);
+        }
+        return false;
+    }
+};
+
+
+//! Same as ServerMessage::ChannelChecker_Handler
+template<IRC_messageType type, int n = 0>
+class BenchChannelChecker_Handler : public MessageHandler {
+    BenchServer *server;
+public:
+    BenchChannelChecker_Handler(BenchServer *s) : server(s){}
+    bool HandleMessage(IRC_Message *msg) override {
+        if( (msg->type==type) && (msg->num_parameters>n)){
+
+            BenchChannel *channel = server->FindChannel_l(msg->parameters[n]);
+            if(channel!=nullptr){
+                channel->GiveMessage(msg);
+            }
+        }
+        return false;
+    }
+};
+
+
+//! Same as ServerMessage::ServerToAllChannels_Handler
+template<IRC_messageType type>
+class BenchToAllChannels_Handler : public MessageHandler {
+    BenchServer *server;
+public:
+    BenchToAllChannels_Handler(BenchServer *s) : server(s){}
+    bool HandleMessage(IRC_Message *msg) override {
+        if(msg->type==type) {
+            for(BenchServer::ChannelList::const_iterator iter = server->channels.cbegin(); iter!=server->channels.cend(); iter++){
+                iter->get()->GiveMessage(msg);
+            }
+        }
+        return false;
+    }
+};
+
+
+//! Same as ServerMessage::Quit_Handler and ServerMessage::Nick_Handler, which
+//! only go to the Channels that the nick is in.
+template<IRC_messageType type>
+class BenchMember_Handler : public MessageHandler {
+    BenchServer *server;
+    from_reader r;
+public:
+    BenchMember_Handler(BenchServer *s) : server(s){}
+    bool HandleMessage(IRC_Message *msg) override {
+        if((msg->type!=type) || (msg->from==nullptr))
+            return false;
+
+        const Interned nick = server->names.Find(r(msg));
+        r.Reset();
+        if(!nick)
+            return false;
+
+        std::unordered_map<const IRC_Interned *, std::vector<BenchChannel *> >::const_iterator iter = server->members.find(nick.Handle());
+        if(iter==server->members.cend())
+            return false;
+
+        for(std::vector<BenchChannel *>::const_iterator i = iter->second.cbegin(); i!=iter->second.cend(); i++)
+            (*i)->GiveMessage(msg);
+
+        return false;
+    }
+};
+
+
+static void SetupServer(BenchServer &server){
+
+    for(int i = 0; i<8; i++){
+        BenchChannel *channel = new BenchChannel(server.names, std::string("#chan") + std::to_string(i));
+        channel->AddHandler(new Count_Handler(channel));
+        server.channels.push_back(std::unique_ptr<BenchChannel>(channel));
+
+        // The QUIT and NICK in line_mix are from users in two of the Channels.
+        if(i<2){
+            static const char *const in_mix[] = {"quitter", "renamed"};
+            for(unsigned e = 0; e<2; e++){
+                channel->AddUser_l(in_mix[e]);
+                server.members[channel->Users.back().nick.Handle()].push_back(channel);
+            }
+        }
+    }
+
+    server.AddHandler(new BenchPing_Handler(&server));
+    server.AddHandler(new Debug_Handler());
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_join>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_part>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_topic>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_privmsg, 0>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_topic_num, 1>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_no_topic_num, 1>(&server));
+    server.AddHandler(new BenchChannelChecker_Handler<IRC_namelist_num, 2>(&server));
+    server.AddHandler(new BenchMember_Handler<IRC_quit>(&server));
+    server.AddHandler(new BenchMember_Handler<IRC_nick>(&server));
+    server.AddHandler(new BenchToAllChannels_Handler<IRC_notice>(&server));
+
+}
+
+
+static std::string NamesPayload(unsigned n){
+    std::string payload;
+    for(unsigned i = 0; i<n; i++){
+        if(i!=0)
+            payload+=' ';
+        if(i%50==0)
+            payload+='@';
+        payload+="user" + std::to_string(i);
+    }
+    return payload;
+}
+
+
+//! @brief An IRC_State with @p num_channels channels of @p users_per_channel
+//! users each.
+//!
+//! The nicks overlap so that each one is in about four channels, as regulars on
+//! a network tend to be.
+class BenchState {
+public:
+    IRC_State state;
+    std::vector<IRC_Channel> channels;
+    std::vector<IRC_ChannelHolder> holders;
+    unsigned num_nicks;
+
+    BenchState(unsigned num_channels, unsigned users_per_channel)
+      : channels(num_channels)
+      , holders(num_channels)
+      , num_nicks(num_channels*users_per_channel/4){
+
+        IRC_InitState(&state, "irc.example.net");
+
+        for(unsigned c = 0; c<num_channels; c++){
+            IRC_InitChannel(&channels[c], "#bench", &state);
+
+            memset(&holders[c], 0, sizeof(IRC_ChannelHolder));
+            holders[c].channel = &channels[c];
+            holders[c].next = &holders[(c+1)%num_channels];
+            holders[c].prev = &holders[(c+num_channels-1)%num_channels];
+        }
+        state.channels = &holders.front();
+
+        for(unsigned c = 0; c<num_channels; c++)
+            for(unsigned k = 0; k<users_per_channel; k++)
+                Join(c, ("user" + std::to_string((c*users_per_channel+k)%num_nicks)).c_str());
+    }
+
+    ~BenchState(){
+        for(std::vector<IRC_Channel>::iterator c = channels.begin(); c!=channels.end(); c++)
+            while(c->users)
+                IRC_ChannelRemoveUserR(&*c, c->users);
+        IRC_CloseState(&state);
+    }
+
+    //! The channel takes ownership of the user and its name.
+    void Join(unsigned channel, const char *nick){
+        IRC_allocator alloc;
+        IRC_GetAllocators(&alloc, NULL);
+
+        IRC_User *user = static_cast<IRC_User *>(alloc(sizeof(IRC_User)));
+        user->name = IRC_Strdup(nick);
+        user->server = nullptr;
+        user->mode = nullptr;
+        IRC_ChannelAddUser(&channels[channel], user);
+    }
+};
+
+
+static void Report(const std::vector<BenchResult> &results, FILE *json){
+
+    const bool counted = AllocCount_Available()!=0;
+
+    fprintf(stderr, "%-32s %14s %12s %12s %12s\n", "benchmark", "ops", "ns/op", "allocs/op", "bytes/op");
+    for(std::vector<BenchResult>::const_iterator iter = results.begin(); iter!=results.end(); iter++){
+        fprintf(stderr, "%-32s %14llu %12.1f", iter->name.c_str(), iter->ops, iter->ns_per_op);
+        if(counted)
+            fprintf(stderr, " %12.2f %12.1f\n", iter->allocs_per_op, iter->bytes_per_op);
+        else
+            fprintf(stderr, " %12s %12s\n", "-", "-");
+    }
+
+    if(!counted)
+        fputs("Allocation counting is not available on this platform.\n", stderr);
+
+    if(!json)
+        return;
+
+    fputs("{\"benchmarks\":[", json);
+    for(std::vector<BenchResult>::const_iterator iter = results.begin(); iter!=results.end(); iter++){
+        if(iter!=results.begin())
+            fputc(',', json);
+        fprintf(json, "{\"name\":\"%s\",\"ops\":%llu,\"ns_per_op\":%f,", iter->name.c_str(), iter->ops, iter->ns_per_op);
+        if(counted)
+            fprintf(json, "\"allocs_per_op\":%f,\"bytes_per_op\":%f}", iter->allocs_per_op, iter->bytes_per_op);
+        else
+            fputs("\"allocs_per_op\":null,\"bytes_per_op\":null}", json);
+    }
+    fputs("]}\n", json);
+
+}
+
+}
+}
+
+
+int main(int argc, char *argv[]){
+
+    using namespace Kashyyyk;
+    using namespace Kashyyyk::Tools;
+
+    const char *filter = "";
+    const char *json_path = nullptr;
+    double min_seconds = 0.25;
+
+    for(int i = 1; i<argc; i++){
+        if(i+1>=argc){
+            fprintf(stderr, "Usage: %s [--filter TEXT] [--time SECONDS] [--json FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        if(strcmp(argv[i], "--filter")==0)
+            filter = argv[++i];
+        else if(strcmp(argv[i], "--time")==0)
+            min_seconds = atof(argv[++i]);
+        else if(strcmp(argv[i], "--json")==0)
+            json_path = argv[++i];
+        else{
+            fprintf(stderr, "Usage: %s [--filter TEXT] [--time SECONDS] [--json FILE]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    const std::function<bool(const char *)> wanted = [filter](const char *name){
+        return strstr(name, filter)!=nullptr;
+    };
+
+    std::string lines;
+    for(unsigned i = 0; i<line_mix_size; i++)
+        lines+=line_mix[i];
+
+    if(wanted("parse_line_mix")){
+        results.push_back(RunBench("parse_line_mix", line_mix_size, min_seconds, [&lines](){
+            ParseAll(lines.c_str());
+        }));
+    }
+
+    if(wanted("parse_tagged_line")){
+        results.push_back(RunBench("parse_tagged_line", 1, min_seconds, [](){
+            ParseAll(tagged_line);
+        }));
+    }
+
+    if(wanted("get_tag")){
+        std::vector<IRC_Message *> messages = ParseToVector(tagged_line);
+        IRC_Message *msg = messages.front();
+        results.push_back(RunBench("get_tag", 2, min_seconds, [msg](){
+            unsigned long seconds;
+            unsigned milliseconds;
+            free(IRC_GetTag(msg, "msgid"));
+            IRC_GetTagTime(msg, &seconds, &milliseconds);
+        }));
+        std::for_each(messages.begin(), messages.end(), IRC_FreeMessage);
+    }
+
+    if(wanted("message_to_string")){
+        IRC_Message *msg = IRC_CreatePrivateMessage("#chan0", "hello there, how is everyone doing today?");
+        msg = IRC_SetMessageFrom(msg, "nick!~user@host.example.com");
+        results.push_back(RunBench("message_to_string", 1, min_seconds, [msg](){
+            free(IRC_MessageToString(msg));
+        }));
+        IRC_FreeMessage(msg);
+    }
+
+    if(wanted("get_token_enum")){
+        static const char *const tokens[] = {"PRIVMSG", "JOIN", "PING", "NOTICE", "353", "366", "473", "005"};
+        const unsigned num_tokens = sizeof(tokens)/sizeof(tokens[0]);
+        results.push_back(RunBench("get_token_enum", num_tokens, min_seconds, [num_tokens](){
+            volatile int sum = 0;
+            for(unsigned i = 0; i<num_tokens; i++)
+                sum+=IRC_GetTokenEnum(tokens[i]);
+        }));
+    }
+
+    if(wanted("dispatch_server_handlers")){
+        BenchServer server;
+        SetupServer(server);
+        std::vector<IRC_Message *> messages = ParseToVector(lines.c_str());
+
+        results.push_back(RunBench("dispatch_server_handlers", messages.size(), min_seconds, [&server, &messages](){
+            for(std::vector<IRC_Message *>::iterator iter = messages.begin(); iter!=messages.end(); iter++)
+                server.GiveMessage(*iter);
+        }));
+
+        std::for_each(messages.begin(), messages.end(), IRC_FreeMessage);
+    }
+
+    static const unsigned user_counts[] = {100, 1000, 10000};
+    for(unsigned i = 0; i<sizeof(user_counts)/sizeof(user_counts[0]); i++){
+        const unsigned n = user_counts[i];
+        const std::string name = "channel_add_remove_user/" + std::to_string(n);
+        if(!wanted(name.c_str()))
+            continue;
+
+        InternTable names;
+        BenchChannel channel(names, "#chan0");
+        for(unsigned e = 0; e<n; e++)
+            channel.AddUser_l((((e%50==0)?"@user":"user") + std::to_string(e)).c_str());
+
+        // Remove and re-add users spread across the list, so the size stays
+        // the same and the average scan length is realistic.
+        unsigned at = 0;
+        results.push_back(RunBench(name, 1, min_seconds, [&channel, &at, n](){
+            at = (at+7919)%n;
+            const std::string user = "user" + std::to_string(at);
+            channel.RemoveUser_l(user.c_str());
+            channel.AddUser_l(user.c_str());
+        }));
+    }
+
+    if(wanted("intern_find")){
+        InternTable names;
+        std::vector<Interned> held;
+        std::vector<std::string> nicks;
+        for(unsigned e = 0; e<10000; e++){
+            nicks.push_back("User" + std::to_string(e));
+            held.push_back(names.Intern(nicks.back()));
+        }
+
+        // Lookups in a different case, as a server would send them.
+        std::transform(nicks.begin(), nicks.end(), nicks.begin(), [](std::string s){
+            std::transform(s.begin(), s.end(), s.begin(), tolower);
+            return s;
+        });
+
+        unsigned at = 0;
+        results.push_back(RunBench("intern_find", 1, min_seconds, [&names, &nicks, &at](){
+            at = (at+7919)%nicks.size();
+            names.Find(nicks[at]);
+        }));
+    }
+
+    // One pass over each line, however many words there are.
+    static const unsigned word_counts[] = {1, 8, 64};
+    for(unsigned i = 0; i<sizeof(word_counts)/sizeof(word_counts[0]); i++){
+        const unsigned n = word_counts[i];
+        const std::string name = "highlight_scan/" + std::to_string(n);
+        if(!wanted(name.c_str()))
+            continue;
+
+        std::vector<std::string> words(1, "Kashyyyk");
+        for(unsigned e = 1; e<n; e++)
+            words.push_back("word" + std::to_string(e) + ((e%4==0)?"*":""));
+
+        Highlighter highlighter;
+        highlighter.Compile(words);
+
+        unsigned at = 0;
+        results.push_back(RunBench(name, 1, min_seconds, [&highlighter, &at](){
+            at = (at+1)%line_mix_size;
+            highlighter.Matches(line_mix[at]);
+        }));
+    }
+
+    static const unsigned names_counts[] = {10, 100, 1000};
+    for(unsigned i = 0; i<sizeof(names_counts)/sizeof(names_counts[0]); i++){
+        const unsigned n = names_counts[i];
+        const std::string name = "csv_parse_names/" + std::to_string(n);
+        if(!wanted(name.c_str()))
+            continue;
+
+        const std::string payload = NamesPayload(n);
+        results.push_back(RunBench(name, 1, min_seconds, [&payload](){
+            FJ::CSV::FreeParse(FJ::CSV::ParseString(payload, ' '));
+        }));
+    }
+
+    for(unsigned i = 0; i<sizeof(names_counts)/sizeof(names_counts[0]); i++){
+        const unsigned n = names_counts[i];
+        const std::string name = "csv_split_names/" + std::to_string(n);
+        if(!wanted(name.c_str()))
+            continue;
+
+        const std::string payload = NamesPayload(n);
+        unsigned long total = 0;
+        results.push_back(RunBench(name, 1, min_seconds, [&payload, &total](){
+            const FJ::CSV::Elements names = FJ::CSV::Split(payload, ' ');
+            for(FJ::CSV::Elements::iterator e = names.begin(); e!=names.end(); e++)
+                total+=(*e).size();
+        }));
+    }
+
+    // The nested scan over every channel that IRC_StateContainsUser fell back
+    // on before the nick index, against the index itself. Half the lookups
+    // miss, which is the worst case for the scan.
+    static const char *const contains_modes[] = {"scan", "index"};
+    for(unsigned i = 0; i<sizeof(contains_modes)/sizeof(contains_modes[0]); i++){
+        const std::string name = std::string("state_contains_user/") + contains_modes[i];
+        if(!wanted(name.c_str()))
+            continue;
+
+        BenchState bench_state(150, 50);
+        IRC_NickIndex *const index = bench_state.state.nicks;
+        if(i==0)
+            bench_state.state.nicks = nullptr;
+
+        std::vector<std::string> nicks;
+        for(unsigned e = 0; e<bench_state.num_nicks; e++)
+            nicks.push_back(((e%2==0)?"user":"nobody") + std::to_string(e));
+
+        unsigned at = 0;
+        IRC_State *const state = &bench_state.state;
+        results.push_back(RunBench(name, 1, min_seconds, [state, &nicks, &at](){
+            at = (at+7919)%nicks.size();
+            IRC_StateContainsUser(state, nicks[at].c_str());
+        }));
+
+        bench_state.state.nicks = index;
+    }
+
+    // A user in 20 of 150 channels changing nick back and forth.
+    if(wanted("apply_nick")){
+        BenchState bench_state(150, 50);
+        for(unsigned c = 0; c<150; c+=150/20)
+            bench_state.Join(c, "mover");
+
+        std::vector<IRC_Message *> messages = ParseToVector(
+            ":mover!~mover@host.example.com NICK :mover_\r\n"
+            ":mover_!~mover@host.example.com NICK :mover\r\n");
+
+        unsigned at = 0;
+        IRC_State *const state = &bench_state.state;
+        results.push_back(RunBench("apply_nick", 1, min_seconds, [state, &messages, &at](){
+            at = (at+1)%messages.size();
+            IRC_ApplyMessage(state, messages[at]);
+        }));
+
+        std::for_each(messages.begin(), messages.end(), IRC_FreeMessage);
+    }
+
+    // The same user quitting, then joining the same channels again. The
+    // rejoin is included, so this also counts the allocations for 20 users.
+    if(wanted("apply_quit_rejoin")){
+        BenchState bench_state(150, 50);
+        for(unsigned c = 0; c<150; c+=150/20)
+            bench_state.Join(c, "mover");
+
+        std::vector<IRC_Message *> messages = ParseToVector(
+            ":mover!~mover@host.example.com QUIT :Ping timeout: 240 seconds\r\n");
+
+        BenchState *const bench = &bench_state;
+        IRC_Message *const quit = messages.front();
+        results.push_back(RunBench("apply_quit_rejoin", 1, min_seconds, [bench, quit](){
+            IRC_ApplyMessage(&bench->state, quit);
+            for(unsigned c = 0; c<150; c+=150/20)
+                bench->Join(c, "mover");
+        }));
+
+        std::for_each(messages.begin(), messages.end(), IRC_FreeMessage);
+    }
+
+    FILE *json = nullptr;
+    if(json_path){
+        json = fopen(json_path, "w");
+        if(!json)
+            fprintf(stderr, "Could not open %s for writing\n", json_path);
+    }
+
+    Report(results, json);
+
+    if(json)
+        fclose(json);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,311 @@
+#include "fakeserver.hpp"
+#include "socket.h"
+#include "poll.h"
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace Kashyyyk {
+namespace Tools {
+
+static const char *const server_name = "irc.loadtest.invalid";
+
+unsigned long long Now_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+bool LoadReplay(const char *path, Traffic &out){
+
+    std::ifstream file(path);
+    if(!file.is_open())
+        return false;
+
+    std::string line;
+    unsigned long last = 0;
+
+    while(std::getline(file, line)){
+
+        if((!line.empty()) && (line.back()=='\r'))
+            line.pop_back();
+
+        if(line.empty())
+            continue;
+
+        const std::string::size_type tab = line.find('\t');
+        if(tab==std::string::npos){
+            out.push_back({last, line, false});
+        }
+        else{
+            last = strtoul(line.c_str(), nullptr, 10);
+            out.push_back({last, line.substr(tab+1), false});
+        }
+    }
+
+    return true;
+}
+
+
+static std::string UserName(unsigned i){
+    char buffer[64];
+    sprintf(buffer, "user%u!~user%u@host%u.split.invalid", i, i, i%97);
+    return buffer;
+}
+
+
+void GenerateNetsplit(unsigned n, const char *channel, Traffic &out, bool batched){
+
+    const unsigned long start = out.empty()?0:out.back().ms;
+    const std::string servers = "irc.left.invalid irc.right.invalid";
+
+    // Each netsplit in a scenario gets its own batch references.
+    const std::string ref = std::to_string(out.size());
+    const std::string tag = batched?("@batch=split" + ref + " "):"";
+
+    if(batched)
+        out.push_back({start, std::string(":") + server_name + " BATCH +split" + ref + " netsplit " + servers, false});
+
+    for(unsigned i = 0; i<n; i++){
+        out.push_back({start, tag + ":" + UserName(i) + " QUIT :" + servers, false});
+    }
+
+    if(batched){
+        out.push_back({start, std::string(":") + server_name + " BATCH -split" + ref, false});
+        out.push_back({start+1000, std::string(":") + server_name + " BATCH +join" + ref + " netjoin " + servers, false});
+    }
+
+    const std::string join_tag = batched?("@batch=join" + ref + " "):"";
+
+    // Real netjoins trickle back in some time after the split.
+    for(unsigned i = 0; i<n; i++){
+        out.push_back({start+1000, join_tag + ":" + UserName(i) +
+            " JOIN " + channel, false});
+    }
+
+    if(batched)
+        out.push_back({start+1000, std::string(":") + server_name + " BATCH -join" + ref, false});
+
+}
+
+
+void GenerateNames(unsigned n, const char *channel, Traffic &out){
+
+    const unsigned long start = out.empty()?0:out.back().ms;
+    const std::string prefix = std::string(":") + server_name +
+        " 353 loadtest = " + channel + " :";
+
+    std::string line = prefix;
+
+    for(unsigned i = 0; i<n; i++){
+        char buffer[32];
+        sprintf(buffer, "%suser%u", (i%50==0)?"@":((i%10==0)?"+":""), i);
+
+        // Keep to the 512 byte line limit, like a real server.
+        if(line.size()+strlen(buffer)+1>500){
+            out.push_back({start, line, false});
+            line = prefix;
+        }
+
+        if(line.size()!=prefix.size())
+            line+=' ';
+        line+=buffer;
+    }
+
+    if(line.size()!=prefix.size())
+        out.push_back({start, line, false});
+
+    out.push_back({start, std::string(":") + server_name + " 366 loadtest " +
+        channel + " :End of /NAMES list.", false});
+
+}
+
+
+void GenerateFlood(unsigned n, const char *channel, Traffic &out){
+
+    const unsigned long start = out.empty()?0:out.back().ms;
+
+    for(unsigned i = 0; i<n; i++){
+        char buffer[32];
+        sprintf(buffer, "%u", i);
+        out.push_back({start + i/100, std::string(":") + UserName(i%16) +
+            " PRIVMSG " + channel + " :flood line " + buffer, true});
+    }
+
+}
+
+
+FakeServer::FakeServer()
+  : listener(Create_Socket())
+  , client(nullptr)
+  , socket_set(GenerateSocketSet(nullptr, 0)){
+
+}
+
+
+FakeServer::~FakeServer(){
+    if(client){
+        RemoveFromSetAndClose(client, socket_set);
+        Destroy_Socket(client);
+    }
+    FreeSocketSet(socket_set);
+    Disconnect_Socket(listener);
+    Destroy_Socket(listener);
+}
+
+
+bool FakeServer::Listen(unsigned long port){
+    return Listen_Socket(listener, port, 1)==eSuccess;
+}
+
+
+unsigned long FakeServer::Port(){
+    return Port_Socket(listener);
+}
+
+
+void FakeServer::UseTLS(const char *cert, const char *key){
+    tls_cert = cert;
+    tls_key = key;
+}
+
+
+bool FakeServer::Send(const std::string &line){
+    const std::string l = line + "\r\n";
+    return Write_Socket(client, l.c_str())==eSuccess;
+}
+
+
+bool FakeServer::ReadLine(std::string &to, long timeout_ms){
+
+    const unsigned long long end = Now_us() + timeout_ms*1000;
+    char *buffer = nullptr;
+
+    std::string::size_type crlf;
+    while((crlf = inbuffer.find("\r\n"))==std::string::npos){
+
+        const unsigned long long now = Now_us();
+        if(now>=end)
+            break;
+
+        PollSet(eRead, socket_set, (end-now)/1000);
+
+        if(Length_Socket(client)==0){
+            if(State_Socket(client)!=eConnected)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        Read_Socket(client, &buffer);
+        inbuffer+=buffer;
+    }
+
+    free(buffer);
+
+    if(crlf==std::string::npos)
+        return false;
+
+    to = inbuffer.substr(0, crlf);
+    inbuffer.erase(0, crlf+2);
+
+    // libfjirc leaves a space after the last parameter.
+    while((!to.empty()) && (to.back()==' '))
+        to.pop_back();
+
+    return true;
+}
+
+
+bool FakeServer::Accept(long timeout_ms, const char *channel){
+
+    if(client){
+        RemoveFromSetAndClose(client, socket_set);
+        Destroy_Socket(client);
+        inbuffer.clear();
+    }
+
+    client = Accept_Socket(listener, timeout_ms);
+    if(!client)
+        return false;
+
+    // The handshake is finished by the reads below.
+    if((!tls_cert.empty()) && (AcceptTLS_Socket(client, tls_cert.c_str(), tls_key.c_str())!=eSuccess))
+        return false;
+
+    AddToSet(client, socket_set);
+
+    bool got_nick = false, got_user = false;
+    std::string line, nick = "loadtest";
+
+    while(!(got_nick && got_user)){
+        if(!ReadLine(line, timeout_ms))
+            return false;
+
+        if(line.compare(0, 5, "NICK ")==0){
+            nick = line.substr(5);
+            if((!nick.empty()) && (nick[0]==':'))
+                nick.erase(0, 1);
+            got_nick = true;
+        }
+        else if(line.compare(0, 5, "USER ")==0)
+            got_user = true;
+    }
+
+    return Send(std::string(":") + server_name + " 001 " + nick +
+            " :Welcome to the load test network " + nick) &&
+        Send(std::string(":") + nick + "!~" + nick + "@localhost JOIN " + channel);
+
+}
+
+
+unsigned long FakeServer::Play(const Traffic &traffic, double speed){
+
+    const unsigned long long start = Now_us();
+    unsigned long sent = 0;
+
+    for(Traffic::const_iterator iter = traffic.begin(); iter!=traffic.end(); iter++){
+
+        if(speed>0.0){
+            const unsigned long long due = start +
+                (unsigned long long)(iter->ms*1000.0/speed);
+            const unsigned long long now = Now_us();
+            if(due>now)
+                std::this_thread::sleep_for(std::chrono::microseconds(due-now));
+        }
+
+        if(iter->stamp){
+            char buffer[32];
+            sprintf(buffer, " %llu", Now_us());
+            if(!Send(iter->line + buffer))
+                break;
+        }
+        else if(!Send(iter->line))
+            break;
+
+        sent++;
+    }
+
+    return sent;
+}
+
+
+bool FakeServer::Sync(long timeout_ms){
+
+    if(!Send("PING :done"))
+        return false;
+
+    std::string line;
+    while(ReadLine(line, timeout_ms)){
+        if((line.compare(0, 4, "PONG")==0) && (line.find("done")!=std::string::npos))
+            return true;
+    }
+
+    return false;
+}
+
+}
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+//! @file
+//! @brief Definition of @link Kashyyyk::Tools::FakeServer @endlink, a minimal
+//! loopback IRC server used to drive the client for load testing.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+
+#include <string>
+#include <vector>
+
+struct WSocket;
+struct SocketSet;
+
+namespace Kashyyyk {
+namespace Tools {
+
+//! @brief A single line of server traffic, and when to send it.
+struct TrafficLine {
+    //! Milliseconds after the start of the scenario that this line is due.
+    unsigned long ms;
+    //! Line without the trailing CRLF.
+    std::string line;
+    //! If true, the current time in microseconds is appended when sent.
+    //! Used by floods to measure end-to-end latency.
+    bool stamp;
+};
+
+//! A sequence of TrafficLines, in order of TrafficLine::ms.
+typedef std::vector<TrafficLine> Traffic;
+
+//! @brief Microseconds on a monotonic clock, comparable across threads.
+unsigned long long Now_us();
+
+//! @brief Loads recorded traffic. Each line of the file is
+//! `<milliseconds><TAB><raw line>`, lines without a tab are sent at once.
+//! @return false if the file could not be opened.
+bool LoadReplay(const char *path, Traffic &out);
+
+//! @brief Appends a netsplit of @p n users from @p channel followed by the
+//! matching netjoin. With @p batched, each half is sent in a BATCH, as a
+//! server does for clients with the batch capability.
+void GenerateNetsplit(unsigned n, const char *channel, Traffic &out, bool batched = false);
+
+//! @brief Appends a NAMES burst of @p n users for @p channel.
+void GenerateNames(unsigned n, const char *channel, Traffic &out);
+
+//! @brief Appends @p n timestamped PRIVMSGs to @p channel from a handful of
+//! different users.
+void GenerateFlood(unsigned n, const char *channel, Traffic &out);
+
+//! @brief Server end of the load test.
+//!
+//! Speaks just enough of the server side of IRC to register a single client,
+//! join it to the load test channel, and then play back a Traffic sequence.
+//! Everything happens over loopback, so it can be run anywhere.
+class FakeServer {
+
+    WSocket *listener;
+    WSocket *client;
+    struct SocketSet *socket_set;
+    std::string inbuffer;
+    std::string tls_cert, tls_key;
+
+    bool Send(const std::string &line);
+
+public:
+
+    FakeServer();
+    ~FakeServer();
+
+    //! Listens on loopback. A port of 0 lets the system choose.
+    bool Listen(unsigned long port);
+    //! Returns the port that the server is listening on.
+    unsigned long Port();
+
+    //! @brief Speaks TLS to every client accepted after this, using the PEM
+    //! certificate chain and key at the given paths.
+    void UseTLS(const char *cert, const char *key);
+
+    //! Waits for a client to connect, and completes registration.
+    //! @return false on timeout or if the client hangs up.
+    bool Accept(long timeout_ms, const char *channel);
+
+    //! @brief Reads a single line sent by the client, without the CRLF.
+    //! @return false on timeout.
+    bool ReadLine(std::string &to, long timeout_ms);
+
+    //! @brief Plays back @p traffic to the client.
+    //!
+    //! @p speed is a multiple of real time. A speed of zero sends everything
+    //! as fast as the socket will take it.
+    //! @return the number of lines sent.
+    unsigned long Play(const Traffic &traffic, double speed);
+
+    //! @brief Sends `PING :done` and waits for the matching PONG, which
+    //! means that the client has processed everything sent before it.
+    bool Sync(long timeout_ms);
+
+};
+
+}
+}
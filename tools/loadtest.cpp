@@ -0,0 +1,986 @@
+//! @file
+//! @brief yyyloadtest, a reproducible load test for the Kashyyyk IRC client.
+//! @author    FlyingJester
+//! @date      2014
+//! @copyright GNU Public License 2.0
+//!
+//! Runs a FakeServer on loopback and drives libfjnet, libfjirc and the
+//! Kashyyyk message handler machinery against it, without needing a display
+//! or a live network. The client side mirrors what ServerTask does: poll the
+//! socket, read, parse, and give every message to a TypedReciever, holding a
+//! lock that stands in for the FLTK lock while it does. Lines split across
+//! reads are stitched together the same way, and any complete line read
+//! but never handled is reported as lost and fails the run.
+//!
+//! Usage:
+//!   yyyloadtest [--replay FILE] [--speed X] [--netsplit N]
+//!               [--batched-netsplit N] [--names N] [--flood N] [--port P]
+//!               [--serve] [--json FILE] [--tls CERT KEY] [--servers N]
+//!               [--shards N] [--unlocked]
+//!
+//! Scenarios are played in the order given. With --serve, no client is
+//! started and the real client can be pointed at 127.0.0.1 on --port.
+//!
+//! The client keeps the load test channel's users as Server and Channel do,
+//! with interned nicks and the membership index. --batched-netsplit sends
+//! the netsplit and netjoin in BATCHes, which the client holds back and
+//! applies all at once, as it does once the batch capability is negotiated.
+//!
+//! With --servers, that many FakeServers each play the whole scenario to
+//! their own client, and the clients are spread over --shards threads, each
+//! polling its own SocketSet as the client's network shards do. The results
+//! are for all of them together. --unlocked leaves out the stand in for the
+//! FLTK lock, to show what it costs.
+//!
+//! With --tls, both ends speak TLS. CERT must be valid for 127.0.0.1, and is
+//! also the only authority the client trusts, so a self-signed one will do:
+//!
+//!   openssl req -x509 -newkey rsa:2048 -nodes -days 30 -subj /CN=127.0.0.1
+//!     -addext subjectAltName=IP:127.0.0.1 -keyout key.pem -out cert.pem
+
+#include "fakeserver.hpp"
+#include "reciever.hpp"
+#include "message.hpp"
+#include "socket.h"
+#include "poll.h"
+#include "intern.hpp"
+#include "parse.h"
+#include "message.h"
+#include "tags.h"
+#include "csv.h"
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace Kashyyyk {
+namespace Tools {
+
+static const char *const load_channel = "#load";
+
+//! Per-run measurements.
+struct Results {
+    unsigned long lines_sent;
+    unsigned long messages;
+    unsigned long parse_errors;
+    //! Line endings in the bytes read, which is every complete line received.
+    unsigned long lines_read;
+    //! Reads that ended partway through a line.
+    unsigned long split_reads;
+    //! Lines that did not reach the handlers as the message that was sent.
+    unsigned long lines_lost;
+    unsigned long long bytes;
+    unsigned long long start_us, end_us;
+    //! Microseconds spent in GiveMessage, per message.
+    std::vector<unsigned long> dispatch_us;
+    //! Microseconds from the server writing a PRIVMSG to its handler running.
+    std::vector<unsigned long> e2e_us;
+};
+
+
+class LoadClient;
+
+//! Mirrors Kashyyyk::User.
+struct LoadUser {
+    Interned nick;
+    std::string mode;
+};
+
+
+//! @brief Headless stand in for Channel.
+//!
+//! Keeps its Users the way Channel::AddUser_l, Channel::RemoveUser_l,
+//! Channel::BulkQuit and Channel::BulkJoin do, including the Server's
+//! membership index, without the widget updates.
+class LoadChannel : public TypedReciever<void> {
+public:
+    LoadClient *client;
+    Interned key;
+    std::list<LoadUser> Users;
+
+    LoadChannel(LoadClient *c, const Interned &k)
+      : TypedReciever<void>(nullptr)
+      , client(c)
+      , key(k){}
+
+    void SendMessage(IRC_Message *msg) override {}
+
+    void AddHandler(MessageHandler *h){
+        Handlers.push_back(std::unique_ptr<MessageHandler>(h));
+    }
+
+    void AddUser_l(const char *user, unsigned long len);
+    void RemoveUser_l(const Interned &nick);
+    void BulkQuit(const std::vector<Interned> &nicks);
+    void BulkJoin(const std::vector<Interned> &nicks);
+
+};
+
+
+//! @brief Headless stand in for Server.
+//!
+//! Routes messages to its single joined Channel the way Server does, with
+//! interned nicks, the membership index, and netsplits and netjoins held
+//! back until their BATCH ends, so that handler costs are comparable to the
+//! real client.
+class LoadClient : public TypedReciever<LoadClient> {
+public:
+
+    WSocket *socket;
+    Results &results;
+    std::atomic<bool> done;
+    //! Stands in for the FLTK lock, which ServerTask holds while it gives
+    //! out the messages from each read. nullptr to not lock at all.
+    std::mutex *dispatch_lock;
+
+    InternTable names;
+    //! Same as Server::members
+    std::unordered_map<const IRC_Interned *, std::vector<LoadChannel *> > members;
+    //! The load test channel, which is the only one joined.
+    std::unique_ptr<LoadChannel> channel;
+
+    //! Same as Server::Batch
+    struct Batch {
+        bool netjoin;
+        std::vector<std::pair<std::string, std::string> > members;
+    };
+    std::map<std::string, Batch> batches;
+
+    LoadClient(WSocket *s, Results &r, std::mutex *l)
+      : TypedReciever<LoadClient>(nullptr)
+      , socket(s)
+      , results(r)
+      , done(false)
+      , dispatch_lock(l)
+      , buffer(nullptr)
+      , old_state(nullptr)
+      , received_at(0){
+
+        channel.reset(new LoadChannel(this, names.Intern(load_channel)));
+    }
+
+    ~LoadClient() override {
+        free(buffer);
+        if(old_state!=nullptr)
+            IRC_DestroyParseState(old_state);
+    }
+
+    void SendMessage(IRC_Message *msg) override {
+        char *str = IRC_MessageToString(msg);
+        Write_Socket(socket, str);
+        free(str);
+    }
+
+    //! Holds back messages in a netsplit or netjoin BATCH, as Server does
+    //! once the batch capability is negotiated.
+    void GiveMessage(IRC_Message *msg) override {
+        if(!BatchMessage_l(msg))
+            TypedReciever<LoadClient>::GiveMessage(msg);
+    }
+
+    void AddHandler(MessageHandler *h){
+        Handlers.push_back(std::unique_ptr<MessageHandler>(h));
+    }
+
+    LoadChannel *FindChannel_l(const char *name);
+    bool AddMember_l(const Interned &nick, LoadChannel *c);
+    void RemoveMember_l(const Interned &nick, LoadChannel *c);
+    std::vector<LoadChannel *> ChannelsWith_l(const Interned &nick) const;
+
+    //! Reads, parses and handles whatever has arrived. Returns false once
+    //! the client is done or the connection is gone.
+    bool Service();
+
+private:
+
+    bool BatchMessage_l(IRC_Message *msg);
+    void ApplyBatch_l(const Batch &batch);
+
+    char *buffer;
+    struct IRC_ParseState *old_state;
+
+    //! Everything read, split into lines independently of the parser, to
+    //! check what the parser gives out against.
+    std::string received;
+    std::string::size_type received_at;
+
+    //! Takes the next line from @p received, and returns whether @p msg came
+    //! from all of it. @p msg is nullptr for a line that did not parse.
+    bool TakeLine(const IRC_Message *msg);
+
+};
+
+
+class Ping_Handler : public MessageHandler {
+    LoadClient *client;
+public:
+    Ping_Handler(LoadClient *c) : client(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if((msg->type!=IRC_ping) || (msg->num_parameters<1))
+            return false;
+
+        IRC_Message *pong = IRC_CreatePongFromPing(msg);
+        client->SendMessage(pong);
+        IRC_FreeMessage(pong);
+
+        if(strcmp(msg->parameters[0], "done")==0)
+            client->done = true;
+
+        return false;
+    }
+};
+
+
+//! Same as ServerMessage::ChannelChecker_Handler
+template<IRC_messageType type, int n = 0>
+class ChannelChecker_Handler : public MessageHandler {
+    LoadClient *client;
+public:
+    ChannelChecker_Handler(LoadClient *c) : client(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if((msg->type==type) && (msg->num_parameters>n)){
+            LoadChannel *channel = client->FindChannel_l(msg->parameters[n]);
+            if(channel!=nullptr)
+                channel->GiveMessage(msg);
+        }
+        return false;
+    }
+};
+
+
+//! Same as ServerMessage::Quit_Handler, which only goes to the Channels that
+//! the nick is in.
+class Quit_Handler : public MessageHandler {
+    LoadClient *client;
+    from_reader r;
+public:
+    Quit_Handler(LoadClient *c) : client(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if((msg->type!=IRC_quit) || (msg->from==nullptr))
+            return false;
+
+        r.Reset();
+        const Interned nick = client->names.Find(r(msg));
+        if(!nick)
+            return false;
+
+        const std::vector<LoadChannel *> in = client->ChannelsWith_l(nick);
+        for(std::vector<LoadChannel *>::const_iterator i = in.cbegin(); i!=in.cend(); i++)
+            (*i)->RemoveUser_l(nick);
+
+        return false;
+    }
+};
+
+
+//! Same as ChannelMessage::Join_Handler
+class Join_Handler : public MessageHandler {
+    LoadChannel *channel;
+    from_reader r;
+public:
+    Join_Handler(LoadChannel *c) : channel(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if(msg->type!=IRC_join)
+            return false;
+
+        r.Reset();
+        const char *user = r(msg);
+        channel->AddUser_l(user, strlen(user));
+
+        return false;
+    }
+};
+
+
+//! Same as ChannelMessage::Namelist_Handler
+class Names_Handler : public MessageHandler {
+    LoadChannel *channel;
+    param_reader<3> r;
+public:
+    Names_Handler(LoadChannel *c) : channel(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if(msg->type!=IRC_namelist_num)
+            return false;
+
+        r.Reset();
+        const FJ::CSV::Elements names = FJ::CSV::Split(r(msg), ' ');
+        for(FJ::CSV::Elements::iterator iter = names.begin(); iter!=names.end(); iter++){
+            const FJ::CSV::Element name = *iter;
+
+            const char *bang = static_cast<const char *>(memchr(name.data(), '!', name.size()));
+            channel->AddUser_l(name.data(), (bang==nullptr)?name.size():(bang-name.data()));
+        }
+
+        return false;
+    }
+};
+
+
+//! Records end-to-end latency of timestamped flood lines.
+class PrivateMessage_Handler : public MessageHandler {
+    LoadClient *client;
+public:
+    PrivateMessage_Handler(LoadClient *c) : client(c){}
+
+    bool HandleMessage(IRC_Message *msg) override {
+        if((msg->type!=IRC_privmsg) || (msg->num_parameters<2))
+            return false;
+
+        const char *stamp = strrchr(msg->parameters[1], ' ');
+        if(stamp){
+            const unsigned long long then = strtoull(stamp+1, nullptr, 10);
+            const unsigned long long now = Now_us();
+            if((then!=0) && (now>=then))
+                client->results.e2e_us.push_back(now-then);
+        }
+
+        return false;
+    }
+};
+
+
+void LoadChannel::AddUser_l(const char *user, unsigned long len){
+
+    const unsigned long prefix = std::min<unsigned long>(strspn(user, "~&@%+"), len);
+    const Interned nick = client->names.Intern(user+prefix, len-prefix);
+
+    if(!client->AddMember_l(nick, this))
+        return;
+
+    Users.push_back({nick, std::string(user, prefix)});
+}
+
+
+void LoadChannel::RemoveUser_l(const Interned &nick){
+
+    for(std::list<LoadUser>::iterator iter = Users.begin(); iter!=Users.end(); iter++){
+        if(iter->nick==nick){
+            client->RemoveMember_l(nick, this);
+            Users.erase(iter);
+            return;
+        }
+    }
+}
+
+
+void LoadChannel::BulkQuit(const std::vector<Interned> &nicks){
+
+    std::unordered_set<const IRC_Interned *> quitting;
+    for(std::vector<Interned>::const_iterator iter = nicks.cbegin(); iter!=nicks.cend(); iter++)
+        quitting.insert(iter->Handle());
+
+    std::list<LoadUser>::iterator iter = Users.begin();
+    while(iter!=Users.end()){
+        if(quitting.count(iter->nick.Handle())){
+            client->RemoveMember_l(iter->nick, this);
+            iter = Users.erase(iter);
+        }
+        else
+            iter++;
+    }
+}
+
+
+void LoadChannel::BulkJoin(const std::vector<Interned> &nicks){
+
+    for(std::vector<Interned>::const_iterator iter = nicks.cbegin(); iter!=nicks.cend(); iter++){
+        if(client->AddMember_l(*iter, this))
+            Users.push_back({*iter, ""});
+    }
+}
+
+
+LoadChannel *LoadClient::FindChannel_l(const char *name){
+
+    const Interned key = names.Find(name);
+    return (key && (key==channel->key))?channel.get():nullptr;
+}
+
+
+bool LoadClient::AddMember_l(const Interned &nick, LoadChannel *c){
+
+    std::vector<LoadChannel *> &in = members[nick.Handle()];
+    if(std::find(in.cbegin(), in.cend(), c)!=in.cend())
+        return false;
+
+    in.push_back(c);
+    return true;
+}
+
+
+void LoadClient::RemoveMember_l(const Interned &nick, LoadChannel *c){
+
+    std::unordered_map<const IRC_Interned *, std::vector<LoadChannel *> >::iterator iter = members.find(nick.Handle());
+    if(iter==members.end())
+        return;
+
+    std::vector<LoadChannel *> &in = iter->second;
+    std::vector<LoadChannel *>::iterator i = std::find(in.begin(), in.end(), c);
+    if(i==in.end())
+        return;
+
+    *i = in.back();
+    in.pop_back();
+
+    if(in.empty())
+        members.erase(iter);
+}
+
+
+std::vector<LoadChannel *> LoadClient::ChannelsWith_l(const Interned &nick) const{
+
+    std::unordered_map<const IRC_Interned *, std::vector<LoadChannel *> >::const_iterator iter = members.find(nick.Handle());
+    return (iter==members.cend())?std::vector<LoadChannel *>():iter->second;
+}
+
+
+bool LoadClient::BatchMessage_l(IRC_Message *msg){
+
+    if(msg->type==IRC_batch){
+        if(msg->num_parameters<1)
+            return false;
+
+        const char *ref = msg->parameters[0];
+
+        if((ref[0]=='+') && (msg->num_parameters>1)){
+            const bool netjoin = strcmp(msg->parameters[1], "netjoin")==0;
+            if((!netjoin) && (strcmp(msg->parameters[1], "netsplit")!=0))
+                return false;
+
+            Batch &batch = batches[ref+1];
+            batch.netjoin = netjoin;
+            batch.members.clear();
+            return true;
+        }
+        else if(ref[0]=='-'){
+            std::map<std::string, Batch>::iterator iter = batches.find(ref+1);
+            if(iter==batches.end())
+                return false;
+
+            ApplyBatch_l(iter->second);
+            batches.erase(iter);
+            return true;
+        }
+
+        return false;
+    }
+
+    if(batches.empty())
+        return false;
+
+    unsigned long len;
+    const char *ref = IRC_FindTag(msg, "batch", &len);
+    if(ref==nullptr)
+        return false;
+
+    std::map<std::string, Batch>::iterator iter = batches.find(std::string(ref, len));
+    if(iter==batches.end())
+        return false;
+
+    Batch &batch = iter->second;
+    from_reader r;
+
+    if(batch.netjoin && (msg->type==IRC_join) && (msg->num_parameters>0)){
+        batch.members.push_back({msg->parameters[0], r(msg)});
+        return true;
+    }
+    else if((!batch.netjoin) && (msg->type==IRC_quit)){
+        batch.members.push_back({std::string(), r(msg)});
+        return true;
+    }
+
+    return false;
+}
+
+
+void LoadClient::ApplyBatch_l(const Batch &batch){
+
+    if(!batch.netjoin){
+        std::map<LoadChannel *, std::vector<Interned> > quits;
+
+        for(std::vector<std::pair<std::string, std::string> >::const_iterator i = batch.members.cbegin(); i!=batch.members.cend(); i++){
+            const Interned nick = names.Find(i->second);
+            if(!nick)
+                continue;
+
+            const std::vector<LoadChannel *> in = ChannelsWith_l(nick);
+            for(std::vector<LoadChannel *>::const_iterator c = in.cbegin(); c!=in.cend(); c++)
+                quits[*c].push_back(nick);
+        }
+
+        for(std::map<LoadChannel *, std::vector<Interned> >::const_iterator i = quits.cbegin(); i!=quits.cend(); i++)
+            i->first->BulkQuit(i->second);
+
+        return;
+    }
+
+    std::map<LoadChannel *, std::vector<Interned> > joins;
+    for(std::vector<std::pair<std::string, std::string> >::const_iterator i = batch.members.cbegin(); i!=batch.members.cend(); i++){
+        LoadChannel *c = FindChannel_l(i->first.c_str());
+        if(c!=nullptr)
+            joins[c].push_back(names.Intern(i->second));
+    }
+
+    for(std::map<LoadChannel *, std::vector<Interned> >::const_iterator i = joins.cbegin(); i!=joins.cend(); i++)
+        i->first->BulkJoin(i->second);
+}
+
+
+bool LoadClient::TakeLine(const IRC_Message *msg){
+
+    const std::string::size_type end = received.find("\r\n", received_at);
+    if(end==std::string::npos)
+        return false;
+
+    const std::string line = received.substr(received_at, end-received_at);
+    received_at = end+2;
+
+    // Only a line that parses on its own can have been lost by failing to.
+    if(msg==nullptr){
+        struct IRC_ParseState *state = IRC_InitParse((line + "\r\n").c_str());
+        IRC_Message *whole = IRC_ConsumeParse(state);
+        IRC_DestroyParseState(state);
+        if(whole==nullptr)
+            return true;
+        IRC_FreeMessage(whole);
+        return false;
+    }
+
+    // The sender and command have to be the ones at the start of the line.
+    std::string::size_type at = line.find_first_not_of(' ');
+    if((at!=std::string::npos) && (line[at]=='@'))
+        at = line.find_first_not_of(' ', line.find(' ', at));
+    if(at==std::string::npos)
+        return false;
+
+    if(line[at]==':'){
+        const std::string::size_type from_end = line.find(' ', at);
+        if((msg->from==nullptr) || (line.compare(at, from_end-at, msg->from)!=0))
+            return false;
+        at = (from_end==std::string::npos)?line.size():(from_end+1);
+    }
+    else if(msg->from!=nullptr)
+        return false;
+
+    const std::string command = line.substr(at, line.find_first_of(" :", at)-at);
+    return IRC_GetTokenEnum(command.c_str())==msg->type;
+}
+
+
+bool LoadClient::Service(){
+
+    if(done)
+        return false;
+
+    if(Length_Socket(socket)==0)
+        return State_Socket(socket)==eConnected;
+
+    Read_Socket(socket, &buffer);
+
+    const std::size_t len = strlen(buffer);
+    results.bytes+=len;
+    results.lines_read+=std::count(buffer, buffer+len, '\n');
+    if((len!=0) && (buffer[len-1]!='\n'))
+        results.split_reads++;
+
+    if(received_at>=received.size()/2){
+        received.erase(0, received_at);
+        received_at = 0;
+    }
+    received.append(buffer, len);
+
+    // Partial lines are stitched to the next read exactly as ServerTask does
+    // it, so that any line it loses is lost here too.
+    struct IRC_ParseState *state;
+    if(old_state==nullptr)
+        state = IRC_InitParse(buffer);
+    else{
+        state = IRC_StitchParse(old_state, buffer);
+        IRC_DestroyParseState(old_state);
+        old_state = nullptr;
+    }
+    struct IRC_Message *msg = IRC_ConsumeParse(state);
+
+    // Taken once for everything in this read, as ServerTask does.
+    std::unique_lock<std::mutex> locked;
+    if(dispatch_lock)
+        locked = std::unique_lock<std::mutex>(*dispatch_lock, std::defer_lock);
+
+    while((msg!=nullptr) || (IRC_GetParseStatus(state)==IRC_badMessage)){
+
+        if(!TakeLine(msg))
+            results.lines_lost++;
+
+        if(msg==nullptr){
+            results.parse_errors++;
+        }
+        else{
+            if(locked.mutex() && !locked.owns_lock())
+                locked.lock();
+
+            const unsigned long long then = Now_us();
+            GiveMessage(msg);
+            results.dispatch_us.push_back(Now_us()-then);
+            results.messages++;
+
+            IRC_FreeMessage(msg);
+        }
+
+        msg = IRC_ConsumeParse(state);
+    }
+
+    if(IRC_GetParseStatus(state)==IRC_unexpectedEnd)
+        old_state = state;
+    else
+        IRC_DestroyParseState(state);
+
+    return !done;
+}
+
+
+//! @brief Stand in for one of the client's network shards.
+//!
+//! Polls one SocketSet holding all of @p clients, and services each of them
+//! on this thread, until they are all finished or @p timeout_ms has passed.
+static void ShardThread(std::vector<LoadClient *> clients, long timeout_ms){
+
+    struct SocketSet *set = GenerateSocketSet(nullptr, 0);
+    for(std::vector<LoadClient *>::const_iterator i = clients.cbegin(); i!=clients.cend(); i++)
+        AddToSet((*i)->socket, set);
+
+    std::vector<LoadClient *> live = clients;
+    const unsigned long long end = Now_us() + timeout_ms*1000;
+
+    while((!live.empty()) && (Now_us()<end)){
+
+        PollSet(eRead, set, 100);
+
+        for(std::vector<LoadClient *>::iterator i = live.begin(); i!=live.end();){
+            if((*i)->Service())
+                i++;
+            else
+                i = live.erase(i);
+        }
+    }
+
+    for(std::vector<LoadClient *>::const_iterator i = clients.cbegin(); i!=clients.cend(); i++)
+        RemoveFromSet((*i)->socket, set);
+    FreeSocketSet(set);
+}
+
+
+static unsigned long Percentile(std::vector<unsigned long> &v, unsigned p){
+    if(v.empty())
+        return 0;
+    return v[std::min<std::size_t>(v.size()-1, (v.size()*p)/100)];
+}
+
+
+static long PeakRSS_KB(){
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss/1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+
+static void Report(Results &results, FILE *json){
+
+    std::sort(results.dispatch_us.begin(), results.dispatch_us.end());
+    std::sort(results.e2e_us.begin(), results.e2e_us.end());
+
+    const double seconds = (results.end_us-results.start_us)/1000000.0;
+    const double lines_per_sec = (seconds>0.0)?(results.messages+results.parse_errors)/seconds:0.0;
+    const unsigned long handled = results.messages+results.parse_errors;
+    const unsigned long lines_lost = results.lines_lost +
+        ((results.lines_read>handled)?(results.lines_read-handled):0);
+
+    fprintf(stderr, "lines sent          %lu\n", results.lines_sent);
+    fprintf(stderr, "messages handled    %lu\n", results.messages);
+    fprintf(stderr, "unparsed lines      %lu\n", results.parse_errors);
+    fprintf(stderr, "lines read          %lu\n", results.lines_read);
+    fprintf(stderr, "split reads         %lu\n", results.split_reads);
+    fprintf(stderr, "lines lost          %lu\n", lines_lost);
+    fprintf(stderr, "bytes read          %llu\n", results.bytes);
+    fprintf(stderr, "seconds             %f\n", seconds);
+    fprintf(stderr, "lines/sec           %f\n", lines_per_sec);
+    fprintf(stderr, "dispatch us p50 %lu p90 %lu p99 %lu max %lu\n",
+        Percentile(results.dispatch_us, 50), Percentile(results.dispatch_us, 90),
+        Percentile(results.dispatch_us, 99), Percentile(results.dispatch_us, 100));
+    fprintf(stderr, "end-to-end us p50 %lu p90 %lu p99 %lu max %lu\n",
+        Percentile(results.e2e_us, 50), Percentile(results.e2e_us, 90),
+        Percentile(results.e2e_us, 99), Percentile(results.e2e_us, 100));
+    fprintf(stderr, "peak rss KB         %li\n", PeakRSS_KB());
+
+    if(!json)
+        return;
+
+    fprintf(json, "{\"lines_sent\":%lu,\"messages\":%lu,\"parse_errors\":%lu,"
+        "\"lines_read\":%lu,\"split_reads\":%lu,\"lines_lost\":%lu,"
+        "\"bytes\":%llu,\"seconds\":%f,\"lines_per_sec\":%f,", results.lines_sent,
+        results.messages, results.parse_errors, results.lines_read, results.split_reads,
+        lines_lost, results.bytes, seconds, lines_per_sec);
+    fprintf(json, "\"dispatch_us\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu},",
+        Percentile(results.dispatch_us, 50), Percentile(results.dispatch_us, 90),
+        Percentile(results.dispatch_us, 99), Percentile(results.dispatch_us, 100));
+    fprintf(json, "\"e2e_us\":{\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"max\":%lu},",
+        Percentile(results.e2e_us, 50), Percentile(results.e2e_us, 90),
+        Percentile(results.e2e_us, 99), Percentile(results.e2e_us, 100));
+    fprintf(json, "\"peak_rss_kb\":%li}\n", PeakRSS_KB());
+
+}
+
+
+static void ServerThread(FakeServer *server, const Traffic *traffic, double speed,
+    unsigned long *sent, bool *ok){
+
+    *ok = false;
+    if(!server->Accept(10000, load_channel))
+        return;
+
+    *sent = server->Play(*traffic, speed);
+    *ok = server->Sync(60000);
+}
+
+
+static int Usage(const char *name){
+    fprintf(stderr, "Usage: %s [--replay FILE] [--speed X] [--netsplit N] "
+        "[--batched-netsplit N] [--names N] [--flood N] [--port P] [--serve] [--json FILE] "
+        "[--tls CERT KEY] [--servers N] [--shards N] [--unlocked]\n", name);
+    return EXIT_FAILURE;
+}
+
+}
+}
+
+
+int main(int argc, char *argv[]){
+
+    using namespace Kashyyyk::Tools;
+
+    Traffic traffic;
+    double speed = 1.0;
+    unsigned long port = 0;
+    bool serve = false;
+    const char *json_path = nullptr;
+    const char *tls_cert = nullptr, *tls_key = nullptr;
+    unsigned num_servers = 1, num_shards = 1;
+    bool unlocked = false;
+
+    for(int i = 1; i<argc; i++){
+        const bool has_arg = (i+1<argc);
+        if(strcmp(argv[i], "--serve")==0)
+            serve = true;
+        else if(strcmp(argv[i], "--unlocked")==0)
+            unlocked = true;
+        else if(!has_arg)
+            return Usage(argv[0]);
+        else if(strcmp(argv[i], "--replay")==0){
+            if(!LoadReplay(argv[++i], traffic)){
+                fprintf(stderr, "Could not open replay file %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if(strcmp(argv[i], "--speed")==0)
+            speed = atof(argv[++i]);
+        else if(strcmp(argv[i], "--netsplit")==0)
+            GenerateNetsplit(atoi(argv[++i]), load_channel, traffic);
+        else if(strcmp(argv[i], "--batched-netsplit")==0)
+            GenerateNetsplit(atoi(argv[++i]), load_channel, traffic, true);
+        else if(strcmp(argv[i], "--names")==0)
+            GenerateNames(atoi(argv[++i]), load_channel, traffic);
+        else if(strcmp(argv[i], "--flood")==0)
+            GenerateFlood(atoi(argv[++i]), load_channel, traffic);
+        else if(strcmp(argv[i], "--port")==0)
+            port = strtoul(argv[++i], nullptr, 10);
+        else if(strcmp(argv[i], "--json")==0)
+            json_path = argv[++i];
+        else if(strcmp(argv[i], "--servers")==0)
+            num_servers = std::max(1, atoi(argv[++i]));
+        else if(strcmp(argv[i], "--shards")==0)
+            num_shards = std::max(1, atoi(argv[++i]));
+        else if((strcmp(argv[i], "--tls")==0) && (i+2<argc)){
+            tls_cert = argv[++i];
+            tls_key = argv[++i];
+        }
+        else
+            return Usage(argv[0]);
+    }
+
+    if(serve){
+        FakeServer server;
+        if(!server.Listen(port)){
+            fprintf(stderr, "Could not listen on port %lu\n", port);
+            return EXIT_FAILURE;
+        }
+
+        if(tls_cert)
+            server.UseTLS(tls_cert, tls_key);
+
+        fprintf(stderr, "Serving %u lines on 127.0.0.1 port %lu\n",
+            (unsigned)traffic.size(), server.Port());
+        if(!server.Accept(-1, load_channel))
+            return EXIT_FAILURE;
+        const unsigned long sent = server.Play(traffic, speed);
+        fprintf(stderr, "Sent %lu lines\n", sent);
+        return server.Sync(60000)?EXIT_SUCCESS:EXIT_FAILURE;
+    }
+
+    if(tls_cert && (SetAuthority_Socket(tls_cert)!=eSuccess)){
+        fprintf(stderr, "Could not use %s for TLS\n", tls_cert);
+        return EXIT_FAILURE;
+    }
+
+    num_shards = std::min(num_shards, num_servers);
+
+    std::vector<std::unique_ptr<FakeServer> > servers;
+    std::vector<Results> results(num_servers, Results());
+    std::vector<std::thread> server_threads;
+    std::unique_ptr<bool[]> ok(new bool[num_servers]);
+    std::vector<WSocket *> sockets;
+    std::vector<std::unique_ptr<LoadClient> > clients;
+    std::mutex dispatch_lock;
+    bool connected = true;
+
+    for(unsigned i = 0; i<num_servers; i++){
+        servers.push_back(std::unique_ptr<FakeServer>(new FakeServer()));
+        if(!servers.back()->Listen((port==0)?0:(port+i))){
+            fprintf(stderr, "Could not listen on port %lu\n", (port==0)?0:(port+i));
+            return EXIT_FAILURE;
+        }
+        if(tls_cert)
+            servers.back()->UseTLS(tls_cert, tls_key);
+    }
+
+    for(unsigned i = 0; i<num_servers; i++){
+        ok[i] = false;
+        server_threads.push_back(std::thread(ServerThread, servers[i].get(), &traffic, speed,
+            &results[i].lines_sent, &ok[i]));
+    }
+
+    for(unsigned i = 0; connected && (i<num_servers); i++){
+        WSocket *socket = Create_Socket();
+        sockets.push_back(socket);
+
+        if((Connect_Socket(socket, "127.0.0.1", servers[i]->Port(), 10000)!=eSuccess) ||
+          (tls_cert && (StartTLS_Socket(socket, "127.0.0.1", nullptr)!=eSuccess))){
+            fprintf(stderr, "Could not connect to the load test server\n");
+            connected = false;
+            break;
+        }
+
+        LoadClient *client = new LoadClient(socket, results[i], unlocked?nullptr:&dispatch_lock);
+        clients.push_back(std::unique_ptr<LoadClient>(client));
+
+        // In the same order as Server adds its own.
+        client->AddHandler(new Ping_Handler(client));
+        client->AddHandler(new ChannelChecker_Handler<IRC_join>(client));
+        client->AddHandler(new PrivateMessage_Handler(client));
+        client->AddHandler(new ChannelChecker_Handler<IRC_namelist_num, 2>(client));
+        client->AddHandler(new Quit_Handler(client));
+
+        client->channel->AddHandler(new Join_Handler(client->channel.get()));
+        client->channel->AddHandler(new Names_Handler(client->channel.get()));
+
+        IRC_Message *msg_nick = IRC_CreateNick("loadtest");
+        IRC_Message *msg_user = IRC_CreateUser("loadtest", "falcon", "millenium", "loadtest");
+        client->SendMessage(msg_nick);
+        client->SendMessage(msg_user);
+        IRC_FreeMessage(msg_nick);
+        IRC_FreeMessage(msg_user);
+    }
+
+    Results total = Results();
+
+    if(connected){
+        // Clients are dealt out to the shards in turn, as Shards::Assign
+        // does when they all start out empty.
+        std::vector<std::vector<LoadClient *> > assigned(num_shards);
+        for(unsigned i = 0; i<num_servers; i++)
+            assigned[i%num_shards].push_back(clients[i].get());
+
+        total.start_us = Now_us();
+
+        std::vector<std::thread> shard_threads;
+        for(unsigned i = 0; i<num_shards; i++)
+            shard_threads.push_back(std::thread(ShardThread, assigned[i], 120000l));
+        for(unsigned i = 0; i<num_shards; i++)
+            shard_threads[i].join();
+
+        total.end_us = Now_us();
+    }
+
+    clients.clear();
+
+    for(unsigned i = 0; i<server_threads.size(); i++)
+        server_threads[i].join();
+
+    for(std::vector<WSocket *>::const_iterator i = sockets.cbegin(); i!=sockets.cend(); i++){
+        Disconnect_Socket(*i);
+        Destroy_Socket(*i);
+    }
+
+    if(!connected)
+        return EXIT_FAILURE;
+
+    bool all_ok = true;
+    for(unsigned i = 0; i<num_servers; i++){
+        all_ok = all_ok && ok[i];
+        total.lines_sent+=results[i].lines_sent;
+        total.messages+=results[i].messages;
+        total.parse_errors+=results[i].parse_errors;
+        total.lines_read+=results[i].lines_read;
+        total.split_reads+=results[i].split_reads;
+        total.lines_lost+=results[i].lines_lost;
+        total.bytes+=results[i].bytes;
+        total.dispatch_us.insert(total.dispatch_us.end(), results[i].dispatch_us.cbegin(), results[i].dispatch_us.cend());
+        total.e2e_us.insert(total.e2e_us.end(), results[i].e2e_us.cbegin(), results[i].e2e_us.cend());
+    }
+
+    // Every complete line read has to have reached the handlers intact.
+    if((total.lines_lost!=0) || (total.lines_read>total.messages+total.parse_errors))
+        all_ok = false;
+
+    if(num_servers>1)
+        fprintf(stderr, "servers %u on shards %u%s\n", num_servers, num_shards, unlocked?", unlocked":"");
+
+    FILE *json = nullptr;
+    if(json_path){
+        json = fopen(json_path, "w");
+        if(!json)
+            fprintf(stderr, "Could not open %s for writing\n", json_path);
+    }
+
+    Report(total, json);
+
+    if(json)
+        fclose(json);
+
+    return all_ok?EXIT_SUCCESS:EXIT_FAILURE;
+}